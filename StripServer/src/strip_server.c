@@ -0,0 +1,541 @@
+// Copyright 2018 Christoph Stiller
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+// Answers strip requests (see slapStripRequestType) for a slap file over a Unix domain socket. The sub frames are sent straight from the file.
+// Every client is served by a thread of its own, so that slow clients don't hold up the others.
+
+#include "slapcodec.h"
+
+#include <signal.h>
+#include <stdlib.h>
+
+// Unix domain sockets are available through Winsock since Windows 10 (version 1803).
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <winsock2.h>
+#include <afunix.h>
+
+typedef SOCKET Socket;
+typedef HANDLE Thread;
+typedef CRITICAL_SECTION Mutex;
+
+#define poll WSAPoll
+#define CloseSocket closesocket
+#define ShutdownSocket(socket) shutdown(socket, SD_BOTH)
+#define MSG_NOSIGNAL 0
+
+#define THREAD_FUNCTION(name) DWORD WINAPI name(LPVOID pParameter)
+#define THREAD_RETURN return 0
+#define CreateThreadWithParameter(pThread, function, pParameter) ((*(pThread) = CreateThread(NULL, 0, function, pParameter, 0, NULL)) != NULL)
+#define JoinThread(thread) (WaitForSingleObject(thread, INFINITE), CloseHandle(thread))
+
+#define MutexInit InitializeCriticalSection
+#define MutexDestroy DeleteCriticalSection
+#define MutexLock EnterCriticalSection
+#define MutexUnlock LeaveCriticalSection
+#else
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+typedef int Socket;
+typedef pthread_t Thread;
+typedef pthread_mutex_t Mutex;
+
+#define INVALID_SOCKET (-1)
+#define CloseSocket close
+#define ShutdownSocket(socket) shutdown(socket, SHUT_RDWR)
+
+#define THREAD_FUNCTION(name) void * name(void *pParameter)
+#define THREAD_RETURN return NULL
+#define CreateThreadWithParameter(pThread, function, pParameter) (pthread_create(pThread, NULL, function, pParameter) == 0)
+#define JoinThread(thread) pthread_join(thread, NULL)
+
+#define MutexInit(pMutex) pthread_mutex_init(pMutex, NULL)
+#define MutexDestroy pthread_mutex_destroy
+#define MutexLock pthread_mutex_lock
+#define MutexUnlock pthread_mutex_unlock
+#endif
+
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+#define MAX_CLIENTS 64
+#define POLL_TIMEOUT_MS 250 // the signal handlers can't interrupt WSAPoll.
+#define MAX_TRANSFER_SIZE 0x7FFFFFFF // Winsock transfers at most INT_MAX bytes per call.
+
+volatile sig_atomic_t isRunning = 1;
+
+typedef struct Client
+{
+  Socket socket;
+  Thread thread;
+  FILE *pFile; // every client reads with a file position of its own.
+  slapFileReader *pFileReader; // only the (pre) header is used, which isn't modified.
+  uint64_t *pPacketHeader;
+  uint64_t *pSubFrameMask;
+
+  Mutex *pMutex;
+  bool_t isDone; // set by the thread of the client (with pMutex locked) once the connection has been closed by the client or an invalid request.
+} Client;
+
+void OnSignal(int signalNumber)
+{
+  (void)signalNumber;
+
+  isRunning = 0;
+}
+
+slapResult SendAll(const Socket socket, IN const void *pData, const size_t size)
+{
+  size_t offset = 0;
+
+  while (offset < size)
+  {
+    const int length = (int)(size - offset < MAX_TRANSFER_SIZE ? size - offset : MAX_TRANSFER_SIZE);
+    const int64_t sent = send(socket, (const char *)pData + offset, length, MSG_NOSIGNAL);
+
+    if (sent <= 0)
+      return slapError_FileError;
+
+    offset += (size_t)sent;
+  }
+
+  return slapSuccess;
+}
+
+slapResult ReceiveAll(const Socket socket, OUT void *pData, const size_t size)
+{
+  size_t offset = 0;
+
+  while (offset < size)
+  {
+    const int length = (int)(size - offset < MAX_TRANSFER_SIZE ? size - offset : MAX_TRANSFER_SIZE);
+    const int64_t received = recv(socket, (char *)pData + offset, length, 0);
+
+    if (received <= 0)
+      return slapError_FileError;
+
+    offset += (size_t)received;
+  }
+
+  return slapSuccess;
+}
+
+// Sends size bytes at position of the file without copying them to user space (where sendfile is available).
+slapResult SendFileRange(const Socket socket, IN FILE *pFile, const uint64_t position, const uint64_t size)
+{
+  uint64_t remaining = size;
+
+#ifdef __linux__
+  off_t offset = (off_t)position;
+
+  while (remaining > 0)
+  {
+    const ssize_t sent = sendfile(socket, fileno(pFile), &offset, (size_t)remaining);
+
+    if (sent <= 0)
+      return slapError_FileError;
+
+    remaining -= (uint64_t)sent;
+  }
+#else
+  uint8_t buffer[64 * 1024];
+
+#ifdef _WIN32
+  if (_fseeki64(pFile, (__int64)position, SEEK_SET))
+#else
+  if (fseeko(pFile, (off_t)position, SEEK_SET))
+#endif
+    return slapError_FileError;
+
+  while (remaining > 0)
+  {
+    const size_t readBytes = fread(buffer, 1, remaining < sizeof(buffer) ? (size_t)remaining : sizeof(buffer), pFile);
+
+    if (readBytes == 0)
+      return slapError_FileError;
+
+    if (SendAll(socket, buffer, readBytes) != slapSuccess)
+      return slapError_FileError;
+
+    remaining -= readBytes;
+  }
+#endif
+
+  return slapSuccess;
+}
+
+slapResult SendResponseHeader(const Socket socket, const slapResult result, const uint64_t payloadSize)
+{
+  uint64_t responseHeader[SLAP_STRIP_RESPONSE_HEADER_SIZE];
+
+  responseHeader[SLAP_STRIP_RESPONSE_RESULT_INDEX] = (uint64_t)result;
+  responseHeader[SLAP_STRIP_RESPONSE_PAYLOAD_SIZE_INDEX] = payloadSize;
+
+  return SendAll(socket, responseHeader, sizeof(responseHeader));
+}
+
+// Returns an error if the connection should be closed. Requests that can't be answered are answered with an error and an empty payload.
+slapResult HandleRequest(IN slapFileReader *pFileReader, IN FILE *pFile, const Socket client, IN_OUT uint64_t *pPacketHeader, IN_OUT uint64_t *pSubFrameMask)
+{
+  slapResult result = slapSuccess;
+  uint64_t requestHeader[SLAP_STRIP_REQUEST_HEADER_SIZE];
+
+  const size_t subFrameCount = pFileReader->pDecoder->subFrameCount;
+  const size_t maskSize = SLAP_STRIP_MASK_SIZE(subFrameCount);
+  const size_t frameCount = (size_t)pFileReader->preHeaderBlock[SLAP_PRE_HEADER_FRAME_COUNT_INDEX];
+  const size_t headerSize = (size_t)pFileReader->preHeaderBlock[SLAP_PRE_HEADER_HEADER_SIZE_INDEX];
+
+  if ((result = ReceiveAll(client, requestHeader, sizeof(requestHeader))) != slapSuccess)
+    goto epilogue;
+
+  const uint64_t type = requestHeader[SLAP_STRIP_REQUEST_TYPE_INDEX];
+  const uint64_t frameIndex = requestHeader[SLAP_STRIP_REQUEST_FRAME_INDEX];
+
+  if (requestHeader[SLAP_STRIP_REQUEST_MASK_SIZE_INDEX] != (type == slapStripRequest_SubFrames ? maskSize : 0))
+  {
+    // The rest of the request can't be skipped.
+    result = slapError_Generic;
+    SendResponseHeader(client, result, 0);
+    goto epilogue;
+  }
+
+  if (type == slapStripRequest_SubFrames)
+    if ((result = ReceiveAll(client, pSubFrameMask, maskSize * sizeof(uint64_t))) != slapSuccess)
+      goto epilogue;
+
+  if (type == slapStripRequest_Info)
+  {
+    if ((result = SendResponseHeader(client, slapSuccess, sizeof(pFileReader->preHeaderBlock) + headerSize * sizeof(uint64_t))) != slapSuccess)
+      goto epilogue;
+
+    if ((result = SendAll(client, pFileReader->preHeaderBlock, sizeof(pFileReader->preHeaderBlock))) != slapSuccess)
+      goto epilogue;
+
+    result = SendAll(client, pFileReader->pHeader, headerSize * sizeof(uint64_t));
+    goto epilogue;
+  }
+
+  if (frameIndex >= frameCount || (type != slapStripRequest_LowRes && type != slapStripRequest_SubFrames))
+  {
+    result = SendResponseHeader(client, frameIndex >= frameCount ? slapError_EndOfStream : slapError_Generic, 0);
+    goto epilogue;
+  }
+
+  const uint64_t *pFrameHeader = pFileReader->pHeader + SLAP_HEADER_PER_FRAME_SIZE(subFrameCount) * frameIndex;
+
+  if (type == slapStripRequest_LowRes)
+  {
+    if ((result = SendResponseHeader(client, slapSuccess, pFrameHeader[SLAP_HEADER_FRAME_DATA_SIZE_INDEX])) != slapSuccess)
+      goto epilogue;
+
+    result = SendFileRange(client, pFile, pFileReader->headerOffset + pFrameHeader[SLAP_HEADER_FRAME_OFFSET_INDEX], pFrameHeader[SLAP_HEADER_FRAME_DATA_SIZE_INDEX]);
+    goto epilogue;
+  }
+
+  // The packet contains the requested sub frames in order, starting right after its header (see slapFramePacket).
+  uint64_t frameSize = 0;
+
+  memset(pPacketHeader, 0, SLAP_HEADER_PER_FRAME_SIZE(subFrameCount) * sizeof(uint64_t));
+
+  for (size_t i = 0; i < subFrameCount; i++)
+  {
+    if (!(pSubFrameMask[i >> 6] & ((uint64_t)1 << (i & 63))))
+      continue;
+
+    pPacketHeader[SLAP_HEADER_PER_FRAME_FULL_FRAME_OFFSET + i * 2 + SLAP_HEADER_FRAME_OFFSET_INDEX] = frameSize;
+    pPacketHeader[SLAP_HEADER_PER_FRAME_FULL_FRAME_OFFSET + i * 2 + SLAP_HEADER_FRAME_DATA_SIZE_INDEX] = pFrameHeader[SLAP_HEADER_PER_FRAME_FULL_FRAME_OFFSET + i * 2 + SLAP_HEADER_FRAME_DATA_SIZE_INDEX];
+    frameSize += pFrameHeader[SLAP_HEADER_PER_FRAME_FULL_FRAME_OFFSET + i * 2 + SLAP_HEADER_FRAME_DATA_SIZE_INDEX];
+  }
+
+  pPacketHeader[2 + SLAP_HEADER_FRAME_DATA_SIZE_INDEX] = frameSize;
+  pPacketHeader[SLAP_HEADER_PER_FRAME_FRAME_TYPE_INDEX(subFrameCount)] = pFrameHeader[SLAP_HEADER_PER_FRAME_FRAME_TYPE_INDEX(subFrameCount)];
+
+  if ((result = SendResponseHeader(client, slapSuccess, SLAP_HEADER_PER_FRAME_SIZE(subFrameCount) * sizeof(uint64_t) + frameSize)) != slapSuccess)
+    goto epilogue;
+
+  if ((result = SendAll(client, pPacketHeader, SLAP_HEADER_PER_FRAME_SIZE(subFrameCount) * sizeof(uint64_t))) != slapSuccess)
+    goto epilogue;
+
+  // Adjacent sub frames are stored next to each other in the file, so they're sent at once.
+  const uint64_t framePosition = pFileReader->headerOffset + pFrameHeader[2 + SLAP_HEADER_FRAME_OFFSET_INDEX];
+  uint64_t rangeStart = 0;
+  uint64_t rangeSize = 0;
+
+  for (size_t i = 0; i < subFrameCount; i++)
+  {
+    const uint64_t offset = pFrameHeader[SLAP_HEADER_PER_FRAME_FULL_FRAME_OFFSET + i * 2 + SLAP_HEADER_FRAME_OFFSET_INDEX];
+    const uint64_t size = pPacketHeader[SLAP_HEADER_PER_FRAME_FULL_FRAME_OFFSET + i * 2 + SLAP_HEADER_FRAME_DATA_SIZE_INDEX];
+
+    if (size == 0)
+      continue;
+
+    if (rangeSize > 0 && rangeStart + rangeSize != offset)
+    {
+      if ((result = SendFileRange(client, pFile, framePosition + rangeStart, rangeSize)) != slapSuccess)
+        goto epilogue;
+
+      rangeSize = 0;
+    }
+
+    if (rangeSize == 0)
+      rangeStart = offset;
+
+    rangeSize += size;
+  }
+
+  if (rangeSize > 0)
+    result = SendFileRange(client, pFile, framePosition + rangeStart, rangeSize);
+
+epilogue:
+  return result;
+}
+
+THREAD_FUNCTION(ServeClient)
+{
+  Client *pClient = (Client *)pParameter;
+
+  while (HandleRequest(pClient->pFileReader, pClient->pFile, pClient->socket, pClient->pPacketHeader, pClient->pSubFrameMask) == slapSuccess)
+    ;
+
+  MutexLock(pClient->pMutex);
+  pClient->isDone = 1;
+  MutexUnlock(pClient->pMutex);
+
+  THREAD_RETURN;
+}
+
+void DestroyClient(IN_OUT Client **ppClient)
+{
+  Client *pClient = *ppClient;
+
+  if (!pClient)
+    return;
+
+  if (pClient->socket != INVALID_SOCKET)
+    CloseSocket(pClient->socket);
+
+  if (pClient->pFile)
+    fclose(pClient->pFile);
+
+  free(pClient->pPacketHeader);
+  free(pClient->pSubFrameMask);
+  free(pClient);
+
+  *ppClient = NULL;
+}
+
+// Takes ownership of the socket. Returns NULL if the client can't be served.
+Client * CreateClient(const Socket socket, const char *filename, IN slapFileReader *pFileReader, IN Mutex *pMutex)
+{
+  Client *pClient = malloc(sizeof(Client));
+
+  if (!pClient)
+  {
+    CloseSocket(socket);
+    return NULL;
+  }
+
+  memset(pClient, 0, sizeof(Client));
+
+  pClient->socket = socket;
+  pClient->pFileReader = pFileReader;
+  pClient->pMutex = pMutex;
+  pClient->pFile = fopen(filename, "rb");
+  pClient->pPacketHeader = malloc(SLAP_HEADER_PER_FRAME_SIZE(pFileReader->pDecoder->subFrameCount) * sizeof(uint64_t));
+  pClient->pSubFrameMask = malloc(SLAP_STRIP_MASK_SIZE(pFileReader->pDecoder->subFrameCount) * sizeof(uint64_t));
+
+  if (!pClient->pFile || !pClient->pPacketHeader || !pClient->pSubFrameMask || !CreateThreadWithParameter(&pClient->thread, ServeClient, pClient))
+  {
+    DestroyClient(&pClient);
+    return NULL;
+  }
+
+  return pClient;
+}
+
+// Only removes the file at path if it's a socket (e.g. one left behind by a previous run), so that files passed by mistake aren't deleted.
+void RemoveSocketFile(const char *path)
+{
+#ifdef _WIN32
+  WIN32_FIND_DATAA findData;
+  const HANDLE findHandle = FindFirstFileA(path, &findData);
+
+  if (findHandle == INVALID_HANDLE_VALUE)
+    return;
+
+  FindClose(findHandle);
+
+  // For reparse points dwReserved0 is the reparse tag.
+  if ((findData.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) && findData.dwReserved0 == IO_REPARSE_TAG_AF_UNIX)
+    DeleteFileA(path);
+#else
+  struct stat status;
+
+  if (lstat(path, &status) == 0 && S_ISSOCK(status.st_mode))
+    unlink(path);
+#endif
+}
+
+int main(int argc, char **argv)
+{
+  int retval = 0;
+  Socket listener = INVALID_SOCKET;
+  Client *pClients[MAX_CLIENTS] = { NULL };
+  Mutex mutex;
+  struct pollfd listenerDescriptor;
+  struct sockaddr_un address;
+  slapFileReader *pFileReader = NULL;
+
+  MutexInit(&mutex);
+
+#ifdef _WIN32
+  WSADATA wsaData;
+
+  // Matched by the WSACleanup in the epilogue.
+  if (WSAStartup(MAKEWORD(2, 2), &wsaData))
+  {
+    printf("Failed to initialize Winsock.");
+    return 1;
+  }
+#endif
+
+  if (argc != 3)
+  {
+    printf("Usage: %s <slapfile> <socket>", argv[0]);
+    retval = 1;
+    goto epilogue;
+  }
+
+  if (strlen(argv[2]) >= sizeof(address.sun_path))
+  {
+    printf("Socket path too long.");
+    retval = 1;
+    goto epilogue;
+  }
+
+  pFileReader = slapCreateFileReader(argv[1]);
+
+  if (!pFileReader)
+  {
+    printf("Failed to open '%s'.", argv[1]);
+    retval = 1;
+    goto epilogue;
+  }
+
+  listener = socket(AF_UNIX, SOCK_STREAM, 0);
+
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  memcpy(address.sun_path, argv[2], strlen(argv[2]) + 1);
+
+  // The socket file of a previous run has to be removed before binding.
+  RemoveSocketFile(argv[2]);
+
+  if (listener == INVALID_SOCKET || bind(listener, (struct sockaddr *)&address, (int)sizeof(address)) || listen(listener, MAX_CLIENTS))
+  {
+    printf("Failed to listen on '%s'.", argv[2]);
+    retval = 1;
+    goto epilogue;
+  }
+
+#ifndef _WIN32
+  signal(SIGPIPE, SIG_IGN);
+#endif
+  signal(SIGINT, OnSignal);
+  signal(SIGTERM, OnSignal);
+
+  printf("Serving '%s' (%" PRIu64 " frames) on '%s'.\n", argv[1], pFileReader->preHeaderBlock[SLAP_PRE_HEADER_FRAME_COUNT_INDEX], argv[2]);
+
+  listenerDescriptor.fd = listener;
+  listenerDescriptor.events = POLLIN;
+
+  while (isRunning)
+  {
+    const int pollResult = poll(&listenerDescriptor, 1, POLL_TIMEOUT_MS);
+
+    if (pollResult < 0)
+    {
+#ifndef _WIN32
+      if (errno == EINTR)
+        continue;
+#endif
+
+      retval = 1;
+      break;
+    }
+
+    // Clean up after the clients that have disconnected.
+    for (size_t i = 0; i < MAX_CLIENTS; i++)
+    {
+      if (!pClients[i])
+        continue;
+
+      MutexLock(&mutex);
+      const bool_t isDone = pClients[i]->isDone;
+      MutexUnlock(&mutex);
+
+      if (isDone)
+      {
+        JoinThread(pClients[i]->thread);
+        DestroyClient(&pClients[i]);
+      }
+    }
+
+    if (pollResult == 0 || !(listenerDescriptor.revents & POLLIN))
+      continue;
+
+    const Socket client = accept(listener, NULL, NULL);
+
+    if (client == INVALID_SOCKET)
+      continue;
+
+    size_t index = 0;
+
+    while (index < MAX_CLIENTS && pClients[index])
+      index++;
+
+    if (index == MAX_CLIENTS)
+      CloseSocket(client);
+    else
+      pClients[index] = CreateClient(client, argv[1], pFileReader, &mutex);
+  }
+
+epilogue:
+  // Shutting the sockets down makes the threads of the clients return from blocking calls.
+  for (size_t i = 0; i < MAX_CLIENTS; i++)
+  {
+    if (!pClients[i])
+      continue;
+
+    ShutdownSocket(pClients[i]->socket);
+    JoinThread(pClients[i]->thread);
+    DestroyClient(&pClients[i]);
+  }
+
+  if (listener != INVALID_SOCKET)
+  {
+    CloseSocket(listener);
+    RemoveSocketFile(argv[2]);
+  }
+
+#ifdef _WIN32
+  WSACleanup();
+#endif
+
+  slapDestroyFileReader(&pFileReader);
+  MutexDestroy(&mutex);
+
+  return retval;
+}
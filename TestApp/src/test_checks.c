@@ -0,0 +1,370 @@
+// Copyright 2018 Christoph Stiller
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "test_checks.h"
+
+#include <stdlib.h>
+
+#define CHECK_RES_X 512
+#define CHECK_RES_Y 512
+#define CHECK_FRAME_SIZE (CHECK_RES_X * CHECK_RES_Y * 3 / 2)
+#define CHECK_FRAME_COUNT 6
+
+#define CHECK_RING_NAME "/slapTestAppRing"
+#define CHECK_RING_CAPACITY (64 * 1024) // a few P-Frames of GenerateFrame.
+#define CHECK_RING_FRAME_COUNT 32
+
+// Jumps to the epilogue of the check with slapError_Generic (after printing the location) if the condition doesn't hold.
+#define CHECK(condition) do { if (!(condition)) { printf("\n  %s(%d): '%s' failed.\n", __FILE__, __LINE__, #condition); result = slapError_Generic; goto epilogue; } } while (0)
+#define CHECK_SUCCESS(function) CHECK((function) == slapSuccess)
+
+// The first byte of the records of the lossless backend (see SLAP_LOSSLESS_MODE_RAW in slapcodec.c).
+#define LOSSLESS_MODE_RAW 0
+#define LOSSLESS_MODE_RANS 1
+
+typedef slapResult (*CheckFunction)();
+
+// A stereo frame with a gradient (shifted between the eyes) and a box that moves with the frame index, so that P-Frames and the stereo difference have something to encode.
+void GenerateFrame(OUT uint8_t *pData, const size_t frameIndex)
+{
+  const size_t eyeResY = CHECK_RES_Y / 2;
+
+  for (size_t eye = 0; eye < 2; eye++)
+  {
+    for (size_t y = 0; y < eyeResY; y++)
+    {
+      for (size_t x = 0; x < CHECK_RES_X; x++)
+      {
+        const size_t shiftedX = (x + eye * 6) % CHECK_RES_X;
+        const size_t boxX = 40 + frameIndex * 8;
+        const size_t boxY = 60 + frameIndex * 2;
+        const bool_t isInBox = shiftedX >= boxX && shiftedX < boxX + 48 && y >= boxY && y < boxY + 40;
+
+        pData[(eye * eyeResY + y) * CHECK_RES_X + x] = (uint8_t)(isInBox ? 230 - (y & 31) : 30 + shiftedX * 150 / CHECK_RES_X + (y & 15));
+      }
+    }
+  }
+
+  uint8_t *pChroma = pData + CHECK_RES_X * CHECK_RES_Y;
+
+  for (size_t i = 0; i < CHECK_RES_X * CHECK_RES_Y / 2; i++)
+    pChroma[i] = (uint8_t)(112 + ((i + frameIndex * 3) & 31));
+}
+
+// Noise doesn't compress, so the lossless backend has to store it raw.
+void GenerateNoiseFrame(OUT uint8_t *pData, const uint32_t seed)
+{
+  uint32_t state = seed;
+
+  for (size_t i = 0; i < CHECK_FRAME_SIZE; i++)
+  {
+    state = state * 1664525 + 1013904223;
+    pData[i] = (uint8_t)(state >> 24);
+  }
+}
+
+// Concatenates the chunks of pPacket into pBuffer (which has to be large enough), as they'd be sent.
+size_t CopyPacket(IN const slapFramePacket *pPacket, OUT uint8_t *pBuffer)
+{
+  size_t offset = 0;
+
+  for (size_t i = 0; i < pPacket->chunkCount; i++)
+  {
+    memcpy(pBuffer + offset, pPacket->pChunks[i].pData, pPacket->pChunks[i].size);
+    offset += pPacket->pChunks[i].size;
+  }
+
+  return offset;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+// Encoding with preserveInput set has to leave the input untouched and produce the same packets as encoding in place.
+slapResult Check_PreserveInput()
+{
+  slapResult result = slapSuccess;
+  slapEncoder *pInPlaceEncoder = slapCreateEncoder(CHECK_RES_X, CHECK_RES_Y, SLAP_FLAG_STEREO);
+  slapEncoder *pPreservingEncoder = slapCreateEncoder(CHECK_RES_X, CHECK_RES_Y, SLAP_FLAG_STEREO);
+  uint8_t *pFrame = slapAlloc(uint8_t, CHECK_FRAME_SIZE);
+  uint8_t *pFrameCopy = slapAlloc(uint8_t, CHECK_FRAME_SIZE);
+
+  CHECK(pInPlaceEncoder && pPreservingEncoder && pFrame && pFrameCopy);
+
+  pPreservingEncoder->preserveInput = 1;
+
+  for (size_t frameIndex = 0; frameIndex < CHECK_FRAME_COUNT; frameIndex++)
+  {
+    slapFramePacket inPlacePacket;
+    slapFramePacket preservedPacket;
+
+    GenerateFrame(pFrame, frameIndex);
+    memcpy(pFrameCopy, pFrame, CHECK_FRAME_SIZE);
+
+    CHECK_SUCCESS(slapEncoder_EncodeFrame(pPreservingEncoder, pFrame, &preservedPacket));
+    CHECK(memcmp(pFrame, pFrameCopy, CHECK_FRAME_SIZE) == 0);
+
+    // The in place encoder overwrites pFrameCopy with the residual.
+    CHECK_SUCCESS(slapEncoder_EncodeFrame(pInPlaceEncoder, pFrameCopy, &inPlacePacket));
+
+    CHECK(preservedPacket.isIframe == inPlacePacket.isIframe);
+    CHECK(preservedPacket.chunkCount == inPlacePacket.chunkCount);
+    CHECK(preservedPacket.size == inPlacePacket.size);
+
+    for (size_t i = 0; i < preservedPacket.chunkCount; i++)
+    {
+      CHECK(preservedPacket.pChunks[i].size == inPlacePacket.pChunks[i].size);
+      CHECK(memcmp(preservedPacket.pChunks[i].pData, inPlacePacket.pChunks[i].pData, preservedPacket.pChunks[i].size) == 0);
+    }
+  }
+
+epilogue:
+  slapDestroyEncoder(&pInPlaceEncoder);
+  slapDestroyEncoder(&pPreservingEncoder);
+  slapFreePtr(&pFrame);
+  slapFreePtr(&pFrameCopy);
+
+  return result;
+}
+
+// The lossless backend has to reproduce I-Frames, P-Frames and sub frames that fall back to raw records bit exactly.
+slapResult Check_LosslessRoundTrip()
+{
+  slapResult result = slapSuccess;
+  const uint64_t flags = SLAP_FLAG_STEREO | SLAP_FLAG_ENCODER(SLAP_ENCODER_LOSSLESS);
+  slapEncoder *pEncoder = slapCreateEncoder(CHECK_RES_X, CHECK_RES_Y, flags);
+  slapDecoder *pDecoder = slapCreateDecoder(CHECK_RES_X, CHECK_RES_Y, flags);
+  uint8_t *pFrame = slapAlloc(uint8_t, CHECK_FRAME_SIZE);
+  uint8_t *pResidual = slapAlloc(uint8_t, CHECK_FRAME_SIZE);
+  uint8_t *pDecodedFrame = slapAlloc(uint8_t, CHECK_FRAME_SIZE);
+  uint8_t *pPacketData = slapAlloc(uint8_t, CHECK_FRAME_SIZE * 2);
+
+  CHECK(pEncoder && pDecoder && pFrame && pResidual && pDecodedFrame && pPacketData);
+
+  // The noise frame would otherwise be encoded as I-Frame.
+  pEncoder->sceneCutThreshold = -1;
+
+  // I-Frame, P-Frame, P-Frame from noise (raw records), P-Frame after the noise.
+  for (size_t frameIndex = 0; frameIndex < 4; frameIndex++)
+  {
+    slapFramePacket packet;
+    size_t rawCount = 0;
+    size_t ransCount = 0;
+
+    if (frameIndex == 2)
+      GenerateNoiseFrame(pFrame, 1234);
+    else
+      GenerateFrame(pFrame, frameIndex);
+
+    memcpy(pResidual, pFrame, CHECK_FRAME_SIZE);
+
+    CHECK_SUCCESS(slapEncoder_EncodeFrame(pEncoder, pResidual, &packet));
+    CHECK(packet.isIframe == (frameIndex == 0));
+
+    // Without any prediction flags the sub frames don't have a prefix. Static P-Frame sub frames are empty.
+    for (size_t i = 2; i < packet.chunkCount; i++)
+    {
+      if (packet.pChunks[i].size == SLAP_STATIC_SUB_FRAME_SIZE)
+        continue;
+
+      const uint8_t mode = ((const uint8_t *)packet.pChunks[i].pData)[0];
+
+      CHECK(mode == LOSSLESS_MODE_RAW || mode == LOSSLESS_MODE_RANS);
+
+      if (mode == LOSSLESS_MODE_RAW)
+        rawCount++;
+      else
+        ransCount++;
+    }
+
+    if (frameIndex == 2)
+      CHECK(rawCount > 0);
+    else
+      CHECK(ransCount > 0);
+
+    CHECK(packet.size <= CHECK_FRAME_SIZE * 2);
+
+    const size_t packetSize = CopyPacket(&packet, pPacketData);
+
+    CHECK_SUCCESS(slapDecoder_DecodePacket(pDecoder, pPacketData, packetSize, pDecodedFrame, NULL));
+    CHECK(memcmp(pDecodedFrame, pFrame, CHECK_FRAME_SIZE) == 0);
+  }
+
+epilogue:
+  slapDestroyEncoder(&pEncoder);
+  slapDestroyDecoder(&pDecoder);
+  slapFreePtr(&pFrame);
+  slapFreePtr(&pResidual);
+  slapFreePtr(&pDecodedFrame);
+  slapFreePtr(&pPacketData);
+
+  return result;
+}
+
+// Reads & decodes all frames that are in the ring and compares them to the reconstructions of the writer. Returns the number of decoded frames in *pDecodedCount and their size in *pDecodedSize.
+slapResult DrainRing(IN slapSharedRingReader *pReader, IN uint8_t **ppReconstructedFrames, OUT size_t *pDecodedCount, OUT size_t *pDecodedSize)
+{
+  slapResult result = slapSuccess;
+
+  *pDecodedCount = 0;
+  *pDecodedSize = 0;
+
+  while ((result = slapSharedRingReader_ReadNextFrame(pReader)) == slapSuccess)
+  {
+    CHECK(pReader->frameIndex < CHECK_RING_FRAME_COUNT);
+    CHECK_SUCCESS(slapSharedRingReader_DecodeCurrentFrame(pReader, NULL));
+    CHECK(pReader->hasReferenceFrame && pReader->referenceFrameIndex == pReader->frameIndex);
+    CHECK(memcmp(pReader->pDecodedFrameYUV, ppReconstructedFrames[pReader->frameIndex], CHECK_FRAME_SIZE) == 0);
+
+    (*pDecodedCount)++;
+    *pDecodedSize += pReader->currentFrameSize;
+  }
+
+  CHECK(result == slapError_EndOfStream);
+  result = slapSuccess;
+
+epilogue:
+  return result;
+}
+
+// A writer & reader of the same ring in one process: The ring has to wrap around while the reader keeps up, drop frames once it's full and continue with an I-Frame after that. P-Frames after frames that haven't been decoded have to be skipped.
+slapResult Check_SharedRing()
+{
+  slapResult result = slapSuccess;
+  slapSharedRingWriter *pWriter = slapCreateSharedRingWriter(CHECK_RING_NAME, CHECK_RING_CAPACITY, CHECK_RES_X, CHECK_RES_Y, SLAP_FLAG_STEREO, SLAP_DEFAULT_SUB_FRAME_ROWS, SLAP_DEFAULT_SUB_FRAME_COLUMNS);
+  slapSharedRingReader *pReader = pWriter ? slapCreateSharedRingReader(CHECK_RING_NAME) : NULL;
+  uint8_t *pFrame = slapAlloc(uint8_t, CHECK_FRAME_SIZE);
+  uint8_t *ppReconstructedFrames[CHECK_RING_FRAME_COUNT] = { NULL };
+  size_t frameIndex = 0;
+  size_t decodedCount = 0;
+  size_t decodedSize = 0;
+  slapResult addResult = slapSuccess;
+
+  CHECK(pWriter && pReader && pFrame);
+
+  for (size_t i = 0; i < CHECK_RING_FRAME_COUNT; i++)
+  {
+    ppReconstructedFrames[i] = slapAlloc(uint8_t, CHECK_FRAME_SIZE);
+    CHECK(ppReconstructedFrames[i]);
+  }
+
+  // Only the dropped frames may cause I-Frames.
+  pWriter->pEncoder->iframeStep = CHECK_RING_FRAME_COUNT * 2;
+
+  // The reader keeps up: Every frame fits and the ring wraps around.
+  for (size_t i = 0; i < 12; i++, frameIndex++)
+  {
+    GenerateFrame(pFrame, frameIndex);
+    CHECK_SUCCESS(slapSharedRingWriter_AddFrameYUV420(pWriter, pFrame));
+    memcpy(ppReconstructedFrames[frameIndex], pWriter->pEncoder->pLastFrame, CHECK_FRAME_SIZE);
+
+    size_t count;
+    size_t size;
+
+    CHECK_SUCCESS(DrainRing(pReader, ppReconstructedFrames, &count, &size));
+    CHECK(count == 1 && pReader->frameIndex == frameIndex);
+
+    decodedSize += size;
+  }
+
+  CHECK(decodedSize > CHECK_RING_CAPACITY);
+  CHECK(pWriter->droppedFrameCount == 0);
+
+  // The reader stalls until the ring is full.
+  const size_t firstUnreadFrameIndex = frameIndex;
+
+  while (frameIndex < 24)
+  {
+    GenerateFrame(pFrame, frameIndex);
+    addResult = slapSharedRingWriter_AddFrameYUV420(pWriter, pFrame);
+    memcpy(ppReconstructedFrames[frameIndex], pWriter->pEncoder->pLastFrame, CHECK_FRAME_SIZE);
+    frameIndex++;
+
+    if (addResult != slapSuccess)
+      break;
+  }
+
+  CHECK(addResult == slapError_FrameDropped);
+  CHECK(pWriter->droppedFrameCount == 1);
+
+  const size_t droppedFrameIndex = frameIndex - 1;
+
+  // Everything before the dropped frame is still decodable.
+  CHECK_SUCCESS(DrainRing(pReader, ppReconstructedFrames, &decodedCount, &decodedSize));
+  CHECK(decodedCount == droppedFrameIndex - firstUnreadFrameIndex && pReader->frameIndex == droppedFrameIndex - 1);
+
+  // The frame after the dropped one is an I-Frame, the one after that a P-Frame referencing it.
+  for (size_t i = 0; i < 2; i++, frameIndex++)
+  {
+    GenerateFrame(pFrame, frameIndex);
+    CHECK_SUCCESS(slapSharedRingWriter_AddFrameYUV420(pWriter, pFrame));
+    CHECK(pWriter->pEncoder->isIframe == (i == 0));
+    memcpy(ppReconstructedFrames[frameIndex], pWriter->pEncoder->pLastFrame, CHECK_FRAME_SIZE);
+  }
+
+  CHECK_SUCCESS(DrainRing(pReader, ppReconstructedFrames, &decodedCount, &decodedSize));
+  CHECK(decodedCount == 2 && pReader->referenceFrameIndex == droppedFrameIndex + 2);
+
+  // A frame that's read but not decoded breaks the chain of references: The following P-Frames are skipped.
+  for (size_t i = 0; i < 3; i++, frameIndex++)
+  {
+    GenerateFrame(pFrame, frameIndex);
+    CHECK_SUCCESS(slapSharedRingWriter_AddFrameYUV420(pWriter, pFrame));
+    CHECK(!pWriter->pEncoder->isIframe);
+  }
+
+  CHECK_SUCCESS(slapSharedRingReader_ReadNextFrame(pReader));
+  CHECK(pReader->frameIndex == droppedFrameIndex + 3);
+  CHECK(slapSharedRingReader_ReadNextFrame(pReader) == slapError_EndOfStream);
+
+epilogue:
+  slapDestroySharedRingReader(&pReader);
+  slapDestroySharedRingWriter(&pWriter);
+  slapFreePtr(&pFrame);
+
+  for (size_t i = 0; i < CHECK_RING_FRAME_COUNT; i++)
+    slapFreePtr(&ppReconstructedFrames[i]);
+
+  return result;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+size_t RunChecks()
+{
+  const struct
+  {
+    const char *name;
+    CheckFunction function;
+  } checks[] =
+  {
+    { "PreserveInput", Check_PreserveInput },
+    { "LosslessRoundTrip", Check_LosslessRoundTrip },
+    { "SharedRing", Check_SharedRing },
+  };
+
+  size_t failedCount = 0;
+
+  for (size_t i = 0; i < sizeof(checks) / sizeof(checks[0]); i++)
+  {
+    printf("Check %s...", checks[i].name);
+
+    if (checks[i].function() == slapSuccess)
+    {
+      printf(" ok.\n");
+    }
+    else
+    {
+      printf("Check %s failed.\n", checks[i].name);
+      failedCount++;
+    }
+  }
+
+  printf("%" PRIu64 " / %" PRIu64 " checks failed.\n", failedCount, sizeof(checks) / sizeof(checks[0]));
+
+  return failedCount;
+}
@@ -7,6 +7,7 @@
 // THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
 #include "slapcodec.h"
+#include "test_checks.h"
 #include <time.h>
 
 #define ASSERT_SUCCESS(function) do { if ((function) != slapSuccess) __debugbreak(); } while (0)
@@ -14,12 +15,16 @@
 int main(int argc, char **argv)
 {
   void *pFileData = NULL;
-  void *pFrame = NULL;
   int retval = 0;
   char *origFile = NULL;
   char *slapFile = NULL;
 
-  if (argc > 2)
+  if (argc == 2 && strcmp(argv[1], "--test") == 0)
+  {
+    retval = RunChecks() == 0 ? 0 : 1;
+    goto epilogue;
+  }
+  else if (argc > 2)
   {
     origFile = argv[1];
     slapFile = argv[2];
@@ -57,7 +62,7 @@ int main(int argc, char **argv)
   }
   else
   {
-    printf("Usage: %s <inputfile> <outputfile>", argv[0]);
+    printf("Usage: %s <inputfile> <outputfile> | %s <slapfile> | %s --test", argv[0], argv[0], argv[0]);
     goto epilogue;
   }
 
@@ -73,13 +78,14 @@ int main(int argc, char **argv)
     frameCount = 100;
     printf("Adding %" PRIu64 " frames...\n", frameCount);
 
-    pFrame = malloc(7680 * 11520);
+    // The encoder writes the residual to an internal buffer, so the same input frame can be passed repeatedly.
+    pFileWriter->pEncoder->preserveInput = 1;
+
     before = clock();
 
     for (size_t i = 0; i < frameCount; i++)
     {
-      slapMemcpy(pFrame, pFileData, 7680 * 11520);
-      ASSERT_SUCCESS(slapFileWriter_AddFrameYUV420(pFileWriter, pFrame));
+      ASSERT_SUCCESS(slapFileWriter_AddFrameYUV420(pFileWriter, pFileData));
       printf("\rFrame %" PRIu64 " / %" PRIu64 " processed.", i + 1, frameCount);
     }
 
@@ -179,6 +185,5 @@ int main(int argc, char **argv)
 
 epilogue:
   free(pFileData);
-  free(pFrame);
   return retval;
 }
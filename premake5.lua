@@ -8,4 +8,7 @@ solution "slapcodec"
     location("slapcodec")
 
   dofile "TestApp/project.lua"
-    location("TestApp")
\ No newline at end of file
+    location("TestApp")
+
+  dofile "StripServer/project.lua"
+    location("StripServer")
@@ -60,15 +60,48 @@ extern "C" {
     slapError_Compress_Internal,
     slapError_FileError,
     slapError_EndOfStream,
-    slapError_MemoryAllocation
+    slapError_MemoryAllocation,
+    slapError_FrameDropped
   } slapResult;
 
   slapResult slapWriteJpegFromYUV(const char *filename, IN void *pData, const size_t resX, const size_t resY);
 
-#define SLAP_SUB_BUFFER_COUNT 24
-#define SLAP_LOW_RES_BUFFER_INDEX SLAP_SUB_BUFFER_COUNT
+// Frames are split into subFrameRows x subFrameColumns sub frames that are en- & decoded independently.
+// The rows are spread over the Y, U and V plane (2 : 1 : 1 after interpreting U and V as resX wide) and both eyes, so the number of rows has to be a multiple of SLAP_SUB_FRAME_ROW_GRANULARITY.
+// As every resX wide row of the U and V plane holds two chroma lines (resX / 2 wide) next to each other, the columns of the chroma sub frames aren't spatial tiles: Column c holds the chroma of the horizontal range [c * resX / subFrameColumns, (c + 1) * resX / subFrameColumns) modulo resX / 2, of the even chroma lines left of resX / 2 and of the odd chroma lines right of it.
+// With an even number of columns the chroma of the luma columns 2c and 2c + 1 is therefore split between the chroma columns c and c + subFrameColumns / 2.
+#define SLAP_SUB_FRAME_ROW_GRANULARITY 12
+#define SLAP_DEFAULT_SUB_FRAME_ROWS 24
+#define SLAP_DEFAULT_SUB_FRAME_COLUMNS 1
 
 #define SLAP_FLAG_STEREO 1
+#define SLAP_FLAG_ENCODER(encoder) ((uint64_t)((encoder) & 0xF) << 1) // selects the backend used for the sub frames & the low res preview (mode.flags.encoder).
+#define SLAP_FLAG_STATIC_BLOCKS (1 << 5)
+#define SLAP_FLAG_MOTION_COMPENSATION (1 << 6)
+#define SLAP_FLAG_STEREO_DISPARITY (1 << 7)
+#define SLAP_FLAG_GLOBAL_MOTION (1 << 8)
+
+#define SLAP_ENCODER_TURBOJPEG 0
+#define SLAP_ENCODER_LOSSLESS 1 // bit exact sub frames, the low res preview stays lossy.
+
+#define SLAP_STATIC_BLOCK_SIZE 16
+
+// With SLAP_FLAG_MOTION_COMPENSATION every block of the top eye luma has a motion vector that's applied to both eyes (and at half resolution to the chroma planes).
+#define SLAP_MOTION_BLOCK_WIDTH 16
+#define SLAP_MOTION_BLOCK_HEIGHT 8
+#define SLAP_DEFAULT_MOTION_SEARCH_RANGE 4
+
+// With SLAP_FLAG_STEREO_DISPARITY every bottom eye sub frame is predicted from the top eye sub frame shifted horizontally by a per sub frame disparity (clamped to the sub frame & chroma line).
+#define SLAP_DEFAULT_DISPARITY_SEARCH_RANGE 32
+
+// With SLAP_FLAG_GLOBAL_MOTION P-Frames are predicted from the last frame shifted cyclically along the x axis (the chroma planes by half the shift, rounded down), as with panning equirectangular frames.
+#define SLAP_DEFAULT_GLOBAL_MOTION_SEARCH_RANGE 64
+
+// Scaled decoders reconstruct the frames at 1 / (1 << scaleShift) of their resolution straight from the DCT coefficients (only supported by SLAP_ENCODER_TURBOJPEG).
+// P-Frames are predicted from the scaled last frame, so the reconstruction drifts from the downscaled full resolution frames until the next I-Frame (especially where residuals wrap around, e.g. at edges with more than 127 difference between the eyes or frames).
+#define SLAP_DECODER_SCALE_FULL 0
+#define SLAP_DECODER_SCALE_HALF 1
+#define SLAP_DECODER_SCALE_QUARTER 2
 
   typedef union mode
   {
@@ -78,14 +111,34 @@ extern "C" {
     {
       unsigned int stereo : 1;
       unsigned int encoder : 4;
+      unsigned int staticBlocks : 1;
+      unsigned int motionCompensation : 1;
+      unsigned int stereoDisparity : 1;
+      unsigned int globalMotion : 1;
     } flags;
 
   } mode;
 
+  // A part of an encoded frame packet (see slapFramePacket).
+  typedef struct slapPacketChunk
+  {
+    void *pData;
+    size_t size;
+  } slapPacketChunk;
+
   typedef struct slapEncoder
   {
     size_t frameIndex;
-    size_t iframeStep;
+    size_t subFrameRows;
+    size_t subFrameColumns;
+    size_t subFrameCount;
+    size_t iframeStep; // the maximum distance between two I-Frames.
+    size_t lastIframeIndex;
+    bool_t isIframe;
+
+    // P-Frames with a mean absolute difference to the last frame above this are encoded as I-Frames. Negative values disable scene cut detection.
+    int sceneCutThreshold;
+
     size_t resX;
     size_t resY;
     uint8_t *pLowResData;
@@ -98,44 +151,152 @@ extern "C" {
     int quality;
     int iframeQuality;
     int lowResQuality;
+
+    // Added to quality / iframeQuality for every plane (Y, U, V) and every sub frame.
+    int planeQualityOffsets[3];
+    int *pSubFrameQualityOffsets;
     void **ppEncoderInternal;
     void **ppLowResEncoderInternal;
-    void **ppDecoderInternal;
     void **ppCompressedBuffers;
-    size_t compressedSubBufferSizes[SLAP_SUB_BUFFER_COUNT + 1];
+    size_t *pCompressedSubBufferSizes; // the size of the low res image is stored after the sizes of the sub frames.
     void *pThreadPoolHandle;
+
+    // P-Frame sub frames whose residual doesn't deviate more than this from the neutral value are stored as zero length records. Negative values disable static sub frames.
+    int staticSubFrameThreshold;
+    bool_t *pStaticSubFrames;
+
+    // Rate Control: Enabled if targetBytesPerSecond isn't zero. Adjusts quality and iframeQuality once every framesPerSecond frames to match the target data rate.
+    size_t targetBytesPerSecond;
+    size_t framesPerSecond;
+    size_t vbvBufferSize; // optional, zero disables the buffer constraint.
+    size_t vbvBufferFullness;
+    double averageFrameSize; // of the last window of framesPerSecond frames.
+    size_t rateControlWindowSize;
+    size_t rateControlWindowFrameCount;
+    int minQuality;
+    int maxQuality;
+
+    // With SLAP_FLAG_STATIC_BLOCKS one bit per SLAP_STATIC_BLOCK_SIZE x SLAP_STATIC_BLOCK_SIZE block of every sub frame (set if the block changed).
+    uint8_t *pChangedBlockMaps;
+    size_t changedBlockMapSize;
+
+    // With SLAP_FLAG_MOTION_COMPENSATION: The maximum motion vector component (in luma pixels) that's searched for. The motion vectors are stored per sub frame (see SLAP_MOTION_BLOCK_WIDTH).
+    int motionSearchRange;
+    int8_t *pMotionVectors;
+    uint8_t *pPrediction;
+
+    // With SLAP_FLAG_STEREO_DISPARITY: The maximum disparity (in pixels of the respective plane) that's searched for. One disparity per sub frame (only used for the bottom eye).
+    int disparitySearchRange;
+    int8_t *pDisparities;
+
+    // With SLAP_FLAG_GLOBAL_MOTION: The maximum global shift (in luma pixels) that's searched for.
+    int globalMotionSearchRange;
+    int globalShift;
+
+    // The global shift, motion vectors & disparities are stored in front of the sub frame data.
+    uint8_t *pSubFramePrefixes;
+    size_t subFramePrefixCapacity;
+
+    // If set, the frames passed to the encoder are only read from and the residuals are written to pResidualFrame instead (allocated on the first frame). Must not be changed between slapEncoder_BeginFrame and slapEncoder_EndFrame.
+    bool_t preserveInput;
+    uint8_t *pResidualFrame;
+
+    // The header & chunks of the frame packet returned by slapEncoder_EncodeFrame.
+    uint64_t *pPacketHeader;
+    slapPacketChunk *pPacketChunks;
   } slapEncoder;
 
   slapEncoder * slapCreateEncoder(const size_t sizeX, const size_t sizeY, const uint64_t flags);
+  slapEncoder * slapCreateEncoderWithSubFrameLayout(const size_t sizeX, const size_t sizeY, const uint64_t flags, const size_t subFrameRows, const size_t subFrameColumns);
   void slapDestroyEncoder(IN_OUT slapEncoder **ppEncoder);
 
   slapResult slapFinalizeEncoder(IN slapEncoder *pEncoder);
 
   // After slapEncoder_BeginFrame has finished, the subFrame can be compressed and written.
+  // Unless pEncoder->preserveInput is set, pData is overwritten with the residual, so the same pointer has to be passed to all other calls for this frame.
   slapResult slapEncoder_BeginFrame(IN slapEncoder *pEncoder, IN void *pData);
 
+  typedef enum slapInputFormat
+  {
+    slapInputFormat_YUV420, // Y, U & V planes.
+    slapInputFormat_NV12, // Y plane & interleaved UV plane.
+    slapInputFormat_UYVY // packed 4:2:2 (U0 Y0 V0 Y1), the chroma of every two lines is averaged.
+  } slapInputFormat;
+
+  // A caller owned image (both eyes, top eye first) that slapEncoder_BeginFrameFromBuffer reads the frame from. The strides may contain padding.
+  typedef struct slapInputBuffer
+  {
+    slapInputFormat format;
+    const uint8_t *pPlanes[3]; // only pPlanes[0] is used for slapInputFormat_UYVY, pPlanes[0] & pPlanes[1] for slapInputFormat_NV12.
+    size_t strides[3]; // in bytes.
+  } slapInputBuffer;
+
+  // Converts pInput to planar YUV420 in pEncoder->pResidualFrame (which the residual is then calculated in), the input isn't modified. pEncoder->pResidualFrame has to be passed as pData to all other calls for this frame.
+  slapResult slapEncoder_BeginFrameFromBuffer(IN slapEncoder *pEncoder, IN const slapInputBuffer *pInput);
+
   // After slapEncoder_BeginSubFrame has finished, the frame can be written to disk.
   slapResult slapEncoder_BeginSubFrame(IN slapEncoder *pEncoder, IN void *pData, OUT void **ppCompressedData, OUT size_t *pSize, const size_t subFrameIndex);
   slapResult slapEncoder_EndSubFrame(IN slapEncoder *pEncoder, IN void *pData, const size_t subFrameIndex);
 
   slapResult slapEncoder_EndFrame(IN slapEncoder *pEncoder, IN void *pData);
 
+  // An encoded frame. The chunks are the header, the low res frame and the sub frames, which can be written out in that order (e.g. with writev) to get a self-describing packet.
+  // The header consists of SLAP_HEADER_PER_FRAME_SIZE(subFrameCount) uint64_t with the same layout as the per frame file header, but the low res & full frame offsets are relative to the end of the header.
+  // All chunks are owned by the encoder and only valid until the next frame is encoded.
+  typedef struct slapFramePacket
+  {
+    size_t frameIndex;
+    bool_t isIframe;
+    slapPacketChunk *pChunks;
+    size_t chunkCount; // subFrameCount + 2.
+    size_t size; // the sum of the sizes of all chunks.
+  } slapFramePacket;
+
+  // Encodes a whole frame (see slapEncoder_BeginFrame / slapEncoder_BeginFrameFromBuffer), without going through slapFileWriter.
+  slapResult slapEncoder_EncodeFrame(IN slapEncoder *pEncoder, IN void *pData, OUT slapFramePacket *pPacket);
+  slapResult slapEncoder_EncodeFrameFromBuffer(IN slapEncoder *pEncoder, IN const slapInputBuffer *pInput, OUT slapFramePacket *pPacket);
+
+  // Lowers the quality of sub frames towards the poles of equirectangular frames depending on how much they're oversampled.
+  slapResult slapEncoder_SetEquirectangularQualityPreset(IN slapEncoder *pEncoder);
+
 #define SLAP_HEADER_BLOCK_SIZE 1024
 
-#define SLAP_PRE_HEADER_SIZE 8
+#define SLAP_PRE_HEADER_SIZE 9
 #define SLAP_PRE_HEADER_HEADER_SIZE_INDEX 0
 #define SLAP_PRE_HEADER_FRAME_COUNT_INDEX 1
 #define SLAP_PRE_HEADER_FRAME_SIZEX_INDEX 2
 #define SLAP_PRE_HEADER_FRAME_SIZEY_INDEX 3
 #define SLAP_PRE_HEADER_IFRAME_STEP_INDEX 4
 #define SLAP_PRE_HEADER_CODEC_FLAGS_INDEX 5
+#define SLAP_PRE_HEADER_SUB_FRAME_ROWS_INDEX 6
+#define SLAP_PRE_HEADER_SUB_FRAME_COLUMNS_INDEX 7
+#define SLAP_PRE_HEADER_FORMAT_VERSION_INDEX 8
+
+// Stored in the pre header. Files, streams & rings with a different version (including files written before it was stored) are rejected.
+#define SLAP_FORMAT_VERSION 0x31544D4650414C53 // "SLAPFMT1", has to be changed with every incompatible change of the format.
 
 #define SLAP_HEADER_PER_FRAME_FULL_FRAME_OFFSET 4
-#define SLAP_HEADER_PER_FRAME_SIZE (SLAP_HEADER_PER_FRAME_FULL_FRAME_OFFSET + SLAP_SUB_BUFFER_COUNT * 2)
+#define SLAP_HEADER_PER_FRAME_FRAME_TYPE_INDEX(subFrameCount) (SLAP_HEADER_PER_FRAME_FULL_FRAME_OFFSET + (subFrameCount) * 2)
+#define SLAP_HEADER_PER_FRAME_SIZE(subFrameCount) (SLAP_HEADER_PER_FRAME_FRAME_TYPE_INDEX(subFrameCount) + 1)
+
+#define SLAP_FRAME_TYPE_PFRAME 0
+#define SLAP_FRAME_TYPE_IFRAME 1
 
 #define SLAP_HEADER_FRAME_OFFSET_INDEX 0
 #define SLAP_HEADER_FRAME_DATA_SIZE_INDEX 1
 
+// A sub frame with a data size of zero in a P-Frame is unchanged from the last frame.
+#define SLAP_STATIC_SUB_FRAME_SIZE 0
+
+// With SLAP_FLAG_STATIC_BLOCKS the data of P-Frame sub frames starts with the changed block map, followed by the compressed changed blocks (packed left to right, top to bottom at the width of the sub frame).
+
+// With SLAP_FLAG_MOTION_COMPENSATION the data of the top eye luma P-Frame sub frames starts with the motion vectors: One bit per block of the sub frame (left to right, top to bottom; set if the block moved), followed by the motion vectors of the moved blocks (int8_t x, y).
+// After that come the changed block map (if any) and the compressed data. Static sub frames of the top eye luma either have a data size of zero (no motion) or only consist of their motion vectors.
+
+// With SLAP_FLAG_STEREO_DISPARITY the data of bottom eye sub frames starts with their disparity (int8_t), followed by the changed block map (if any) and the compressed data. Static bottom eye sub frames either have a data size of zero (no disparity) or only consist of their disparity.
+
+// With SLAP_FLAG_GLOBAL_MOTION the data of the first P-Frame sub frame starts with the global shift (int16_t), in front of the motion vectors (if any). A data size of zero means no shift.
+
   typedef struct slapFileWriter
   {
     FILE *pMainFile;
@@ -152,33 +313,77 @@ extern "C" {
   } slapFileWriter;
 
   slapFileWriter * slapCreateFileWriter(const char *filename, const size_t sizeX, const size_t sizeY, const uint64_t flags);
+  slapFileWriter * slapCreateFileWriterWithSubFrameLayout(const char *filename, const size_t sizeX, const size_t sizeY, const uint64_t flags, const size_t subFrameRows, const size_t subFrameColumns);
   void slapDestroyFileWriter(IN_OUT slapFileWriter **ppFileWriter);
 
   slapResult slapFinalizeFileWriter(IN slapFileWriter *pFileWriter);
 
   slapResult slapFileWriter_AddFrameYUV420(IN slapFileWriter *pFileWriter, IN void *pData);
+  slapResult slapFileWriter_AddFrameFromBuffer(IN slapFileWriter *pFileWriter, IN const slapInputBuffer *pInput);
 
   typedef struct slapDecoder
   {
-    size_t frameIndex;
-    size_t iframeStep;
+    size_t frameIndex; // the index of the frame after the last fully decoded one (low res decodes don't advance it).
+    size_t subFrameRows;
+    size_t subFrameColumns;
+    size_t subFrameCount;
+    bool_t isIframe; // has to be set for every frame before decoding it (see SLAP_HEADER_PER_FRAME_FRAME_TYPE_INDEX()).
     size_t resX;
     size_t resY;
+    size_t scaleShift; // the decoded frames (and the last frame) are (resX >> scaleShift) x (resY >> scaleShift).
 
     mode mode;
 
     void **ppDecoders;
+    void *pLowResDecoderInternal;
     uint8_t *pLowResData;
     uint8_t *pLastFrame;
     void *pThreadPoolHandle;
+    bool_t *pStaticSubFrames;
+    int8_t *pMotionVectors;
+    uint8_t *pPrediction;
+    int8_t *pDisparities;
+    int globalShift;
+
+    bool_t isThreadPoolShared; // the thread pool belongs to a slapDecodeSession.
+    uint64_t taskSchedulingKey; // the sub frame decode tasks are scheduled with this key (see ThreadPool_EnqueueTaskWithKey).
+    uint64_t lastFrameDecodeTimeUs; // the time the sub frame tasks & the finalize pass of the last frame took, summed up. Doesn't include the time the tasks waited for a worker thread.
+
+    // For partial decoding (see slapStripClient): If not NULL, only the sub frames set in the mask (one bit per sub frame) are decoded, all others are skipped and undefined. Without it, empty I-Frames & I-Frame sub frames are invalid.
+    const uint64_t *pSubFrameMask;
   } slapDecoder;
 
+  typedef enum slapOutputFormat
+  {
+    slapOutputFormat_YUV420, // Y, U & V planes.
+    slapOutputFormat_NV12, // Y plane & interleaved UV plane.
+    slapOutputFormat_RGBA, // full range BT.601 (as the frames are stored in JPEG).
+    slapOutputFormat_BGRA
+  } slapOutputFormat;
+
+  // A caller owned image (both eyes, top eye first) that slapDecoder_FinalizeFrameToBuffer writes the decoded frame to.
+  typedef struct slapOutputBuffer
+  {
+    slapOutputFormat format;
+    uint8_t *pPlanes[3]; // only pPlanes[0] is used for slapOutputFormat_RGBA & slapOutputFormat_BGRA, pPlanes[0] & pPlanes[1] for slapOutputFormat_NV12.
+    size_t strides[3]; // in bytes.
+  } slapOutputBuffer;
+
   slapDecoder * slapCreateDecoder(const size_t sizeX, const size_t sizeY, const uint64_t flags);
+  slapDecoder * slapCreateDecoderWithSubFrameLayout(const size_t sizeX, const size_t sizeY, const uint64_t flags, const size_t subFrameRows, const size_t subFrameColumns);
+  slapDecoder * slapCreateScaledDecoderWithSubFrameLayout(const size_t sizeX, const size_t sizeY, const uint64_t flags, const size_t subFrameRows, const size_t subFrameColumns, const size_t scaleShift);
   void slapDestroyDecoder(IN_OUT slapDecoder **ppDecoder);
 
   slapResult slapDecoder_DecodeSubFrame(IN slapDecoder *pDecoder, const size_t decoderIndex, IN void **ppCompressedData, IN size_t *pLength, IN_OUT void *pYUVData);
   slapResult slapDecoder_FinalizeFrame(IN slapDecoder *pDecoder, IN void *pData, const size_t length, IN_OUT void *pYUVData);
 
+  // Converts the frame to pOutput while reconstructing it, instead of writing it back to pYUVData (which only contains the decoded sub frames afterwards).
+  slapResult slapDecoder_FinalizeFrameToBuffer(IN slapDecoder *pDecoder, IN void *pData, const size_t length, IN_OUT void *pYUVData, IN const slapOutputBuffer *pOutput);
+
+  // Decodes a whole frame from a packet (the chunks of a slapFramePacket in order, see slapEncoder_EncodeFrame) with the thread pool of the decoder. pYUVData receives the frame, unless pOutput isn't NULL (see slapDecoder_FinalizeFrameToBuffer).
+  // The packets have to be decoded in order, starting with an I-Frame.
+  slapResult slapDecoder_DecodePacket(IN slapDecoder *pDecoder, IN void *pPacket, const size_t packetSize, IN_OUT void *pYUVData, IN const slapOutputBuffer *pOutput);
+
   typedef struct slapFileReader
   {
     FILE *pFile;
@@ -197,10 +402,19 @@ extern "C" {
   } slapFileReader;
 
   slapFileReader * slapCreateFileReader(const char *filename);
+  slapFileReader * slapCreateScaledFileReader(const char *filename, const size_t scaleShift);
   void slapDestroyFileReader(IN_OUT slapFileReader **ppFileReader);
 
   slapResult slapFileReader_GetResolution(IN slapFileReader *pFileReader, OUT size_t *pResolutionX, OUT size_t *pResolutionY);
   slapResult slapFileReader_GetLowResFrameResolution(IN slapFileReader *pFileReader, OUT size_t *pResolutionX, OUT size_t *pResolutionY);
+  slapResult slapFileReader_GetDecodedFrameResolution(IN slapFileReader *pFileReader, OUT size_t *pResolutionX, OUT size_t *pResolutionY);
+
+  // Decodes from the closest I-Frame up to frameIndex, so that frameIndex is the next frame to be read.
+  slapResult slapFileReader_SeekFrame(IN slapFileReader *pFileReader, const size_t frameIndex);
+
+  // Decodes the frame read by _slapFileReader_ReadNextFrameFull straight into the caller owned pOutput (see slapDecoder_FinalizeFrameToBuffer) instead of pDecodedFrameYUV (if pOutput isn't NULL).
+  // pDecodedFrameYUV is still required as scratch space for the decoded residuals and doesn't contain the frame afterwards.
+  slapResult slapFileReader_DecodeCurrentFrameToBuffer(IN slapFileReader *pFileReader, IN const slapOutputBuffer *pOutput);
 
   slapResult _slapFileReader_ReadNextFrameFull(IN slapFileReader *pFileReader);
   slapResult _slapFileReader_DecodeCurrentFrameFull(IN slapFileReader *pFileReader);
@@ -208,6 +422,227 @@ extern "C" {
   slapResult _slapFileReader_ReadNextFrameLowRes(IN slapFileReader *pFileReader);
   slapResult _slapFileReader_DecodeCurrentFrameLowRes(IN slapFileReader *pFileReader);
 
+// Stream files start with the pre header (with SLAP_STREAM_MAGIC instead of the header size and zero as frame count), followed by chunks of frame packets (see slapFramePacket).
+// Every chunk starts with SLAP_STREAM_CHUNK_HEADER_SIZE uint64_t, followed by the offset & size of every packet (relative to the end of the index) and the packets.
+// Chunks are only written once they're complete, so stream files can be read while they're being written and everything up to the last complete chunk can be read if the writer didn't finish.
+#define SLAP_STREAM_MAGIC 0x4D41455254534C53 // "SLSTREAM"
+#define SLAP_STREAM_CHUNK_MAGIC 0x4B4E484350414C53 // "SLAPCHNK"
+
+#define SLAP_STREAM_CHUNK_HEADER_SIZE 4
+#define SLAP_STREAM_CHUNK_MAGIC_INDEX 0
+#define SLAP_STREAM_CHUNK_FIRST_FRAME_INDEX 1
+#define SLAP_STREAM_CHUNK_FRAME_COUNT_INDEX 2
+#define SLAP_STREAM_CHUNK_DATA_SIZE_INDEX 3
+
+#define SLAP_STREAM_DEFAULT_FRAMES_PER_CHUNK 8
+
+  typedef struct slapStreamWriter
+  {
+    FILE *pFile;
+    slapEncoder *pEncoder;
+    uint64_t frameCount;
+
+    // Frames are buffered until the chunk is full (or slapStreamWriter_Flush is called), so this is the maximum latency of readers in frames.
+    size_t framesPerChunk;
+    uint64_t *pChunkIndex;
+    size_t chunkFrameCount;
+    uint8_t *pChunkData;
+    size_t chunkDataSize;
+    size_t chunkDataCapacity;
+  } slapStreamWriter;
+
+  slapStreamWriter * slapCreateStreamWriter(const char *filename, const size_t sizeX, const size_t sizeY, const uint64_t flags, const size_t subFrameRows, const size_t subFrameColumns, const size_t framesPerChunk);
+
+  // Writes the buffered frames (see slapStreamWriter_Flush) before closing the file.
+  void slapDestroyStreamWriter(IN_OUT slapStreamWriter **ppStreamWriter);
+
+  slapResult slapStreamWriter_AddFrameYUV420(IN slapStreamWriter *pStreamWriter, IN void *pData);
+  slapResult slapStreamWriter_AddFrameFromBuffer(IN slapStreamWriter *pStreamWriter, IN const slapInputBuffer *pInput);
+
+  // Writes the buffered frames as a chunk (if there are any), so that readers don't have to wait for the chunk to fill up. Also called by slapDestroyStreamWriter.
+  slapResult slapStreamWriter_Flush(IN slapStreamWriter *pStreamWriter);
+
+  typedef struct slapStreamReader
+  {
+    FILE *pFile;
+    uint64_t preHeaderBlock[SLAP_PRE_HEADER_SIZE];
+    slapDecoder *pDecoder;
+    void *pDecodedFrameYUV;
+    size_t frameIndex;
+
+    uint64_t chunkHeader[SLAP_STREAM_CHUNK_HEADER_SIZE];
+    uint64_t nextChunkPosition;
+    size_t chunkFrameIndex;
+    uint8_t *pChunk; // the index & data of the current chunk.
+    size_t chunkCapacity;
+
+    void *pCurrentFrame; // the packet of the current frame (in pChunk).
+    size_t currentFrameSize;
+  } slapStreamReader;
+
+  slapStreamReader * slapCreateStreamReader(const char *filename);
+  void slapDestroyStreamReader(IN_OUT slapStreamReader **ppStreamReader);
+
+  // Returns slapError_EndOfStream if the next chunk hasn't been written (completely) yet. Can be called again later to continue reading a stream file that's still being written.
+  slapResult slapStreamReader_ReadNextFrame(IN slapStreamReader *pStreamReader);
+
+  // Decodes the current frame to pDecodedFrameYUV, or to pOutput if it isn't NULL (see slapDecoder_FinalizeFrameToBuffer).
+  slapResult slapStreamReader_DecodeCurrentFrame(IN slapStreamReader *pStreamReader, IN const slapOutputBuffer *pOutput);
+
+// Shared memory rings carry frame packets from one encoding process to one decoding process on the same machine (a named file mapping on Windows, POSIX shared memory otherwise).
+// The ring starts with the pre header of the stream (see SLAP_PRE_HEADER_SIZE), followed by the write & read positions and the data, which consists of the size & index of every frame followed by its packet (padded to 8 bytes).
+// The writer only ever changes the write position and the reader only ever changes the read position, so no locks are required.
+#define SLAP_SHARED_RING_MAGIC 0x474E495250414C53 // "SLAPRING"
+#define SLAP_SHARED_RING_DEFAULT_CAPACITY (64 * 1024 * 1024)
+
+  typedef struct slapSharedRingWriter
+  {
+    slapEncoder *pEncoder;
+    void *pRing;
+    void *pSharedMemoryHandle;
+    size_t sharedMemorySize;
+    char *name;
+
+    // Frames that don't fit into the ring (because the reader is too slow) are dropped and the next frame is encoded as I-Frame.
+    size_t droppedFrameCount;
+  } slapSharedRingWriter;
+
+  // The capacity should be large enough to hold a few I-Frames.
+  slapSharedRingWriter * slapCreateSharedRingWriter(const char *name, const size_t capacity, const size_t sizeX, const size_t sizeY, const uint64_t flags, const size_t subFrameRows, const size_t subFrameColumns);
+  void slapDestroySharedRingWriter(IN_OUT slapSharedRingWriter **ppSharedRingWriter);
+
+  // Returns slapError_FrameDropped if the frame didn't fit into the ring.
+  slapResult slapSharedRingWriter_AddFrameYUV420(IN slapSharedRingWriter *pSharedRingWriter, IN void *pData);
+  slapResult slapSharedRingWriter_AddFrameFromBuffer(IN slapSharedRingWriter *pSharedRingWriter, IN const slapInputBuffer *pInput);
+
+  typedef struct slapSharedRingReader
+  {
+    void *pRing;
+    void *pSharedMemoryHandle;
+    size_t sharedMemorySize;
+    slapDecoder *pDecoder;
+    void *pDecodedFrameYUV;
+
+    uint64_t frameIndex; // the index of the current frame.
+    uint64_t referenceFrameIndex; // the index of the last successfully decoded frame.
+    bool_t hasReferenceFrame;
+
+    uint8_t *pCurrentFrame; // the packet of the current frame (copied out of the ring).
+    size_t currentFrameSize;
+    size_t currentFrameCapacity;
+  } slapSharedRingReader;
+
+  // The ring has to be created by the writer first.
+  slapSharedRingReader * slapCreateSharedRingReader(const char *name);
+  void slapDestroySharedRingReader(IN_OUT slapSharedRingReader **ppSharedRingReader);
+
+  // Returns slapError_EndOfStream if there's no new frame in the ring. P-Frames that can't be decoded because frames before them were dropped are skipped.
+  // Frames that have been read but not decoded (or failed to decode) are treated like dropped frames, so the following P-Frames are skipped until the next I-Frame.
+  slapResult slapSharedRingReader_ReadNextFrame(IN slapSharedRingReader *pSharedRingReader);
+  slapResult slapSharedRingReader_DecodeCurrentFrame(IN slapSharedRingReader *pSharedRingReader, IN const slapOutputBuffer *pOutput);
+
+// Strip servers (see StripServer) answer requests for parts of the frames of a slap file over a Unix domain socket (on Windows 10 version 1803 or newer), so that clients only receive the sub frames they need.
+// Every request consists of SLAP_STRIP_REQUEST_HEADER_SIZE uint64_t, followed by the sub frame mask (one bit per sub frame, as many uint64_t as given in the request header) for slapStripRequest_SubFrames.
+// Every response consists of SLAP_STRIP_RESPONSE_HEADER_SIZE uint64_t (the slapResult & the size of the payload), followed by the payload:
+// - slapStripRequest_Info: The pre header (with the default sub frame layout filled in) & the header of the file.
+// - slapStripRequest_LowRes: The low res preview of the frame.
+// - slapStripRequest_SubFrames: A frame packet (see slapFramePacket) that only contains the requested sub frames. All other sub frames have a data size of zero.
+#define SLAP_STRIP_REQUEST_HEADER_SIZE 3
+#define SLAP_STRIP_REQUEST_TYPE_INDEX 0
+#define SLAP_STRIP_REQUEST_FRAME_INDEX 1
+#define SLAP_STRIP_REQUEST_MASK_SIZE_INDEX 2
+
+#define SLAP_STRIP_RESPONSE_HEADER_SIZE 2
+#define SLAP_STRIP_RESPONSE_RESULT_INDEX 0
+#define SLAP_STRIP_RESPONSE_PAYLOAD_SIZE_INDEX 1
+
+#define SLAP_STRIP_MASK_SIZE(subFrameCount) (((subFrameCount) + 63) / 64)
+
+  typedef enum slapStripRequestType
+  {
+    slapStripRequest_Info,
+    slapStripRequest_LowRes,
+    slapStripRequest_SubFrames
+  } slapStripRequestType;
+
+  typedef struct slapStripClient
+  {
+    intptr_t socket; // a SOCKET on Windows, a file descriptor otherwise (-1 if invalid).
+    bool_t isSocketLibraryInitialized; // only used on Windows.
+
+    uint64_t preHeaderBlock[SLAP_PRE_HEADER_SIZE];
+    uint64_t *pHeader;
+
+    slapDecoder *pDecoder;
+    void *pDecodedFrameYUV;
+    void *pLowResFrameYUV;
+
+    uint8_t *pPayload;
+    size_t payloadCapacity;
+
+    size_t frameIndex; // the index of the next frame.
+    bool_t hasReferenceFrame;
+    uint64_t *pValidSubFrameMask; // the sub frames that can be decoded from the current position without going back to the last I-Frame.
+    uint64_t *pSubFrameMask;
+  } slapStripClient;
+
+  slapStripClient * slapCreateStripClient(const char *socketPath);
+  void slapDestroyStripClient(IN_OUT slapStripClient **ppStripClient);
+
+  // Decodes the sub frames in pSubFrameMask (or all sub frames if pSubFrameMask is NULL) of frameIndex to pDecodedFrameYUV, or to pOutput if it isn't NULL (see slapDecoder_FinalizeFrameToBuffer).
+  // The stereo counterparts of the requested sub frames are always requested as well, as they're required to reconstruct them. So are the chroma sub frames of the same row that hold the other chroma lines of the same horizontal range (see SLAP_SUB_FRAME_ROW_GRANULARITY). With SLAP_FLAG_GLOBAL_MOTION the whole rows of the requested sub frames (and the first sub frame) are requested. All other sub frames are undefined.
+  // With SLAP_FLAG_MOTION_COMPENSATION sub frames can be predicted from any other sub frame, so pSubFrameMask has to be NULL or contain all sub frames.
+  // Frames since the last I-Frame are requested as well if the sub frames aren't available from the last decoded frame.
+  slapResult slapStripClient_DecodeFrame(IN slapStripClient *pStripClient, const size_t frameIndex, IN const uint64_t *pSubFrameMask, IN const slapOutputBuffer *pOutput);
+
+  // Decodes the low res preview of frameIndex to pLowResFrameYUV (see slapFileReader_GetLowResFrameResolution).
+  slapResult slapStripClient_DecodeLowResFrame(IN slapStripClient *pStripClient, const size_t frameIndex);
+
+// Decode sessions decode multiple streams with one thread pool. The sub frame decode tasks of all streams are scheduled by the priority of their stream first and by the deadline of their frame second (earliest deadline first), so that no stream can starve the others.
+#define SLAP_DECODE_STREAM_MAX_PRIORITY 0xFF
+
+  typedef struct slapDecodeStream
+  {
+    struct slapDecodeSession *pSession;
+    slapFileReader *pFileReader;
+
+    size_t priority; // streams with a higher priority (up to SLAP_DECODE_STREAM_MAX_PRIORITY) are decoded first.
+    double frameTimeMs; // every frame has to be decoded within this time (1000 / frames per second).
+
+    double averageDecodeTimeMs; // of the decode work (see slapDecoder::lastFrameDecodeTimeUs), so that it isn't inflated by waiting for the tasks of other streams.
+    size_t decodedFrameCount;
+    size_t missedDeadlineCount;
+    bool_t lastFrameMissedDeadline;
+  } slapDecodeStream;
+
+  typedef struct slapDecodeSession
+  {
+    void *pThreadPoolHandle;
+    size_t threadCount;
+
+    slapDecodeStream **ppStreams;
+    size_t streamCount;
+    size_t maxStreamCount;
+  } slapDecodeSession;
+
+  // Uses the number of hardware threads if threadCount is zero.
+  slapDecodeSession * slapCreateDecodeSession(const size_t threadCount, const size_t maxStreamCount);
+
+  // Also destroys all remaining streams.
+  void slapDestroyDecodeSession(IN_OUT slapDecodeSession **ppDecodeSession);
+
+  // Returns NULL if the session already has maxStreamCount streams or if it would be saturated with the new stream.
+  // The first frame of the new stream is decoded to measure its decode time, so every stream has been measured when it's admitted. The stream starts at the first frame afterwards.
+  // Streams are added & removed by one thread, but the frames of different streams can be decoded from different threads.
+  slapDecodeStream * slapDecodeSession_AddStream(IN slapDecodeSession *pDecodeSession, const char *filename, const size_t priority, const double framesPerSecond);
+  void slapDecodeSession_RemoveStream(IN slapDecodeSession *pDecodeSession, IN_OUT slapDecodeStream **ppDecodeStream);
+
+  // The load is the fraction of the time the threads of the thread pool are busy with the streams at their frame rate. The session is saturated if the load reaches one or the last frame of any stream missed its deadline.
+  slapResult slapDecodeSession_GetLoad(IN slapDecodeSession *pDecodeSession, OUT double *pLoad, OUT bool_t *pIsSaturated);
+
+  // Decodes the next frame to pFileReader->pDecodedFrameYUV, or to pOutput if it isn't NULL (see slapDecoder_FinalizeFrameToBuffer).
+  slapResult slapDecodeStream_DecodeNextFrame(IN slapDecodeStream *pDecodeStream, IN const slapOutputBuffer *pOutput);
+
 #ifdef __cplusplus
 }
 #endif
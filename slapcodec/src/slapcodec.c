@@ -8,12 +8,31 @@
 
 #include "slapcodec.h"
 #include "turbojpeg.h"
+#include "jpeglib.h"
+
+#include <setjmp.h>
+#include <math.h>
 
 #include "apex_memmove/apex_memmove.h"
 #include "apex_memmove/apex_memmove.c"
 
 #include "threadpool.h"
 
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <winsock2.h>
+#include <afunix.h>
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
 #include <intrin.h>
 #include <xmmintrin.h>
 #include <emmintrin.h>
@@ -27,26 +46,154 @@
 
 slapResult _slapCompressChannel(IN void *pData, IN_OUT void **ppCompressedData, IN_OUT size_t *pCompressedDataSize, const size_t width, const size_t height, const int quality, IN void *pCompressor);
 slapResult _slapCompressYUV420(IN void *pData, IN_OUT void **ppCompressedData, IN_OUT size_t *pCompressedDataSize, const size_t width, const size_t height, const int quality, IN void *pCompressor);
-slapResult _slapDecompressChannel(IN void *pData, IN_OUT void *pCompressedData, const size_t compressedDataSize, const size_t width, const size_t height, IN void *pDecompressor);
+slapResult _slapDecompressChannel(IN void *pData, IN_OUT void *pCompressedData, const size_t compressedDataSize, const size_t width, const size_t height, const size_t stride, IN void *pDecompressor);
 slapResult _slapDecompressYUV420(IN void *pData, IN_OUT void *pCompressedData, const size_t compressedDataSize, const size_t width, const size_t height, IN void *pDecompressor);
-void _slapLastFrameDiffAndStereoDiffAndSubBufferYUV420(IN_OUT void *pLastFrame, IN_OUT void *pData, IN_OUT void *pLowRes, const size_t resX, const size_t resY);
-void _slapCopyToLastFrameAndGenSubBufferAndStereoDiffYUV420(IN_OUT void *pData, OUT void *pLowResData, OUT void *pLastFrame, const size_t resX, const size_t resY);
+void * _slapCreateStripCoder();
+void _slapDestroyStripCoder(IN_OUT void **ppStripCoder);
+slapResult _slapCompressChannelCoefficients(IN void *pData, IN_OUT void **ppCompressedData, IN_OUT size_t *pCompressedDataSize, const size_t width, const size_t height, const size_t stride, const int quality, IN void *pStripCoder, const size_t prefixSize);
+void _slapReconstructChannelFromCoefficients(OUT void *pData, IN void *pStripCoder, const size_t width, const size_t height, const size_t stride);
+uint64_t _slapLastFrameDiffAndStereoDiffAndSubBufferYUV420(IN_OUT void *pLastFrame, IN void *pData, OUT void *pResidual, IN_OUT void *pLowRes, const size_t resX, const size_t resY);
+void _slapUndoLastFrameDiffAndStereoDiffYUV420(IN void *pLastFrame, IN_OUT void *pData, const size_t resX, const size_t resY);
+void _slapCopyToLastFrameAndGenSubBufferAndStereoDiffYUV420(IN void *pData, OUT void *pResidual, OUT void *pLowResData, OUT void *pLastFrame, const size_t resX, const size_t resY);
 void _slapAddStereoDiffYUV420(IN_OUT void *pData, const size_t resX, const size_t resY);
 void _slapAddStereoDiffYUV420AndCopyToLastFrame(IN_OUT void *pData, OUT void *pLastFrame, const size_t resX, const size_t resY);
-void _slapAddStereoDiffYUV420AndAddLastFrameDiff(IN_OUT void *pData, OUT void *pLastFrame, const size_t resX, const size_t resY);
+void _slapAddStereoDiffYUV420AndAddLastFrameDiff(IN_OUT void *pData, OUT void *pLastFrame, const size_t resX, const size_t resY, const size_t subFrameRows, const size_t subFrameColumns, IN const bool_t *pStaticSubFrames);
+void _slapReconstructYUV420ToBuffer(IN_OUT void *pData, IN_OUT void *pLastFrame, const size_t resX, const size_t resY, const bool_t isIframe, IN const slapOutputBuffer *pOutput);
+bool_t _slapIsValidInputBuffer(IN const slapInputBuffer *pInput, const size_t resX);
+slapDecoder * _slapCreateDecoder(const size_t sizeX, const size_t sizeY, const uint64_t flags, const size_t subFrameRows, const size_t subFrameColumns, const size_t scaleShift, IN void *pThreadPoolHandle);
+slapFileReader * _slapCreateFileReader(const char *filename, const size_t scaleShift, IN void *pThreadPoolHandle);
+uint64_t _slapGetTimeUs();
+double _slapDecodeStream_GetLoad(IN const slapDecodeStream *pDecodeStream);
+void _slapConvertInputToYUV420(IN const slapInputBuffer *pInput, OUT uint8_t *pTarget, const size_t resX, const size_t resY);
+void _slapEncoder_UpdateRateControl(IN slapEncoder *pEncoder);
+bool_t _slapIsValidSubFrameLayout(const size_t resX, const size_t resY, const size_t subFrameRows, const size_t subFrameColumns);
+size_t _slapGetSubFrameOffset(const size_t resX, const size_t resY, const size_t subFrameRows, const size_t subFrameColumns, const size_t subFrameIndex);
+size_t _slapGetSubFramePlane(const size_t subFrameRow, const size_t subFrameRows);
+bool_t _slapChromaSubFrameColumnsOverlap(const size_t resX, const size_t subFrameColumns, const size_t columnA, const size_t columnB);
+void _slapGetSubFrameOrderByCost(IN const size_t *pCost, const size_t count, OUT size_t *pOrder);
+int _slapEncoder_GetSubFrameQuality(IN slapEncoder *pEncoder, const size_t subFrameIndex);
+uint8_t * _slapEncoder_GetResidualFrame(IN slapEncoder *pEncoder, IN void *pData);
+slapResult _slapEncoder_BeginFrame(IN slapEncoder *pEncoder, IN void *pData, OUT uint8_t *pResidual);
+slapResult _slapEncoder_AllocateResidualFrame(IN slapEncoder *pEncoder);
+slapResult _slapFileWriter_AddFrame(IN slapFileWriter *pFileWriter, IN void *pData, IN const slapInputBuffer *pInput);
+slapResult _slapFileWriter_WritePacket(IN slapFileWriter *pFileWriter, IN const slapFramePacket *pPacket);
+slapResult _slapDecoder_DecodeFrame(IN slapDecoder *pDecoder, IN const uint64_t *pFrameHeader, IN void *pFrameData, const size_t frameSize, IN_OUT void *pYUVData, IN const slapOutputBuffer *pOutput);
+slapResult _slapStreamWriter_AddFrame(IN slapStreamWriter *pStreamWriter, IN void *pData, IN const slapInputBuffer *pInput);
+slapResult _slapStreamReader_ReadNextChunk(IN slapStreamReader *pStreamReader);
+slapResult _slapSharedRingWriter_AddFrame(IN slapSharedRingWriter *pSharedRingWriter, IN void *pData, IN const slapInputBuffer *pInput);
+slapResult _slapStripClient_Request(IN slapStripClient *pStripClient, const slapStripRequestType type, const size_t frameIndex, IN const uint64_t *pSubFrameMask, OUT size_t *pPayloadSize);
+slapResult _slapEncoder_EncodeFrame(IN slapEncoder *pEncoder, IN void *pData, IN const slapInputBuffer *pInput, OUT slapFramePacket *pPacket, IN slapFileWriter *pFileWriter);
+uint8_t _slapGetStaticSubFrameValue(const size_t subFrameRow, const size_t subFrameRows);
+void _slapFillSubFrame(OUT void *pData, const size_t width, const size_t height, const size_t stride, const uint8_t value);
+size_t _slapGetMotionBlockCount(const mode mode, const size_t resX, const size_t resY, const size_t subFrameRows, const size_t subFrameColumns, const size_t subFrameIndex);
+void _slapEstimateMotion(IN const void *pLastFrame, IN const void *pData, OUT int8_t *pMotionVectors, const size_t resX, const size_t resY, const size_t subFrameRows, const size_t subFrameColumns, const int searchRange);
+void _slapMotionCompensateYUV420(IN const void *pLastFrame, OUT void *pPrediction, IN const int8_t *pMotionVectors, const size_t resX, const size_t resY, const size_t subFrameRows, const size_t subFrameColumns, const size_t scaleShift);
+size_t _slapGetMotionBlockMapSize(const size_t blockCount);
+size_t _slapGetMotionVectorRecordCapacity(const size_t blockCount);
+size_t _slapPackMotionVectors(IN const int8_t *pMotionVectors, const size_t blockCount, OUT uint8_t *pRecord);
+size_t _slapUnpackMotionVectors(IN const uint8_t *pRecord, const size_t recordSize, const size_t blockCount, OUT int8_t *pMotionVectors);
+int _slapEstimateGlobalShift(IN const void *pLastFrame, IN const void *pData, const size_t resX, const size_t resY, const int searchRange);
+void _slapShiftFrameYUV420(IN const void *pSource, OUT void *pTarget, const size_t resX, const size_t resY, const int shift, const size_t scaleShift);
+uint8_t * _slapGetReferenceFrame(const mode mode, const int globalShift, IN uint8_t *pLastFrame, IN uint8_t *pPrediction);
+size_t _slapEncoder_WriteSubFramePrefix(IN slapEncoder *pEncoder, const size_t subFrameIndex, OUT uint8_t *pPrefix, OUT bool_t *pIsRequired);
+slapResult _slapDecoder_ReadSubFramePrefix(IN slapDecoder *pDecoder, const size_t subFrameIndex, IN_OUT uint8_t **ppRecord, IN_OUT size_t *pRecordSize);
+size_t _slapGetSubFrameRowsPerEye(const size_t subFrameRow, const size_t subFrameRows);
+bool_t _slapIsBottomEyeSubFrameRow(const size_t subFrameRow, const size_t subFrameRows);
+size_t _slapGetDisparitySize(const mode mode, const size_t subFrameRows, const size_t subFrameColumns, const size_t subFrameIndex);
+void _slapEstimateStereoDisparities(IN const void *pData, OUT int8_t *pDisparities, const size_t resX, const size_t resY, const size_t subFrameRows, const size_t subFrameColumns, const int searchRange);
+void _slapApplyStereoDisparities(IN_OUT void *pData, IN const int8_t *pDisparities, const size_t resX, const size_t resY, const size_t subFrameRows, const size_t subFrameColumns, const bool_t undo);
+uint8_t _slapGetExactResidualCorrection(const bool_t isIframe, const size_t subFrameRow, const size_t subFrameRows);
+void _slapSubtractFromSubFrame(IN_OUT void *pData, const size_t width, const size_t height, const size_t stride, const uint8_t value);
+bool_t _slapIsStaticSubFrame(IN const void *pData, const size_t width, const size_t height, const size_t stride, const uint8_t value, const int threshold);
+size_t _slapGetChangedBlockMapSize(const size_t width, const size_t height);
+size_t _slapGetChangedBlocks(IN const void *pData, const size_t width, const size_t height, const size_t stride, const uint8_t value, const int threshold, OUT uint8_t *pChangedBlockMap);
+size_t _slapGetPackedHeight(IN const uint8_t *pChangedBlockMap, const size_t width, const size_t height);
+size_t _slapPackChangedBlocks(IN_OUT void *pData, const size_t width, const size_t height, const size_t stride, IN const uint8_t *pChangedBlockMap, const uint8_t value);
+void _slapUnpackChangedBlocks(IN_OUT void *pData, const size_t width, const size_t height, const size_t stride, IN const uint8_t *pChangedBlockMap, const uint8_t value);
+void _slapUnpackScaledChangedBlocks(IN_OUT void *pData, const size_t width, const size_t height, const size_t stride, IN const uint8_t *pChangedBlockMap, const uint8_t value, const size_t scaleShift);
+
+// The libjpeg compressor that entropy codes the strips. Shared by all strip coders of a worker thread (see _slapStripCoder_GetCompressor).
+typedef struct _slapJpegCompressor
+{
+  struct jpeg_compress_struct compressInfo;
+  struct jpeg_error_mgr errorManager;
+  jmp_buf jumpBuffer;
+} _slapJpegCompressor;
+
+// Keeps the quantized DCT coefficients of the last compressed strip around, so that the encoder can reconstruct the strip without having to entropy decode it again.
+typedef struct _slapStripCoder
+{
+  // Only used if the strip is compressed outside of the thread pool.
+  _slapJpegCompressor *pCompressor;
+
+  JCOEF *pCoefficients;
+  size_t coefficientCapacity;
+  size_t widthInBlocks;
+  size_t heightInBlocks;
+
+  int quality;
+  float quantReciprocals[DCTSIZE2];
+  int16_t dequantMultipliers[DCTSIZE2];
+
+  size_t compressedCapacity;
+} _slapStripCoder;
+
+// The en- & decoders of the sub frames and the low res preview. Selected by mode.flags.encoder (see SLAP_FLAG_ENCODER).
+typedef struct _slapBackend
+{
+  void * (*pCreateStripEncoder)();
+  void (*pDestroyStripEncoder)(IN_OUT void **ppStripEncoder);
+
+  // Has to leave room for prefixSize bytes in front of the compressed data. The compressed data has to be allocated with malloc.
+  slapResult (*pCompressStrip)(IN void *pData, IN_OUT void **ppCompressedData, IN_OUT size_t *pCompressedDataSize, const size_t width, const size_t height, const size_t stride, const int quality, IN void *pStripEncoder, const size_t prefixSize);
+
+  // Has to result in exactly the same image as pDecompressStrip for the strip that was last compressed with pStripEncoder.
+  void (*pReconstructStrip)(OUT void *pData, IN void *pStripEncoder, const size_t width, const size_t height, const size_t stride);
+
+  void * (*pCreateStripDecoder)();
+  void (*pDestroyStripDecoder)(IN_OUT void **ppStripDecoder);
+  slapResult (*pDecompressStrip)(OUT void *pData, IN void *pCompressedData, const size_t compressedDataSize, const size_t width, const size_t height, const size_t stride, IN void *pStripDecoder);
+
+  void * (*pCreatePreviewEncoder)();
+  void (*pDestroyPreviewEncoder)(IN_OUT void **ppPreviewEncoder);
+  slapResult (*pCompressPreview)(IN void *pData, IN_OUT void **ppCompressedData, IN_OUT size_t *pCompressedDataSize, const size_t width, const size_t height, const int quality, IN void *pPreviewEncoder);
+  void (*pFreeCompressedPreview)(IN_OUT void **ppCompressedData);
 
-typedef struct _slapFrameEncoderBlock
+  void * (*pCreatePreviewDecoder)();
+  void (*pDestroyPreviewDecoder)(IN_OUT void **ppPreviewDecoder);
+  slapResult (*pDecompressPreview)(OUT void *pData, IN void *pCompressedData, const size_t compressedDataSize, const size_t width, const size_t height, IN void *pPreviewDecoder);
+
+  // Whether the residuals are compensated for the rounding of the decoder (see _slapGetExactResidualCorrection). Sub frames are only static if they match exactly.
+  bool_t exactResiduals;
+
+  // Whether pDecompressStrip can decode strips at a fraction of their resolution, if it's called with the scaled width, height & stride (see SLAP_DECODER_SCALE_HALF).
+  bool_t scaledDecode;
+} _slapBackend;
+
+const _slapBackend * _slapGetBackend(const size_t encoder);
+
+#define SLAP_BACKEND_COUNT (SLAP_ENCODER_LOSSLESS + 1)
+
+// The strip decoders & the jpeg compressor of a worker thread (see ThreadPool_GetWorkerData), shared by all en- & decoders that use its thread pool. The strip decoders are indexed by mode.flags.encoder.
+typedef struct _slapWorkerData
 {
-  size_t frameSize;
-  void *pFrameData;
-} _slapFrameEncoderBlock;
+  void *pStripDecoders[SLAP_BACKEND_COUNT];
+  _slapJpegCompressor *pJpegCompressor;
+} _slapWorkerData;
+
+_slapWorkerData * _slapGetWorkerData(IN void **ppWorkerData);
+void _slapDestroyWorkerData(IN void *pWorkerData);
+_slapJpegCompressor * _slapCreateJpegCompressor();
+void _slapDestroyJpegCompressor(IN_OUT _slapJpegCompressor **ppCompressor);
+_slapJpegCompressor * _slapStripCoder_GetCompressor(IN _slapStripCoder *pStripCoder);
+void * _slapDecoder_GetStripDecoder(IN slapDecoder *pDecoder, const size_t subFrameIndex);
 
 #ifdef SLAP_MULTITHREADED
 typedef struct _slapEncoderSubTaskData0
 {
   slapEncoder *pEncoder;
   void *pData;
-  _slapFrameEncoderBlock *pSubFrameEncoderData;
+  slapPacketChunk *pChunk;
   size_t index;
 } _slapEncoderSubTaskData0;
 
@@ -57,6 +204,7 @@ typedef struct _slapDecoderSubTaskData0
   void **pDataAddrs;
   size_t *pDataSizes;
   void *pYUVFrame;
+  uint64_t decodeTimeUs; // without the time the task waited for a worker thread.
 } _slapDecoderSubTaskData0;
 #endif
 
@@ -134,10 +282,26 @@ epilogue:
 }
 
 slapEncoder * slapCreateEncoder(const size_t sizeX, const size_t sizeY, const uint64_t flags)
+{
+  return slapCreateEncoderWithSubFrameLayout(sizeX, sizeY, flags, SLAP_DEFAULT_SUB_FRAME_ROWS, SLAP_DEFAULT_SUB_FRAME_COLUMNS);
+}
+
+slapEncoder * slapCreateEncoderWithSubFrameLayout(const size_t sizeX, const size_t sizeY, const uint64_t flags, const size_t subFrameRows, const size_t subFrameColumns)
 {
   if (sizeX & 31 || sizeY & 31) // must be multiple of 32.
     return NULL;
 
+  if (!_slapIsValidSubFrameLayout(sizeX, sizeY, subFrameRows, subFrameColumns))
+    return NULL;
+
+  mode encoderMode;
+  encoderMode.flagsPack = flags;
+
+  const _slapBackend *pBackend = _slapGetBackend(encoderMode.flags.encoder);
+
+  if (!pBackend)
+    return NULL;
+
   slapEncoder *pEncoder = slapAlloc(slapEncoder, 1);
 
   if (!pEncoder)
@@ -147,11 +311,22 @@ slapEncoder * slapCreateEncoder(const size_t sizeX, const size_t sizeY, const ui
 
   pEncoder->resX = sizeX;
   pEncoder->resY = sizeY;
+  pEncoder->subFrameRows = subFrameRows;
+  pEncoder->subFrameColumns = subFrameColumns;
+  pEncoder->subFrameCount = subFrameRows * subFrameColumns;
   pEncoder->iframeStep = 30;
   pEncoder->mode.flagsPack = flags;
   pEncoder->quality = 75;
   pEncoder->iframeQuality = 75;
   pEncoder->lowResQuality = 85;
+  pEncoder->staticSubFrameThreshold = 2;
+  pEncoder->sceneCutThreshold = 24;
+  pEncoder->framesPerSecond = 60;
+  pEncoder->minQuality = 10;
+  pEncoder->maxQuality = 95;
+  pEncoder->motionSearchRange = SLAP_DEFAULT_MOTION_SEARCH_RANGE;
+  pEncoder->disparitySearchRange = SLAP_DEFAULT_DISPARITY_SEARCH_RANGE;
+  pEncoder->globalMotionSearchRange = SLAP_DEFAULT_GLOBAL_MOTION_SEARCH_RANGE;
 
   pEncoder->lowResX = pEncoder->resX >> 3;
   pEncoder->lowResY = pEncoder->resY >> 3;
@@ -169,48 +344,108 @@ slapEncoder * slapCreateEncoder(const size_t sizeX, const size_t sizeY, const ui
   if (!pEncoder->pLastFrame)
     goto epilogue;
 
-  pEncoder->ppEncoderInternal = slapAlloc(void *, SLAP_SUB_BUFFER_COUNT + 1);
+  pEncoder->pSubFrameQualityOffsets = slapAlloc(int, pEncoder->subFrameCount);
+  pEncoder->pCompressedSubBufferSizes = slapAlloc(size_t, pEncoder->subFrameCount + 1);
+  pEncoder->pStaticSubFrames = slapAlloc(bool_t, pEncoder->subFrameCount);
+
+  if (!pEncoder->pSubFrameQualityOffsets || !pEncoder->pCompressedSubBufferSizes || !pEncoder->pStaticSubFrames)
+    goto epilogue;
+
+  memset(pEncoder->pSubFrameQualityOffsets, 0, sizeof(int) * pEncoder->subFrameCount);
+  memset(pEncoder->pCompressedSubBufferSizes, 0, sizeof(size_t) * (pEncoder->subFrameCount + 1));
+  memset(pEncoder->pStaticSubFrames, 0, sizeof(bool_t) * pEncoder->subFrameCount);
+
+  pEncoder->ppEncoderInternal = slapAlloc(void *, pEncoder->subFrameCount);
 
   if (!pEncoder->ppEncoderInternal)
     goto epilogue;
 
-  memset(pEncoder->ppEncoderInternal, 0, sizeof(void *) * (SLAP_SUB_BUFFER_COUNT + 1));
+  memset(pEncoder->ppEncoderInternal, 0, sizeof(void *) * pEncoder->subFrameCount);
 
-  for (size_t i = 0; i < SLAP_SUB_BUFFER_COUNT + 1; i++)
+  for (size_t i = 0; i < pEncoder->subFrameCount; i++)
   {
-    pEncoder->ppEncoderInternal[i] = tjInitCompress();
+    pEncoder->ppEncoderInternal[i] = pBackend->pCreateStripEncoder();
 
     if (!pEncoder->ppEncoderInternal[i])
       goto epilogue;
   }
 
-  pEncoder->ppLowResEncoderInternal = tjInitCompress();
+  if (pEncoder->mode.flags.staticBlocks)
+  {
+    const size_t subFrameHeight = pEncoder->resY * 3 / 2 / pEncoder->subFrameRows;
+
+    if (subFrameHeight % SLAP_STATIC_BLOCK_SIZE != 0)
+    {
+      pEncoder->mode.flags.staticBlocks = 0;
+    }
+    else
+    {
+      pEncoder->changedBlockMapSize = _slapGetChangedBlockMapSize(pEncoder->resX / pEncoder->subFrameColumns, subFrameHeight);
+      pEncoder->pChangedBlockMaps = slapAlloc(uint8_t, pEncoder->changedBlockMapSize * pEncoder->subFrameCount);
+
+      if (!pEncoder->pChangedBlockMaps)
+        goto epilogue;
+    }
+  }
+
+  const size_t motionBlockCount = _slapGetMotionBlockCount(pEncoder->mode, sizeX, sizeY, subFrameRows, subFrameColumns, 0);
 
-  pEncoder->ppDecoderInternal = slapAlloc(void *, SLAP_SUB_BUFFER_COUNT);
+  if (pEncoder->mode.flags.motionCompensation)
+  {
+    pEncoder->pMotionVectors = slapAlloc(int8_t, motionBlockCount * 2 * (subFrameRows / 3 * subFrameColumns));
 
-  if (!pEncoder->ppDecoderInternal)
-    goto epilogue;
+    if (!pEncoder->pMotionVectors)
+      goto epilogue;
+  }
+
+  if (pEncoder->mode.flags.motionCompensation || pEncoder->mode.flags.globalMotion)
+  {
+    pEncoder->pPrediction = slapAlloc(uint8_t, sizeX * sizeY * 3 / 2);
+
+    if (!pEncoder->pPrediction)
+      goto epilogue;
+  }
+
+  if (pEncoder->mode.flags.stereoDisparity)
+  {
+    pEncoder->pDisparities = slapAlloc(int8_t, pEncoder->subFrameCount);
+
+    if (!pEncoder->pDisparities)
+      goto epilogue;
 
-  memset(pEncoder->ppDecoderInternal, 0, sizeof(void *) * SLAP_SUB_BUFFER_COUNT);
+    memset(pEncoder->pDisparities, 0, sizeof(int8_t) * pEncoder->subFrameCount);
+  }
 
-  for (size_t i = 0; i < SLAP_SUB_BUFFER_COUNT; i++)
+  if (pEncoder->mode.flags.motionCompensation || pEncoder->mode.flags.stereoDisparity || pEncoder->mode.flags.globalMotion)
   {
-    pEncoder->ppDecoderInternal[i] = tjInitDecompress();
+    pEncoder->subFramePrefixCapacity = sizeof(int16_t) + _slapGetMotionVectorRecordCapacity(motionBlockCount) + sizeof(int8_t);
+    pEncoder->pSubFramePrefixes = slapAlloc(uint8_t, pEncoder->subFramePrefixCapacity * pEncoder->subFrameCount);
 
-    if (!pEncoder->ppDecoderInternal[i])
+    if (!pEncoder->pSubFramePrefixes)
       goto epilogue;
   }
 
-  pEncoder->ppCompressedBuffers = slapAlloc(void *, SLAP_SUB_BUFFER_COUNT + 1);
+  pEncoder->ppLowResEncoderInternal = pBackend->pCreatePreviewEncoder();
+
+  if (!pEncoder->ppLowResEncoderInternal)
+    goto epilogue;
+
+  pEncoder->ppCompressedBuffers = slapAlloc(void *, pEncoder->subFrameCount + 1);
 
   if (!pEncoder->ppCompressedBuffers)
     goto epilogue;
 
-  memset(pEncoder->ppCompressedBuffers, 0, sizeof(void *) * (SLAP_SUB_BUFFER_COUNT + 1));
+  memset(pEncoder->ppCompressedBuffers, 0, sizeof(void *) * (pEncoder->subFrameCount + 1));
+
+  pEncoder->pPacketHeader = slapAlloc(uint64_t, SLAP_HEADER_PER_FRAME_SIZE(pEncoder->subFrameCount));
+  pEncoder->pPacketChunks = slapAlloc(slapPacketChunk, pEncoder->subFrameCount + 2);
+
+  if (!pEncoder->pPacketHeader || !pEncoder->pPacketChunks)
+    goto epilogue;
 
   const size_t threadCount = ThreadPool_GetSystemThreadCount();
 
-  pEncoder->pThreadPoolHandle = ThreadPool_Init(threadCount);
+  pEncoder->pThreadPoolHandle = ThreadPool_InitWithWorkerData(threadCount, _slapDestroyWorkerData);
 
   if (!pEncoder->pThreadPoolHandle)
     goto epilogue;
@@ -223,28 +458,33 @@ epilogue:
 
   if (pEncoder->ppEncoderInternal)
   {
-    for (size_t i = 0; i < SLAP_SUB_BUFFER_COUNT + 1; i++)
+    for (size_t i = 0; i < pEncoder->subFrameCount; i++)
       if (pEncoder->ppEncoderInternal[i])
-        tjDestroy(pEncoder->ppEncoderInternal[i]);
+        pBackend->pDestroyStripEncoder(&pEncoder->ppEncoderInternal[i]);
 
     slapFreePtr(&pEncoder->ppEncoderInternal);
   }
 
-  if (pEncoder->ppLowResEncoderInternal)
-    tjDestroy(pEncoder->ppLowResEncoderInternal);
-
-  if (pEncoder->ppDecoderInternal)
-  {
-    for (size_t i = 0; i < SLAP_SUB_BUFFER_COUNT; i++)
-      if (pEncoder->ppDecoderInternal[i])
-        tjDestroy(pEncoder->ppDecoderInternal[i]);
+  slapFreePtr(&pEncoder->pSubFrameQualityOffsets);
+  slapFreePtr(&pEncoder->pCompressedSubBufferSizes);
+  slapFreePtr(&pEncoder->pStaticSubFrames);
 
-    slapFreePtr(&pEncoder->ppDecoderInternal);
-  }
+  if (pEncoder->ppLowResEncoderInternal)
+    pBackend->pDestroyPreviewEncoder((void **)&pEncoder->ppLowResEncoderInternal);
 
   if ((pEncoder)->pLastFrame)
     slapFreePtr(&(pEncoder)->pLastFrame);
 
+  if (pEncoder->pChangedBlockMaps)
+    slapFreePtr(&pEncoder->pChangedBlockMaps);
+
+  slapFreePtr(&pEncoder->pMotionVectors);
+  slapFreePtr(&pEncoder->pPrediction);
+  slapFreePtr(&pEncoder->pSubFramePrefixes);
+  slapFreePtr(&pEncoder->pDisparities);
+  slapFreePtr(&pEncoder->pPacketHeader);
+  slapFreePtr(&pEncoder->pPacketChunks);
+
   if ((pEncoder)->ppCompressedBuffers)
     slapFreePtr(&(pEncoder)->ppCompressedBuffers);
 
@@ -260,29 +500,35 @@ void slapDestroyEncoder(IN_OUT slapEncoder **ppEncoder)
 {
   if (ppEncoder && *ppEncoder)
   {
+    const _slapBackend *pBackend = _slapGetBackend((*ppEncoder)->mode.flags.encoder);
+
     if ((*ppEncoder)->ppEncoderInternal)
     {
-      for (size_t i = 0; i < SLAP_SUB_BUFFER_COUNT + 1; i++)
+      for (size_t i = 0; i < (*ppEncoder)->subFrameCount; i++)
         if ((*ppEncoder)->ppEncoderInternal[i])
-          tjDestroy((*ppEncoder)->ppEncoderInternal[i]);
+          pBackend->pDestroyStripEncoder(&(*ppEncoder)->ppEncoderInternal[i]);
 
       slapFreePtr(&(*ppEncoder)->ppEncoderInternal);
     }
 
+    slapFreePtr(&(*ppEncoder)->pSubFrameQualityOffsets);
+    slapFreePtr(&(*ppEncoder)->pCompressedSubBufferSizes);
+    slapFreePtr(&(*ppEncoder)->pStaticSubFrames);
+
     if ((*ppEncoder)->ppLowResEncoderInternal)
-      tjDestroy((*ppEncoder)->ppLowResEncoderInternal);
+      pBackend->pDestroyPreviewEncoder((void **)&(*ppEncoder)->ppLowResEncoderInternal);
 
-    if ((*ppEncoder)->ppDecoderInternal)
+    if ((*ppEncoder)->ppCompressedBuffers)
     {
-      for (size_t i = 0; i < SLAP_SUB_BUFFER_COUNT; i++)
-        if ((*ppEncoder)->ppDecoderInternal[i])
-          tjDestroy((*ppEncoder)->ppDecoderInternal[i]);
+      for (size_t i = 0; i < (*ppEncoder)->subFrameCount; i++)
+        slapFreePtr(&(*ppEncoder)->ppCompressedBuffers[i]);
 
-      slapFreePtr(&(*ppEncoder)->ppDecoderInternal);
-    }
+      // The low res buffer is stored after the sub frame buffers.
+      if ((*ppEncoder)->ppCompressedBuffers[(*ppEncoder)->subFrameCount])
+        pBackend->pFreeCompressedPreview(&(*ppEncoder)->ppCompressedBuffers[(*ppEncoder)->subFrameCount]);
 
-    if ((*ppEncoder)->ppCompressedBuffers)
       slapFreePtr(&(*ppEncoder)->ppCompressedBuffers);
+    }
 
     if ((*ppEncoder)->pLowResData)
       slapFreePtr(&(*ppEncoder)->pLowResData);
@@ -290,6 +536,17 @@ void slapDestroyEncoder(IN_OUT slapEncoder **ppEncoder)
     if ((*ppEncoder)->pLastFrame)
       slapFreePtr(&(*ppEncoder)->pLastFrame);
 
+    if ((*ppEncoder)->pChangedBlockMaps)
+      slapFreePtr(&(*ppEncoder)->pChangedBlockMaps);
+
+    slapFreePtr(&(*ppEncoder)->pMotionVectors);
+    slapFreePtr(&(*ppEncoder)->pPrediction);
+    slapFreePtr(&(*ppEncoder)->pSubFramePrefixes);
+    slapFreePtr(&(*ppEncoder)->pDisparities);
+    slapFreePtr(&(*ppEncoder)->pResidualFrame);
+    slapFreePtr(&(*ppEncoder)->pPacketHeader);
+    slapFreePtr(&(*ppEncoder)->pPacketChunks);
+
     if ((*ppEncoder)->pThreadPoolHandle)
       ThreadPool_Destroy((*ppEncoder)->pThreadPoolHandle);
   }
@@ -314,194 +571,594 @@ slapResult slapEncoder_BeginFrame(IN slapEncoder *pEncoder, IN void *pData)
     goto epilogue;
   }
 
-  if (pEncoder->mode.flags.encoder == 0)
+  if (pEncoder->preserveInput)
   {
-    if (pEncoder->frameIndex % pEncoder->iframeStep != 0)
-      _slapLastFrameDiffAndStereoDiffAndSubBufferYUV420(pEncoder->pLastFrame, pData, pEncoder->pLowResData, pEncoder->resX, pEncoder->resY);
-    else
-      _slapCopyToLastFrameAndGenSubBufferAndStereoDiffYUV420(pData, pEncoder->pLowResData, pEncoder->pLastFrame, pEncoder->resX, pEncoder->resY);
+    result = _slapEncoder_AllocateResidualFrame(pEncoder);
+
+    if (result != slapSuccess)
+      goto epilogue;
   }
 
+  result = _slapEncoder_BeginFrame(pEncoder, pData, _slapEncoder_GetResidualFrame(pEncoder, pData));
+
 epilogue:
   return result;
 }
 
-slapResult slapEncoder_BeginSubFrame(IN slapEncoder *pEncoder, IN void *pData, OUT void **ppCompressedData, OUT size_t *pSize, const size_t subFrameIndex)
+slapResult slapEncoder_BeginFrameFromBuffer(IN slapEncoder *pEncoder, IN const slapInputBuffer *pInput)
 {
   slapResult result = slapSuccess;
 
-  if (!pEncoder || !pData || !ppCompressedData || !pSize)
+  if (!pEncoder || !pInput)
   {
     result = slapError_ArgumentNull;
     goto epilogue;
   }
 
-  const size_t subFrameHeight = pEncoder->resY * 3 / 2 / SLAP_SUB_BUFFER_COUNT;
-
-  if (pEncoder->mode.flags.encoder == 0)
+  if (!_slapIsValidInputBuffer(pInput, pEncoder->resX))
   {
-    if (subFrameHeight * subFrameIndex * 2 / 3 < pEncoder->resY)
-    {
-      result = _slapCompressChannel(((uint8_t *)pData) + subFrameIndex * subFrameHeight * pEncoder->resX, &pEncoder->ppCompressedBuffers[subFrameIndex], &pEncoder->compressedSubBufferSizes[subFrameIndex], pEncoder->resX, subFrameHeight, (pEncoder->frameIndex % pEncoder->iframeStep == 0) ? pEncoder->quality : pEncoder->iframeQuality, pEncoder->ppEncoderInternal[subFrameIndex]);
-    }
-    else
-    {
-      result = _slapCompressChannel(((uint8_t *)pData) + subFrameIndex * subFrameHeight * pEncoder->resX, &pEncoder->ppCompressedBuffers[subFrameIndex], &pEncoder->compressedSubBufferSizes[subFrameIndex], pEncoder->resX >> 1, subFrameHeight << 1, (pEncoder->frameIndex % pEncoder->iframeStep == 0) ? pEncoder->quality : pEncoder->iframeQuality, pEncoder->ppEncoderInternal[subFrameIndex]);
-    }
+    result = slapError_Generic;
+    goto epilogue;
+  }
 
-    if (result != slapSuccess)
-      goto epilogue;
+  result = _slapEncoder_AllocateResidualFrame(pEncoder);
 
-    *pSize = pEncoder->compressedSubBufferSizes[subFrameIndex];
-    *ppCompressedData = pEncoder->ppCompressedBuffers[subFrameIndex];
-  }
+  if (result != slapSuccess)
+    goto epilogue;
+
+  // The converted frame is only used to calculate the residual in place.
+  _slapConvertInputToYUV420(pInput, pEncoder->pResidualFrame, pEncoder->resX, pEncoder->resY);
+
+  result = _slapEncoder_BeginFrame(pEncoder, pEncoder->pResidualFrame, pEncoder->pResidualFrame);
 
 epilogue:
   return result;
 }
 
-slapResult slapEncoder_EndSubFrame(IN slapEncoder *pEncoder, IN void *pData, const size_t subFrameIndex)
+slapResult _slapEncoder_AllocateResidualFrame(IN slapEncoder *pEncoder)
+{
+  if (!pEncoder->pResidualFrame)
+  {
+    pEncoder->pResidualFrame = slapAlloc(uint8_t, pEncoder->resX * pEncoder->resY * 3 / 2);
+
+    if (!pEncoder->pResidualFrame)
+      return slapError_MemoryAllocation;
+  }
+
+  return slapSuccess;
+}
+
+// pData is only read from, unless pResidual is pData.
+slapResult _slapEncoder_BeginFrame(IN slapEncoder *pEncoder, IN void *pData, OUT uint8_t *pResidual)
 {
   slapResult result = slapSuccess;
 
-  const size_t subFrameHeight = pEncoder->resY * 3 / 2 / SLAP_SUB_BUFFER_COUNT;
-  
-  if (pEncoder->mode.flags.encoder == 0)
+  pEncoder->isIframe = (pEncoder->frameIndex == 0 || pEncoder->frameIndex - pEncoder->lastIframeIndex >= pEncoder->iframeStep);
+
+  // The disparities are estimated on the original frame, but applied to the stereo diff.
+  if (pEncoder->mode.flags.stereoDisparity)
+    _slapEstimateStereoDisparities(pData, pEncoder->pDisparities, pEncoder->resX, pEncoder->resY, pEncoder->subFrameRows, pEncoder->subFrameColumns, pEncoder->disparitySearchRange);
+
+  if (!pEncoder->isIframe)
   {
-    if (pEncoder->frameIndex % pEncoder->iframeStep != 0)
+    uint8_t *pReference = pEncoder->pLastFrame;
+
+    // The residual is calculated against the shifted and / or motion compensated last frame (see _slapGetReferenceFrame).
+    if (pEncoder->mode.flags.globalMotion)
     {
-      if (subFrameHeight * subFrameIndex * 2 / 3 < pEncoder->resY)
-        result = _slapDecompressChannel(((uint8_t *)pData) + subFrameIndex * subFrameHeight * pEncoder->resX, pEncoder->ppCompressedBuffers[subFrameIndex], pEncoder->compressedSubBufferSizes[subFrameIndex], pEncoder->resX, subFrameHeight, pEncoder->ppDecoderInternal[subFrameIndex]);
-      else
-        result = _slapDecompressChannel(((uint8_t *)pData) + subFrameIndex * subFrameHeight * pEncoder->resX, pEncoder->ppCompressedBuffers[subFrameIndex], pEncoder->compressedSubBufferSizes[subFrameIndex], pEncoder->resX >> 1, subFrameHeight << 1, pEncoder->ppDecoderInternal[subFrameIndex]);
+      pEncoder->globalShift = _slapEstimateGlobalShift(pEncoder->pLastFrame, pData, pEncoder->resX, pEncoder->resY, pEncoder->globalMotionSearchRange);
 
-      if (result != slapSuccess)
-        goto epilogue;
+      if (pEncoder->globalShift != 0)
+      {
+        _slapShiftFrameYUV420(pEncoder->pLastFrame, pEncoder->pPrediction, pEncoder->resX, pEncoder->resY, pEncoder->globalShift, 0);
+        pReference = pEncoder->pPrediction;
+      }
     }
-    else
+
+    if (pEncoder->mode.flags.motionCompensation)
     {
-      result = _slapDecompressChannel(pEncoder->pLastFrame + pEncoder->resX * subFrameHeight * subFrameIndex, pEncoder->ppCompressedBuffers[subFrameIndex], pEncoder->compressedSubBufferSizes[subFrameIndex], pEncoder->resX, subFrameHeight, pEncoder->ppDecoderInternal[subFrameIndex]);
+      uint8_t *pTarget = pReference == pEncoder->pPrediction ? pEncoder->pLastFrame : pEncoder->pPrediction;
 
-      if (result != slapSuccess)
-        goto epilogue;
+      _slapEstimateMotion(pReference, pData, pEncoder->pMotionVectors, pEncoder->resX, pEncoder->resY, pEncoder->subFrameRows, pEncoder->subFrameColumns, pEncoder->motionSearchRange);
+      _slapMotionCompensateYUV420(pReference, pTarget, pEncoder->pMotionVectors, pEncoder->resX, pEncoder->resY, pEncoder->subFrameRows, pEncoder->subFrameColumns, 0);
+      pReference = pTarget;
+    }
+
+    const uint64_t sad = _slapLastFrameDiffAndStereoDiffAndSubBufferYUV420(pReference, pData, pResidual, pEncoder->pLowResData, pEncoder->resX, pEncoder->resY);
+
+    // Scene Cut: The SAD only covers the top eye of all planes.
+    if (pEncoder->sceneCutThreshold >= 0 && sad > (uint64_t)pEncoder->sceneCutThreshold * (pEncoder->resX * pEncoder->resY * 3 / 4))
+    {
+      // The original frame only has to be restored if the residual has been written in place.
+      if (pResidual == pData)
+        _slapUndoLastFrameDiffAndStereoDiffYUV420(pReference, pData, pEncoder->resX, pEncoder->resY);
+
+      pEncoder->isIframe = 1;
     }
   }
 
-epilogue:
+  if (pEncoder->isIframe)
+  {
+    _slapCopyToLastFrameAndGenSubBufferAndStereoDiffYUV420(pData, pResidual, pEncoder->pLowResData, pEncoder->pLastFrame, pEncoder->resX, pEncoder->resY);
+    pEncoder->lastIframeIndex = pEncoder->frameIndex;
+  }
+
+  if (pEncoder->mode.flags.stereoDisparity)
+    _slapApplyStereoDisparities(pResidual, pEncoder->pDisparities, pEncoder->resX, pEncoder->resY, pEncoder->subFrameRows, pEncoder->subFrameColumns, 0);
+
   return result;
 }
 
-slapResult slapEncoder_EndFrame(IN slapEncoder *pEncoder, IN void *pData)
+slapResult slapEncoder_BeginSubFrame(IN slapEncoder *pEncoder, IN void *pData, OUT void **ppCompressedData, OUT size_t *pSize, const size_t subFrameIndex)
 {
   slapResult result = slapSuccess;
 
-  if (!pEncoder)
+  if (!pEncoder || !pData || !ppCompressedData || !pSize)
   {
     result = slapError_ArgumentNull;
     goto epilogue;
   }
-  
-  if (pEncoder->mode.flags.encoder == 0)
+
+  pEncoder->pStaticSubFrames[subFrameIndex] = 0;
+
+  const _slapBackend *pBackend = _slapGetBackend(pEncoder->mode.flags.encoder);
+  uint8_t *pSubFrame = _slapEncoder_GetResidualFrame(pEncoder, pData) + _slapGetSubFrameOffset(pEncoder->resX, pEncoder->resY, pEncoder->subFrameRows, pEncoder->subFrameColumns, subFrameIndex);
+  const size_t width = pEncoder->resX / pEncoder->subFrameColumns;
+  size_t height = pEncoder->resY * 3 / 2 / pEncoder->subFrameRows;
+  uint8_t *pPrefix = pEncoder->pSubFramePrefixes + subFrameIndex * pEncoder->subFramePrefixCapacity;
+  bool_t isPrefixRequired = 0;
+  size_t prefixSize = 0;
+  size_t changedBlockMapSize = 0;
+
+  if (pEncoder->pSubFramePrefixes)
+    prefixSize = _slapEncoder_WriteSubFramePrefix(pEncoder, subFrameIndex, pPrefix, &isPrefixRequired);
+
+  if (pBackend->exactResiduals)
+  {
+    const uint8_t correction = _slapGetExactResidualCorrection(pEncoder->isIframe, subFrameIndex / pEncoder->subFrameColumns, pEncoder->subFrameRows);
+
+    if (correction)
+      _slapSubtractFromSubFrame(pSubFrame, width, height, pEncoder->resX, correction);
+  }
+
+  if (!pEncoder->isIframe)
   {
-    if (pEncoder->frameIndex % pEncoder->iframeStep != 0)
-      _slapAddStereoDiffYUV420AndAddLastFrameDiff(pData, pEncoder->pLastFrame, pEncoder->resX, pEncoder->resY);
+    const uint8_t staticValue = _slapGetStaticSubFrameValue(subFrameIndex / pEncoder->subFrameColumns, pEncoder->subFrameRows);
+    uint8_t *pChangedBlockMap = pEncoder->pChangedBlockMaps + subFrameIndex * pEncoder->changedBlockMapSize;
+    const int staticThreshold = pBackend->exactResiduals ? 0 : pEncoder->staticSubFrameThreshold;
+
+    if (pEncoder->mode.flags.staticBlocks)
+      pEncoder->pStaticSubFrames[subFrameIndex] = (0 == _slapGetChangedBlocks(pSubFrame, width, height, pEncoder->resX, staticValue, staticThreshold, pChangedBlockMap));
     else
-      _slapAddStereoDiffYUV420(pEncoder->pLastFrame, pEncoder->resX, pEncoder->resY);
+      pEncoder->pStaticSubFrames[subFrameIndex] = _slapIsStaticSubFrame(pSubFrame, width, height, pEncoder->resX, staticValue, staticThreshold);
+
+    if (pEncoder->pStaticSubFrames[subFrameIndex])
+    {
+      // Static sub frames only consist of their prefix, unless there's no shift, motion or disparity.
+      if (isPrefixRequired)
+      {
+        pEncoder->pCompressedSubBufferSizes[subFrameIndex] = prefixSize;
+
+        *pSize = prefixSize;
+        *ppCompressedData = pPrefix;
+      }
+      else
+      {
+        pEncoder->pCompressedSubBufferSizes[subFrameIndex] = SLAP_STATIC_SUB_FRAME_SIZE;
+
+        *pSize = SLAP_STATIC_SUB_FRAME_SIZE;
+        *ppCompressedData = pEncoder->ppCompressedBuffers[subFrameIndex];
+      }
+
+      goto epilogue;
+    }
+
+    // Only the changed blocks are compressed, the block map is stored in front of the compressed data.
+    if (pEncoder->mode.flags.staticBlocks)
+    {
+      height = _slapPackChangedBlocks(pSubFrame, width, height, pEncoder->resX, pChangedBlockMap, staticValue);
+      changedBlockMapSize = pEncoder->changedBlockMapSize;
+    }
   }
 
-  pEncoder->frameIndex++;
+  result = pBackend->pCompressStrip(pSubFrame, &pEncoder->ppCompressedBuffers[subFrameIndex], &pEncoder->pCompressedSubBufferSizes[subFrameIndex], width, height, pEncoder->resX, _slapEncoder_GetSubFrameQuality(pEncoder, subFrameIndex), pEncoder->ppEncoderInternal[subFrameIndex], prefixSize + changedBlockMapSize);
+
+  if (result != slapSuccess)
+    goto epilogue;
+
+  if (prefixSize)
+    memcpy(pEncoder->ppCompressedBuffers[subFrameIndex], pPrefix, prefixSize);
+
+  if (changedBlockMapSize)
+    memcpy(((uint8_t *)pEncoder->ppCompressedBuffers[subFrameIndex]) + prefixSize, pEncoder->pChangedBlockMaps + subFrameIndex * pEncoder->changedBlockMapSize, changedBlockMapSize);
+
+  *pSize = pEncoder->pCompressedSubBufferSizes[subFrameIndex];
+  *ppCompressedData = pEncoder->ppCompressedBuffers[subFrameIndex];
 
 epilogue:
   return result;
 }
 
-slapResult _slapWriteToHeader(IN slapFileWriter *pFileWriter, const uint64_t data)
+slapResult slapEncoder_EndSubFrame(IN slapEncoder *pEncoder, IN void *pData, const size_t subFrameIndex)
 {
   slapResult result = slapSuccess;
 
-  pFileWriter->frameSizeOffsets[pFileWriter->frameSizeOffsetIndex++] = data;
-  pFileWriter->headerPosition++;
+  // The backend still has the state of this sub frame around from slapEncoder_BeginSubFrame (the quantized coefficients for backend 0, so only the IDCT is required to get to the same result as the decoder).
+  const _slapBackend *pBackend = _slapGetBackend(pEncoder->mode.flags.encoder);
+  const size_t offset = _slapGetSubFrameOffset(pEncoder->resX, pEncoder->resY, pEncoder->subFrameRows, pEncoder->subFrameColumns, subFrameIndex);
+  const size_t width = pEncoder->resX / pEncoder->subFrameColumns;
+  const size_t height = pEncoder->resY * 3 / 2 / pEncoder->subFrameRows;
+  const uint8_t staticValue = _slapGetStaticSubFrameValue(subFrameIndex / pEncoder->subFrameColumns, pEncoder->subFrameRows);
+  uint8_t *pTarget;
 
-  if (pFileWriter->frameSizeOffsetIndex >= (uint64_t)SLAP_HEADER_BLOCK_SIZE)
+  if (!pEncoder->isIframe)
+    pTarget = _slapEncoder_GetResidualFrame(pEncoder, pData) + offset;
+  else
+    pTarget = pEncoder->pLastFrame + offset;
+
+  if (pEncoder->pStaticSubFrames[subFrameIndex])
   {
-    if ((size_t)SLAP_HEADER_BLOCK_SIZE != fwrite(pFileWriter->frameSizeOffsets, sizeof(uint64_t), SLAP_HEADER_BLOCK_SIZE, pFileWriter->pHeaderFile))
-    {
-      result = slapError_FileError;
-      goto epilogue;
-    }
+    _slapFillSubFrame(pTarget, width, height, pEncoder->resX, staticValue);
+  }
+  else if (!pEncoder->isIframe && pEncoder->mode.flags.staticBlocks)
+  {
+    const uint8_t *pChangedBlockMap = pEncoder->pChangedBlockMaps + subFrameIndex * pEncoder->changedBlockMapSize;
 
-    pFileWriter->frameSizeOffsetIndex = 0;
+    pBackend->pReconstructStrip(pTarget, pEncoder->ppEncoderInternal[subFrameIndex], width, _slapGetPackedHeight(pChangedBlockMap, width, height), pEncoder->resX);
+    _slapUnpackChangedBlocks(pTarget, width, height, pEncoder->resX, pChangedBlockMap, staticValue);
+  }
+  else
+  {
+    pBackend->pReconstructStrip(pTarget, pEncoder->ppEncoderInternal[subFrameIndex], width, height, pEncoder->resX);
   }
 
-epilogue:
   return result;
 }
 
-slapFileWriter * slapCreateFileWriter(const char *filename, const size_t sizeX, const size_t sizeY, const uint64_t flags)
+slapResult slapEncoder_EndFrame(IN slapEncoder *pEncoder, IN void *pData)
 {
-  slapFileWriter *pFileWriter = slapAlloc(slapFileWriter, 1);
-  char filenameBuffer[0xFF];
-  char headerFilenameBuffer[0xFF];
+  slapResult result = slapSuccess;
 
-  if (!pFileWriter)
+  if (!pEncoder)
+  {
+    result = slapError_ArgumentNull;
     goto epilogue;
+  }
+  
+  pData = _slapEncoder_GetResidualFrame(pEncoder, pData);
 
-  slapSetZero(pFileWriter, slapFileWriter);
-  slapStrCpy(pFileWriter->filename, filename);
+  if (pEncoder->mode.flags.stereoDisparity)
+    _slapApplyStereoDisparities(pEncoder->isIframe ? pEncoder->pLastFrame : pData, pEncoder->pDisparities, pEncoder->resX, pEncoder->resY, pEncoder->subFrameRows, pEncoder->subFrameColumns, 1);
 
-  if (!pFileWriter->filename)
-    goto epilogue;
+  if (!pEncoder->isIframe)
+  {
+    uint8_t *pReference = _slapGetReferenceFrame(pEncoder->mode, pEncoder->globalShift, pEncoder->pLastFrame, pEncoder->pPrediction);
 
-  pFileWriter->pEncoder = slapCreateEncoder(sizeX, sizeY, flags);
+    _slapAddStereoDiffYUV420AndAddLastFrameDiff(pData, pReference, pEncoder->resX, pEncoder->resY, pEncoder->subFrameRows, pEncoder->subFrameColumns, pEncoder->pStaticSubFrames);
 
-  if (!pFileWriter->pEncoder)
-    goto epilogue;
+    // The prediction becomes the last frame.
+    if (pReference != pEncoder->pLastFrame)
+    {
+      pEncoder->pPrediction = pEncoder->pLastFrame;
+      pEncoder->pLastFrame = pReference;
+    }
+  }
+  else
+  {
+    _slapAddStereoDiffYUV420(pEncoder->pLastFrame, pEncoder->resX, pEncoder->resY);
+  }
 
-  sprintf_s(filenameBuffer, 0xFF, "%s.raw", filename);
-  sprintf_s(headerFilenameBuffer, 0xFF, "%s.header", filename);
+  _slapEncoder_UpdateRateControl(pEncoder);
 
-  pFileWriter->pMainFile = fopen(filenameBuffer, "wb");
+  pEncoder->frameIndex++;
 
-  if (!pFileWriter->pMainFile)
-    goto epilogue;
+epilogue:
+  return result;
+}
 
-  pFileWriter->pHeaderFile = fopen(headerFilenameBuffer, "wb");
+slapResult slapEncoder_SetEquirectangularQualityPreset(IN slapEncoder *pEncoder)
+{
+  if (!pEncoder)
+    return slapError_ArgumentNull;
 
-  if (!pFileWriter->pHeaderFile)
-    goto epilogue;
+  const double pi = 3.14159265358979323846;
+  const size_t rowsPerPlane[3] = { pEncoder->subFrameRows * 2 / 3, pEncoder->subFrameRows / 6, pEncoder->subFrameRows / 6 };
+  size_t row = 0;
 
-  if (slapSuccess != _slapWriteToHeader(pFileWriter, 0))
-    goto epilogue;
+  for (size_t plane = 0; plane < 3; plane++)
+  {
+    const size_t rowsPerEye = pEncoder->mode.flags.stereo ? rowsPerPlane[plane] / 2 : rowsPerPlane[plane];
 
-  if (slapSuccess != _slapWriteToHeader(pFileWriter, 0))
-    goto epilogue;
+    for (size_t i = 0; i < rowsPerPlane[plane]; i++, row++)
+    {
+      const double latitudeTop = pi / 2 - pi * (double)(i % rowsPerEye) / (double)rowsPerEye;
+      const double latitudeBottom = latitudeTop - pi / (double)rowsPerEye;
 
-  if (slapSuccess != _slapWriteToHeader(pFileWriter, (uint64_t)pFileWriter->pEncoder->resX))
-    goto epilogue;
+      // Average of cos(latitude) over the sub frame: the fraction of the pixels actually needed on the sphere.
+      const double coverage = (sin(latitudeTop) - sin(latitudeBottom)) / (latitudeTop - latitudeBottom);
 
-  if (slapSuccess != _slapWriteToHeader(pFileWriter, (uint64_t)pFileWriter->pEncoder->resY))
-    goto epilogue;
+      // JPEG sizes roughly halve every 8 quality steps.
+      const int offset = (int)floor(8.0 * log2(coverage) + 0.5);
 
-  if (slapSuccess != _slapWriteToHeader(pFileWriter, (uint64_t)pFileWriter->pEncoder->iframeStep))
-    goto epilogue;
+      for (size_t column = 0; column < pEncoder->subFrameColumns; column++)
+        pEncoder->pSubFrameQualityOffsets[row * pEncoder->subFrameColumns + column] = offset;
+    }
+  }
 
-  if (slapSuccess != _slapWriteToHeader(pFileWriter, (uint64_t)pFileWriter->pEncoder->mode.flagsPack))
-    goto epilogue;
+  return slapSuccess;
+}
 
-  if (slapSuccess != _slapWriteToHeader(pFileWriter, 0))
-    goto epilogue;
+bool_t _slapIsValidSubFrameLayout(const size_t resX, const size_t resY, const size_t subFrameRows, const size_t subFrameColumns)
+{
+  if (subFrameRows == 0 || subFrameColumns == 0 || subFrameRows % SLAP_SUB_FRAME_ROW_GRANULARITY != 0)
+    return 0;
 
-  if (slapSuccess != _slapWriteToHeader(pFileWriter, 0))
-    goto epilogue;
+  // Sub frames have to be made of whole DCT blocks and start at 16 byte aligned addresses.
+  if ((resY * 3 / 2) % (subFrameRows * 8) != 0 || resX % (subFrameColumns * 16) != 0)
+    return 0;
 
-  if (pFileWriter->headerPosition != SLAP_PRE_HEADER_SIZE)
-    goto epilogue;
+  return 1;
+}
 
-  return pFileWriter;
+size_t _slapGetSubFrameOffset(const size_t resX, const size_t resY, const size_t subFrameRows, const size_t subFrameColumns, const size_t subFrameIndex)
+{
+  const size_t row = subFrameIndex / subFrameColumns;
+  const size_t column = subFrameIndex % subFrameColumns;
 
-epilogue:
+  return row * (resY * 3 / 2 / subFrameRows) * resX + column * (resX / subFrameColumns);
+}
 
-  if (pFileWriter)
+// Whether the chroma sub frame columns contain chroma of the same horizontal range (see SLAP_SUB_FRAME_ROW_GRANULARITY). A column holds either part of one chroma line or the end of one and the start of the next.
+bool_t _slapChromaSubFrameColumnsOverlap(const size_t resX, const size_t subFrameColumns, const size_t columnA, const size_t columnB)
+{
+  const size_t lineWidth = resX / 2;
+  const size_t columnWidth = resX / subFrameColumns;
+  const size_t columns[2] = { columnA, columnB };
+  size_t ranges[2][2][2];
+
+  for (size_t i = 0; i < 2; i++)
+  {
+    const size_t start = columns[i] * columnWidth;
+    const size_t end = start + columnWidth;
+
+    if (end <= lineWidth || start >= lineWidth)
+    {
+      ranges[i][0][0] = ranges[i][1][0] = start % lineWidth;
+      ranges[i][0][1] = ranges[i][1][1] = (end - 1) % lineWidth + 1;
+    }
+    else
+    {
+      ranges[i][0][0] = start;
+      ranges[i][0][1] = lineWidth;
+      ranges[i][1][0] = 0;
+      ranges[i][1][1] = end - lineWidth;
+    }
+  }
+
+  for (size_t a = 0; a < 2; a++)
+    for (size_t b = 0; b < 2; b++)
+      if (ranges[0][a][0] < ranges[1][b][1] && ranges[1][b][0] < ranges[0][a][1])
+        return 1;
+
+  return 0;
+}
+
+size_t _slapGetSubFramePlane(const size_t subFrameRow, const size_t subFrameRows)
+{
+  if (subFrameRow < subFrameRows * 2 / 3)
+    return 0;
+  else if (subFrameRow < subFrameRows * 5 / 6)
+    return 1;
+  else
+    return 2;
+}
+
+// Sorts the sub frame indices by descending cost (stable, so equal costs keep their order). Enqueueing the most expensive sub frames first keeps the slowest sub frame from ending up last in the queue.
+void _slapGetSubFrameOrderByCost(IN const size_t *pCost, const size_t count, OUT size_t *pOrder)
+{
+  for (size_t i = 0; i < count; i++)
+  {
+    size_t j = i;
+
+    for (; j > 0 && pCost[pOrder[j - 1]] < pCost[i]; j--)
+      pOrder[j] = pOrder[j - 1];
+
+    pOrder[j] = i;
+  }
+}
+
+// The residual is written in place, unless the encoder has to preserve the input frame.
+uint8_t * _slapEncoder_GetResidualFrame(IN slapEncoder *pEncoder, IN void *pData)
+{
+  if (pEncoder->preserveInput)
+    return pEncoder->pResidualFrame;
+
+  return (uint8_t *)pData;
+}
+
+int _slapEncoder_GetSubFrameQuality(IN slapEncoder *pEncoder, const size_t subFrameIndex)
+{
+  int quality = pEncoder->isIframe ? pEncoder->iframeQuality : pEncoder->quality;
+
+  quality += pEncoder->planeQualityOffsets[_slapGetSubFramePlane(subFrameIndex / pEncoder->subFrameColumns, pEncoder->subFrameRows)] + pEncoder->pSubFrameQualityOffsets[subFrameIndex];
+
+  if (quality < 1)
+    quality = 1;
+  else if (quality > 100)
+    quality = 100;
+
+  return quality;
+}
+
+void _slapEncoder_UpdateRateControl(IN slapEncoder *pEncoder)
+{
+  if (!pEncoder->targetBytesPerSecond || !pEncoder->framesPerSecond)
+    return;
+
+  size_t frameSize = 0;
+
+  for (size_t i = 0; i < pEncoder->subFrameCount + 1; i++)
+    frameSize += pEncoder->pCompressedSubBufferSizes[i];
+
+  const double targetFrameSize = (double)pEncoder->targetBytesPerSecond / (double)pEncoder->framesPerSecond;
+
+  // The VBV buffer fills up with every frame and is drained at the target rate.
+  if (pEncoder->vbvBufferSize)
+  {
+    const size_t drain = (size_t)targetFrameSize;
+
+    pEncoder->vbvBufferFullness += frameSize;
+    pEncoder->vbvBufferFullness = pEncoder->vbvBufferFullness > drain ? pEncoder->vbvBufferFullness - drain : 0;
+
+    if (pEncoder->vbvBufferFullness > pEncoder->vbvBufferSize)
+      pEncoder->vbvBufferFullness = pEncoder->vbvBufferSize;
+  }
+
+  // The quality is only adjusted once per window of roughly one second, so that single I-Frames don't make the quality jump and every adjustment is measured before the next one.
+  pEncoder->rateControlWindowSize += frameSize;
+  pEncoder->rateControlWindowFrameCount++;
+
+  if (pEncoder->rateControlWindowFrameCount < pEncoder->framesPerSecond)
+    return;
+
+  pEncoder->averageFrameSize = (double)pEncoder->rateControlWindowSize / (double)pEncoder->rateControlWindowFrameCount;
+  pEncoder->rateControlWindowSize = 0;
+  pEncoder->rateControlWindowFrameCount = 0;
+
+  double ratio = pEncoder->averageFrameSize / targetFrameSize;
+
+  // Lower the quality more aggressively once the VBV buffer is more than half full.
+  if (pEncoder->vbvBufferSize)
+  {
+    const double fullness = (double)pEncoder->vbvBufferFullness / (double)pEncoder->vbvBufferSize;
+
+    if (fullness > 0.5)
+      ratio *= 2.0 * fullness;
+  }
+
+  // JPEG sizes roughly double every 8 quality steps in the usual range.
+  const double change = -8.0 * log2(ratio);
+
+  if (fabs(change) < 1.0)
+    return;
+
+  const int maxStep = 4;
+  int step = (int)change;
+
+  if (step > maxStep)
+    step = maxStep;
+  else if (step < -maxStep)
+    step = -maxStep;
+
+  // Both qualities are moved by the same step, so that the offset between I- & P-Frames is kept once one of them reaches a bound.
+  const int highestQuality = pEncoder->quality > pEncoder->iframeQuality ? pEncoder->quality : pEncoder->iframeQuality;
+  const int lowestQuality = pEncoder->quality < pEncoder->iframeQuality ? pEncoder->quality : pEncoder->iframeQuality;
+
+  if (step > pEncoder->maxQuality - highestQuality)
+    step = pEncoder->maxQuality - highestQuality;
+
+  if (step < pEncoder->minQuality - lowestQuality)
+    step = pEncoder->minQuality - lowestQuality;
+
+  pEncoder->quality += step;
+  pEncoder->iframeQuality += step;
+}
+
+slapResult _slapWriteToHeader(IN slapFileWriter *pFileWriter, const uint64_t data)
+{
+  slapResult result = slapSuccess;
+
+  pFileWriter->frameSizeOffsets[pFileWriter->frameSizeOffsetIndex++] = data;
+  pFileWriter->headerPosition++;
+
+  if (pFileWriter->frameSizeOffsetIndex >= (uint64_t)SLAP_HEADER_BLOCK_SIZE)
+  {
+    if ((size_t)SLAP_HEADER_BLOCK_SIZE != fwrite(pFileWriter->frameSizeOffsets, sizeof(uint64_t), SLAP_HEADER_BLOCK_SIZE, pFileWriter->pHeaderFile))
+    {
+      result = slapError_FileError;
+      goto epilogue;
+    }
+
+    pFileWriter->frameSizeOffsetIndex = 0;
+  }
+
+epilogue:
+  return result;
+}
+
+slapFileWriter * slapCreateFileWriter(const char *filename, const size_t sizeX, const size_t sizeY, const uint64_t flags)
+{
+  return slapCreateFileWriterWithSubFrameLayout(filename, sizeX, sizeY, flags, SLAP_DEFAULT_SUB_FRAME_ROWS, SLAP_DEFAULT_SUB_FRAME_COLUMNS);
+}
+
+slapFileWriter * slapCreateFileWriterWithSubFrameLayout(const char *filename, const size_t sizeX, const size_t sizeY, const uint64_t flags, const size_t subFrameRows, const size_t subFrameColumns)
+{
+  slapFileWriter *pFileWriter = slapAlloc(slapFileWriter, 1);
+  char filenameBuffer[0xFF];
+  char headerFilenameBuffer[0xFF];
+
+  if (!pFileWriter)
+    goto epilogue;
+
+  slapSetZero(pFileWriter, slapFileWriter);
+  slapStrCpy(pFileWriter->filename, filename);
+
+  if (!pFileWriter->filename)
+    goto epilogue;
+
+  pFileWriter->pEncoder = slapCreateEncoderWithSubFrameLayout(sizeX, sizeY, flags, subFrameRows, subFrameColumns);
+
+  if (!pFileWriter->pEncoder)
+    goto epilogue;
+
+  sprintf_s(filenameBuffer, 0xFF, "%s.raw", filename);
+  sprintf_s(headerFilenameBuffer, 0xFF, "%s.header", filename);
+
+  pFileWriter->pMainFile = fopen(filenameBuffer, "wb");
+
+  if (!pFileWriter->pMainFile)
+    goto epilogue;
+
+  pFileWriter->pHeaderFile = fopen(headerFilenameBuffer, "wb");
+
+  if (!pFileWriter->pHeaderFile)
+    goto epilogue;
+
+  if (slapSuccess != _slapWriteToHeader(pFileWriter, 0))
+    goto epilogue;
+
+  if (slapSuccess != _slapWriteToHeader(pFileWriter, 0))
+    goto epilogue;
+
+  if (slapSuccess != _slapWriteToHeader(pFileWriter, (uint64_t)pFileWriter->pEncoder->resX))
+    goto epilogue;
+
+  if (slapSuccess != _slapWriteToHeader(pFileWriter, (uint64_t)pFileWriter->pEncoder->resY))
+    goto epilogue;
+
+  if (slapSuccess != _slapWriteToHeader(pFileWriter, (uint64_t)pFileWriter->pEncoder->iframeStep))
+    goto epilogue;
+
+  if (slapSuccess != _slapWriteToHeader(pFileWriter, (uint64_t)pFileWriter->pEncoder->mode.flagsPack))
+    goto epilogue;
+
+  if (slapSuccess != _slapWriteToHeader(pFileWriter, (uint64_t)pFileWriter->pEncoder->subFrameRows))
+    goto epilogue;
+
+  if (slapSuccess != _slapWriteToHeader(pFileWriter, (uint64_t)pFileWriter->pEncoder->subFrameColumns))
+    goto epilogue;
+
+  if (slapSuccess != _slapWriteToHeader(pFileWriter, SLAP_FORMAT_VERSION))
+    goto epilogue;
+
+  if (pFileWriter->headerPosition != SLAP_PRE_HEADER_SIZE)
+    goto epilogue;
+
+  return pFileWriter;
+
+epilogue:
+
+  if (pFileWriter)
   {
     slapDestroyEncoder(&pFileWriter->pEncoder);
 
@@ -654,7 +1311,7 @@ size_t _slapEncoderTask_CallBeginSubframe(void *pData)
 {
   _slapEncoderSubTaskData0 *pUserData = (_slapEncoderSubTaskData0 *)pData;
 
-  return (size_t)slapEncoder_BeginSubFrame(pUserData->pEncoder, pUserData->pData, &pUserData->pSubFrameEncoderData->pFrameData, &pUserData->pSubFrameEncoderData->frameSize, pUserData->index);
+  return (size_t)slapEncoder_BeginSubFrame(pUserData->pEncoder, pUserData->pData, &pUserData->pChunk->pData, &pUserData->pChunk->size, pUserData->index);
 }
 
 size_t _slapEncoderTask_CallEndSubframe(void *pData)
@@ -667,61 +1324,180 @@ size_t _slapEncoderTask_CallEndSubframe(void *pData)
 #endif
 
 slapResult slapFileWriter_AddFrameYUV420(IN slapFileWriter *pFileWriter, IN void *pData)
+{
+  if (!pData)
+    return slapError_ArgumentNull;
+
+  return _slapFileWriter_AddFrame(pFileWriter, pData, NULL);
+}
+
+slapResult slapFileWriter_AddFrameFromBuffer(IN slapFileWriter *pFileWriter, IN const slapInputBuffer *pInput)
+{
+  if (!pInput)
+    return slapError_ArgumentNull;
+
+  return _slapFileWriter_AddFrame(pFileWriter, NULL, pInput);
+}
+
+// Either pData or pInput is used.
+slapResult _slapFileWriter_AddFrame(IN slapFileWriter *pFileWriter, IN void *pData, IN const slapInputBuffer *pInput)
+{
+  slapResult result = slapSuccess;
+  slapFramePacket packet;
+
+  if (!pFileWriter)
+  {
+    result = slapError_ArgumentNull;
+    goto epilogue;
+  }
+
+  result = _slapEncoder_EncodeFrame(pFileWriter->pEncoder, pData, pInput, &packet, pFileWriter);
+
+  if (result != slapSuccess)
+    goto epilogue;
+
+  pFileWriter->frameCount++;
+
+epilogue:
+  return result;
+}
+
+slapResult _slapFileWriter_WritePacket(IN slapFileWriter *pFileWriter, IN const slapFramePacket *pPacket)
+{
+  slapResult result = slapSuccess;
+  const uint64_t *pHeader = (const uint64_t *)pPacket->pChunks[0].pData;
+  const size_t headerSize = pPacket->pChunks[0].size / sizeof(uint64_t);
+  const uint64_t filePosition = ftell(pFileWriter->pMainFile);
+
+  // The offsets of the low res & full frame are absolute in the file header.
+  for (size_t i = 0; i < headerSize; i++)
+  {
+    const uint64_t data = (i == 0 || i == 2) ? pHeader[i] + filePosition : pHeader[i];
+
+    if ((result = _slapWriteToHeader(pFileWriter, data)) != slapSuccess)
+      goto epilogue;
+  }
+
+  for (size_t i = 1; i < pPacket->chunkCount; i++)
+  {
+    if (pPacket->pChunks[i].size != fwrite(pPacket->pChunks[i].pData, 1, pPacket->pChunks[i].size, pFileWriter->pMainFile))
+    {
+      result = slapError_FileError;
+      goto epilogue;
+    }
+  }
+
+epilogue:
+  return result;
+}
+
+slapResult slapEncoder_EncodeFrame(IN slapEncoder *pEncoder, IN void *pData, OUT slapFramePacket *pPacket)
+{
+  if (!pData)
+    return slapError_ArgumentNull;
+
+  return _slapEncoder_EncodeFrame(pEncoder, pData, NULL, pPacket, NULL);
+}
+
+slapResult slapEncoder_EncodeFrameFromBuffer(IN slapEncoder *pEncoder, IN const slapInputBuffer *pInput, OUT slapFramePacket *pPacket)
+{
+  if (!pInput)
+    return slapError_ArgumentNull;
+
+  return _slapEncoder_EncodeFrame(pEncoder, NULL, pInput, pPacket, NULL);
+}
+
+// Either pData or pInput is used. If pFileWriter isn't NULL, the packet is written to it while the sub frames are being reconstructed.
+slapResult _slapEncoder_EncodeFrame(IN slapEncoder *pEncoder, IN void *pData, IN const slapInputBuffer *pInput, OUT slapFramePacket *pPacket, IN slapFileWriter *pFileWriter)
 {
   slapResult result = slapSuccess;
-  size_t filePosition = 0;
-  _slapFrameEncoderBlock subFrames[SLAP_SUB_BUFFER_COUNT];
-  size_t totalFullFrameSize = 0;
 #ifdef SLAP_MULTITHREADED
-  ThreadPool_TaskHandle tasks[SLAP_SUB_BUFFER_COUNT];
-  _slapEncoderSubTaskData0 encoderData[SLAP_SUB_BUFFER_COUNT];
+  ThreadPool_TaskHandle *pTasks = NULL;
+  _slapEncoderSubTaskData0 *pEncoderData = NULL;
+  size_t *pOrder = NULL;
 #endif
 
-  if (!pFileWriter || !pData)
+  if (!pEncoder || !pPacket)
   {
     result = slapError_ArgumentNull;
     goto epilogue;
   }
 
-  result = slapEncoder_BeginFrame(pFileWriter->pEncoder, pData);
+  const size_t subFrameCount = pEncoder->subFrameCount;
+  slapPacketChunk *pLowResChunk = &pEncoder->pPacketChunks[1];
+  slapPacketChunk *pSubFrameChunks = &pEncoder->pPacketChunks[2];
+
+#ifdef SLAP_MULTITHREADED
+  pTasks = slapAlloc(ThreadPool_TaskHandle, subFrameCount);
+  pEncoderData = slapAlloc(_slapEncoderSubTaskData0, subFrameCount);
+  pOrder = slapAlloc(size_t, subFrameCount);
+
+  if (!pTasks || !pEncoderData || !pOrder)
+  {
+    result = slapError_MemoryAllocation;
+    goto epilogue;
+  }
+
+  // The compressed sizes of the last frame are the best guess for the cost of the sub frames of this frame.
+  _slapGetSubFrameOrderByCost(pEncoder->pCompressedSubBufferSizes, subFrameCount, pOrder);
+#endif
+
+  if (pInput)
+  {
+    result = slapEncoder_BeginFrameFromBuffer(pEncoder, pInput);
+    pData = pEncoder->pResidualFrame;
+  }
+  else
+  {
+    result = slapEncoder_BeginFrame(pEncoder, pData);
+  }
 
   if (result != slapSuccess)
     goto epilogue;
 
   // compress sub frame
-  result = _slapCompressYUV420(pFileWriter->pEncoder->pLowResData, &pFileWriter->pEncoder->ppCompressedBuffers[SLAP_LOW_RES_BUFFER_INDEX], &pFileWriter->pEncoder->compressedSubBufferSizes[SLAP_LOW_RES_BUFFER_INDEX], pFileWriter->pEncoder->lowResX, pFileWriter->pEncoder->lowResY, pFileWriter->pEncoder->lowResQuality, pFileWriter->pEncoder->ppEncoderInternal[SLAP_LOW_RES_BUFFER_INDEX]);
+  result = _slapGetBackend(pEncoder->mode.flags.encoder)->pCompressPreview(pEncoder->pLowResData, &pEncoder->ppCompressedBuffers[subFrameCount], &pEncoder->pCompressedSubBufferSizes[subFrameCount], pEncoder->lowResX, pEncoder->lowResY, pEncoder->lowResQuality, pEncoder->ppLowResEncoderInternal);
 
   if (result != slapSuccess)
     goto epilogue;
 
+  pLowResChunk->pData = pEncoder->ppCompressedBuffers[subFrameCount];
+  pLowResChunk->size = pEncoder->pCompressedSubBufferSizes[subFrameCount];
+
   // compress full frame
 #ifdef SLAP_MULTITHREADED
 
-  for (size_t i = 0; i < SLAP_SUB_BUFFER_COUNT; i++)
+  for (size_t i = 0; i < subFrameCount; i++)
   {
-    encoderData[i].pEncoder = pFileWriter->pEncoder;
-    encoderData[i].pData = pData;
-    encoderData[i].pSubFrameEncoderData = &subFrames[i];
-    encoderData[i].index = i;
+    const size_t index = pOrder[i];
 
-    tasks[i] = ThreadPool_CreateTask(_slapEncoderTask_CallBeginSubframe, (void *)&encoderData[i]);
-    ThreadPool_EnqueueTask(pFileWriter->pEncoder->pThreadPoolHandle, tasks[i]);
+    pEncoderData[index].pEncoder = pEncoder;
+    pEncoderData[index].pData = pData;
+    pEncoderData[index].pChunk = &pSubFrameChunks[index];
+    pEncoderData[index].index = index;
+
+    pTasks[index] = ThreadPool_CreateTask(_slapEncoderTask_CallBeginSubframe, (void *)&pEncoderData[index]);
+    ThreadPool_EnqueueTask(pEncoder->pThreadPoolHandle, pTasks[index]);
   }
 
-  for (size_t i = 0; i < SLAP_SUB_BUFFER_COUNT; i++)
-    ThreadPool_JoinTask(tasks[i]);
+  for (size_t i = 0; i < subFrameCount; i++)
+    ThreadPool_JoinTask(pTasks[i]);
+
+  _slapGetSubFrameOrderByCost(pEncoder->pCompressedSubBufferSizes, subFrameCount, pOrder);
 
-  for (size_t i = 0; i < SLAP_SUB_BUFFER_COUNT; i++)
+  for (size_t i = 0; i < subFrameCount; i++)
   {
-    tasks[i] = ThreadPool_CreateTask(_slapEncoderTask_CallEndSubframe, (void *)&encoderData[i]);
-    ThreadPool_EnqueueTask(pFileWriter->pEncoder->pThreadPoolHandle, tasks[i]);
+    const size_t index = pOrder[i];
+
+    pTasks[index] = ThreadPool_CreateTask(_slapEncoderTask_CallEndSubframe, (void *)&pEncoderData[index]);
+    ThreadPool_EnqueueTask(pEncoder->pThreadPoolHandle, pTasks[index]);
   }
 
 #else
 
-  for (size_t i = 0; i < SLAP_SUB_BUFFER_COUNT; i++)
+  for (size_t i = 0; i < subFrameCount; i++)
   {
-    result = slapEncoder_BeginSubFrame(pFileWriter->pEncoder, pData, &subFrames[i].pFrameData, &subFrames[i].frameSize, i);
+    result = slapEncoder_BeginSubFrame(pEncoder, pData, &pSubFrameChunks[i].pData, &pSubFrameChunks[i].size, i);
 
     if (result != slapSuccess)
       goto epilogue;
@@ -729,53 +1505,56 @@ slapResult slapFileWriter_AddFrameYUV420(IN slapFileWriter *pFileWriter, IN void
 
 #endif
 
-  // save to disk
-  filePosition = ftell(pFileWriter->pMainFile);
+  // build packet
+  {
+    uint64_t *pHeader = pEncoder->pPacketHeader;
+    uint64_t subFrameOffset = 0;
 
-  if ((result = _slapWriteToHeader(pFileWriter, filePosition)) != slapSuccess) goto epilogue;
-  if ((result = _slapWriteToHeader(pFileWriter, pFileWriter->pEncoder->compressedSubBufferSizes[SLAP_LOW_RES_BUFFER_INDEX])) != slapSuccess) goto epilogue;
+    pHeader[0] = 0;
+    pHeader[1] = pLowResChunk->size;
+    pHeader[2] = pLowResChunk->size;
 
-  if (pFileWriter->pEncoder->compressedSubBufferSizes[SLAP_LOW_RES_BUFFER_INDEX] != fwrite(pFileWriter->pEncoder->ppCompressedBuffers[SLAP_LOW_RES_BUFFER_INDEX], 1, pFileWriter->pEncoder->compressedSubBufferSizes[SLAP_LOW_RES_BUFFER_INDEX], pFileWriter->pMainFile))
-  {
-    result = slapError_FileError;
-    goto epilogue;
-  }
+    for (size_t i = 0; i < subFrameCount; i++)
+    {
+      pHeader[SLAP_HEADER_PER_FRAME_FULL_FRAME_OFFSET + i * 2] = subFrameOffset;
+      pHeader[SLAP_HEADER_PER_FRAME_FULL_FRAME_OFFSET + i * 2 + 1] = pSubFrameChunks[i].size;
 
-  filePosition = ftell(pFileWriter->pMainFile);
-  if ((result = _slapWriteToHeader(pFileWriter, filePosition)) != slapSuccess) goto epilogue;
+      subFrameOffset += pSubFrameChunks[i].size;
+    }
 
-  for (size_t i = 0; i < SLAP_SUB_BUFFER_COUNT; i++)
-    totalFullFrameSize += subFrames[i].frameSize;
+    pHeader[3] = subFrameOffset;
+    pHeader[SLAP_HEADER_PER_FRAME_FRAME_TYPE_INDEX(subFrameCount)] = pEncoder->isIframe ? SLAP_FRAME_TYPE_IFRAME : SLAP_FRAME_TYPE_PFRAME;
 
-  if ((result = _slapWriteToHeader(pFileWriter, totalFullFrameSize)) != slapSuccess) goto epilogue;
+    pEncoder->pPacketChunks[0].pData = pHeader;
+    pEncoder->pPacketChunks[0].size = SLAP_HEADER_PER_FRAME_SIZE(subFrameCount) * sizeof(uint64_t);
 
-  filePosition = 0;
+    pPacket->frameIndex = pEncoder->frameIndex;
+    pPacket->isIframe = pEncoder->isIframe;
+    pPacket->pChunks = pEncoder->pPacketChunks;
+    pPacket->chunkCount = subFrameCount + 2;
+    pPacket->size = pEncoder->pPacketChunks[0].size + pLowResChunk->size + subFrameOffset;
+  }
 
-  for (size_t i = 0; i < SLAP_SUB_BUFFER_COUNT; i++)
+  // save to disk
+  if (pFileWriter)
   {
-    if ((result = _slapWriteToHeader(pFileWriter, filePosition)) != slapSuccess) goto epilogue;
-    if ((result = _slapWriteToHeader(pFileWriter, subFrames[i].frameSize)) != slapSuccess) goto epilogue;
+    result = _slapFileWriter_WritePacket(pFileWriter, pPacket);
 
-    filePosition += subFrames[i].frameSize;
-
-    if (subFrames[i].frameSize != fwrite(subFrames[i].pFrameData, 1, subFrames[i].frameSize, pFileWriter->pMainFile))
-    {
-      result = slapError_FileError;
+    if (result != slapSuccess)
       goto epilogue;
-    }
   }
 
   // get ready for next frame
 #ifdef SLAP_MULTITHREADED
 
-  for (size_t i = 0; i < SLAP_SUB_BUFFER_COUNT; i++)
-    ThreadPool_JoinTask(tasks[i]);
+  for (size_t i = 0; i < subFrameCount; i++)
+    ThreadPool_JoinTask(pTasks[i]);
 
 #else
 
-  for (size_t i = 0; i < SLAP_SUB_BUFFER_COUNT; i++)
+  for (size_t i = 0; i < subFrameCount; i++)
   {
-    result = slapEncoder_EndSubFrame(pFileWriter->pEncoder, pData, i);
+    result = slapEncoder_EndSubFrame(pEncoder, pData, i);
 
     if (result != slapSuccess)
       goto epilogue;
@@ -784,23 +1563,61 @@ slapResult slapFileWriter_AddFrameYUV420(IN slapFileWriter *pFileWriter, IN void
 #endif
 
   // finalize frame.
-  result = slapEncoder_EndFrame(pFileWriter->pEncoder, pData);
-
-  if (result != slapSuccess)
-    goto epilogue;
-
-  pFileWriter->frameCount++; 
+  result = slapEncoder_EndFrame(pEncoder, pData);
 
 epilogue:
+#ifdef SLAP_MULTITHREADED
+  slapFreePtr(&pTasks);
+  slapFreePtr(&pEncoderData);
+  slapFreePtr(&pOrder);
+#endif
+
   return result;
 }
 
 slapDecoder * slapCreateDecoder(const size_t sizeX, const size_t sizeY, const uint64_t flags)
 {
-  if (sizeX & 63 || sizeY & 63) // must be multiple of 64.
-    return NULL;
+  return slapCreateDecoderWithSubFrameLayout(sizeX, sizeY, flags, SLAP_DEFAULT_SUB_FRAME_ROWS, SLAP_DEFAULT_SUB_FRAME_COLUMNS);
+}
 
-  slapDecoder *pDecoder = slapAlloc(slapDecoder, 1);
+slapDecoder * slapCreateDecoderWithSubFrameLayout(const size_t sizeX, const size_t sizeY, const uint64_t flags, const size_t subFrameRows, const size_t subFrameColumns)
+{
+  return slapCreateScaledDecoderWithSubFrameLayout(sizeX, sizeY, flags, subFrameRows, subFrameColumns, SLAP_DECODER_SCALE_FULL);
+}
+
+slapDecoder * slapCreateScaledDecoderWithSubFrameLayout(const size_t sizeX, const size_t sizeY, const uint64_t flags, const size_t subFrameRows, const size_t subFrameColumns, const size_t scaleShift)
+{
+  return _slapCreateDecoder(sizeX, sizeY, flags, subFrameRows, subFrameColumns, scaleShift, NULL);
+}
+
+// Decoders with pThreadPoolHandle share that thread pool (see slapDecodeSession) instead of creating their own.
+slapDecoder * _slapCreateDecoder(const size_t sizeX, const size_t sizeY, const uint64_t flags, const size_t subFrameRows, const size_t subFrameColumns, const size_t scaleShift, IN void *pThreadPoolHandle)
+{
+  if (sizeX & 63 || sizeY & 63) // must be multiple of 64.
+    return NULL;
+
+  if (!_slapIsValidSubFrameLayout(sizeX, sizeY, subFrameRows, subFrameColumns))
+    return NULL;
+
+  if (scaleShift > SLAP_DECODER_SCALE_QUARTER)
+    return NULL;
+
+  // The scaled sub frames still have to start at 16 byte aligned addresses.
+  if ((sizeX >> scaleShift) % (subFrameColumns * 16) != 0)
+    return NULL;
+
+  mode decoderMode;
+  decoderMode.flagsPack = flags;
+
+  const _slapBackend *pBackend = _slapGetBackend(decoderMode.flags.encoder);
+
+  if (!pBackend)
+    return NULL;
+
+  if (scaleShift != SLAP_DECODER_SCALE_FULL && !pBackend->scaledDecode)
+    return NULL;
+
+  slapDecoder *pDecoder = slapAlloc(slapDecoder, 1);
 
   if (!pDecoder)
     goto epilogue;
@@ -809,23 +1626,32 @@ slapDecoder * slapCreateDecoder(const size_t sizeX, const size_t sizeY, const ui
 
   pDecoder->resX = sizeX;
   pDecoder->resY = sizeY;
-  pDecoder->iframeStep = 30;
+  pDecoder->scaleShift = scaleShift;
+  pDecoder->subFrameRows = subFrameRows;
+  pDecoder->subFrameColumns = subFrameColumns;
+  pDecoder->subFrameCount = subFrameRows * subFrameColumns;
+  pDecoder->isIframe = 1;
   pDecoder->mode.flagsPack = flags;
 
-  pDecoder->ppDecoders = slapAlloc(void *, SLAP_SUB_BUFFER_COUNT);
+  pDecoder->pStaticSubFrames = slapAlloc(bool_t, pDecoder->subFrameCount);
+
+  if (!pDecoder->pStaticSubFrames)
+    goto epilogue;
+
+  memset(pDecoder->pStaticSubFrames, 0, sizeof(bool_t) * pDecoder->subFrameCount);
+
+  pDecoder->ppDecoders = slapAlloc(void *, pDecoder->subFrameCount);
   
   if (!pDecoder->ppDecoders)
     goto epilogue;
 
-  memset(pDecoder->ppDecoders, 0, sizeof(void *) * SLAP_SUB_BUFFER_COUNT);
+  // The strip decoders are only created if sub frames are decoded outside of the thread pool (see _slapDecoder_GetStripDecoder).
+  memset(pDecoder->ppDecoders, 0, sizeof(void *) * pDecoder->subFrameCount);
 
-  for (size_t i = 0; i < SLAP_SUB_BUFFER_COUNT; i++)
-  {
-    pDecoder->ppDecoders[i] = tjInitDecompress();
+  pDecoder->pLowResDecoderInternal = pBackend->pCreatePreviewDecoder();
 
-    if (!pDecoder->ppDecoders[i])
-      goto epilogue;
-  }
+  if (!pDecoder->pLowResDecoderInternal)
+    goto epilogue;
 
   size_t lowResSizeX = sizeX >> 3;
   size_t lowResSizeY = sizeY >> 3;
@@ -838,37 +1664,84 @@ slapDecoder * slapCreateDecoder(const size_t sizeX, const size_t sizeY, const ui
   if (!pDecoder->pLowResData)
     goto epilogue;
 
-  pDecoder->pLastFrame = slapAlloc(uint8_t, sizeX * sizeY * 3 / 2);
+  const size_t frameSize = (sizeX >> scaleShift) * (sizeY >> scaleShift) * 3 / 2;
+
+  pDecoder->pLastFrame = slapAlloc(uint8_t, frameSize);
 
   if (!pDecoder->pLastFrame)
     goto epilogue;
 
-  const size_t threadCount = ThreadPool_GetSystemThreadCount();
+  if (pDecoder->mode.flags.motionCompensation)
+  {
+    const size_t motionBlockCount = _slapGetMotionBlockCount(pDecoder->mode, sizeX, sizeY, subFrameRows, subFrameColumns, 0);
 
-  pDecoder->pThreadPoolHandle = ThreadPool_Init(threadCount);
+    pDecoder->pMotionVectors = slapAlloc(int8_t, motionBlockCount * 2 * (subFrameRows / 3 * subFrameColumns));
 
-  if (!pDecoder->pThreadPoolHandle)
-    goto epilogue;
+    if (!pDecoder->pMotionVectors)
+      goto epilogue;
+  }
+
+  if (pDecoder->mode.flags.motionCompensation || pDecoder->mode.flags.globalMotion)
+  {
+    pDecoder->pPrediction = slapAlloc(uint8_t, frameSize);
+
+    if (!pDecoder->pPrediction)
+      goto epilogue;
+  }
+
+  if (pDecoder->mode.flags.stereoDisparity)
+  {
+    pDecoder->pDisparities = slapAlloc(int8_t, pDecoder->subFrameCount);
+
+    if (!pDecoder->pDisparities)
+      goto epilogue;
+
+    memset(pDecoder->pDisparities, 0, sizeof(int8_t) * pDecoder->subFrameCount);
+  }
+
+  if (pThreadPoolHandle)
+  {
+    pDecoder->pThreadPoolHandle = pThreadPoolHandle;
+    pDecoder->isThreadPoolShared = 1;
+  }
+  else
+  {
+    const size_t threadCount = ThreadPool_GetSystemThreadCount();
+
+    pDecoder->pThreadPoolHandle = ThreadPool_InitWithWorkerData(threadCount, _slapDestroyWorkerData);
+
+    if (!pDecoder->pThreadPoolHandle)
+      goto epilogue;
+  }
 
   return pDecoder;
 
 epilogue:
   if (pDecoder->ppDecoders)
   {
-    for (size_t i = 0; i < SLAP_SUB_BUFFER_COUNT; i++)
+    for (size_t i = 0; i < pDecoder->subFrameCount; i++)
       if (pDecoder->ppDecoders[i])
-        tjDestroy(pDecoder->ppDecoders[i]);
+        pBackend->pDestroyStripDecoder(&pDecoder->ppDecoders[i]);
 
     slapFreePtr(&pDecoder->ppDecoders);
   }
 
+  if (pDecoder->pLowResDecoderInternal)
+    pBackend->pDestroyPreviewDecoder(&pDecoder->pLowResDecoderInternal);
+
+  slapFreePtr(&pDecoder->pStaticSubFrames);
+
   if (pDecoder->pLowResData)
     slapFreePtr(&pDecoder->pLowResData);
 
   if (pDecoder->pLastFrame)
     slapFreePtr(&pDecoder->pLastFrame);
 
-  if (pDecoder->pThreadPoolHandle)
+  slapFreePtr(&pDecoder->pMotionVectors);
+  slapFreePtr(&pDecoder->pPrediction);
+  slapFreePtr(&pDecoder->pDisparities);
+
+  if (pDecoder->pThreadPoolHandle && !pDecoder->isThreadPoolShared)
     ThreadPool_Destroy(pDecoder->pThreadPoolHandle);
 
   slapFreePtr(&pDecoder);
@@ -880,22 +1753,33 @@ void slapDestroyDecoder(IN_OUT slapDecoder **ppDecoder)
 {
   if (ppDecoder && *ppDecoder)
   {
+    const _slapBackend *pBackend = _slapGetBackend((*ppDecoder)->mode.flags.encoder);
+
     if ((*ppDecoder)->ppDecoders)
     {
-      for (size_t i = 0; i < SLAP_SUB_BUFFER_COUNT; i++)
+      for (size_t i = 0; i < (*ppDecoder)->subFrameCount; i++)
         if ((*ppDecoder)->ppDecoders[i])
-          tjDestroy((*ppDecoder)->ppDecoders[i]);
+          pBackend->pDestroyStripDecoder(&(*ppDecoder)->ppDecoders[i]);
 
       slapFreePtr(&(*ppDecoder)->ppDecoders);
     }
 
+    if ((*ppDecoder)->pLowResDecoderInternal)
+      pBackend->pDestroyPreviewDecoder(&(*ppDecoder)->pLowResDecoderInternal);
+
+    slapFreePtr(&(*ppDecoder)->pStaticSubFrames);
+
     if ((*ppDecoder)->pLowResData)
       slapFreePtr(&(*ppDecoder)->pLowResData);
 
     if ((*ppDecoder)->pLastFrame)
       slapFreePtr(&(*ppDecoder)->pLastFrame);
 
-    if ((*ppDecoder)->pThreadPoolHandle)
+    slapFreePtr(&(*ppDecoder)->pMotionVectors);
+    slapFreePtr(&(*ppDecoder)->pPrediction);
+    slapFreePtr(&(*ppDecoder)->pDisparities);
+
+    if ((*ppDecoder)->pThreadPoolHandle && !(*ppDecoder)->isThreadPoolShared)
       ThreadPool_Destroy((*ppDecoder)->pThreadPoolHandle);
   }
 
@@ -906,40 +1790,213 @@ slapResult slapDecoder_DecodeSubFrame(IN slapDecoder *pDecoder, const size_t dec
 {
   slapResult result = slapSuccess;
 
-  const size_t subFrameHeight = pDecoder->resY * 3 / 2 / SLAP_SUB_BUFFER_COUNT;
-  uint8_t *pOutData = ((uint8_t *)pYUVData) + decoderIndex * subFrameHeight * pDecoder->resX;
+  const size_t resX = pDecoder->resX >> pDecoder->scaleShift;
+  const size_t resY = pDecoder->resY >> pDecoder->scaleShift;
+  const size_t width = resX / pDecoder->subFrameColumns;
+  const size_t height = resY * 3 / 2 / pDecoder->subFrameRows;
+  const uint8_t staticValue = _slapGetStaticSubFrameValue(decoderIndex / pDecoder->subFrameColumns, pDecoder->subFrameRows);
+  uint8_t *pOutData = ((uint8_t *)pYUVData) + _slapGetSubFrameOffset(resX, resY, pDecoder->subFrameRows, pDecoder->subFrameColumns, decoderIndex);
+  uint8_t *pRecord = (uint8_t *)ppCompressedData[decoderIndex];
+  size_t recordSize = pLength[decoderIndex];
+
+  // Skipped sub frames are treated like static sub frames.
+  if (pDecoder->pSubFrameMask && !(pDecoder->pSubFrameMask[decoderIndex >> 6] & ((uint64_t)1 << (decoderIndex & 63))))
+  {
+    pDecoder->pStaticSubFrames[decoderIndex] = !pDecoder->isIframe;
+
+    if (_slapGetDisparitySize(pDecoder->mode, pDecoder->subFrameRows, pDecoder->subFrameColumns, decoderIndex))
+      pDecoder->pDisparities[decoderIndex] = 0;
+
+    _slapFillSubFrame(pOutData, width, height, resX, staticValue);
+    goto epilogue;
+  }
+
+  result = _slapDecoder_ReadSubFramePrefix(pDecoder, decoderIndex, &pRecord, &recordSize);
+
+  if (result != slapSuccess)
+    goto epilogue;
 
-  if (pDecoder->mode.flags.encoder == 0)
+  pDecoder->pStaticSubFrames[decoderIndex] = (!pDecoder->isIframe && recordSize == SLAP_STATIC_SUB_FRAME_SIZE);
+
+  if (pDecoder->pStaticSubFrames[decoderIndex])
   {
-    if (subFrameHeight * decoderIndex * 2 / 3 < pDecoder->resY)
-      result = _slapDecompressChannel(pOutData, ppCompressedData[decoderIndex], pLength[decoderIndex], pDecoder->resX, subFrameHeight, pDecoder->ppDecoders[decoderIndex]);
-    else
-      result = _slapDecompressChannel(pOutData, ppCompressedData[decoderIndex], pLength[decoderIndex], pDecoder->resX >> 1, subFrameHeight << 1, pDecoder->ppDecoders[decoderIndex]);
+    _slapFillSubFrame(pOutData, width, height, resX, staticValue);
+    goto epilogue;
+  }
+
+  const _slapBackend *pBackend = _slapGetBackend(pDecoder->mode.flags.encoder);
+  void *pStripDecoder = _slapDecoder_GetStripDecoder(pDecoder, decoderIndex);
+
+  if (!pStripDecoder)
+  {
+    result = slapError_MemoryAllocation;
+    goto epilogue;
+  }
+
+  if (!pDecoder->isIframe && pDecoder->mode.flags.staticBlocks)
+  {
+    // The changed block map refers to the blocks at full resolution.
+    const size_t fullWidth = pDecoder->resX / pDecoder->subFrameColumns;
+    const size_t fullHeight = pDecoder->resY * 3 / 2 / pDecoder->subFrameRows;
+    const uint8_t *pChangedBlockMap = pRecord;
+    const size_t changedBlockMapSize = _slapGetChangedBlockMapSize(fullWidth, fullHeight);
+
+    if (recordSize <= changedBlockMapSize)
+    {
+      result = slapError_Compress_Internal;
+      goto epilogue;
+    }
+
+    result = pBackend->pDecompressStrip(pOutData, pRecord + changedBlockMapSize, recordSize - changedBlockMapSize, width, _slapGetPackedHeight(pChangedBlockMap, fullWidth, fullHeight) >> pDecoder->scaleShift, resX, pStripDecoder);
 
     if (result != slapSuccess)
       goto epilogue;
+
+    if (pDecoder->scaleShift == SLAP_DECODER_SCALE_FULL)
+      _slapUnpackChangedBlocks(pOutData, width, height, resX, pChangedBlockMap, staticValue);
+    else
+      _slapUnpackScaledChangedBlocks(pOutData, width, height, resX, pChangedBlockMap, staticValue, pDecoder->scaleShift);
+  }
+  else
+  {
+    result = pBackend->pDecompressStrip(pOutData, pRecord, recordSize, width, height, resX, pStripDecoder);
   }
 
+  if (result != slapSuccess)
+    goto epilogue;
+
 epilogue:
   return result;
 }
 
+// Tasks of the thread pool use the strip decoder of their worker thread, other callers the one of the sub frame.
+void * _slapDecoder_GetStripDecoder(IN slapDecoder *pDecoder, const size_t subFrameIndex)
+{
+  const size_t encoder = pDecoder->mode.flags.encoder;
+  const _slapBackend *pBackend = _slapGetBackend(encoder);
+  void **ppWorkerData = ThreadPool_GetWorkerData();
+
+  if (ppWorkerData)
+  {
+    _slapWorkerData *pWorkerData = _slapGetWorkerData(ppWorkerData);
+
+    if (!pWorkerData)
+      return NULL;
+
+    if (!pWorkerData->pStripDecoders[encoder])
+      pWorkerData->pStripDecoders[encoder] = pBackend->pCreateStripDecoder();
+
+    return pWorkerData->pStripDecoders[encoder];
+  }
+
+  if (!pDecoder->ppDecoders[subFrameIndex])
+    pDecoder->ppDecoders[subFrameIndex] = pBackend->pCreateStripDecoder();
+
+  return pDecoder->ppDecoders[subFrameIndex];
+}
+
+// Allocates the worker data of the current worker thread on first use.
+_slapWorkerData * _slapGetWorkerData(IN void **ppWorkerData)
+{
+  if (!*ppWorkerData)
+  {
+    *ppWorkerData = slapAlloc(_slapWorkerData, 1);
+
+    if (!*ppWorkerData)
+      return NULL;
+
+    slapSetZero((_slapWorkerData *)*ppWorkerData, _slapWorkerData);
+  }
+
+  return (_slapWorkerData *)*ppWorkerData;
+}
+
+void _slapDestroyWorkerData(IN void *pWorkerData)
+{
+  _slapWorkerData *pData = (_slapWorkerData *)pWorkerData;
+
+  for (size_t i = 0; i < SLAP_BACKEND_COUNT; i++)
+    if (pData->pStripDecoders[i])
+      _slapGetBackend(i)->pDestroyStripDecoder(&pData->pStripDecoders[i]);
+
+  _slapDestroyJpegCompressor(&pData->pJpegCompressor);
+
+  slapFreePtr(&pData);
+}
+
 slapResult slapDecoder_FinalizeFrame(IN slapDecoder *pDecoder, IN void *pData, const size_t length, IN_OUT void *pYUVData)
+{
+  return slapDecoder_FinalizeFrameToBuffer(pDecoder, pData, length, pYUVData, NULL);
+}
+
+slapResult slapDecoder_FinalizeFrameToBuffer(IN slapDecoder *pDecoder, IN void *pData, const size_t length, IN_OUT void *pYUVData, IN const slapOutputBuffer *pOutput)
 {
   slapResult result = slapSuccess;
 
-  if (!pDecoder || !pData || !length || !pYUVData)
+  // P-Frames that only consist of static sub frames have no data, I-Frames only if all of their sub frames have been skipped.
+  if (!pDecoder || !pData || !pYUVData || (!length && pDecoder->isIframe && !pDecoder->pSubFrameMask))
   {
     result = slapError_ArgumentNull;
     goto epilogue;
   }
 
-  if (pDecoder->mode.flags.encoder == 0)
+  if (pOutput)
+  {
+    const size_t planeCount = pOutput->format == slapOutputFormat_YUV420 ? 3 : (pOutput->format == slapOutputFormat_NV12 ? 2 : 1);
+
+    for (size_t i = 0; i < planeCount; i++)
+    {
+      if (!pOutput->pPlanes[i])
+      {
+        result = slapError_ArgumentNull;
+        goto epilogue;
+      }
+    }
+  }
+
+  const size_t resX = pDecoder->resX >> pDecoder->scaleShift;
+  const size_t resY = pDecoder->resY >> pDecoder->scaleShift;
+
+  if (pDecoder->mode.flags.stereoDisparity)
+    _slapApplyStereoDisparities(pYUVData, pDecoder->pDisparities, resX, resY, pDecoder->subFrameRows, pDecoder->subFrameColumns, 1);
+
+  if (!pDecoder->isIframe)
+  {
+    uint8_t *pReference = pDecoder->pLastFrame;
+
+    // Same as in slapEncoder_BeginFrame.
+    if (pDecoder->mode.flags.globalMotion && pDecoder->globalShift != 0)
+    {
+      _slapShiftFrameYUV420(pDecoder->pLastFrame, pDecoder->pPrediction, resX, resY, pDecoder->globalShift, pDecoder->scaleShift);
+      pReference = pDecoder->pPrediction;
+    }
+
+    if (pDecoder->mode.flags.motionCompensation)
+    {
+      uint8_t *pTarget = pReference == pDecoder->pPrediction ? pDecoder->pLastFrame : pDecoder->pPrediction;
+
+      _slapMotionCompensateYUV420(pReference, pTarget, pDecoder->pMotionVectors, resX, resY, pDecoder->subFrameRows, pDecoder->subFrameColumns, pDecoder->scaleShift);
+      pReference = pTarget;
+    }
+
+    if (pOutput)
+      _slapReconstructYUV420ToBuffer(pYUVData, pReference, resX, resY, 0, pOutput);
+    else
+      _slapAddStereoDiffYUV420AndAddLastFrameDiff(pYUVData, pReference, resX, resY, pDecoder->subFrameRows, pDecoder->subFrameColumns, pDecoder->pStaticSubFrames);
+
+    // The prediction becomes the last frame.
+    if (pReference != pDecoder->pLastFrame)
+    {
+      pDecoder->pPrediction = pDecoder->pLastFrame;
+      pDecoder->pLastFrame = pReference;
+    }
+  }
+  else
   {
-    if (pDecoder->frameIndex % pDecoder->iframeStep != 0)
-      _slapAddStereoDiffYUV420AndAddLastFrameDiff(pYUVData, pDecoder->pLastFrame, pDecoder->resX, pDecoder->resY);
+    if (pOutput)
+      _slapReconstructYUV420ToBuffer(pYUVData, pDecoder->pLastFrame, resX, resY, 1, pOutput);
     else
-      _slapAddStereoDiffYUV420AndCopyToLastFrame(pYUVData, pDecoder->pLastFrame, pDecoder->resX, pDecoder->resY);
+      _slapAddStereoDiffYUV420AndCopyToLastFrame(pYUVData, pDecoder->pLastFrame, resX, resY);
   }
 
   pDecoder->frameIndex++;
@@ -949,6 +2006,16 @@ epilogue:
 }
 
 slapFileReader * slapCreateFileReader(const char *filename)
+{
+  return slapCreateScaledFileReader(filename, SLAP_DECODER_SCALE_FULL);
+}
+
+slapFileReader * slapCreateScaledFileReader(const char *filename, const size_t scaleShift)
+{
+  return _slapCreateFileReader(filename, scaleShift, NULL);
+}
+
+slapFileReader * _slapCreateFileReader(const char *filename, const size_t scaleShift, IN void *pThreadPoolHandle)
 {
   slapFileReader *pFileReader = slapAlloc(slapFileReader, 1);
   size_t frameSize = 0;
@@ -966,6 +2033,10 @@ slapFileReader * slapCreateFileReader(const char *filename)
   if (SLAP_PRE_HEADER_SIZE != fread(pFileReader->preHeaderBlock, sizeof(uint64_t), SLAP_PRE_HEADER_SIZE, pFileReader->pFile))
     goto epilogue;
 
+  // Files written before the format version was stored have the start of the header here (and a different header layout).
+  if (pFileReader->preHeaderBlock[SLAP_PRE_HEADER_FORMAT_VERSION_INDEX] != SLAP_FORMAT_VERSION)
+    goto epilogue;
+
   pFileReader->pHeader = slapAlloc(uint64_t, pFileReader->preHeaderBlock[SLAP_PRE_HEADER_HEADER_SIZE_INDEX]);
 
   if (!pFileReader->pHeader)
@@ -976,13 +2047,17 @@ slapFileReader * slapCreateFileReader(const char *filename)
 
   pFileReader->headerOffset = ftell(pFileReader->pFile);
 
-  pFileReader->pDecoder = slapCreateDecoder(pFileReader->preHeaderBlock[SLAP_PRE_HEADER_FRAME_SIZEX_INDEX], pFileReader->preHeaderBlock[SLAP_PRE_HEADER_FRAME_SIZEY_INDEX], pFileReader->preHeaderBlock[SLAP_PRE_HEADER_CODEC_FLAGS_INDEX]);
+  pFileReader->pDecoder = _slapCreateDecoder(pFileReader->preHeaderBlock[SLAP_PRE_HEADER_FRAME_SIZEX_INDEX], pFileReader->preHeaderBlock[SLAP_PRE_HEADER_FRAME_SIZEY_INDEX], pFileReader->preHeaderBlock[SLAP_PRE_HEADER_CODEC_FLAGS_INDEX], pFileReader->preHeaderBlock[SLAP_PRE_HEADER_SUB_FRAME_ROWS_INDEX], pFileReader->preHeaderBlock[SLAP_PRE_HEADER_SUB_FRAME_COLUMNS_INDEX], scaleShift, pThreadPoolHandle);
 
   if (!pFileReader->pDecoder)
     goto epilogue;
 
+  // The low res preview is decoded into the same buffer.
   frameSize = pFileReader->pDecoder->resX * pFileReader->pDecoder->resX * 3 / 2;
 
+  if (scaleShift != SLAP_DECODER_SCALE_FULL)
+    frameSize = (pFileReader->pDecoder->resX >> scaleShift) * (pFileReader->pDecoder->resY >> scaleShift) * 3 / 2;
+
   pFileReader->pDecodedFrameYUV = slapAlloc(uint8_t, frameSize);
 
   if (!pFileReader->pDecodedFrameYUV)
@@ -1046,6 +2121,53 @@ slapResult slapFileReader_GetLowResFrameResolution(IN slapFileReader * pFileRead
   return slapSuccess;
 }
 
+slapResult slapFileReader_GetDecodedFrameResolution(IN slapFileReader *pFileReader, OUT size_t *pResolutionX, OUT size_t *pResolutionY)
+{
+  if (!pFileReader || !pResolutionX || !pResolutionY)
+    return slapError_ArgumentNull;
+
+  *pResolutionX = pFileReader->pDecoder->resX >> pFileReader->pDecoder->scaleShift;
+  *pResolutionY = pFileReader->pDecoder->resY >> pFileReader->pDecoder->scaleShift;
+
+  return slapSuccess;
+}
+
+slapResult slapFileReader_SeekFrame(IN slapFileReader *pFileReader, const size_t frameIndex)
+{
+  slapResult result = slapSuccess;
+  size_t iframeIndex = frameIndex;
+
+  if (!pFileReader)
+  {
+    result = slapError_ArgumentNull;
+    goto epilogue;
+  }
+
+  if (frameIndex >= pFileReader->preHeaderBlock[SLAP_PRE_HEADER_FRAME_COUNT_INDEX])
+  {
+    result = slapError_EndOfStream;
+    goto epilogue;
+  }
+
+  while (iframeIndex > 0 && pFileReader->pHeader[SLAP_HEADER_PER_FRAME_SIZE(pFileReader->pDecoder->subFrameCount) * iframeIndex + SLAP_HEADER_PER_FRAME_FRAME_TYPE_INDEX(pFileReader->pDecoder->subFrameCount)] != SLAP_FRAME_TYPE_IFRAME)
+    iframeIndex--;
+
+  // Continue from the last fully decoded frame if the I-Frame has already been decoded. pFileReader->frameIndex can't be used for this, as it's also advanced by low res reads and by reads that weren't decoded.
+  if (pFileReader->pDecoder->frameIndex <= iframeIndex || pFileReader->pDecoder->frameIndex > frameIndex)
+    pFileReader->pDecoder->frameIndex = iframeIndex;
+
+  pFileReader->frameIndex = pFileReader->pDecoder->frameIndex;
+
+  while (pFileReader->frameIndex < frameIndex)
+  {
+    if ((result = _slapFileReader_ReadNextFrameFull(pFileReader)) != slapSuccess) goto epilogue;
+    if ((result = _slapFileReader_DecodeCurrentFrameFull(pFileReader)) != slapSuccess) goto epilogue;
+  }
+
+epilogue:
+  return result;
+}
+
 slapResult _slapFileReader_ReadNextFrameFull(IN slapFileReader *pFileReader)
 {
   slapResult result = slapSuccess;
@@ -1063,8 +2185,8 @@ slapResult _slapFileReader_ReadNextFrameFull(IN slapFileReader *pFileReader)
     goto epilogue;
   }
 
-  position = pFileReader->pHeader[SLAP_HEADER_PER_FRAME_SIZE * pFileReader->frameIndex + 2 + SLAP_HEADER_FRAME_OFFSET_INDEX] + pFileReader->headerOffset;
-  pFileReader->currentFrameSize = pFileReader->pHeader[SLAP_HEADER_PER_FRAME_SIZE * pFileReader->frameIndex + 2 + SLAP_HEADER_FRAME_DATA_SIZE_INDEX];
+  position = pFileReader->pHeader[SLAP_HEADER_PER_FRAME_SIZE(pFileReader->pDecoder->subFrameCount) * pFileReader->frameIndex + 2 + SLAP_HEADER_FRAME_OFFSET_INDEX] + pFileReader->headerOffset;
+  pFileReader->currentFrameSize = pFileReader->pHeader[SLAP_HEADER_PER_FRAME_SIZE(pFileReader->pDecoder->subFrameCount) * pFileReader->frameIndex + 2 + SLAP_HEADER_FRAME_DATA_SIZE_INDEX];
 
   if (pFileReader->currentFrameAllocatedSize < pFileReader->currentFrameSize)
   {
@@ -1102,8 +2224,13 @@ epilogue:
 size_t _slapDecoderTask_DecodeSubframe(void *pData)
 {
   _slapDecoderSubTaskData0 *pUserData = (_slapDecoderSubTaskData0 *)pData;
+  const uint64_t startTimeUs = _slapGetTimeUs();
 
-  return (size_t)slapDecoder_DecodeSubFrame(pUserData->pDecoder, pUserData->index, pUserData->pDataAddrs, pUserData->pDataSizes, pUserData->pYUVFrame);
+  const slapResult result = slapDecoder_DecodeSubFrame(pUserData->pDecoder, pUserData->index, pUserData->pDataAddrs, pUserData->pDataSizes, pUserData->pYUVFrame);
+
+  pUserData->decodeTimeUs = _slapGetTimeUs() - startTimeUs;
+
+  return (size_t)result;
 }
 
 #endif
@@ -1112,106 +2239,214 @@ size_t _slapDecoderTask_DecodeSubframe(void *pData)
 
 slapResult _slapFileReader_DecodeCurrentFrameFull(IN slapFileReader *pFileReader)
 {
-  slapResult result = slapSuccess;
-  void *dataAddrs[SLAP_SUB_BUFFER_COUNT];
-  size_t dataSizes[SLAP_SUB_BUFFER_COUNT];
-#ifdef SLAP_MULTITHREADED
-  ThreadPool_TaskHandle taskHandle[SLAP_SUB_BUFFER_COUNT];
-  _slapDecoderSubTaskData0 taskData[SLAP_SUB_BUFFER_COUNT];
-#endif
+  return slapFileReader_DecodeCurrentFrameToBuffer(pFileReader, NULL);
+}
 
+slapResult slapFileReader_DecodeCurrentFrameToBuffer(IN slapFileReader *pFileReader, IN const slapOutputBuffer *pOutput)
+{
   if (!pFileReader)
+    return slapError_ArgumentNull;
+
+  const uint64_t *pFrameHeader = pFileReader->pHeader + SLAP_HEADER_PER_FRAME_SIZE(pFileReader->pDecoder->subFrameCount) * (pFileReader->frameIndex - 1);
+
+  return _slapDecoder_DecodeFrame(pFileReader->pDecoder, pFrameHeader, pFileReader->pCurrentFrame, pFileReader->currentFrameSize, pFileReader->pDecodedFrameYUV, pOutput);
+}
+
+slapResult slapDecoder_DecodePacket(IN slapDecoder *pDecoder, IN void *pPacket, const size_t packetSize, IN_OUT void *pYUVData, IN const slapOutputBuffer *pOutput)
+{
+  slapResult result = slapSuccess;
+
+  if (!pDecoder || !pPacket || !pYUVData)
   {
     result = slapError_ArgumentNull;
     goto epilogue;
   }
 
-  for (size_t i = 0; i < SLAP_SUB_BUFFER_COUNT; i++)
+  const size_t subFrameCount = pDecoder->subFrameCount;
+  const size_t headerSize = SLAP_HEADER_PER_FRAME_SIZE(subFrameCount) * sizeof(uint64_t);
+  const uint64_t *pFrameHeader = (const uint64_t *)pPacket;
+
+  if (packetSize < headerSize)
   {
-    dataAddrs[i] = ((uint8_t *)pFileReader->pCurrentFrame) + pFileReader->pHeader[SLAP_HEADER_PER_FRAME_SIZE * (pFileReader->frameIndex - 1) + SLAP_HEADER_PER_FRAME_FULL_FRAME_OFFSET + i * 2 + SLAP_HEADER_FRAME_OFFSET_INDEX];
-    dataSizes[i] = pFileReader->pHeader[SLAP_HEADER_PER_FRAME_SIZE * (pFileReader->frameIndex - 1) + SLAP_HEADER_PER_FRAME_FULL_FRAME_OFFSET + i * 2 + SLAP_HEADER_FRAME_DATA_SIZE_INDEX];
+    result = slapError_Generic;
+    goto epilogue;
   }
 
-  clock_t t = clock();
-
-#ifdef SLAP_MULTITHREADED
+  // The offsets are relative to the end of the header.
+  const uint64_t frameOffset = pFrameHeader[2 + SLAP_HEADER_FRAME_OFFSET_INDEX];
+  const uint64_t frameSize = pFrameHeader[2 + SLAP_HEADER_FRAME_DATA_SIZE_INDEX];
 
-  for (size_t i = 0; i < SLAP_SUB_BUFFER_COUNT; i++)
+  if (frameOffset > packetSize - headerSize || frameSize > packetSize - headerSize - frameOffset)
   {
-    taskData[i].pDataSizes = dataSizes;
-    taskData[i].index = i;
-    taskData[i].pDataAddrs = dataAddrs;
-    taskData[i].pDecoder = pFileReader->pDecoder;
-    taskData[i].pYUVFrame = pFileReader->pDecodedFrameYUV;
-
-    taskHandle[i] = ThreadPool_CreateTask(_slapDecoderTask_DecodeSubframe, (void *)&taskData[i]);
-    ThreadPool_EnqueueTask(pFileReader->pDecoder->pThreadPoolHandle, taskHandle[i]);
+    result = slapError_Generic;
+    goto epilogue;
   }
 
-  for (size_t i = 0; i < SLAP_SUB_BUFFER_COUNT; i++)
-    ThreadPool_JoinTask(taskHandle[i]);
-
-#else
-  for (size_t i = 0; i < SLAP_SUB_BUFFER_COUNT; i++)
-    result = slapDecoder_DecodeSubFrame(pFileReader->pDecoder, i, dataAddrs, dataSizes, pFileReader->pDecodedFrameYUV);
-#endif
-
-  t = clock() - t;
-  printf("Decoding part1: %" PRIi32 " ms | ", t);
-  t = clock();
-
-  result = slapDecoder_FinalizeFrame(pFileReader->pDecoder, pFileReader->pCurrentFrame, pFileReader->currentFrameSize, pFileReader->pDecodedFrameYUV);
+  for (size_t i = 0; i < subFrameCount; i++)
+  {
+    const uint64_t offset = pFrameHeader[SLAP_HEADER_PER_FRAME_FULL_FRAME_OFFSET + i * 2 + SLAP_HEADER_FRAME_OFFSET_INDEX];
+    const uint64_t size = pFrameHeader[SLAP_HEADER_PER_FRAME_FULL_FRAME_OFFSET + i * 2 + SLAP_HEADER_FRAME_DATA_SIZE_INDEX];
 
-  t = clock() - t;
-  printf("Decoding part2: %" PRIi32 " ms \n", t);
+    if (offset > frameSize || size > frameSize - offset)
+    {
+      result = slapError_Generic;
+      goto epilogue;
+    }
+  }
 
-  if (result != slapSuccess)
-    goto epilogue;
+  result = _slapDecoder_DecodeFrame(pDecoder, pFrameHeader, (uint8_t *)pPacket + headerSize + frameOffset, (size_t)frameSize, pYUVData, pOutput);
 
 epilogue:
   return result;
 }
 
-slapResult _slapFileReader_ReadNextFrameLowRes(IN slapFileReader *pFileReader)
+// Decodes the full frame pFrameData (which pFrameHeader, the per frame header, describes) with the thread pool of the decoder.
+slapResult _slapDecoder_DecodeFrame(IN slapDecoder *pDecoder, IN const uint64_t *pFrameHeader, IN void *pFrameData, const size_t frameSize, IN_OUT void *pYUVData, IN const slapOutputBuffer *pOutput)
 {
   slapResult result = slapSuccess;
-  uint64_t position;
+  void **pDataAddrs = NULL;
+  size_t *pDataSizes = NULL;
+#ifdef SLAP_MULTITHREADED
+  ThreadPool_TaskHandle *pTaskHandles = NULL;
+  _slapDecoderSubTaskData0 *pTaskData = NULL;
+  size_t *pOrder = NULL;
+#endif
 
-  if (!pFileReader)
+  const size_t subFrameCount = pDecoder->subFrameCount;
+  uint64_t decodeTimeUs = 0;
+
+  pDataAddrs = slapAlloc(void *, subFrameCount);
+  pDataSizes = slapAlloc(size_t, subFrameCount);
+
+#ifdef SLAP_MULTITHREADED
+  pTaskHandles = slapAlloc(ThreadPool_TaskHandle, subFrameCount);
+  pTaskData = slapAlloc(_slapDecoderSubTaskData0, subFrameCount);
+  pOrder = slapAlloc(size_t, subFrameCount);
+
+  if (!pTaskHandles || !pTaskData || !pOrder)
   {
-    result = slapError_ArgumentNull;
+    result = slapError_MemoryAllocation;
     goto epilogue;
   }
+#endif
 
-  if (pFileReader->frameIndex >= pFileReader->preHeaderBlock[SLAP_PRE_HEADER_FRAME_COUNT_INDEX])
+  if (!pDataAddrs || !pDataSizes)
   {
-    result = slapError_EndOfStream;
+    result = slapError_MemoryAllocation;
     goto epilogue;
   }
 
-  position = pFileReader->pHeader[SLAP_HEADER_PER_FRAME_SIZE * pFileReader->frameIndex + SLAP_HEADER_FRAME_OFFSET_INDEX] + pFileReader->headerOffset;
-  pFileReader->currentFrameSize = pFileReader->pHeader[SLAP_HEADER_PER_FRAME_SIZE * pFileReader->frameIndex + SLAP_HEADER_FRAME_DATA_SIZE_INDEX];
+  for (size_t i = 0; i < subFrameCount; i++)
+  {
+    pDataAddrs[i] = ((uint8_t *)pFrameData) + pFrameHeader[SLAP_HEADER_PER_FRAME_FULL_FRAME_OFFSET + i * 2 + SLAP_HEADER_FRAME_OFFSET_INDEX];
+    pDataSizes[i] = pFrameHeader[SLAP_HEADER_PER_FRAME_FULL_FRAME_OFFSET + i * 2 + SLAP_HEADER_FRAME_DATA_SIZE_INDEX];
+  }
+
+  pDecoder->isIframe = (pFrameHeader[SLAP_HEADER_PER_FRAME_FRAME_TYPE_INDEX(subFrameCount)] == SLAP_FRAME_TYPE_IFRAME);
 
-  if (pFileReader->currentFrameAllocatedSize < pFileReader->currentFrameSize)
+#ifdef SLAP_MULTITHREADED
+
+  // The decoding time of a sub frame is roughly proportional to its compressed size.
+  _slapGetSubFrameOrderByCost(pDataSizes, subFrameCount, pOrder);
+
+  for (size_t i = 0; i < subFrameCount; i++)
   {
-    slapRealloc(&pFileReader->pCurrentFrame, uint8_t, pFileReader->currentFrameSize);
-    pFileReader->currentFrameAllocatedSize = pFileReader->currentFrameSize;
+    const size_t index = pOrder[i];
 
-    if (!pFileReader->pCurrentFrame)
-    {
-      pFileReader->currentFrameAllocatedSize = 0;
-      result = slapError_MemoryAllocation;
-      goto epilogue;
-    }
+    pTaskData[index].pDataSizes = pDataSizes;
+    pTaskData[index].index = index;
+    pTaskData[index].pDataAddrs = pDataAddrs;
+    pTaskData[index].pDecoder = pDecoder;
+    pTaskData[index].pYUVFrame = pYUVData;
+
+    pTaskHandles[index] = ThreadPool_CreateTask(_slapDecoderTask_DecodeSubframe, (void *)&pTaskData[index]);
+    ThreadPool_EnqueueTaskWithKey(pDecoder->pThreadPoolHandle, pTaskHandles[index], pDecoder->taskSchedulingKey);
   }
 
-  if (fseek(pFileReader->pFile, (long)position, SEEK_SET))
+  // All tasks have to be joined before returning, as they reference pTaskData. The first error is returned.
+  for (size_t i = 0; i < subFrameCount; i++)
   {
-    result = slapError_FileError;
-    goto epilogue;
+    const slapResult subFrameResult = (slapResult)ThreadPool_JoinTask(pTaskHandles[i]);
+    ThreadPool_DestroyTask(pTaskHandles[i]);
+
+    decodeTimeUs += pTaskData[i].decodeTimeUs;
+
+    if (result == slapSuccess)
+      result = subFrameResult;
   }
 
-  if (pFileReader->currentFrameSize != fread(pFileReader->pCurrentFrame, 1, pFileReader->currentFrameSize, pFileReader->pFile))
+  if (result != slapSuccess)
+    goto epilogue;
+
+#else
+  const uint64_t subFramesStartTimeUs = _slapGetTimeUs();
+
+  for (size_t i = 0; i < subFrameCount; i++)
+    if ((result = slapDecoder_DecodeSubFrame(pDecoder, i, pDataAddrs, pDataSizes, pYUVData)) != slapSuccess)
+      goto epilogue;
+
+  decodeTimeUs += _slapGetTimeUs() - subFramesStartTimeUs;
+#endif
+
+  const uint64_t finalizeStartTimeUs = _slapGetTimeUs();
+
+  result = slapDecoder_FinalizeFrameToBuffer(pDecoder, pFrameData, frameSize, pYUVData, pOutput);
+
+  decodeTimeUs += _slapGetTimeUs() - finalizeStartTimeUs;
+  pDecoder->lastFrameDecodeTimeUs = decodeTimeUs;
+
+epilogue:
+  slapFreePtr(&pDataAddrs);
+  slapFreePtr(&pDataSizes);
+#ifdef SLAP_MULTITHREADED
+  slapFreePtr(&pTaskHandles);
+  slapFreePtr(&pTaskData);
+  slapFreePtr(&pOrder);
+#endif
+
+  return result;
+}
+
+slapResult _slapFileReader_ReadNextFrameLowRes(IN slapFileReader *pFileReader)
+{
+  slapResult result = slapSuccess;
+  uint64_t position;
+
+  if (!pFileReader)
+  {
+    result = slapError_ArgumentNull;
+    goto epilogue;
+  }
+
+  if (pFileReader->frameIndex >= pFileReader->preHeaderBlock[SLAP_PRE_HEADER_FRAME_COUNT_INDEX])
+  {
+    result = slapError_EndOfStream;
+    goto epilogue;
+  }
+
+  position = pFileReader->pHeader[SLAP_HEADER_PER_FRAME_SIZE(pFileReader->pDecoder->subFrameCount) * pFileReader->frameIndex + SLAP_HEADER_FRAME_OFFSET_INDEX] + pFileReader->headerOffset;
+  pFileReader->currentFrameSize = pFileReader->pHeader[SLAP_HEADER_PER_FRAME_SIZE(pFileReader->pDecoder->subFrameCount) * pFileReader->frameIndex + SLAP_HEADER_FRAME_DATA_SIZE_INDEX];
+
+  if (pFileReader->currentFrameAllocatedSize < pFileReader->currentFrameSize)
+  {
+    slapRealloc(&pFileReader->pCurrentFrame, uint8_t, pFileReader->currentFrameSize);
+    pFileReader->currentFrameAllocatedSize = pFileReader->currentFrameSize;
+
+    if (!pFileReader->pCurrentFrame)
+    {
+      pFileReader->currentFrameAllocatedSize = 0;
+      result = slapError_MemoryAllocation;
+      goto epilogue;
+    }
+  }
+
+  if (fseek(pFileReader->pFile, (long)position, SEEK_SET))
+  {
+    result = slapError_FileError;
+    goto epilogue;
+  }
+
+  if (pFileReader->currentFrameSize != fread(pFileReader->pCurrentFrame, 1, pFileReader->currentFrameSize, pFileReader->pFile))
   {
     result = slapError_FileError;
     goto epilogue;
@@ -1236,18 +2471,9 @@ slapResult _slapFileReader_DecodeCurrentFrameLowRes(IN slapFileReader *pFileRead
   size_t resX, resY;
   slapFileReader_GetLowResFrameResolution(pFileReader, &resX, &resY);
 
-  if (pFileReader->pDecoder->mode.flags.encoder == 0)
-  {
-    if (tjDecompressToYUV2(pFileReader->pDecoder->ppDecoders[0], (unsigned char *)pFileReader->pCurrentFrame, (unsigned long)pFileReader->currentFrameSize, (unsigned char *)pFileReader->pDecodedFrameYUV, (int)resX, 4, (int)resY, TJFLAG_FASTDCT))
-    {
-      slapLog(tjGetErrorStr2(pFileReader->pDecoder->ppDecoders[0]));
-      result = slapError_Compress_Internal;
-      goto epilogue;
-    }
-  }
-
-  pFileReader->pDecoder->frameIndex++;
+  result = _slapGetBackend(pFileReader->pDecoder->mode.flags.encoder)->pDecompressPreview(pFileReader->pDecodedFrameYUV, pFileReader->pCurrentFrame, pFileReader->currentFrameSize, resX, resY, pFileReader->pDecoder->pLowResDecoderInternal);
 
+  // pDecoder->frameIndex isn't advanced, as the last frame hasn't been updated.
   if (result != slapSuccess)
     goto epilogue;
 
@@ -1256,861 +2482,4246 @@ epilogue:
 }
 
 //////////////////////////////////////////////////////////////////////////
-// Core En- & Decoding Functions
+// Stream Container
 //////////////////////////////////////////////////////////////////////////
 
-slapResult _slapCompressChannel(IN void *pData, IN_OUT void **ppCompressedData, IN_OUT size_t *pCompressedDataSize, const size_t width, const size_t height, const int quality, IN void *pCompressor)
+// Live streams quickly grow beyond 2 GiB, which fseek & ftell can't address where long is 32 bit (as with MSVC).
+#ifdef _WIN32
+#define _slapFileSeek64(pFile, offset, origin) _fseeki64(pFile, (__int64)(offset), origin)
+#define _slapFileTell64(pFile) (uint64_t)_ftelli64(pFile)
+#else
+#define _slapFileSeek64(pFile, offset, origin) fseeko(pFile, (off_t)(offset), origin)
+#define _slapFileTell64(pFile) (uint64_t)ftello(pFile)
+#endif
+
+slapStreamWriter * slapCreateStreamWriter(const char *filename, const size_t sizeX, const size_t sizeY, const uint64_t flags, const size_t subFrameRows, const size_t subFrameColumns, const size_t framesPerChunk)
 {
-  unsigned long length = (unsigned long)*pCompressedDataSize;
+  slapStreamWriter *pStreamWriter = NULL;
+  uint64_t preHeader[SLAP_PRE_HEADER_SIZE];
 
-  if (tjCompress2(pCompressor, (unsigned char *)pData, (int)width, (int)width, (int)height, TJPF_GRAY, (unsigned char **)ppCompressedData, &length, TJSAMP_GRAY, quality, TJFLAG_FASTDCT))
-  {
-    slapLog(tjGetErrorStr2(pCompressor));
-    return slapError_Compress_Internal;
-  }
+  if (!filename || framesPerChunk == 0)
+    goto epilogue;
 
-  *pCompressedDataSize = length;
+  pStreamWriter = slapAlloc(slapStreamWriter, 1);
 
-  return slapSuccess;
-}
+  if (!pStreamWriter)
+    goto epilogue;
 
-slapResult _slapCompressYUV420(IN void *pData, IN_OUT void **ppCompressedData, IN_OUT size_t *pCompressedDataSize, const size_t width, const size_t height, const int quality, IN void *pCompressor)
-{
-  unsigned long length = (unsigned long)*pCompressedDataSize;
+  slapSetZero(pStreamWriter, slapStreamWriter);
+  pStreamWriter->framesPerChunk = framesPerChunk;
 
-  if (tjCompressFromYUV(pCompressor, (unsigned char *)pData, (int)width, 32, (int)height, TJSAMP_420, (unsigned char **)ppCompressedData, &length, quality, TJFLAG_FASTDCT))
-  {
-    slapLog(tjGetErrorStr2(pCompressor));
-    return slapError_Compress_Internal;
-  }
+  pStreamWriter->pEncoder = slapCreateEncoderWithSubFrameLayout(sizeX, sizeY, flags, subFrameRows, subFrameColumns);
 
-  *pCompressedDataSize = length;
+  if (!pStreamWriter->pEncoder)
+    goto epilogue;
 
-  return slapSuccess;
+  pStreamWriter->pChunkIndex = slapAlloc(uint64_t, framesPerChunk * 2);
+
+  if (!pStreamWriter->pChunkIndex)
+    goto epilogue;
+
+  pStreamWriter->pFile = fopen(filename, "wb");
+
+  if (!pStreamWriter->pFile)
+    goto epilogue;
+
+  preHeader[SLAP_PRE_HEADER_HEADER_SIZE_INDEX] = SLAP_STREAM_MAGIC;
+  preHeader[SLAP_PRE_HEADER_FRAME_COUNT_INDEX] = 0;
+  preHeader[SLAP_PRE_HEADER_FRAME_SIZEX_INDEX] = (uint64_t)pStreamWriter->pEncoder->resX;
+  preHeader[SLAP_PRE_HEADER_FRAME_SIZEY_INDEX] = (uint64_t)pStreamWriter->pEncoder->resY;
+  preHeader[SLAP_PRE_HEADER_IFRAME_STEP_INDEX] = (uint64_t)pStreamWriter->pEncoder->iframeStep;
+  preHeader[SLAP_PRE_HEADER_CODEC_FLAGS_INDEX] = (uint64_t)pStreamWriter->pEncoder->mode.flagsPack;
+  preHeader[SLAP_PRE_HEADER_SUB_FRAME_ROWS_INDEX] = (uint64_t)pStreamWriter->pEncoder->subFrameRows;
+  preHeader[SLAP_PRE_HEADER_SUB_FRAME_COLUMNS_INDEX] = (uint64_t)pStreamWriter->pEncoder->subFrameColumns;
+  preHeader[SLAP_PRE_HEADER_FORMAT_VERSION_INDEX] = SLAP_FORMAT_VERSION;
+
+  if (SLAP_PRE_HEADER_SIZE != fwrite(preHeader, sizeof(uint64_t), SLAP_PRE_HEADER_SIZE, pStreamWriter->pFile))
+    goto epilogue;
+
+  // Readers can open the stream as soon as the pre header has been written.
+  if (fflush(pStreamWriter->pFile))
+    goto epilogue;
+
+  return pStreamWriter;
+
+epilogue:
+  slapDestroyStreamWriter(&pStreamWriter);
+
+  return NULL;
 }
 
-slapResult _slapDecompressChannel(IN void *pData, IN_OUT void *pCompressedData, const size_t compressedDataSize, const size_t width, const size_t height, IN void *pDecompressor)
+void slapDestroyStreamWriter(IN_OUT slapStreamWriter **ppStreamWriter)
 {
-  if (tjDecompress2(pDecompressor, (unsigned char *)pCompressedData, (unsigned long)compressedDataSize, (unsigned char *)pData, (int)width, (int)width, (int)height, TJPF_GRAY, TJFLAG_FASTDCT))
+  if (ppStreamWriter && *ppStreamWriter)
   {
-    slapLog(tjGetErrorStr2(pDecompressor));
-    return slapError_Compress_Internal;
+    // Write the buffered frames, so that they aren't lost.
+    if ((*ppStreamWriter)->pFile)
+    {
+      slapStreamWriter_Flush(*ppStreamWriter);
+      fclose((*ppStreamWriter)->pFile);
+    }
+
+    slapDestroyEncoder(&(*ppStreamWriter)->pEncoder);
+    slapFreePtr(&(*ppStreamWriter)->pChunkIndex);
+    slapFreePtr(&(*ppStreamWriter)->pChunkData);
   }
 
-  return slapSuccess;
+  slapFreePtr(ppStreamWriter);
 }
 
-slapResult _slapDecompressYUV420(IN void *pData, IN_OUT void *pCompressedData, const size_t compressedDataSize, const size_t width, const size_t height, IN void *pDecompressor)
+slapResult slapStreamWriter_AddFrameYUV420(IN slapStreamWriter *pStreamWriter, IN void *pData)
 {
-  if (tjDecompressToYUV2(pDecompressor, (unsigned char *)pCompressedData, (unsigned long)compressedDataSize, (unsigned char *)pData, (int)width, 32, (int)height, TJFLAG_FASTDCT))
-  {
-    slapLog(tjGetErrorStr2(pDecompressor));
-    return slapError_Compress_Internal;
-  }
+  if (!pData)
+    return slapError_ArgumentNull;
 
-  return slapSuccess;
+  return _slapStreamWriter_AddFrame(pStreamWriter, pData, NULL);
 }
 
-void _slapLastFrameDiffAndStereoDiffAndSubBufferYUV420(IN_OUT void *pLastFrame, IN_OUT void *pData, IN_OUT void *pLowRes, const size_t resX, const size_t resY)
+slapResult slapStreamWriter_AddFrameFromBuffer(IN slapStreamWriter *pStreamWriter, IN const slapInputBuffer *pInput)
 {
-  uint8_t *pMainFrameY = (uint8_t *)pData;
-  uint16_t *pSubFrameYUV = (uint16_t *)pLowRes;
-  __m128i *pLastFrameYUV = (__m128i *)pLastFrame;
+  if (!pInput)
+    return slapError_ArgumentNull;
 
-  size_t resXdiv16 = resX >> 4;
-  size_t halfFrameDiv16Quarter = resXdiv16 * resY >> 3;
+  return _slapStreamWriter_AddFrame(pStreamWriter, NULL, pInput);
+}
 
-  __m128i *pCB0 = (__m128i *)pMainFrameY;
-  __m128i *pCB1 = (__m128i *)pCB0 + 1;
+// Either pData or pInput is used.
+slapResult _slapStreamWriter_AddFrame(IN slapStreamWriter *pStreamWriter, IN void *pData, IN const slapInputBuffer *pInput)
+{
+  slapResult result = slapSuccess;
+  slapFramePacket packet;
 
-  __m128i *pCB0_ = (__m128i *)pMainFrameY + resXdiv16 * (resY >> 1);
-  __m128i *pCB1_ = (__m128i *)pCB0_ + 1;
+  if (!pStreamWriter)
+  {
+    result = slapError_ArgumentNull;
+    goto epilogue;
+  }
 
-  __m128i *pLF0 = (__m128i *)pLastFrameYUV;
-  __m128i *pLF1 = (__m128i *)pLF0 + 1;
+  result = _slapEncoder_EncodeFrame(pStreamWriter->pEncoder, pData, pInput, &packet, NULL);
 
-  __m128i *pLF0_ = (__m128i *)pLastFrameYUV + resXdiv16 * (resY >> 1);
-  __m128i *pLF1_ = (__m128i *)pLF0_ + 1;
+  if (result != slapSuccess)
+    goto epilogue;
 
-  __m128i half = { 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127 };
+  if (pStreamWriter->chunkDataSize + packet.size > pStreamWriter->chunkDataCapacity)
+  {
+    const size_t capacity = (pStreamWriter->chunkDataSize + packet.size) * 2;
 
-#ifdef SLAP_HIGH_QUALITY_DOWNSCALE
-  __m128i shuffle = { 0, 7, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 };
-#endif
+    slapRealloc(&pStreamWriter->pChunkData, uint8_t, capacity);
 
-  const size_t stepSize = 2;
-  size_t itX = resX / (sizeof(__m128i) * stepSize);
-  size_t itY = resY >> 1;
+    if (!pStreamWriter->pChunkData)
+    {
+      pStreamWriter->chunkDataCapacity = 0;
+      pStreamWriter->chunkDataSize = 0;
+      pStreamWriter->chunkFrameCount = 0;
+      result = slapError_MemoryAllocation;
+      goto epilogue;
+    }
 
-  for (size_t i = 0; i < 3; i++)
+    pStreamWriter->chunkDataCapacity = capacity;
+  }
+
+  pStreamWriter->pChunkIndex[pStreamWriter->chunkFrameCount * 2 + SLAP_HEADER_FRAME_OFFSET_INDEX] = pStreamWriter->chunkDataSize;
+  pStreamWriter->pChunkIndex[pStreamWriter->chunkFrameCount * 2 + SLAP_HEADER_FRAME_DATA_SIZE_INDEX] = packet.size;
+
+  for (size_t i = 0; i < packet.chunkCount; i++)
   {
-    for (size_t y = 0; y < itY; y += 8)
-    {
-      for (size_t x = 0; x < itX; x++)
-      {
-        __m128i cb0 = _mm_load_si128(pCB0);
-        __m128i cb1 = _mm_load_si128(pCB1);
-        __m128i cb0_ = _mm_load_si128(pCB0_);
-        __m128i cb1_ = _mm_load_si128(pCB1_);
+    memcpy(pStreamWriter->pChunkData + pStreamWriter->chunkDataSize, packet.pChunks[i].pData, packet.pChunks[i].size);
+    pStreamWriter->chunkDataSize += packet.pChunks[i].size;
+  }
 
-        // SubBuffer
-        {
-#ifdef SLAP_HIGH_QUALITY_DOWNSCALE
-          __m128i v = _mm_shuffle_epi8(cb0, shuffle);
-#else
-          __m128i v = _mm_srli_si128(cb0, 7);
-#endif
-          *pSubFrameYUV = *(uint16_t *)&v;
-          pSubFrameYUV++;
+  pStreamWriter->chunkFrameCount++;
+  pStreamWriter->frameCount++;
 
-#ifdef SLAP_HIGH_QUALITY_DOWNSCALE
-          v = _mm_shuffle_epi8(cb1, shuffle);
-#else
-          v = _mm_srli_si128(cb1, 7);
-#endif
-          *pSubFrameYUV = *(uint16_t *)&v;
-          pSubFrameYUV++;
-        }
+  if (pStreamWriter->chunkFrameCount >= pStreamWriter->framesPerChunk)
+    result = slapStreamWriter_Flush(pStreamWriter);
 
-        __m128i lf0 = _mm_load_si128(pLF0);
-        __m128i lf1 = _mm_load_si128(pLF1);
-        __m128i lf0_ = _mm_load_si128(pLF0_);
-        __m128i lf1_ = _mm_load_si128(pLF1_);
+epilogue:
+  return result;
+}
 
-        // last frame diff
-        cb0 = _mm_add_epi8(_mm_sub_epi8(lf0, cb0), half);
-        cb0_ = _mm_add_epi8(_mm_sub_epi8(lf0_, cb0_), half);
-        cb1 = _mm_add_epi8(_mm_sub_epi8(lf1, cb1), half);
-        cb1_ = _mm_add_epi8(_mm_sub_epi8(lf1_, cb1_), half);
+slapResult slapStreamWriter_Flush(IN slapStreamWriter *pStreamWriter)
+{
+  slapResult result = slapSuccess;
+  uint64_t chunkHeader[SLAP_STREAM_CHUNK_HEADER_SIZE];
 
-        _mm_store_si128(pCB0, cb0);
-        _mm_store_si128(pCB1, cb1);
+  if (!pStreamWriter)
+  {
+    result = slapError_ArgumentNull;
+    goto epilogue;
+  }
 
-        // Stereo diff
-        cb0_ = _mm_add_epi8(_mm_sub_epi8(cb0_, cb0), half);
-        cb1_ = _mm_add_epi8(_mm_sub_epi8(cb1_, cb1), half);
-        _mm_store_si128(pCB0_, cb0_);
-        _mm_store_si128(pCB1_, cb1_);
+  if (pStreamWriter->chunkFrameCount == 0)
+    goto epilogue;
 
-        pCB0 += stepSize;
-        pCB1 += stepSize;
-        pCB0_ += stepSize;
-        pCB1_ += stepSize;
-        pLF0 += stepSize;
-        pLF1 += stepSize;
-        pLF0_ += stepSize;
-        pLF1_ += stepSize;
-      }
+  chunkHeader[SLAP_STREAM_CHUNK_MAGIC_INDEX] = SLAP_STREAM_CHUNK_MAGIC;
+  chunkHeader[SLAP_STREAM_CHUNK_FIRST_FRAME_INDEX] = pStreamWriter->frameCount - pStreamWriter->chunkFrameCount;
+  chunkHeader[SLAP_STREAM_CHUNK_FRAME_COUNT_INDEX] = pStreamWriter->chunkFrameCount;
+  chunkHeader[SLAP_STREAM_CHUNK_DATA_SIZE_INDEX] = pStreamWriter->chunkDataSize;
 
+  if (SLAP_STREAM_CHUNK_HEADER_SIZE != fwrite(chunkHeader, sizeof(uint64_t), SLAP_STREAM_CHUNK_HEADER_SIZE, pStreamWriter->pFile))
+  {
+    result = slapError_FileError;
+    goto epilogue;
+  }
 
-      for (size_t k = 0; k < 7; k++)
-      {
-        for (size_t x = 0; x < itX; x++)
-        {
-          __m128i cb0 = _mm_load_si128(pCB0);
-          __m128i cb1 = _mm_load_si128(pCB1);
-          __m128i cb0_ = _mm_load_si128(pCB0_);
-          __m128i cb1_ = _mm_load_si128(pCB1_);
-          __m128i lf0 = _mm_load_si128(pLF0);
-          __m128i lf1 = _mm_load_si128(pLF1);
-          __m128i lf0_ = _mm_load_si128(pLF0_);
-          __m128i lf1_ = _mm_load_si128(pLF1_);
+  if (pStreamWriter->chunkFrameCount * 2 != fwrite(pStreamWriter->pChunkIndex, sizeof(uint64_t), pStreamWriter->chunkFrameCount * 2, pStreamWriter->pFile))
+  {
+    result = slapError_FileError;
+    goto epilogue;
+  }
 
-          // last frame diff
-          cb0 = _mm_add_epi8(_mm_sub_epi8(lf0, cb0), half);
-          cb0_ = _mm_add_epi8(_mm_sub_epi8(lf0_, cb0_), half);
-          cb1 = _mm_add_epi8(_mm_sub_epi8(lf1, cb1), half);
-          cb1_ = _mm_add_epi8(_mm_sub_epi8(lf1_, cb1_), half);
+  if (pStreamWriter->chunkDataSize != fwrite(pStreamWriter->pChunkData, 1, pStreamWriter->chunkDataSize, pStreamWriter->pFile))
+  {
+    result = slapError_FileError;
+    goto epilogue;
+  }
 
-          _mm_store_si128(pCB0, cb0);
-          _mm_store_si128(pCB1, cb1);
+  if (fflush(pStreamWriter->pFile))
+  {
+    result = slapError_FileError;
+    goto epilogue;
+  }
 
-          // Stereo diff
-          cb0_ = _mm_add_epi8(_mm_sub_epi8(cb0_, cb0), half);
-          cb1_ = _mm_add_epi8(_mm_sub_epi8(cb1_, cb1), half);
-          _mm_store_si128(pCB0_, cb0_);
-          _mm_store_si128(pCB1_, cb1_);
+  pStreamWriter->chunkFrameCount = 0;
+  pStreamWriter->chunkDataSize = 0;
 
-          pCB0 += stepSize;
-          pCB1 += stepSize;
-          pCB0_ += stepSize;
-          pCB1_ += stepSize;
-          pLF0 += stepSize;
-          pLF1 += stepSize;
-          pLF0_ += stepSize;
-          pLF1_ += stepSize;
-        }
-      }
-    }
+epilogue:
+  return result;
+}
 
-    if (i == 0)
+slapStreamReader * slapCreateStreamReader(const char *filename)
+{
+  slapStreamReader *pStreamReader = NULL;
+
+  if (!filename)
+    goto epilogue;
+
+  pStreamReader = slapAlloc(slapStreamReader, 1);
+
+  if (!pStreamReader)
+    goto epilogue;
+
+  slapSetZero(pStreamReader, slapStreamReader);
+
+  pStreamReader->pFile = fopen(filename, "rb");
+
+  if (!pStreamReader->pFile)
+    goto epilogue;
+
+  if (SLAP_PRE_HEADER_SIZE != fread(pStreamReader->preHeaderBlock, sizeof(uint64_t), SLAP_PRE_HEADER_SIZE, pStreamReader->pFile))
+    goto epilogue;
+
+  if (pStreamReader->preHeaderBlock[SLAP_PRE_HEADER_HEADER_SIZE_INDEX] != SLAP_STREAM_MAGIC || pStreamReader->preHeaderBlock[SLAP_PRE_HEADER_FORMAT_VERSION_INDEX] != SLAP_FORMAT_VERSION)
+    goto epilogue;
+
+  pStreamReader->pDecoder = slapCreateDecoderWithSubFrameLayout(pStreamReader->preHeaderBlock[SLAP_PRE_HEADER_FRAME_SIZEX_INDEX], pStreamReader->preHeaderBlock[SLAP_PRE_HEADER_FRAME_SIZEY_INDEX], pStreamReader->preHeaderBlock[SLAP_PRE_HEADER_CODEC_FLAGS_INDEX], pStreamReader->preHeaderBlock[SLAP_PRE_HEADER_SUB_FRAME_ROWS_INDEX], pStreamReader->preHeaderBlock[SLAP_PRE_HEADER_SUB_FRAME_COLUMNS_INDEX]);
+
+  if (!pStreamReader->pDecoder)
+    goto epilogue;
+
+  pStreamReader->pDecodedFrameYUV = slapAlloc(uint8_t, pStreamReader->pDecoder->resX * pStreamReader->pDecoder->resY * 3 / 2);
+
+  if (!pStreamReader->pDecodedFrameYUV)
+    goto epilogue;
+
+  pStreamReader->nextChunkPosition = SLAP_PRE_HEADER_SIZE * sizeof(uint64_t);
+
+  return pStreamReader;
+
+epilogue:
+  slapDestroyStreamReader(&pStreamReader);
+
+  return NULL;
+}
+
+void slapDestroyStreamReader(IN_OUT slapStreamReader **ppStreamReader)
+{
+  if (ppStreamReader && *ppStreamReader)
+  {
+    slapFreePtr(&(*ppStreamReader)->pChunk);
+    slapFreePtr(&(*ppStreamReader)->pDecodedFrameYUV);
+
+    if ((*ppStreamReader)->pDecoder)
+      slapDestroyDecoder(&(*ppStreamReader)->pDecoder);
+
+    if ((*ppStreamReader)->pFile)
+      fclose((*ppStreamReader)->pFile);
+  }
+
+  slapFreePtr(ppStreamReader);
+}
+
+slapResult slapStreamReader_ReadNextFrame(IN slapStreamReader *pStreamReader)
+{
+  slapResult result = slapSuccess;
+
+  if (!pStreamReader)
+  {
+    result = slapError_ArgumentNull;
+    goto epilogue;
+  }
+
+  if (pStreamReader->chunkFrameIndex >= pStreamReader->chunkHeader[SLAP_STREAM_CHUNK_FRAME_COUNT_INDEX])
+  {
+    result = _slapStreamReader_ReadNextChunk(pStreamReader);
+
+    if (result != slapSuccess)
+      goto epilogue;
+  }
+
+  const uint64_t *pIndex = (const uint64_t *)pStreamReader->pChunk;
+  const size_t indexSize = pStreamReader->chunkHeader[SLAP_STREAM_CHUNK_FRAME_COUNT_INDEX] * 2 * sizeof(uint64_t);
+
+  pStreamReader->pCurrentFrame = pStreamReader->pChunk + indexSize + pIndex[pStreamReader->chunkFrameIndex * 2 + SLAP_HEADER_FRAME_OFFSET_INDEX];
+  pStreamReader->currentFrameSize = pIndex[pStreamReader->chunkFrameIndex * 2 + SLAP_HEADER_FRAME_DATA_SIZE_INDEX];
+
+  pStreamReader->chunkFrameIndex++;
+  pStreamReader->frameIndex++;
+
+epilogue:
+  return result;
+}
+
+// Reads the chunk at nextChunkPosition, if it has been written completely.
+slapResult _slapStreamReader_ReadNextChunk(IN slapStreamReader *pStreamReader)
+{
+  slapResult result = slapSuccess;
+  uint64_t chunkHeader[SLAP_STREAM_CHUNK_HEADER_SIZE];
+
+  // The writer may have appended to the file since the end of the file has been reached.
+  clearerr(pStreamReader->pFile);
+
+  if (_slapFileSeek64(pStreamReader->pFile, 0, SEEK_END))
+  {
+    result = slapError_FileError;
+    goto epilogue;
+  }
+
+  const uint64_t fileSize = _slapFileTell64(pStreamReader->pFile);
+
+  if (fileSize < pStreamReader->nextChunkPosition + sizeof(chunkHeader))
+  {
+    result = slapError_EndOfStream;
+    goto epilogue;
+  }
+
+  if (_slapFileSeek64(pStreamReader->pFile, pStreamReader->nextChunkPosition, SEEK_SET))
+  {
+    result = slapError_FileError;
+    goto epilogue;
+  }
+
+  if (SLAP_STREAM_CHUNK_HEADER_SIZE != fread(chunkHeader, sizeof(uint64_t), SLAP_STREAM_CHUNK_HEADER_SIZE, pStreamReader->pFile))
+  {
+    result = slapError_FileError;
+    goto epilogue;
+  }
+
+  if (chunkHeader[SLAP_STREAM_CHUNK_MAGIC_INDEX] != SLAP_STREAM_CHUNK_MAGIC || chunkHeader[SLAP_STREAM_CHUNK_FRAME_COUNT_INDEX] == 0 || chunkHeader[SLAP_STREAM_CHUNK_FIRST_FRAME_INDEX] != pStreamReader->frameIndex)
+  {
+    result = slapError_FileError;
+    goto epilogue;
+  }
+
+  const uint64_t indexSize = chunkHeader[SLAP_STREAM_CHUNK_FRAME_COUNT_INDEX] * 2 * sizeof(uint64_t);
+  const uint64_t chunkSize = indexSize + chunkHeader[SLAP_STREAM_CHUNK_DATA_SIZE_INDEX];
+
+  // The chunk is still being written.
+  if (fileSize - pStreamReader->nextChunkPosition - sizeof(chunkHeader) < chunkSize)
+  {
+    result = slapError_EndOfStream;
+    goto epilogue;
+  }
+
+  if (pStreamReader->chunkCapacity < chunkSize)
+  {
+    slapRealloc(&pStreamReader->pChunk, uint8_t, chunkSize);
+    pStreamReader->chunkCapacity = (size_t)chunkSize;
+
+    if (!pStreamReader->pChunk)
     {
-      itX >>= 1;
-      itY >>= 1;
+      pStreamReader->chunkCapacity = 0;
+      result = slapError_MemoryAllocation;
+      goto epilogue;
     }
+  }
 
-    pCB0 = pCB0_;
-    pCB1 = pCB1_;
-    pCB0_ += halfFrameDiv16Quarter;
-    pCB1_ = pCB0_ + 1;
-    pLF0 = pLF0_;
-    pLF1 = pLF1_;
-    pLF0_ += halfFrameDiv16Quarter;
-    pLF1_ = pLF0_ + 1;
+  if (chunkSize != fread(pStreamReader->pChunk, 1, (size_t)chunkSize, pStreamReader->pFile))
+  {
+    result = slapError_FileError;
+    goto epilogue;
+  }
+
+  const uint64_t *pIndex = (const uint64_t *)pStreamReader->pChunk;
+
+  for (size_t i = 0; i < chunkHeader[SLAP_STREAM_CHUNK_FRAME_COUNT_INDEX]; i++)
+  {
+    const uint64_t offset = pIndex[i * 2 + SLAP_HEADER_FRAME_OFFSET_INDEX];
+    const uint64_t size = pIndex[i * 2 + SLAP_HEADER_FRAME_DATA_SIZE_INDEX];
+
+    if (offset > chunkHeader[SLAP_STREAM_CHUNK_DATA_SIZE_INDEX] || size > chunkHeader[SLAP_STREAM_CHUNK_DATA_SIZE_INDEX] - offset)
+    {
+      result = slapError_FileError;
+      goto epilogue;
+    }
   }
+
+  memcpy(pStreamReader->chunkHeader, chunkHeader, sizeof(chunkHeader));
+  pStreamReader->chunkFrameIndex = 0;
+  pStreamReader->nextChunkPosition += sizeof(chunkHeader) + chunkSize;
+
+epilogue:
+  return result;
 }
 
-void _slapCopyToLastFrameAndGenSubBufferAndStereoDiffYUV420(IN_OUT void *pData, OUT void *pLowResData, OUT void *pLastFrame, const size_t resX, const size_t resY)
+slapResult slapStreamReader_DecodeCurrentFrame(IN slapStreamReader *pStreamReader, IN const slapOutputBuffer *pOutput)
 {
-  uint8_t *pMainFrameY = (uint8_t *)pData;
-  uint16_t *pSubFrameYUV = (uint16_t *)pLowResData;
-  __m128i *pLastFrameYUV = (__m128i *)pLastFrame;
+  if (!pStreamReader || !pStreamReader->pCurrentFrame)
+    return slapError_ArgumentNull;
 
-#define GREATER_OR_EQUAL_TO_6_BLOCKS
-#define GREATER_OR_EQUAL_TO_8_BLOCKS
+  return slapDecoder_DecodePacket(pStreamReader->pDecoder, pStreamReader->pCurrentFrame, pStreamReader->currentFrameSize, pStreamReader->pDecodedFrameYUV, pOutput);
+}
 
-  size_t resXdiv16 = resX >> 4;
-  size_t halfFrameDiv16Quarter = resXdiv16 * resY >> 3;
+//////////////////////////////////////////////////////////////////////////
+// Shared Memory Ring
+//////////////////////////////////////////////////////////////////////////
 
-  __m128i *pCB0 = (__m128i *)pMainFrameY;
-  __m128i *pCB1 = pCB0 + 1;
-#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
-  __m128i *pCB2 = pCB0 + 2;
-#endif
-#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
-  __m128i *pCB3 = pCB0 + 3;
+// The layout of the shared memory of slapSharedRingWriter & slapSharedRingReader (followed by the data). The positions are the total amount of bytes written / read, the data is at position % capacity.
+typedef struct _slapSharedRing
+{
+  volatile uint64_t magic; // written last, once the ring has been initialized.
+  uint64_t preHeaderBlock[SLAP_PRE_HEADER_SIZE];
+  uint64_t capacity;
+  uint64_t padding0[6];
+
+  // The positions are in separate cache lines, as they're written by different processes.
+  volatile uint64_t writePosition;
+  uint64_t padding1[7];
+  volatile uint64_t readPosition;
+  uint64_t padding2[7];
+} _slapSharedRing;
+
+#define SLAP_SHARED_RING_RECORD_HEADER_SIZE (sizeof(uint64_t) * 2)
+
+// x86 doesn't reorder stores with other stores or loads with other loads, so only the compiler has to be prevented from reordering the data & position accesses.
+#ifdef _MSC_VER
+#define _slapCompilerBarrier() _ReadWriteBarrier()
+#else
+#define _slapCompilerBarrier() __asm__ __volatile__("" ::: "memory")
 #endif
 
-  __m128i *pCB0_ = (__m128i *)pMainFrameY + resXdiv16 * (resY >> 1);
-  __m128i *pCB1_ = pCB0_ + 1;
-#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
-  __m128i *pCB2_ = pCB0_ + 2;
-#endif
-#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
-  __m128i *pCB3_ = pCB0_ + 3;
-#endif
+void * _slapMapSharedMemory(const char *name, IN_OUT size_t *pSize, const bool_t create, OUT void **ppHandle)
+{
+  void *pMemory = NULL;
 
-  __m128i *pLF0 = (__m128i *)pLastFrameYUV;
-  __m128i *pLF1 = pLF0 + 1;
-#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
-  __m128i *pLF2 = pLF0 + 2;
-#endif
-#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
-  __m128i *pLF3 = pLF0 + 3;
-#endif
+#ifdef _WIN32
+  HANDLE handle;
 
-  __m128i *pLF0_ = (__m128i *)pLastFrameYUV + resXdiv16 * (resY >> 1);
-  __m128i *pLF1_ = pLF0_ + 1;
-#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
-  __m128i *pLF2_ = pLF0_ + 2;
-#endif
-#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
-  __m128i *pLF3_ = pLF0_ + 3;
-#endif
+  if (create)
+    handle = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, (DWORD)((uint64_t)*pSize >> 32), (DWORD)*pSize, name);
+  else
+    handle = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, name);
 
-    __m128i half = { 118, 118, 118, 118, 118, 118, 118, 118, 118, 118, 118, 118, 118, 118, 118, 118 };
+  if (!handle)
+    goto epilogue;
 
-#ifdef SLAP_HIGH_QUALITY_DOWNSCALE
-  __m128i shuffle = { 0, 7, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 };
-#endif
+  pMemory = MapViewOfFile(handle, FILE_MAP_ALL_ACCESS, 0, 0, create ? *pSize : 0);
 
-#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
-  const size_t stepSize = 4;
-#else
-#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
-  const size_t stepSize = 3;
+  if (!pMemory)
+  {
+    CloseHandle(handle);
+    goto epilogue;
+  }
+
+  if (!create)
+  {
+    MEMORY_BASIC_INFORMATION info;
+
+    if (!VirtualQuery(pMemory, &info, sizeof(info)))
+    {
+      UnmapViewOfFile(pMemory);
+      CloseHandle(handle);
+      pMemory = NULL;
+      goto epilogue;
+    }
+
+    *pSize = info.RegionSize;
+  }
+
+  *ppHandle = (void *)handle;
 #else
-  const size_t stepSize = 2;
-#endif
-#endif
+  const int fileDescriptor = shm_open(name, create ? (O_CREAT | O_RDWR | O_TRUNC) : O_RDWR, 0600);
 
-  size_t itX = resX / (sizeof(__m128i) * stepSize);
-  size_t itY = resY >> 1;
+  if (fileDescriptor < 0)
+    goto epilogue;
 
-  for (size_t i = 0; i < 3; i++)
+  if (create)
   {
-    for (size_t y = 0; y < itY; y += 8)
+    if (ftruncate(fileDescriptor, (off_t)*pSize))
     {
-      for (size_t x = 0; x < itX; x++)
-      {
-        __m128i cb0 = _mm_load_si128(pCB0);
-        __m128i cb1 = _mm_load_si128(pCB1);
-#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
-        __m128i cb2 = _mm_load_si128(pCB2);
-#endif
-#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
-        __m128i cb3 = _mm_load_si128(pCB3);
-#endif
+      close(fileDescriptor);
+      goto epilogue;
+    }
+  }
+  else
+  {
+    struct stat info;
 
-        // SubBuffer
-        {
-#ifdef SLAP_HIGH_QUALITY_DOWNSCALE
-          __m128i v = _mm_shuffle_epi8(cb0, shuffle);
-#else
-          __m128i v = _mm_srli_si128(cb0, 7);
+    if (fstat(fileDescriptor, &info))
+    {
+      close(fileDescriptor);
+      goto epilogue;
+    }
+
+    *pSize = (size_t)info.st_size;
+  }
+
+  pMemory = mmap(NULL, *pSize, PROT_READ | PROT_WRITE, MAP_SHARED, fileDescriptor, 0);
+
+  if (pMemory == MAP_FAILED)
+  {
+    close(fileDescriptor);
+    pMemory = NULL;
+    goto epilogue;
+  }
+
+  *ppHandle = (void *)(intptr_t)fileDescriptor;
 #endif
-          *pSubFrameYUV = *(uint16_t *)&v;
-          pSubFrameYUV++;
 
-#ifdef SLAP_HIGH_QUALITY_DOWNSCALE
-          v = _mm_shuffle_epi8(cb1, shuffle);
+epilogue:
+  return pMemory;
+}
+
+void _slapUnmapSharedMemory(IN void *pMemory, const size_t size, IN void *pHandle)
+{
+#ifdef _WIN32
+  (void)size;
+
+  UnmapViewOfFile(pMemory);
+  CloseHandle((HANDLE)pHandle);
 #else
-          v = _mm_srli_si128(cb1, 7);
+  munmap(pMemory, size);
+  close((int)(intptr_t)pHandle);
 #endif
-          *pSubFrameYUV = *(uint16_t *)&v;
-          pSubFrameYUV++;
+}
 
-#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
-#ifdef SLAP_HIGH_QUALITY_DOWNSCALE
-          v = _mm_shuffle_epi8(cb2, shuffle);
+// Writes (or reads) size bytes at position, wrapping around at the end of the ring.
+void _slapSharedRing_Write(IN_OUT _slapSharedRing *pRing, const uint64_t position, IN const void *pData, const size_t size)
+{
+  uint8_t *pRingData = (uint8_t *)(pRing + 1);
+  const size_t offset = (size_t)(position % pRing->capacity);
+  const size_t firstPart = (size < pRing->capacity - offset) ? size : (size_t)(pRing->capacity - offset);
+
+  memcpy(pRingData + offset, pData, firstPart);
+  memcpy(pRingData, (const uint8_t *)pData + firstPart, size - firstPart);
+}
+
+void _slapSharedRing_Read(IN _slapSharedRing *pRing, const uint64_t position, OUT void *pData, const size_t size)
+{
+  const uint8_t *pRingData = (const uint8_t *)(pRing + 1);
+  const size_t offset = (size_t)(position % pRing->capacity);
+  const size_t firstPart = (size < pRing->capacity - offset) ? size : (size_t)(pRing->capacity - offset);
+
+  memcpy(pData, pRingData + offset, firstPart);
+  memcpy((uint8_t *)pData + firstPart, pRingData, size - firstPart);
+}
+
+slapSharedRingWriter * slapCreateSharedRingWriter(const char *name, const size_t capacity, const size_t sizeX, const size_t sizeY, const uint64_t flags, const size_t subFrameRows, const size_t subFrameColumns)
+{
+  slapSharedRingWriter *pSharedRingWriter = NULL;
+
+  if (!name || capacity == 0)
+    goto epilogue;
+
+  pSharedRingWriter = slapAlloc(slapSharedRingWriter, 1);
+
+  if (!pSharedRingWriter)
+    goto epilogue;
+
+  slapSetZero(pSharedRingWriter, slapSharedRingWriter);
+  slapStrCpy(pSharedRingWriter->name, name);
+
+  if (!pSharedRingWriter->name)
+    goto epilogue;
+
+  pSharedRingWriter->pEncoder = slapCreateEncoderWithSubFrameLayout(sizeX, sizeY, flags, subFrameRows, subFrameColumns);
+
+  if (!pSharedRingWriter->pEncoder)
+    goto epilogue;
+
+  // Records are padded to 8 bytes.
+  const size_t ringCapacity = (capacity + 7) & ~(size_t)7;
+
+  pSharedRingWriter->sharedMemorySize = sizeof(_slapSharedRing) + ringCapacity;
+  pSharedRingWriter->pRing = _slapMapSharedMemory(name, &pSharedRingWriter->sharedMemorySize, 1, &pSharedRingWriter->pSharedMemoryHandle);
+
+  if (!pSharedRingWriter->pRing)
+    goto epilogue;
+
+  _slapSharedRing *pRing = (_slapSharedRing *)pSharedRingWriter->pRing;
+
+  pRing->magic = 0;
+  pRing->preHeaderBlock[SLAP_PRE_HEADER_HEADER_SIZE_INDEX] = 0;
+  pRing->preHeaderBlock[SLAP_PRE_HEADER_FRAME_COUNT_INDEX] = 0;
+  pRing->preHeaderBlock[SLAP_PRE_HEADER_FRAME_SIZEX_INDEX] = (uint64_t)pSharedRingWriter->pEncoder->resX;
+  pRing->preHeaderBlock[SLAP_PRE_HEADER_FRAME_SIZEY_INDEX] = (uint64_t)pSharedRingWriter->pEncoder->resY;
+  pRing->preHeaderBlock[SLAP_PRE_HEADER_IFRAME_STEP_INDEX] = (uint64_t)pSharedRingWriter->pEncoder->iframeStep;
+  pRing->preHeaderBlock[SLAP_PRE_HEADER_CODEC_FLAGS_INDEX] = (uint64_t)pSharedRingWriter->pEncoder->mode.flagsPack;
+  pRing->preHeaderBlock[SLAP_PRE_HEADER_SUB_FRAME_ROWS_INDEX] = (uint64_t)pSharedRingWriter->pEncoder->subFrameRows;
+  pRing->preHeaderBlock[SLAP_PRE_HEADER_SUB_FRAME_COLUMNS_INDEX] = (uint64_t)pSharedRingWriter->pEncoder->subFrameColumns;
+  pRing->preHeaderBlock[SLAP_PRE_HEADER_FORMAT_VERSION_INDEX] = SLAP_FORMAT_VERSION;
+  pRing->capacity = ringCapacity;
+  pRing->writePosition = 0;
+  pRing->readPosition = 0;
+
+  _slapCompilerBarrier();
+  pRing->magic = SLAP_SHARED_RING_MAGIC;
+
+  return pSharedRingWriter;
+
+epilogue:
+  slapDestroySharedRingWriter(&pSharedRingWriter);
+
+  return NULL;
+}
+
+void slapDestroySharedRingWriter(IN_OUT slapSharedRingWriter **ppSharedRingWriter)
+{
+  if (ppSharedRingWriter && *ppSharedRingWriter)
+  {
+    slapDestroyEncoder(&(*ppSharedRingWriter)->pEncoder);
+
+    if ((*ppSharedRingWriter)->pRing)
+    {
+      _slapUnmapSharedMemory((*ppSharedRingWriter)->pRing, (*ppSharedRingWriter)->sharedMemorySize, (*ppSharedRingWriter)->pSharedMemoryHandle);
+
+#ifndef _WIN32
+      // Named file mappings are released with their last handle, POSIX shared memory has to be removed explicitly.
+      shm_unlink((*ppSharedRingWriter)->name);
+#endif
+    }
+
+    if ((*ppSharedRingWriter)->name)
+      free((*ppSharedRingWriter)->name);
+  }
+
+  slapFreePtr(ppSharedRingWriter);
+}
+
+slapResult slapSharedRingWriter_AddFrameYUV420(IN slapSharedRingWriter *pSharedRingWriter, IN void *pData)
+{
+  if (!pData)
+    return slapError_ArgumentNull;
+
+  return _slapSharedRingWriter_AddFrame(pSharedRingWriter, pData, NULL);
+}
+
+slapResult slapSharedRingWriter_AddFrameFromBuffer(IN slapSharedRingWriter *pSharedRingWriter, IN const slapInputBuffer *pInput)
+{
+  if (!pInput)
+    return slapError_ArgumentNull;
+
+  return _slapSharedRingWriter_AddFrame(pSharedRingWriter, NULL, pInput);
+}
+
+// Either pData or pInput is used.
+slapResult _slapSharedRingWriter_AddFrame(IN slapSharedRingWriter *pSharedRingWriter, IN void *pData, IN const slapInputBuffer *pInput)
+{
+  slapResult result = slapSuccess;
+  slapFramePacket packet;
+
+  if (!pSharedRingWriter)
+  {
+    result = slapError_ArgumentNull;
+    goto epilogue;
+  }
+
+  _slapSharedRing *pRing = (_slapSharedRing *)pSharedRingWriter->pRing;
+
+  result = _slapEncoder_EncodeFrame(pSharedRingWriter->pEncoder, pData, pInput, &packet, NULL);
+
+  if (result != slapSuccess)
+    goto epilogue;
+
+  const uint64_t recordSize = SLAP_SHARED_RING_RECORD_HEADER_SIZE + ((packet.size + 7) & ~(uint64_t)7);
+  const uint64_t writePosition = pRing->writePosition;
+  const uint64_t readPosition = pRing->readPosition;
+
+  if (recordSize > pRing->capacity - (writePosition - readPosition))
+  {
+    pSharedRingWriter->droppedFrameCount++;
+
+    // The frames after this one can't be decoded until the next I-Frame.
+    pSharedRingWriter->pEncoder->lastIframeIndex = pSharedRingWriter->pEncoder->frameIndex - pSharedRingWriter->pEncoder->iframeStep;
+
+    result = slapError_FrameDropped;
+    goto epilogue;
+  }
+
+  const uint64_t recordHeader[2] = { packet.size, packet.frameIndex };
+  uint64_t position = writePosition;
+
+  _slapSharedRing_Write(pRing, position, recordHeader, sizeof(recordHeader));
+  position += sizeof(recordHeader);
+
+  for (size_t i = 0; i < packet.chunkCount; i++)
+  {
+    _slapSharedRing_Write(pRing, position, packet.pChunks[i].pData, packet.pChunks[i].size);
+    position += packet.pChunks[i].size;
+  }
+
+  // The record has to be written before the reader can see it.
+  _slapCompilerBarrier();
+  pRing->writePosition = writePosition + recordSize;
+
+epilogue:
+  return result;
+}
+
+slapSharedRingReader * slapCreateSharedRingReader(const char *name)
+{
+  slapSharedRingReader *pSharedRingReader = NULL;
+
+  if (!name)
+    goto epilogue;
+
+  pSharedRingReader = slapAlloc(slapSharedRingReader, 1);
+
+  if (!pSharedRingReader)
+    goto epilogue;
+
+  slapSetZero(pSharedRingReader, slapSharedRingReader);
+
+  pSharedRingReader->pRing = _slapMapSharedMemory(name, &pSharedRingReader->sharedMemorySize, 0, &pSharedRingReader->pSharedMemoryHandle);
+
+  if (!pSharedRingReader->pRing)
+    goto epilogue;
+
+  _slapSharedRing *pRing = (_slapSharedRing *)pSharedRingReader->pRing;
+
+  if (pSharedRingReader->sharedMemorySize < sizeof(_slapSharedRing) || pRing->magic != SLAP_SHARED_RING_MAGIC)
+    goto epilogue;
+
+  _slapCompilerBarrier();
+
+  if (pRing->capacity > pSharedRingReader->sharedMemorySize - sizeof(_slapSharedRing) || pRing->preHeaderBlock[SLAP_PRE_HEADER_FORMAT_VERSION_INDEX] != SLAP_FORMAT_VERSION)
+    goto epilogue;
+
+  pSharedRingReader->pDecoder = slapCreateDecoderWithSubFrameLayout(pRing->preHeaderBlock[SLAP_PRE_HEADER_FRAME_SIZEX_INDEX], pRing->preHeaderBlock[SLAP_PRE_HEADER_FRAME_SIZEY_INDEX], pRing->preHeaderBlock[SLAP_PRE_HEADER_CODEC_FLAGS_INDEX], pRing->preHeaderBlock[SLAP_PRE_HEADER_SUB_FRAME_ROWS_INDEX], pRing->preHeaderBlock[SLAP_PRE_HEADER_SUB_FRAME_COLUMNS_INDEX]);
+
+  if (!pSharedRingReader->pDecoder)
+    goto epilogue;
+
+  pSharedRingReader->pDecodedFrameYUV = slapAlloc(uint8_t, pSharedRingReader->pDecoder->resX * pSharedRingReader->pDecoder->resY * 3 / 2);
+
+  if (!pSharedRingReader->pDecodedFrameYUV)
+    goto epilogue;
+
+  // Old frames are skipped, decoding starts at the next I-Frame.
+  pRing->readPosition = pRing->writePosition;
+
+  return pSharedRingReader;
+
+epilogue:
+  slapDestroySharedRingReader(&pSharedRingReader);
+
+  return NULL;
+}
+
+void slapDestroySharedRingReader(IN_OUT slapSharedRingReader **ppSharedRingReader)
+{
+  if (ppSharedRingReader && *ppSharedRingReader)
+  {
+    if ((*ppSharedRingReader)->pRing)
+      _slapUnmapSharedMemory((*ppSharedRingReader)->pRing, (*ppSharedRingReader)->sharedMemorySize, (*ppSharedRingReader)->pSharedMemoryHandle);
+
+    if ((*ppSharedRingReader)->pDecoder)
+      slapDestroyDecoder(&(*ppSharedRingReader)->pDecoder);
+
+    slapFreePtr(&(*ppSharedRingReader)->pDecodedFrameYUV);
+    slapFreePtr(&(*ppSharedRingReader)->pCurrentFrame);
+  }
+
+  slapFreePtr(ppSharedRingReader);
+}
+
+slapResult slapSharedRingReader_ReadNextFrame(IN slapSharedRingReader *pSharedRingReader)
+{
+  slapResult result = slapSuccess;
+
+  if (!pSharedRingReader)
+  {
+    result = slapError_ArgumentNull;
+    goto epilogue;
+  }
+
+  _slapSharedRing *pRing = (_slapSharedRing *)pSharedRingReader->pRing;
+  const size_t subFrameCount = pSharedRingReader->pDecoder->subFrameCount;
+
+  while (1)
+  {
+    const uint64_t readPosition = pRing->readPosition;
+    const uint64_t writePosition = pRing->writePosition;
+
+    // The record can't be read before the write position.
+    _slapCompilerBarrier();
+
+    if (readPosition == writePosition)
+    {
+      result = slapError_EndOfStream;
+      goto epilogue;
+    }
+
+    uint64_t recordHeader[2];
+    _slapSharedRing_Read(pRing, readPosition, recordHeader, sizeof(recordHeader));
+
+    const uint64_t recordSize = SLAP_SHARED_RING_RECORD_HEADER_SIZE + ((recordHeader[0] + 7) & ~(uint64_t)7);
+
+    if (recordSize > writePosition - readPosition || recordHeader[0] < SLAP_HEADER_PER_FRAME_SIZE(subFrameCount) * sizeof(uint64_t))
+    {
+      result = slapError_Generic;
+      goto epilogue;
+    }
+
+    if (pSharedRingReader->currentFrameCapacity < recordHeader[0])
+    {
+      slapRealloc(&pSharedRingReader->pCurrentFrame, uint8_t, recordHeader[0]);
+      pSharedRingReader->currentFrameCapacity = (size_t)recordHeader[0];
+
+      if (!pSharedRingReader->pCurrentFrame)
+      {
+        pSharedRingReader->currentFrameCapacity = 0;
+        result = slapError_MemoryAllocation;
+        goto epilogue;
+      }
+    }
+
+    _slapSharedRing_Read(pRing, readPosition + SLAP_SHARED_RING_RECORD_HEADER_SIZE, pSharedRingReader->pCurrentFrame, (size_t)recordHeader[0]);
+
+    // The record has to be copied before the writer can overwrite it.
+    _slapCompilerBarrier();
+    pRing->readPosition = readPosition + recordSize;
+
+    const bool_t isIframe = (((uint64_t *)pSharedRingReader->pCurrentFrame)[SLAP_HEADER_PER_FRAME_FRAME_TYPE_INDEX(subFrameCount)] == SLAP_FRAME_TYPE_IFRAME);
+
+    // P-Frames can only be decoded if their predecessor has been decoded.
+    if (isIframe || (pSharedRingReader->hasReferenceFrame && recordHeader[1] == pSharedRingReader->referenceFrameIndex + 1))
+    {
+      pSharedRingReader->currentFrameSize = (size_t)recordHeader[0];
+      pSharedRingReader->frameIndex = recordHeader[1];
+      break;
+    }
+  }
+
+epilogue:
+  return result;
+}
+
+slapResult slapSharedRingReader_DecodeCurrentFrame(IN slapSharedRingReader *pSharedRingReader, IN const slapOutputBuffer *pOutput)
+{
+  slapResult result = slapSuccess;
+
+  if (!pSharedRingReader || !pSharedRingReader->currentFrameSize)
+  {
+    result = slapError_ArgumentNull;
+    goto epilogue;
+  }
+
+  const bool_t isIframe = (((uint64_t *)pSharedRingReader->pCurrentFrame)[SLAP_HEADER_PER_FRAME_FRAME_TYPE_INDEX(pSharedRingReader->pDecoder->subFrameCount)] == SLAP_FRAME_TYPE_IFRAME);
+
+  // The reference frame may have changed since the frame has been read (e.g. if the frame is decoded twice).
+  if (!isIframe && (!pSharedRingReader->hasReferenceFrame || pSharedRingReader->frameIndex != pSharedRingReader->referenceFrameIndex + 1))
+  {
+    result = slapError_Generic;
+    goto epilogue;
+  }
+
+  result = slapDecoder_DecodePacket(pSharedRingReader->pDecoder, pSharedRingReader->pCurrentFrame, pSharedRingReader->currentFrameSize, pSharedRingReader->pDecodedFrameYUV, pOutput);
+
+  // The last frame of the decoder is undefined if decoding failed.
+  pSharedRingReader->hasReferenceFrame = (result == slapSuccess);
+  pSharedRingReader->referenceFrameIndex = pSharedRingReader->frameIndex;
+
+epilogue:
+  return result;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Strip Client
+//////////////////////////////////////////////////////////////////////////
+
+// Unix domain sockets are available through Winsock since Windows 10 (version 1803).
+#ifdef _WIN32
+typedef SOCKET _slapSocket;
+
+#define _slapCloseSocket(socket) closesocket(socket)
+#define SLAP_SOCKET_SEND_FLAGS 0
 #else
-          v = _mm_srli_si128(cb2, 7);
+typedef int _slapSocket;
+
+#define _slapCloseSocket(socket) close(socket)
+#define SLAP_SOCKET_SEND_FLAGS MSG_NOSIGNAL // broken connections are reported as errors instead of raising SIGPIPE.
 #endif
-          *pSubFrameYUV = *(uint16_t *)&v;
-          pSubFrameYUV++;
+
+// Winsock transfers at most INT_MAX bytes per call.
+#define SLAP_SOCKET_MAX_TRANSFER_SIZE 0x7FFFFFFF
+
+slapResult _slapStripClient_Send(const intptr_t socket, IN const void *pData, const size_t size)
+{
+  size_t offset = 0;
+
+  while (offset < size)
+  {
+    const int length = (int)(size - offset < SLAP_SOCKET_MAX_TRANSFER_SIZE ? size - offset : SLAP_SOCKET_MAX_TRANSFER_SIZE);
+    const int64_t sent = send((_slapSocket)socket, (const char *)pData + offset, length, SLAP_SOCKET_SEND_FLAGS);
+
+    if (sent <= 0)
+      return slapError_FileError;
+
+    offset += (size_t)sent;
+  }
+
+  return slapSuccess;
+}
+
+slapResult _slapStripClient_Receive(const intptr_t socket, OUT void *pData, const size_t size)
+{
+  size_t offset = 0;
+
+  while (offset < size)
+  {
+    const int length = (int)(size - offset < SLAP_SOCKET_MAX_TRANSFER_SIZE ? size - offset : SLAP_SOCKET_MAX_TRANSFER_SIZE);
+    const int64_t received = recv((_slapSocket)socket, (char *)pData + offset, length, 0);
+
+    if (received <= 0)
+      return slapError_FileError;
+
+    offset += (size_t)received;
+  }
+
+  return slapSuccess;
+}
+
+// Sends the request and receives the payload of the response to pPayload.
+slapResult _slapStripClient_Request(IN slapStripClient *pStripClient, const slapStripRequestType type, const size_t frameIndex, IN const uint64_t *pSubFrameMask, OUT size_t *pPayloadSize)
+{
+  slapResult result = slapSuccess;
+  const size_t maskSize = pSubFrameMask ? SLAP_STRIP_MASK_SIZE(pStripClient->pDecoder->subFrameCount) : 0;
+  uint64_t requestHeader[SLAP_STRIP_REQUEST_HEADER_SIZE];
+  uint64_t responseHeader[SLAP_STRIP_RESPONSE_HEADER_SIZE];
+
+  requestHeader[SLAP_STRIP_REQUEST_TYPE_INDEX] = (uint64_t)type;
+  requestHeader[SLAP_STRIP_REQUEST_FRAME_INDEX] = (uint64_t)frameIndex;
+  requestHeader[SLAP_STRIP_REQUEST_MASK_SIZE_INDEX] = (uint64_t)maskSize;
+
+  if ((result = _slapStripClient_Send(pStripClient->socket, requestHeader, sizeof(requestHeader))) != slapSuccess)
+    goto epilogue;
+
+  if (maskSize)
+    if ((result = _slapStripClient_Send(pStripClient->socket, pSubFrameMask, maskSize * sizeof(uint64_t))) != slapSuccess)
+      goto epilogue;
+
+  if ((result = _slapStripClient_Receive(pStripClient->socket, responseHeader, sizeof(responseHeader))) != slapSuccess)
+    goto epilogue;
+
+  const size_t payloadSize = (size_t)responseHeader[SLAP_STRIP_RESPONSE_PAYLOAD_SIZE_INDEX];
+
+  if (pStripClient->payloadCapacity < payloadSize)
+  {
+    slapRealloc(&pStripClient->pPayload, uint8_t, payloadSize);
+    pStripClient->payloadCapacity = payloadSize;
+
+    if (!pStripClient->pPayload)
+    {
+      pStripClient->payloadCapacity = 0;
+      result = slapError_MemoryAllocation;
+      goto epilogue;
+    }
+  }
+
+  if ((result = _slapStripClient_Receive(pStripClient->socket, pStripClient->pPayload, payloadSize)) != slapSuccess)
+    goto epilogue;
+
+  *pPayloadSize = payloadSize;
+  result = (slapResult)responseHeader[SLAP_STRIP_RESPONSE_RESULT_INDEX];
+
+epilogue:
+  return result;
+}
+
+slapStripClient * slapCreateStripClient(const char *socketPath)
+{
+  slapStripClient *pStripClient = NULL;
+  struct sockaddr_un address;
+  size_t payloadSize = 0;
+
+  if (!socketPath || strlen(socketPath) >= sizeof(address.sun_path))
+    goto epilogue;
+
+  pStripClient = slapAlloc(slapStripClient, 1);
+
+  if (!pStripClient)
+    goto epilogue;
+
+  slapSetZero(pStripClient, slapStripClient);
+  pStripClient->socket = -1;
+
+#ifdef _WIN32
+  WSADATA wsaData;
+
+  // Every successful WSAStartup is matched by the WSACleanup in slapDestroyStripClient.
+  if (WSAStartup(MAKEWORD(2, 2), &wsaData))
+    goto epilogue;
+
+  pStripClient->isSocketLibraryInitialized = 1;
 #endif
 
-#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
-#ifdef SLAP_HIGH_QUALITY_DOWNSCALE
-          v = _mm_shuffle_epi8(cb3, shuffle);
-#else
-          v = _mm_srli_si128(cb3, 7);
-#endif
-          *pSubFrameYUV = *(uint16_t *)&v;
-          pSubFrameYUV++;
-#endif
-        }
+  // INVALID_SOCKET is -1 as well.
+  pStripClient->socket = (intptr_t)socket(AF_UNIX, SOCK_STREAM, 0);
+
+  if (pStripClient->socket == -1)
+    goto epilogue;
+
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  memcpy(address.sun_path, socketPath, strlen(socketPath) + 1);
+
+  if (connect((_slapSocket)pStripClient->socket, (struct sockaddr *)&address, (int)sizeof(address)))
+    goto epilogue;
+
+  if (slapSuccess != _slapStripClient_Request(pStripClient, slapStripRequest_Info, 0, NULL, &payloadSize))
+    goto epilogue;
+
+  if (payloadSize < sizeof(pStripClient->preHeaderBlock))
+    goto epilogue;
+
+  memcpy(pStripClient->preHeaderBlock, pStripClient->pPayload, sizeof(pStripClient->preHeaderBlock));
+
+  if (pStripClient->preHeaderBlock[SLAP_PRE_HEADER_FORMAT_VERSION_INDEX] != SLAP_FORMAT_VERSION)
+    goto epilogue;
+
+  const size_t headerSize = (size_t)pStripClient->preHeaderBlock[SLAP_PRE_HEADER_HEADER_SIZE_INDEX];
+
+  if (payloadSize != sizeof(pStripClient->preHeaderBlock) + headerSize * sizeof(uint64_t))
+    goto epilogue;
+
+  pStripClient->pHeader = slapAlloc(uint64_t, headerSize);
+
+  if (!pStripClient->pHeader)
+    goto epilogue;
+
+  memcpy(pStripClient->pHeader, pStripClient->pPayload + sizeof(pStripClient->preHeaderBlock), headerSize * sizeof(uint64_t));
+
+  pStripClient->pDecoder = slapCreateDecoderWithSubFrameLayout(pStripClient->preHeaderBlock[SLAP_PRE_HEADER_FRAME_SIZEX_INDEX], pStripClient->preHeaderBlock[SLAP_PRE_HEADER_FRAME_SIZEY_INDEX], pStripClient->preHeaderBlock[SLAP_PRE_HEADER_CODEC_FLAGS_INDEX], pStripClient->preHeaderBlock[SLAP_PRE_HEADER_SUB_FRAME_ROWS_INDEX], pStripClient->preHeaderBlock[SLAP_PRE_HEADER_SUB_FRAME_COLUMNS_INDEX]);
+
+  if (!pStripClient->pDecoder)
+    goto epilogue;
+
+  if (headerSize < SLAP_HEADER_PER_FRAME_SIZE(pStripClient->pDecoder->subFrameCount) * pStripClient->preHeaderBlock[SLAP_PRE_HEADER_FRAME_COUNT_INDEX])
+    goto epilogue;
+
+  const size_t resX = pStripClient->pDecoder->resX;
+  const size_t resY = pStripClient->pDecoder->resY;
+  const size_t lowResY = pStripClient->pDecoder->mode.flags.stereo ? (resY >> 4) : (resY >> 3);
+
+  pStripClient->pDecodedFrameYUV = slapAlloc(uint8_t, resX * resY * 3 / 2);
+  pStripClient->pLowResFrameYUV = slapAlloc(uint8_t, (resX >> 3) * lowResY * 3 / 2);
+  pStripClient->pValidSubFrameMask = slapAlloc(uint64_t, SLAP_STRIP_MASK_SIZE(pStripClient->pDecoder->subFrameCount));
+  pStripClient->pSubFrameMask = slapAlloc(uint64_t, SLAP_STRIP_MASK_SIZE(pStripClient->pDecoder->subFrameCount));
+
+  if (!pStripClient->pDecodedFrameYUV || !pStripClient->pLowResFrameYUV || !pStripClient->pValidSubFrameMask || !pStripClient->pSubFrameMask)
+    goto epilogue;
+
+  // The sub frames that haven't been requested are empty in the packets.
+  pStripClient->pDecoder->pSubFrameMask = pStripClient->pSubFrameMask;
+
+  return pStripClient;
+
+epilogue:
+  slapDestroyStripClient(&pStripClient);
+
+  return NULL;
+}
+
+void slapDestroyStripClient(IN_OUT slapStripClient **ppStripClient)
+{
+  if (ppStripClient && *ppStripClient)
+  {
+    if ((*ppStripClient)->socket != -1)
+      _slapCloseSocket((_slapSocket)(*ppStripClient)->socket);
+
+#ifdef _WIN32
+    if ((*ppStripClient)->isSocketLibraryInitialized)
+      WSACleanup();
+#endif
+
+    if ((*ppStripClient)->pDecoder)
+      slapDestroyDecoder(&(*ppStripClient)->pDecoder);
+
+    slapFreePtr(&(*ppStripClient)->pHeader);
+    slapFreePtr(&(*ppStripClient)->pDecodedFrameYUV);
+    slapFreePtr(&(*ppStripClient)->pLowResFrameYUV);
+    slapFreePtr(&(*ppStripClient)->pPayload);
+    slapFreePtr(&(*ppStripClient)->pValidSubFrameMask);
+    slapFreePtr(&(*ppStripClient)->pSubFrameMask);
+  }
+
+  slapFreePtr(ppStripClient);
+}
+
+slapResult slapStripClient_DecodeFrame(IN slapStripClient *pStripClient, const size_t frameIndex, IN const uint64_t *pSubFrameMask, IN const slapOutputBuffer *pOutput)
+{
+  slapResult result = slapSuccess;
+
+  if (!pStripClient)
+  {
+    result = slapError_ArgumentNull;
+    goto epilogue;
+  }
+
+  if (frameIndex >= pStripClient->preHeaderBlock[SLAP_PRE_HEADER_FRAME_COUNT_INDEX])
+  {
+    result = slapError_EndOfStream;
+    goto epilogue;
+  }
+
+  slapDecoder *pDecoder = pStripClient->pDecoder;
+  const size_t subFrameCount = pDecoder->subFrameCount;
+  const size_t maskSize = SLAP_STRIP_MASK_SIZE(subFrameCount);
+  uint64_t *pMask = pStripClient->pSubFrameMask;
+
+  memset(pMask, 0, maskSize * sizeof(uint64_t));
+
+  for (size_t i = 0; i < subFrameCount; i++)
+  {
+    if (pSubFrameMask && !(pSubFrameMask[i >> 6] & ((uint64_t)1 << (i & 63))))
+      continue;
+
+    const size_t row = i / pDecoder->subFrameColumns;
+    const size_t column = i % pDecoder->subFrameColumns;
+    size_t rows[2] = { row, row };
+
+    if (pDecoder->mode.flags.stereo)
+    {
+      const size_t rowsPerEye = _slapGetSubFrameRowsPerEye(row, pDecoder->subFrameRows);
+      rows[1] = _slapIsBottomEyeSubFrameRow(row, pDecoder->subFrameRows) ? row - rowsPerEye : row + rowsPerEye;
+    }
+
+    // The chroma sub frames only hold the even or odd chroma lines of parts of their horizontal range, so the columns with the other lines are requested as well.
+    const bool_t isChroma = (_slapGetSubFramePlane(row, pDecoder->subFrameRows) != 0);
+
+    for (size_t otherColumn = 0; otherColumn < pDecoder->subFrameColumns; otherColumn++)
+    {
+      if (otherColumn != column && (!isChroma || !_slapChromaSubFrameColumnsOverlap(pDecoder->resX, pDecoder->subFrameColumns, column, otherColumn)))
+        continue;
+
+      // The stereo counterparts are required to reconstruct the sub frames.
+      for (size_t j = 0; j < 2; j++)
+      {
+        const size_t index = rows[j] * pDecoder->subFrameColumns + otherColumn;
+        pMask[index >> 6] |= (uint64_t)1 << (index & 63);
+      }
+    }
+  }
+
+  // Whole lines are shifted along the x axis, so every sub frame depends on the other sub frames of its row. The global shift is stored in the first sub frame.
+  if (pDecoder->mode.flags.globalMotion)
+  {
+    pMask[0] |= 1;
+
+    for (size_t row = 0; row < pDecoder->subFrameRows; row++)
+    {
+      bool_t isRowRequested = 0;
+
+      for (size_t column = 0; column < pDecoder->subFrameColumns; column++)
+      {
+        const size_t index = row * pDecoder->subFrameColumns + column;
+        isRowRequested |= ((pMask[index >> 6] >> (index & 63)) & 1);
+      }
+
+      if (isRowRequested)
+      {
+        for (size_t column = 0; column < pDecoder->subFrameColumns; column++)
+        {
+          const size_t index = row * pDecoder->subFrameColumns + column;
+          pMask[index >> 6] |= (uint64_t)1 << (index & 63);
+        }
+      }
+    }
+  }
+
+  // Motion compensated blocks can be predicted from anywhere in the last frame and the chroma planes use the motion vectors of the luma sub frames, so sub frames depend on all others within a few frames.
+  if (pDecoder->mode.flags.motionCompensation)
+  {
+    for (size_t i = 0; i < subFrameCount; i++)
+    {
+      if (!(pMask[i >> 6] & ((uint64_t)1 << (i & 63))))
+      {
+        result = slapError_Generic;
+        goto epilogue;
+      }
+    }
+  }
+
+  bool_t isValid = pStripClient->hasReferenceFrame;
+
+  for (size_t i = 0; i < maskSize; i++)
+    isValid &= ((pMask[i] & ~pStripClient->pValidSubFrameMask[i]) == 0);
+
+  size_t iframeIndex = frameIndex;
+
+  while (iframeIndex > 0 && pStripClient->pHeader[SLAP_HEADER_PER_FRAME_SIZE(subFrameCount) * iframeIndex + SLAP_HEADER_PER_FRAME_FRAME_TYPE_INDEX(subFrameCount)] != SLAP_FRAME_TYPE_IFRAME)
+    iframeIndex--;
+
+  // Continue from the current position if the I-Frame has already been decoded with all of the requested sub frames.
+  if (!isValid || pStripClient->frameIndex <= iframeIndex || pStripClient->frameIndex > frameIndex)
+  {
+    pStripClient->frameIndex = iframeIndex;
+    pDecoder->frameIndex = iframeIndex;
+  }
+
+  // Sub frames that aren't requested are stale from now on.
+  memcpy(pStripClient->pValidSubFrameMask, pMask, maskSize * sizeof(uint64_t));
+  pStripClient->hasReferenceFrame = 0;
+
+  while (pStripClient->frameIndex <= frameIndex)
+  {
+    size_t payloadSize = 0;
+
+    if ((result = _slapStripClient_Request(pStripClient, slapStripRequest_SubFrames, pStripClient->frameIndex, pMask, &payloadSize)) != slapSuccess)
+      goto epilogue;
+
+    if ((result = slapDecoder_DecodePacket(pDecoder, pStripClient->pPayload, payloadSize, pStripClient->pDecodedFrameYUV, pStripClient->frameIndex == frameIndex ? pOutput : NULL)) != slapSuccess)
+      goto epilogue;
+
+    pStripClient->frameIndex++;
+  }
+
+  pStripClient->hasReferenceFrame = 1;
+
+epilogue:
+  return result;
+}
+
+slapResult slapStripClient_DecodeLowResFrame(IN slapStripClient *pStripClient, const size_t frameIndex)
+{
+  slapResult result = slapSuccess;
+  size_t payloadSize = 0;
+
+  if (!pStripClient)
+  {
+    result = slapError_ArgumentNull;
+    goto epilogue;
+  }
+
+  if (frameIndex >= pStripClient->preHeaderBlock[SLAP_PRE_HEADER_FRAME_COUNT_INDEX])
+  {
+    result = slapError_EndOfStream;
+    goto epilogue;
+  }
+
+  if ((result = _slapStripClient_Request(pStripClient, slapStripRequest_LowRes, frameIndex, NULL, &payloadSize)) != slapSuccess)
+    goto epilogue;
+
+  // Same as slapFileReader_GetLowResFrameResolution.
+  const size_t resX = pStripClient->pDecoder->resX >> 3;
+  const size_t resY = pStripClient->pDecoder->mode.flags.stereo ? (pStripClient->pDecoder->resY >> 4) : (pStripClient->pDecoder->resY >> 3);
+
+  result = _slapGetBackend(pStripClient->pDecoder->mode.flags.encoder)->pDecompressPreview(pStripClient->pLowResFrameYUV, pStripClient->pPayload, payloadSize, resX, resY, pStripClient->pDecoder->pLowResDecoderInternal);
+
+epilogue:
+  return result;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Decode Session
+//////////////////////////////////////////////////////////////////////////
+
+uint64_t _slapGetTimeUs()
+{
+  struct timespec time;
+  timespec_get(&time, TIME_UTC);
+
+  return (uint64_t)time.tv_sec * 1000000 + (uint64_t)time.tv_nsec / 1000;
+}
+
+// The fraction of the time of all threads of the thread pool that the stream needs at its frame rate.
+double _slapDecodeStream_GetLoad(IN const slapDecodeStream *pDecodeStream)
+{
+  return pDecodeStream->averageDecodeTimeMs / (pDecodeStream->frameTimeMs * (double)pDecodeStream->pSession->threadCount);
+}
+
+slapDecodeSession * slapCreateDecodeSession(const size_t threadCount, const size_t maxStreamCount)
+{
+  slapDecodeSession *pDecodeSession = NULL;
+
+  if (maxStreamCount == 0)
+    goto epilogue;
+
+  pDecodeSession = slapAlloc(slapDecodeSession, 1);
+
+  if (!pDecodeSession)
+    goto epilogue;
+
+  slapSetZero(pDecodeSession, slapDecodeSession);
+
+  pDecodeSession->maxStreamCount = maxStreamCount;
+  pDecodeSession->threadCount = threadCount ? threadCount : ThreadPool_GetSystemThreadCount();
+  pDecodeSession->ppStreams = slapAlloc(slapDecodeStream *, maxStreamCount);
+
+  if (!pDecodeSession->ppStreams)
+    goto epilogue;
+
+  pDecodeSession->pThreadPoolHandle = ThreadPool_InitWithWorkerData(pDecodeSession->threadCount, _slapDestroyWorkerData);
+
+  if (!pDecodeSession->pThreadPoolHandle)
+    goto epilogue;
+
+  return pDecodeSession;
+
+epilogue:
+  slapDestroyDecodeSession(&pDecodeSession);
+
+  return NULL;
+}
+
+void slapDestroyDecodeSession(IN_OUT slapDecodeSession **ppDecodeSession)
+{
+  if (ppDecodeSession && *ppDecodeSession)
+  {
+    while ((*ppDecodeSession)->streamCount > 0)
+    {
+      slapDecodeStream *pDecodeStream = (*ppDecodeSession)->ppStreams[0];
+      slapDecodeSession_RemoveStream(*ppDecodeSession, &pDecodeStream);
+    }
+
+    slapFreePtr(&(*ppDecodeSession)->ppStreams);
+
+    // The streams use the thread pool, so it's destroyed last.
+    if ((*ppDecodeSession)->pThreadPoolHandle)
+      ThreadPool_Destroy((*ppDecodeSession)->pThreadPoolHandle);
+  }
+
+  slapFreePtr(ppDecodeSession);
+}
+
+slapDecodeStream * slapDecodeSession_AddStream(IN slapDecodeSession *pDecodeSession, const char *filename, const size_t priority, const double framesPerSecond)
+{
+  slapDecodeStream *pDecodeStream = NULL;
+
+  if (!pDecodeSession || !filename || framesPerSecond <= 0 || priority > SLAP_DECODE_STREAM_MAX_PRIORITY)
+    goto epilogue;
+
+  if (pDecodeSession->streamCount >= pDecodeSession->maxStreamCount)
+    goto epilogue;
+
+  pDecodeStream = slapAlloc(slapDecodeStream, 1);
+
+  if (!pDecodeStream)
+    goto epilogue;
+
+  slapSetZero(pDecodeStream, slapDecodeStream);
+
+  pDecodeStream->pSession = pDecodeSession;
+  pDecodeStream->priority = priority;
+  pDecodeStream->frameTimeMs = 1000.0 / framesPerSecond;
+  pDecodeStream->pFileReader = _slapCreateFileReader(filename, SLAP_DECODER_SCALE_FULL, pDecodeSession->pThreadPoolHandle);
+
+  if (!pDecodeStream->pFileReader)
+    goto epilogue;
+
+  // Measure the new stream by decoding its first frame. As the decode time doesn't include waiting for the thread pool, this works while the other streams are decoding. The first frame is an I-Frame, so this errs on the high side.
+  if (slapDecodeStream_DecodeNextFrame(pDecodeStream, NULL) != slapSuccess)
+    goto epilogue;
+
+  if (slapFileReader_SeekFrame(pDecodeStream->pFileReader, 0) != slapSuccess)
+    goto epilogue;
+
+  pDecodeStream->decodedFrameCount = 0;
+  pDecodeStream->missedDeadlineCount = 0;
+  pDecodeStream->lastFrameMissedDeadline = 0;
+
+  double load = 0;
+  bool_t isSaturated = 0;
+
+  if (slapDecodeSession_GetLoad(pDecodeSession, &load, &isSaturated) != slapSuccess)
+    goto epilogue;
+
+  if (load + _slapDecodeStream_GetLoad(pDecodeStream) >= 1)
+    goto epilogue;
+
+  pDecodeSession->ppStreams[pDecodeSession->streamCount] = pDecodeStream;
+  pDecodeSession->streamCount++;
+
+  return pDecodeStream;
+
+epilogue:
+  if (pDecodeStream)
+  {
+    if (pDecodeStream->pFileReader)
+      slapDestroyFileReader(&pDecodeStream->pFileReader);
+
+    slapFreePtr(&pDecodeStream);
+  }
+
+  return NULL;
+}
+
+void slapDecodeSession_RemoveStream(IN slapDecodeSession *pDecodeSession, IN_OUT slapDecodeStream **ppDecodeStream)
+{
+  if (!pDecodeSession || !ppDecodeStream || !*ppDecodeStream)
+    return;
+
+  for (size_t i = 0; i < pDecodeSession->streamCount; i++)
+  {
+    if (pDecodeSession->ppStreams[i] == *ppDecodeStream)
+    {
+      pDecodeSession->ppStreams[i] = pDecodeSession->ppStreams[pDecodeSession->streamCount - 1];
+      pDecodeSession->streamCount--;
+      break;
+    }
+  }
+
+  slapDestroyFileReader(&(*ppDecodeStream)->pFileReader);
+  slapFreePtr(ppDecodeStream);
+}
+
+slapResult slapDecodeSession_GetLoad(IN slapDecodeSession *pDecodeSession, OUT double *pLoad, OUT bool_t *pIsSaturated)
+{
+  if (!pDecodeSession || !pLoad || !pIsSaturated)
+    return slapError_ArgumentNull;
+
+  double load = 0;
+  bool_t missedDeadline = 0;
+
+  for (size_t i = 0; i < pDecodeSession->streamCount; i++)
+  {
+    load += _slapDecodeStream_GetLoad(pDecodeSession->ppStreams[i]);
+    missedDeadline |= pDecodeSession->ppStreams[i]->lastFrameMissedDeadline;
+  }
+
+  *pLoad = load;
+  *pIsSaturated = (load >= 1 || missedDeadline);
+
+  return slapSuccess;
+}
+
+slapResult slapDecodeStream_DecodeNextFrame(IN slapDecodeStream *pDecodeStream, IN const slapOutputBuffer *pOutput)
+{
+  slapResult result = slapSuccess;
+
+  if (!pDecodeStream)
+  {
+    result = slapError_ArgumentNull;
+    goto epilogue;
+  }
+
+  const uint64_t startTimeUs = _slapGetTimeUs();
+  const uint64_t deadlineUs = startTimeUs + (uint64_t)(pDecodeStream->frameTimeMs * 1000.0);
+
+  // The priority takes the upper 8 bits, the deadline the rest.
+  pDecodeStream->pFileReader->pDecoder->taskSchedulingKey = ((uint64_t)(SLAP_DECODE_STREAM_MAX_PRIORITY - pDecodeStream->priority) << 56) | (deadlineUs & 0x00FFFFFFFFFFFFFFULL);
+
+  if ((result = _slapFileReader_ReadNextFrameFull(pDecodeStream->pFileReader)) != slapSuccess)
+    goto epilogue;
+
+  if ((result = slapFileReader_DecodeCurrentFrameToBuffer(pDecodeStream->pFileReader, pOutput)) != slapSuccess)
+    goto epilogue;
+
+  const uint64_t endTimeUs = _slapGetTimeUs();
+  const double decodeTimeMs = (double)pDecodeStream->pFileReader->pDecoder->lastFrameDecodeTimeUs / 1000.0;
+
+  if (pDecodeStream->decodedFrameCount == 0)
+    pDecodeStream->averageDecodeTimeMs = decodeTimeMs;
+  else
+    pDecodeStream->averageDecodeTimeMs = pDecodeStream->averageDecodeTimeMs * 0.9 + decodeTimeMs * 0.1;
+
+  pDecodeStream->decodedFrameCount++;
+  pDecodeStream->lastFrameMissedDeadline = (endTimeUs > deadlineUs);
+
+  if (pDecodeStream->lastFrameMissedDeadline)
+    pDecodeStream->missedDeadlineCount++;
+
+epilogue:
+  return result;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Core En- & Decoding Functions
+//////////////////////////////////////////////////////////////////////////
+
+slapResult _slapCompressChannel(IN void *pData, IN_OUT void **ppCompressedData, IN_OUT size_t *pCompressedDataSize, const size_t width, const size_t height, const int quality, IN void *pCompressor)
+{
+  unsigned long length = (unsigned long)*pCompressedDataSize;
+
+  if (tjCompress2(pCompressor, (unsigned char *)pData, (int)width, (int)width, (int)height, TJPF_GRAY, (unsigned char **)ppCompressedData, &length, TJSAMP_GRAY, quality, TJFLAG_FASTDCT))
+  {
+    slapLog(tjGetErrorStr2(pCompressor));
+    return slapError_Compress_Internal;
+  }
+
+  *pCompressedDataSize = length;
+
+  return slapSuccess;
+}
+
+slapResult _slapCompressYUV420(IN void *pData, IN_OUT void **ppCompressedData, IN_OUT size_t *pCompressedDataSize, const size_t width, const size_t height, const int quality, IN void *pCompressor)
+{
+  unsigned long length = (unsigned long)*pCompressedDataSize;
+
+  if (tjCompressFromYUV(pCompressor, (unsigned char *)pData, (int)width, 32, (int)height, TJSAMP_420, (unsigned char **)ppCompressedData, &length, quality, TJFLAG_FASTDCT))
+  {
+    slapLog(tjGetErrorStr2(pCompressor));
+    return slapError_Compress_Internal;
+  }
+
+  *pCompressedDataSize = length;
+
+  return slapSuccess;
+}
+
+slapResult _slapDecompressChannel(IN void *pData, IN_OUT void *pCompressedData, const size_t compressedDataSize, const size_t width, const size_t height, const size_t stride, IN void *pDecompressor)
+{
+  if (tjDecompress2(pDecompressor, (unsigned char *)pCompressedData, (unsigned long)compressedDataSize, (unsigned char *)pData, (int)width, (int)stride, (int)height, TJPF_GRAY, TJFLAG_FASTDCT))
+  {
+    slapLog(tjGetErrorStr2(pDecompressor));
+    return slapError_Compress_Internal;
+  }
+
+  return slapSuccess;
+}
+
+slapResult _slapDecompressYUV420(IN void *pData, IN_OUT void *pCompressedData, const size_t compressedDataSize, const size_t width, const size_t height, IN void *pDecompressor)
+{
+  if (tjDecompressToYUV2(pDecompressor, (unsigned char *)pCompressedData, (unsigned long)compressedDataSize, (unsigned char *)pData, (int)width, 4, (int)height, TJFLAG_FASTDCT))
+  {
+    slapLog(tjGetErrorStr2(pDecompressor));
+    return slapError_Compress_Internal;
+  }
+
+  return slapSuccess;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Coefficient Domain Strip Coding
+//////////////////////////////////////////////////////////////////////////
+
+// Scale factors of the AA&N DCT, scaled up by 14 bits (as in libjpeg's jddctmgr.c).
+static const int16_t _slapAanScales[DCTSIZE2] =
+{
+  16384, 22725, 21407, 19266, 16384, 12873,  8867,  4520,
+  22725, 31521, 29692, 26722, 22725, 17855, 12299,  6270,
+  21407, 29692, 27969, 25172, 21407, 16819, 11585,  5906,
+  19266, 26722, 25172, 22654, 19266, 15137, 10426,  5315,
+  16384, 22725, 21407, 19266, 16384, 12873,  8867,  4520,
+  12873, 17855, 16819, 15137, 12873, 10114,  6967,  3552,
+   8867, 12299, 11585, 10426,  8867,  6967,  4799,  2446,
+   4520,  6270,  5906,  5315,  4520,  3552,  2446,  1247
+};
+
+static const double _slapAanScaleFactors[DCTSIZE] = { 1.0, 1.387039845, 1.306562965, 1.175875602, 1.0, 0.785694958, 0.541196100, 0.275899379 };
+
+void _slapJpegErrorExit(j_common_ptr pInfo)
+{
+  char message[JMSG_LENGTH_MAX];
+
+  (*pInfo->err->format_message)(pInfo, message);
+  slapLog("%s", message);
+
+  longjmp(((_slapJpegCompressor *)pInfo->client_data)->jumpBuffer, 1);
+}
+
+_slapJpegCompressor * _slapCreateJpegCompressor()
+{
+  _slapJpegCompressor *pCompressor = slapAlloc(_slapJpegCompressor, 1);
+
+  if (!pCompressor)
+    return NULL;
+
+  slapSetZero(pCompressor, _slapJpegCompressor);
+
+  pCompressor->compressInfo.err = jpeg_std_error(&pCompressor->errorManager);
+  pCompressor->errorManager.error_exit = _slapJpegErrorExit;
+  pCompressor->compressInfo.client_data = pCompressor;
+
+  if (setjmp(pCompressor->jumpBuffer))
+  {
+    slapFreePtr(&pCompressor);
+    return NULL;
+  }
+
+  jpeg_create_compress(&pCompressor->compressInfo);
+
+  return pCompressor;
+}
+
+void _slapDestroyJpegCompressor(IN_OUT _slapJpegCompressor **ppCompressor)
+{
+  if (ppCompressor && *ppCompressor)
+    jpeg_destroy_compress(&(*ppCompressor)->compressInfo);
+
+  slapFreePtr(ppCompressor);
+}
+
+// Tasks of the thread pool use the compressor of their worker thread, other callers the one of the strip coder.
+_slapJpegCompressor * _slapStripCoder_GetCompressor(IN _slapStripCoder *pStripCoder)
+{
+  void **ppWorkerData = ThreadPool_GetWorkerData();
+
+  if (ppWorkerData)
+  {
+    _slapWorkerData *pWorkerData = _slapGetWorkerData(ppWorkerData);
+
+    if (!pWorkerData)
+      return NULL;
+
+    if (!pWorkerData->pJpegCompressor)
+      pWorkerData->pJpegCompressor = _slapCreateJpegCompressor();
+
+    return pWorkerData->pJpegCompressor;
+  }
+
+  if (!pStripCoder->pCompressor)
+    pStripCoder->pCompressor = _slapCreateJpegCompressor();
+
+  return pStripCoder->pCompressor;
+}
+
+void * _slapCreateStripCoder()
+{
+  _slapStripCoder *pStripCoder = slapAlloc(_slapStripCoder, 1);
+
+  if (!pStripCoder)
+    return NULL;
+
+  slapSetZero(pStripCoder, _slapStripCoder);
+
+  return pStripCoder;
+}
+
+void _slapDestroyStripCoder(IN_OUT void **ppStripCoder)
+{
+  if (ppStripCoder && *ppStripCoder)
+  {
+    _slapStripCoder *pStripCoder = (_slapStripCoder *)*ppStripCoder;
+
+    _slapDestroyJpegCompressor(&pStripCoder->pCompressor);
+    slapFreePtr(&pStripCoder->pCoefficients);
+  }
+
+  slapFreePtr(ppStripCoder);
+}
+
+// The quantization tables are taken from pInfo, after jpeg_set_quality.
+void _slapStripCoder_UpdateQuantization(IN_OUT _slapStripCoder *pStripCoder, IN const struct jpeg_compress_struct *pInfo, const int quality)
+{
+  if (pStripCoder->quality == quality)
+    return;
+
+  const UINT16 *pQuantValues = pInfo->quant_tbl_ptrs[0]->quantval;
+
+  for (size_t y = 0; y < DCTSIZE; y++)
+  {
+    for (size_t x = 0; x < DCTSIZE; x++)
+    {
+      const size_t i = y * DCTSIZE + x;
+
+      // Forward: the float AA&N DCT output is scaled by 8 * scale[y] * scale[x].
+      pStripCoder->quantReciprocals[i] = (float)(1.0 / (pQuantValues[i] * _slapAanScaleFactors[y] * _slapAanScaleFactors[x] * 8.0));
+
+      // Inverse: identical to the IFAST multiplier table libjpeg uses when decoding with TJFLAG_FASTDCT.
+      pStripCoder->dequantMultipliers[i] = (int16_t)(((int32_t)pQuantValues[i] * _slapAanScales[i] + (1 << 11)) >> 12);
+    }
+  }
+
+  pStripCoder->quality = quality;
+}
+
+inline void _slapFloatDCT8(IN_OUT __m128 *pV, const size_t stride)
+{
+  const __m128 c0_707106781 = _mm_set1_ps(0.707106781f);
+  const __m128 c0_382683433 = _mm_set1_ps(0.382683433f);
+  const __m128 c0_541196100 = _mm_set1_ps(0.541196100f);
+  const __m128 c1_306562965 = _mm_set1_ps(1.306562965f);
+
+  const __m128 tmp0 = _mm_add_ps(pV[0 * stride], pV[7 * stride]);
+  const __m128 tmp7 = _mm_sub_ps(pV[0 * stride], pV[7 * stride]);
+  const __m128 tmp1 = _mm_add_ps(pV[1 * stride], pV[6 * stride]);
+  const __m128 tmp6 = _mm_sub_ps(pV[1 * stride], pV[6 * stride]);
+  const __m128 tmp2 = _mm_add_ps(pV[2 * stride], pV[5 * stride]);
+  const __m128 tmp5 = _mm_sub_ps(pV[2 * stride], pV[5 * stride]);
+  const __m128 tmp3 = _mm_add_ps(pV[3 * stride], pV[4 * stride]);
+  const __m128 tmp4 = _mm_sub_ps(pV[3 * stride], pV[4 * stride]);
+
+  // Even part
+  __m128 tmp10 = _mm_add_ps(tmp0, tmp3);
+  const __m128 tmp13 = _mm_sub_ps(tmp0, tmp3);
+  __m128 tmp11 = _mm_add_ps(tmp1, tmp2);
+  __m128 tmp12 = _mm_sub_ps(tmp1, tmp2);
+
+  pV[0 * stride] = _mm_add_ps(tmp10, tmp11);
+  pV[4 * stride] = _mm_sub_ps(tmp10, tmp11);
+
+  const __m128 z1 = _mm_mul_ps(_mm_add_ps(tmp12, tmp13), c0_707106781);
+  pV[2 * stride] = _mm_add_ps(tmp13, z1);
+  pV[6 * stride] = _mm_sub_ps(tmp13, z1);
+
+  // Odd part
+  tmp10 = _mm_add_ps(tmp4, tmp5);
+  tmp11 = _mm_add_ps(tmp5, tmp6);
+  tmp12 = _mm_add_ps(tmp6, tmp7);
+
+  const __m128 z5 = _mm_mul_ps(_mm_sub_ps(tmp10, tmp12), c0_382683433);
+  const __m128 z2 = _mm_add_ps(_mm_mul_ps(tmp10, c0_541196100), z5);
+  const __m128 z4 = _mm_add_ps(_mm_mul_ps(tmp12, c1_306562965), z5);
+  const __m128 z3 = _mm_mul_ps(tmp11, c0_707106781);
+
+  const __m128 z11 = _mm_add_ps(tmp7, z3);
+  const __m128 z13 = _mm_sub_ps(tmp7, z3);
+
+  pV[5 * stride] = _mm_add_ps(z13, z2);
+  pV[3 * stride] = _mm_sub_ps(z13, z2);
+  pV[1 * stride] = _mm_add_ps(z11, z4);
+  pV[7 * stride] = _mm_sub_ps(z11, z4);
+}
+
+// pV[row * 2 + half]
+inline void _slapTranspose8x8ps(IN_OUT __m128 *pV)
+{
+  __m128 a0 = pV[0], a1 = pV[2], a2 = pV[4], a3 = pV[6];
+  __m128 b0 = pV[1], b1 = pV[3], b2 = pV[5], b3 = pV[7];
+  __m128 c0 = pV[8], c1 = pV[10], c2 = pV[12], c3 = pV[14];
+  __m128 d0 = pV[9], d1 = pV[11], d2 = pV[13], d3 = pV[15];
+
+  _MM_TRANSPOSE4_PS(a0, a1, a2, a3);
+  _MM_TRANSPOSE4_PS(b0, b1, b2, b3);
+  _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+  _MM_TRANSPOSE4_PS(d0, d1, d2, d3);
+
+  pV[0] = a0; pV[2] = a1; pV[4] = a2; pV[6] = a3;
+  pV[1] = c0; pV[3] = c1; pV[5] = c2; pV[7] = c3;
+  pV[8] = b0; pV[10] = b1; pV[12] = b2; pV[14] = b3;
+  pV[9] = d0; pV[11] = d1; pV[13] = d2; pV[15] = d3;
+}
+
+void _slapForwardDCTQuantizeBlock(IN const uint8_t *pSource, const size_t stride, const size_t rows, IN const float *pQuantReciprocals, OUT JCOEF *pCoefficients)
+{
+  __m128 v[DCTSIZE * 2];
+  const __m128i zero = _mm_setzero_si128();
+  const __m128 center = _mm_set1_ps(128.f);
+
+  for (size_t y = 0; y < DCTSIZE; y++)
+  {
+    // Replicate the last row into the padding (like libjpeg does).
+    const __m128i row = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(pSource + (y < rows ? y : rows - 1) * stride)), zero);
+
+    v[y * 2 + 0] = _mm_sub_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(row, zero)), center);
+    v[y * 2 + 1] = _mm_sub_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(row, zero)), center);
+  }
+
+  _slapFloatDCT8(v + 0, 2);
+  _slapFloatDCT8(v + 1, 2);
+  _slapTranspose8x8ps(v);
+  _slapFloatDCT8(v + 0, 2);
+  _slapFloatDCT8(v + 1, 2);
+  _slapTranspose8x8ps(v);
+
+  for (size_t y = 0; y < DCTSIZE; y++)
+  {
+    const __m128i lo = _mm_cvtps_epi32(_mm_mul_ps(v[y * 2 + 0], _mm_loadu_ps(pQuantReciprocals + y * DCTSIZE)));
+    const __m128i hi = _mm_cvtps_epi32(_mm_mul_ps(v[y * 2 + 1], _mm_loadu_ps(pQuantReciprocals + y * DCTSIZE + 4)));
+
+    _mm_storeu_si128((__m128i *)(pCoefficients + y * DCTSIZE), _mm_packs_epi32(lo, hi));
+  }
+}
+
+inline void _slapTranspose8x8epi16(IN_OUT __m128i *pV)
+{
+  const __m128i a0 = _mm_unpacklo_epi16(pV[0], pV[1]);
+  const __m128i a1 = _mm_unpackhi_epi16(pV[0], pV[1]);
+  const __m128i a2 = _mm_unpacklo_epi16(pV[2], pV[3]);
+  const __m128i a3 = _mm_unpackhi_epi16(pV[2], pV[3]);
+  const __m128i a4 = _mm_unpacklo_epi16(pV[4], pV[5]);
+  const __m128i a5 = _mm_unpackhi_epi16(pV[4], pV[5]);
+  const __m128i a6 = _mm_unpacklo_epi16(pV[6], pV[7]);
+  const __m128i a7 = _mm_unpackhi_epi16(pV[6], pV[7]);
+
+  const __m128i b0 = _mm_unpacklo_epi32(a0, a2);
+  const __m128i b1 = _mm_unpackhi_epi32(a0, a2);
+  const __m128i b2 = _mm_unpacklo_epi32(a1, a3);
+  const __m128i b3 = _mm_unpackhi_epi32(a1, a3);
+  const __m128i b4 = _mm_unpacklo_epi32(a4, a6);
+  const __m128i b5 = _mm_unpackhi_epi32(a4, a6);
+  const __m128i b6 = _mm_unpacklo_epi32(a5, a7);
+  const __m128i b7 = _mm_unpackhi_epi32(a5, a7);
+
+  pV[0] = _mm_unpacklo_epi64(b0, b4);
+  pV[1] = _mm_unpackhi_epi64(b0, b4);
+  pV[2] = _mm_unpacklo_epi64(b1, b5);
+  pV[3] = _mm_unpackhi_epi64(b1, b5);
+  pV[4] = _mm_unpacklo_epi64(b2, b6);
+  pV[5] = _mm_unpackhi_epi64(b2, b6);
+  pV[6] = _mm_unpacklo_epi64(b3, b7);
+  pV[7] = _mm_unpackhi_epi64(b3, b7);
+}
+
+// One pass of the libjpeg-turbo SSE2 IFAST IDCT (jidctfst-sse2). The order of operations and the pre-multiply shifts have to stay exactly like this to stay bit exact with tjDecompress2(..., TJFLAG_FASTDCT).
+inline void _slapIDCTIFast8(IN_OUT __m128i *pV)
+{
+  const __m128i f1_414 = _mm_set1_epi16(362 << 6);
+  const __m128i f1_847 = _mm_set1_epi16(473 << 6);
+  const __m128i mf1_613 = _mm_set1_epi16(-((669 - 256) << 6));
+  const __m128i f1_082 = _mm_set1_epi16(277 << 6);
+
+  // Even part
+  const __m128i tmp10 = _mm_add_epi16(pV[0], pV[4]);
+  const __m128i tmp11 = _mm_sub_epi16(pV[0], pV[4]);
+  const __m128i tmp13 = _mm_add_epi16(pV[2], pV[6]);
+  const __m128i tmp12 = _mm_sub_epi16(_mm_mulhi_epi16(_mm_slli_epi16(_mm_sub_epi16(pV[2], pV[6]), 2), f1_414), tmp13);
+
+  const __m128i tmp0 = _mm_add_epi16(tmp10, tmp13);
+  const __m128i tmp3 = _mm_sub_epi16(tmp10, tmp13);
+  const __m128i tmp1 = _mm_add_epi16(tmp11, tmp12);
+  const __m128i tmp2 = _mm_sub_epi16(tmp11, tmp12);
+
+  // Odd part
+  const __m128i z13 = _mm_add_epi16(pV[5], pV[3]);
+  const __m128i z10 = _mm_sub_epi16(pV[5], pV[3]);
+  const __m128i z11 = _mm_add_epi16(pV[1], pV[7]);
+  const __m128i z12 = _mm_sub_epi16(pV[1], pV[7]);
+
+  const __m128i z10s = _mm_slli_epi16(z10, 2);
+  const __m128i z12s = _mm_slli_epi16(z12, 2);
+
+  const __m128i tmp7 = _mm_add_epi16(z11, z13);
+  const __m128i tmp11o = _mm_mulhi_epi16(_mm_slli_epi16(_mm_sub_epi16(z11, z13), 2), f1_414);
+
+  const __m128i z5 = _mm_mulhi_epi16(_mm_add_epi16(z10s, z12s), f1_847);
+  const __m128i tmp10o = _mm_sub_epi16(_mm_mulhi_epi16(z12s, f1_082), z5);
+  const __m128i tmp12o = _mm_add_epi16(_mm_sub_epi16(_mm_mulhi_epi16(z10s, mf1_613), z10), z5);
+
+  const __m128i tmp6 = _mm_sub_epi16(tmp12o, tmp7);
+  const __m128i tmp5 = _mm_sub_epi16(tmp11o, tmp6);
+  const __m128i tmp4 = _mm_add_epi16(tmp10o, tmp5);
+
+  pV[0] = _mm_add_epi16(tmp0, tmp7);
+  pV[7] = _mm_sub_epi16(tmp0, tmp7);
+  pV[1] = _mm_add_epi16(tmp1, tmp6);
+  pV[6] = _mm_sub_epi16(tmp1, tmp6);
+  pV[2] = _mm_add_epi16(tmp2, tmp5);
+  pV[5] = _mm_sub_epi16(tmp2, tmp5);
+  pV[4] = _mm_add_epi16(tmp3, tmp4);
+  pV[3] = _mm_sub_epi16(tmp3, tmp4);
+}
+
+void _slapInverseDCTBlock(IN const JCOEF *pCoefficients, IN const int16_t *pDequantMultipliers, OUT uint8_t *pTarget, const size_t stride, const size_t rows)
+{
+  __m128i v[DCTSIZE];
+  __m128i ac = _mm_setzero_si128();
+
+  for (size_t y = 0; y < DCTSIZE; y++)
+  {
+    v[y] = _mm_mullo_epi16(_mm_loadu_si128((const __m128i *)(pCoefficients + y * DCTSIZE)), _mm_loadu_si128((const __m128i *)(pDequantMultipliers + y * DCTSIZE)));
+
+    if (y > 0)
+      ac = _mm_or_si128(ac, v[y]);
+  }
+
+  // If all AC terms of the columns are zero, the first pass results in the DC row for every row.
+  if (_mm_movemask_epi8(_mm_cmpeq_epi8(ac, _mm_setzero_si128())) == 0xFFFF)
+  {
+    for (size_t y = 1; y < DCTSIZE; y++)
+      v[y] = v[0];
+  }
+  else
+  {
+    _slapIDCTIFast8(v);
+  }
+
+  _slapTranspose8x8epi16(v);
+  _slapIDCTIFast8(v);
+  _slapTranspose8x8epi16(v);
+
+  const __m128i center = _mm_set1_epi8((char)CENTERJSAMPLE);
+
+  for (size_t y = 0; y < rows; y += 2)
+  {
+    const __m128i packed = _mm_add_epi8(_mm_packs_epi16(_mm_srai_epi16(v[y], 5), _mm_srai_epi16(v[y + 1], 5)), center);
+
+    _mm_storel_epi64((__m128i *)(pTarget + y * stride), packed);
+
+    if (y + 1 < rows)
+      _mm_storel_epi64((__m128i *)(pTarget + (y + 1) * stride), _mm_srli_si128(packed, 8));
+  }
+}
+
+slapResult _slapCompressChannelCoefficients(IN void *pData, IN_OUT void **ppCompressedData, IN_OUT size_t *pCompressedDataSize, const size_t width, const size_t height, const size_t stride, const int quality, IN void *pStripCoder, const size_t prefixSize)
+{
+  _slapStripCoder *pCoder = (_slapStripCoder *)pStripCoder;
+  _slapJpegCompressor *pCompressor = _slapStripCoder_GetCompressor(pCoder);
+
+  if (!pCompressor)
+    return slapError_MemoryAllocation;
+
+  struct jpeg_compress_struct *pInfo = &pCompressor->compressInfo;
+  unsigned char *pBuffer = (unsigned char *)*ppCompressedData;
+  unsigned long length = (unsigned long)pCoder->compressedCapacity;
+
+  if (setjmp(pCompressor->jumpBuffer))
+  {
+    jpeg_abort_compress(pInfo);
+
+    if (pBuffer != *ppCompressedData)
+      free(pBuffer);
+
+    return slapError_Compress_Internal;
+  }
+
+  pInfo->image_width = (JDIMENSION)width;
+  pInfo->image_height = (JDIMENSION)height;
+  pInfo->input_components = 1;
+  pInfo->in_color_space = JCS_GRAYSCALE;
+
+  jpeg_set_defaults(pInfo);
+  jpeg_set_quality(pInfo, quality, TRUE);
+  _slapStripCoder_UpdateQuantization(pCoder, pInfo, quality);
+
+  pCoder->widthInBlocks = (width + DCTSIZE - 1) / DCTSIZE;
+  pCoder->heightInBlocks = (height + DCTSIZE - 1) / DCTSIZE;
+
+  const size_t coefficientCount = pCoder->widthInBlocks * pCoder->heightInBlocks * DCTSIZE2;
+
+  if (pCoder->coefficientCapacity < coefficientCount)
+  {
+    slapFreePtr(&pCoder->pCoefficients);
+    pCoder->pCoefficients = slapAlloc(JCOEF, coefficientCount);
+    pCoder->coefficientCapacity = 0;
+
+    if (!pCoder->pCoefficients)
+      return slapError_MemoryAllocation;
+
+    pCoder->coefficientCapacity = coefficientCount;
+  }
+
+  // Forward DCT & Quantization.
+  for (size_t by = 0; by < pCoder->heightInBlocks; by++)
+  {
+    const size_t rows = (height - by * DCTSIZE) < DCTSIZE ? (height - by * DCTSIZE) : DCTSIZE;
+    const uint8_t *pSourceLine = ((uint8_t *)pData) + by * DCTSIZE * stride;
+    JCOEF *pCoefficientLine = pCoder->pCoefficients + by * pCoder->widthInBlocks * DCTSIZE2;
+
+    for (size_t bx = 0; bx < pCoder->widthInBlocks; bx++)
+      _slapForwardDCTQuantizeBlock(pSourceLine + bx * DCTSIZE, stride, rows, pCoder->quantReciprocals, pCoefficientLine + bx * DCTSIZE2);
+  }
+
+  // Entropy coding only.
+  jvirt_barray_ptr pCoefficientArray = (*pInfo->mem->request_virt_barray)((j_common_ptr)pInfo, JPOOL_IMAGE, TRUE, (JDIMENSION)pCoder->widthInBlocks, (JDIMENSION)pCoder->heightInBlocks, 1);
+
+  if (!pBuffer || !length)
+  {
+    length = (unsigned long)(width * height);
+    pBuffer = slapAlloc(unsigned char, length);
+
+    if (!pBuffer)
+    {
+      jpeg_abort_compress(pInfo);
+      return slapError_MemoryAllocation;
+    }
+
+    *ppCompressedData = pBuffer;
+    pCoder->compressedCapacity = length;
+  }
+
+  jpeg_mem_dest(pInfo, &pBuffer, &length);
+  jpeg_write_coefficients(pInfo, &pCoefficientArray);
+
+  for (size_t by = 0; by < pCoder->heightInBlocks; by++)
+  {
+    JBLOCKARRAY ppBlocks = (*pInfo->mem->access_virt_barray)((j_common_ptr)pInfo, pCoefficientArray, (JDIMENSION)by, 1, TRUE);
+    memcpy(ppBlocks[0], pCoder->pCoefficients + by * pCoder->widthInBlocks * DCTSIZE2, sizeof(JBLOCK) * pCoder->widthInBlocks);
+  }
+
+  jpeg_finish_compress(pInfo);
+
+  // libjpeg allocates a new buffer if the old one wasn't large enough. Its size isn't reported (length is only the used part), so it's resized below to a known capacity.
+  if (pBuffer != *ppCompressedData)
+  {
+    free(*ppCompressedData);
+    *ppCompressedData = pBuffer;
+    pCoder->compressedCapacity = 0;
+  }
+
+  // Leave room for prefixSize bytes in front of the compressed data.
+  if (pCoder->compressedCapacity < length + prefixSize)
+  {
+    slapRealloc(ppCompressedData, uint8_t, length + prefixSize);
+
+    if (!*ppCompressedData)
+    {
+      pCoder->compressedCapacity = 0;
+      return slapError_MemoryAllocation;
+    }
+
+    pCoder->compressedCapacity = length + prefixSize;
+  }
+
+  if (prefixSize)
+  {
+    memmove(((uint8_t *)*ppCompressedData) + prefixSize, *ppCompressedData, length);
+    length += (unsigned long)prefixSize;
+  }
+
+  *pCompressedDataSize = length;
+
+  return slapSuccess;
+}
+
+void _slapReconstructChannelFromCoefficients(OUT void *pData, IN void *pStripCoder, const size_t width, const size_t height, const size_t stride)
+{
+  _slapStripCoder *pCoder = (_slapStripCoder *)pStripCoder;
+
+  (void)width;
+
+  for (size_t by = 0; by < pCoder->heightInBlocks; by++)
+  {
+    const size_t rows = (height - by * DCTSIZE) < DCTSIZE ? (height - by * DCTSIZE) : DCTSIZE;
+    uint8_t *pTargetLine = ((uint8_t *)pData) + by * DCTSIZE * stride;
+    const JCOEF *pCoefficientLine = pCoder->pCoefficients + by * pCoder->widthInBlocks * DCTSIZE2;
+
+    for (size_t bx = 0; bx < pCoder->widthInBlocks; bx++)
+      _slapInverseDCTBlock(pCoefficientLine + bx * DCTSIZE2, pCoder->dequantMultipliers, pTargetLine + bx * DCTSIZE, stride, rows);
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Lossless Strip Coding
+//////////////////////////////////////////////////////////////////////////
+
+// Every row is predicted from the row above (the first row from the pixel to the left) and the prediction error is entropy coded with two interleaved rANS states.
+// Record layout: SLAP_LOSSLESS_MODE_RAW followed by the pixels, or SLAP_LOSSLESS_MODE_RANS followed by the 256 normalized symbol frequencies (uint16_t), the two initial decoder states (uint32_t) and the rANS byte stream.
+
+#define SLAP_LOSSLESS_MODE_RAW 0
+#define SLAP_LOSSLESS_MODE_RANS 1
+
+#define SLAP_RANS_PROB_BITS 12
+#define SLAP_RANS_PROB_SCALE (1 << SLAP_RANS_PROB_BITS)
+#define SLAP_RANS_LOWER_BOUND (1 << 23)
+
+#define SLAP_LOSSLESS_HEADER_SIZE (1 + 256 * sizeof(uint16_t) + 2 * sizeof(uint32_t))
+
+typedef struct _slapLosslessCoder
+{
+  uint8_t *pResidual; // the prediction error of the last strip.
+  uint8_t *pStrip; // a copy of the last strip, required to reconstruct it.
+  size_t capacity;
+
+  uint16_t frequencies[256];
+  uint16_t cumulativeFrequencies[257];
+  uint8_t slotToSymbol[SLAP_RANS_PROB_SCALE];
+} _slapLosslessCoder;
+
+void * _slapCreateLosslessCoder()
+{
+  _slapLosslessCoder *pCoder = slapAlloc(_slapLosslessCoder, 1);
+
+  if (!pCoder)
+    return NULL;
+
+  slapSetZero(pCoder, _slapLosslessCoder);
+
+  return pCoder;
+}
+
+void _slapDestroyLosslessCoder(IN_OUT void **ppCoder)
+{
+  if (ppCoder && *ppCoder)
+  {
+    _slapLosslessCoder *pCoder = (_slapLosslessCoder *)*ppCoder;
+
+    slapFreePtr(&pCoder->pResidual);
+    slapFreePtr(&pCoder->pStrip);
+  }
+
+  slapFreePtr(ppCoder);
+}
+
+slapResult _slapLosslessCoder_Reserve(IN_OUT _slapLosslessCoder *pCoder, const size_t size)
+{
+  if (pCoder->capacity >= size)
+    return slapSuccess;
+
+  slapFreePtr(&pCoder->pResidual);
+  slapFreePtr(&pCoder->pStrip);
+  pCoder->capacity = 0;
+
+  pCoder->pResidual = slapAlloc(uint8_t, size);
+  pCoder->pStrip = slapAlloc(uint8_t, size);
+
+  if (!pCoder->pResidual || !pCoder->pStrip)
+    return slapError_MemoryAllocation;
+
+  pCoder->capacity = size;
+
+  return slapSuccess;
+}
+
+void _slapLosslessPredict(IN const uint8_t *pData, OUT uint8_t *pResidual, const size_t width, const size_t height, const size_t stride)
+{
+  const size_t widthDiv16 = width >> 4;
+
+  uint8_t last = 0;
+
+  for (size_t x = 0; x < width; x++)
+  {
+    pResidual[x] = (uint8_t)(pData[x] - last);
+    last = pData[x];
+  }
+
+  for (size_t y = 1; y < height; y++)
+  {
+    const __m128i *pAbove = (const __m128i *)(pData + (y - 1) * stride);
+    const __m128i *pCurrent = (const __m128i *)(pData + y * stride);
+    __m128i *pOut = (__m128i *)(pResidual + y * width);
+
+    for (size_t x = 0; x < widthDiv16; x++)
+      _mm_storeu_si128(pOut + x, _mm_sub_epi8(_mm_load_si128(pCurrent + x), _mm_load_si128(pAbove + x)));
+  }
+}
+
+void _slapLosslessUnpredict(IN const uint8_t *pResidual, OUT uint8_t *pData, const size_t width, const size_t height, const size_t stride)
+{
+  const size_t widthDiv16 = width >> 4;
+
+  uint8_t last = 0;
+
+  for (size_t x = 0; x < width; x++)
+  {
+    last = (uint8_t)(last + pResidual[x]);
+    pData[x] = last;
+  }
+
+  for (size_t y = 1; y < height; y++)
+  {
+    const __m128i *pAbove = (const __m128i *)(pData + (y - 1) * stride);
+    const __m128i *pIn = (const __m128i *)(pResidual + y * width);
+    __m128i *pCurrent = (__m128i *)(pData + y * stride);
+
+    for (size_t x = 0; x < widthDiv16; x++)
+      _mm_store_si128(pCurrent + x, _mm_add_epi8(_mm_loadu_si128(pIn + x), _mm_load_si128(pAbove + x)));
+  }
+}
+
+// Scales the histogram to SLAP_RANS_PROB_SCALE, so that every symbol that occurs keeps a frequency of at least one.
+void _slapLosslessNormalizeFrequencies(IN const uint32_t *pHistogram, const size_t count, OUT uint16_t *pFrequencies)
+{
+  size_t sum = 0;
+
+  for (size_t i = 0; i < 256; i++)
+  {
+    if (pHistogram[i] == 0)
+    {
+      pFrequencies[i] = 0;
+      continue;
+    }
+
+    size_t frequency = (size_t)pHistogram[i] * SLAP_RANS_PROB_SCALE / count;
+
+    if (frequency == 0)
+      frequency = 1;
+
+    pFrequencies[i] = (uint16_t)frequency;
+    sum += frequency;
+  }
+
+  while (sum != SLAP_RANS_PROB_SCALE)
+  {
+    size_t largest = 0;
+
+    for (size_t i = 1; i < 256; i++)
+      if (pFrequencies[i] > pFrequencies[largest])
+        largest = i;
+
+    if (sum < SLAP_RANS_PROB_SCALE)
+    {
+      pFrequencies[largest] += (uint16_t)(SLAP_RANS_PROB_SCALE - sum);
+      sum = SLAP_RANS_PROB_SCALE;
+    }
+    else
+    {
+      const size_t excess = sum - SLAP_RANS_PROB_SCALE;
+      const size_t reduction = excess < (size_t)pFrequencies[largest] - 1 ? excess : (size_t)pFrequencies[largest] - 1;
+
+      pFrequencies[largest] -= (uint16_t)reduction;
+      sum -= reduction;
+
+      // Every other symbol is down to a frequency of one.
+      if (reduction == 0)
+        break;
+    }
+  }
+}
+
+// The frequencies may come straight from a file, so they have to sum up to exactly SLAP_RANS_PROB_SCALE without wrapping around.
+slapResult _slapLosslessCoder_SetFrequencies(IN_OUT _slapLosslessCoder *pCoder, IN const uint16_t *pFrequencies)
+{
+  uint32_t sum = 0;
+
+  pCoder->cumulativeFrequencies[0] = 0;
+
+  for (size_t i = 0; i < 256; i++)
+  {
+    if (pFrequencies[i] > SLAP_RANS_PROB_SCALE - sum)
+      return slapError_Compress_Internal;
+
+    sum += pFrequencies[i];
+    pCoder->frequencies[i] = pFrequencies[i];
+    pCoder->cumulativeFrequencies[i + 1] = (uint16_t)sum;
+  }
+
+  if (sum != SLAP_RANS_PROB_SCALE)
+    return slapError_Compress_Internal;
+
+  return slapSuccess;
+}
+
+inline void _slapRansEncode(IN_OUT uint32_t *pState, IN_OUT uint8_t **ppOut, const uint32_t start, const uint32_t frequency)
+{
+  uint32_t x = *pState;
+  const uint32_t maxState = ((SLAP_RANS_LOWER_BOUND >> SLAP_RANS_PROB_BITS) << 8) * frequency;
+
+  while (x >= maxState)
+  {
+    *--(*ppOut) = (uint8_t)(x & 0xFF);
+    x >>= 8;
+  }
+
+  *pState = ((x / frequency) << SLAP_RANS_PROB_BITS) + (x % frequency) + start;
+}
+
+inline uint8_t _slapRansDecode(IN_OUT uint32_t *pState, IN_OUT const uint8_t **ppIn, IN const uint8_t *pEnd, IN const _slapLosslessCoder *pCoder)
+{
+  uint32_t x = *pState;
+  const uint32_t slot = x & (SLAP_RANS_PROB_SCALE - 1);
+  const uint8_t symbol = pCoder->slotToSymbol[slot];
+
+  x = pCoder->frequencies[symbol] * (x >> SLAP_RANS_PROB_BITS) + slot - pCoder->cumulativeFrequencies[symbol];
+
+  while (x < SLAP_RANS_LOWER_BOUND && *ppIn < pEnd)
+    x = (x << 8) | *(*ppIn)++;
+
+  *pState = x;
+
+  return symbol;
+}
+
+slapResult _slapCompressChannelLossless(IN void *pData, IN_OUT void **ppCompressedData, IN_OUT size_t *pCompressedDataSize, const size_t width, const size_t height, const size_t stride, const int quality, IN void *pStripCoder, const size_t prefixSize)
+{
+  _slapLosslessCoder *pCoder = (_slapLosslessCoder *)pStripCoder;
+  const size_t count = width * height;
+  slapResult result = slapSuccess;
+
+  (void)quality;
+
+  if ((result = _slapLosslessCoder_Reserve(pCoder, count)) != slapSuccess)
+    return result;
+
+  for (size_t y = 0; y < height; y++)
+    memcpy(pCoder->pStrip + y * width, ((uint8_t *)pData) + y * stride, width);
+
+  _slapLosslessPredict((uint8_t *)pData, pCoder->pResidual, width, height, stride);
+
+  uint32_t histogram[256];
+  memset(histogram, 0, sizeof(histogram));
+
+  for (size_t i = 0; i < count; i++)
+    histogram[pCoder->pResidual[i]]++;
+
+  uint16_t frequencies[256];
+  _slapLosslessNormalizeFrequencies(histogram, count, frequencies);
+
+  if ((result = _slapLosslessCoder_SetFrequencies(pCoder, frequencies)) != slapSuccess)
+    return result;
+
+  // Worst case: every symbol has a frequency of 1 / SLAP_RANS_PROB_SCALE and emits SLAP_RANS_PROB_BITS bits. Anything larger than the raw strip is stored raw anyways.
+  const size_t capacity = prefixSize + SLAP_LOSSLESS_HEADER_SIZE + count * 2;
+
+  slapRealloc(ppCompressedData, uint8_t, capacity);
+
+  if (!*ppCompressedData)
+    return slapError_MemoryAllocation;
+
+  uint8_t *pRecord = ((uint8_t *)*ppCompressedData) + prefixSize;
+  uint8_t *pEnd = ((uint8_t *)*ppCompressedData) + capacity;
+  uint8_t *pOut = pEnd;
+  uint32_t states[2] = { SLAP_RANS_LOWER_BOUND, SLAP_RANS_LOWER_BOUND };
+
+  // rANS is last in, first out: encode back to front, so that the decoder can run front to back.
+  for (size_t i = count; i > 0; i--)
+  {
+    const uint8_t symbol = pCoder->pResidual[i - 1];
+    _slapRansEncode(&states[(i - 1) & 1], &pOut, pCoder->cumulativeFrequencies[symbol], pCoder->frequencies[symbol]);
+  }
+
+  const size_t streamSize = pEnd - pOut;
+
+  if (SLAP_LOSSLESS_HEADER_SIZE + streamSize >= 1 + count)
+  {
+    pRecord[0] = SLAP_LOSSLESS_MODE_RAW;
+    memcpy(pRecord + 1, pCoder->pStrip, count);
+
+    *pCompressedDataSize = prefixSize + 1 + count;
+
+    return slapSuccess;
+  }
+
+  pRecord[0] = SLAP_LOSSLESS_MODE_RANS;
+  memcpy(pRecord + 1, frequencies, sizeof(frequencies));
+  memcpy(pRecord + 1 + sizeof(frequencies), states, sizeof(states));
+  memmove(pRecord + SLAP_LOSSLESS_HEADER_SIZE, pOut, streamSize);
+
+  *pCompressedDataSize = prefixSize + SLAP_LOSSLESS_HEADER_SIZE + streamSize;
+
+  return slapSuccess;
+}
+
+void _slapReconstructChannelLossless(OUT void *pData, IN void *pStripCoder, const size_t width, const size_t height, const size_t stride)
+{
+  _slapLosslessCoder *pCoder = (_slapLosslessCoder *)pStripCoder;
+
+  for (size_t y = 0; y < height; y++)
+    memcpy(((uint8_t *)pData) + y * stride, pCoder->pStrip + y * width, width);
+}
+
+slapResult _slapDecompressChannelLossless(OUT void *pData, IN void *pCompressedData, const size_t compressedDataSize, const size_t width, const size_t height, const size_t stride, IN void *pStripDecoder)
+{
+  _slapLosslessCoder *pCoder = (_slapLosslessCoder *)pStripDecoder;
+  const uint8_t *pRecord = (const uint8_t *)pCompressedData;
+  const size_t count = width * height;
+  slapResult result = slapSuccess;
+
+  if (compressedDataSize < 1)
+    return slapError_Compress_Internal;
+
+  if (pRecord[0] == SLAP_LOSSLESS_MODE_RAW)
+  {
+    if (compressedDataSize < 1 + count)
+      return slapError_Compress_Internal;
+
+    for (size_t y = 0; y < height; y++)
+      memcpy(((uint8_t *)pData) + y * stride, pRecord + 1 + y * width, width);
+
+    return slapSuccess;
+  }
+
+  if (pRecord[0] != SLAP_LOSSLESS_MODE_RANS || compressedDataSize < SLAP_LOSSLESS_HEADER_SIZE)
+    return slapError_Compress_Internal;
+
+  if ((result = _slapLosslessCoder_Reserve(pCoder, count)) != slapSuccess)
+    return result;
+
+  uint16_t frequencies[256];
+  uint32_t states[2];
+
+  memcpy(frequencies, pRecord + 1, sizeof(frequencies));
+  memcpy(states, pRecord + 1 + sizeof(frequencies), sizeof(states));
+
+  if ((result = _slapLosslessCoder_SetFrequencies(pCoder, frequencies)) != slapSuccess)
+    return result;
+
+  for (size_t i = 0; i < 256; i++)
+    memset(pCoder->slotToSymbol + pCoder->cumulativeFrequencies[i], (int)i, pCoder->frequencies[i]);
+
+  const uint8_t *pIn = pRecord + SLAP_LOSSLESS_HEADER_SIZE;
+  const uint8_t *pEnd = pRecord + compressedDataSize;
+
+  for (size_t i = 0; i + 1 < count; i += 2)
+  {
+    pCoder->pResidual[i] = _slapRansDecode(&states[0], &pIn, pEnd, pCoder);
+    pCoder->pResidual[i + 1] = _slapRansDecode(&states[1], &pIn, pEnd, pCoder);
+  }
+
+  if (count & 1)
+    pCoder->pResidual[count - 1] = _slapRansDecode(&states[0], &pIn, pEnd, pCoder);
+
+  _slapLosslessUnpredict(pCoder->pResidual, (uint8_t *)pData, width, height, stride);
+
+  return slapSuccess;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Backends
+//////////////////////////////////////////////////////////////////////////
+
+void * _slapCreateTurboJpegCompressor()
+{
+  return tjInitCompress();
+}
+
+void * _slapCreateTurboJpegDecompressor()
+{
+  return tjInitDecompress();
+}
+
+void _slapDestroyTurboJpegHandle(IN_OUT void **ppHandle)
+{
+  if (ppHandle && *ppHandle)
+  {
+    tjDestroy(*ppHandle);
+    *ppHandle = NULL;
+  }
+}
+
+void _slapFreeTurboJpegBuffer(IN_OUT void **ppBuffer)
+{
+  if (ppBuffer && *ppBuffer)
+  {
+    tjFree((unsigned char *)*ppBuffer);
+    *ppBuffer = NULL;
+  }
+}
+
+// Indexed by mode.flags.encoder.
+static const _slapBackend _slapBackends[] =
+{
+  // SLAP_ENCODER_TURBOJPEG
+  {
+    _slapCreateStripCoder, _slapDestroyStripCoder, _slapCompressChannelCoefficients, _slapReconstructChannelFromCoefficients,
+    _slapCreateTurboJpegDecompressor, _slapDestroyTurboJpegHandle, _slapDecompressChannel,
+    _slapCreateTurboJpegCompressor, _slapDestroyTurboJpegHandle, _slapCompressYUV420, _slapFreeTurboJpegBuffer,
+    _slapCreateTurboJpegDecompressor, _slapDestroyTurboJpegHandle, _slapDecompressYUV420,
+    0, 1
+  },
+
+  // SLAP_ENCODER_LOSSLESS: The preview stays lossy.
+  {
+    _slapCreateLosslessCoder, _slapDestroyLosslessCoder, _slapCompressChannelLossless, _slapReconstructChannelLossless,
+    _slapCreateLosslessCoder, _slapDestroyLosslessCoder, _slapDecompressChannelLossless,
+    _slapCreateTurboJpegCompressor, _slapDestroyTurboJpegHandle, _slapCompressYUV420, _slapFreeTurboJpegBuffer,
+    _slapCreateTurboJpegDecompressor, _slapDestroyTurboJpegHandle, _slapDecompressYUV420,
+    1, 0
+  },
+};
+
+const _slapBackend * _slapGetBackend(const size_t encoder)
+{
+  if (encoder >= sizeof(_slapBackends) / sizeof(_slapBackends[0]))
+    return NULL;
+
+  return &_slapBackends[encoder];
+}
+
+// Returns the sum of absolute differences between the top eye and the last frame.
+uint64_t _slapLastFrameDiffAndStereoDiffAndSubBufferYUV420(IN_OUT void *pLastFrame, IN void *pData, OUT void *pResidual, IN_OUT void *pLowRes, const size_t resX, const size_t resY)
+{
+  uint8_t *pMainFrameY = (uint8_t *)pData;
+  uint16_t *pSubFrameYUV = (uint16_t *)pLowRes;
+  __m128i *pLastFrameYUV = (__m128i *)pLastFrame;
+
+  // The residual may be written to a separate buffer, the source frame is only read from then.
+  const ptrdiff_t residualOffset = (__m128i *)pResidual - (__m128i *)pData;
+
+  size_t resXdiv16 = resX >> 4;
+  size_t halfFrameDiv16Quarter = resXdiv16 * resY >> 3;
+
+  __m128i *pCB0 = (__m128i *)pMainFrameY;
+  __m128i *pCB1 = (__m128i *)pCB0 + 1;
+
+  __m128i *pCB0_ = (__m128i *)pMainFrameY + resXdiv16 * (resY >> 1);
+  __m128i *pCB1_ = (__m128i *)pCB0_ + 1;
+
+  __m128i *pLF0 = (__m128i *)pLastFrameYUV;
+  __m128i *pLF1 = (__m128i *)pLF0 + 1;
+
+  __m128i *pLF0_ = (__m128i *)pLastFrameYUV + resXdiv16 * (resY >> 1);
+  __m128i *pLF1_ = (__m128i *)pLF0_ + 1;
+
+  __m128i half = { 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127 };
+  __m128i sad = _mm_setzero_si128();
+
+#ifdef SLAP_HIGH_QUALITY_DOWNSCALE
+  __m128i shuffle = { 0, 7, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 };
+#endif
+
+  const size_t stepSize = 2;
+  size_t itX = resX / (sizeof(__m128i) * stepSize);
+  size_t itY = resY >> 1;
+
+  for (size_t i = 0; i < 3; i++)
+  {
+    for (size_t y = 0; y < itY; y += 8)
+    {
+      for (size_t x = 0; x < itX; x++)
+      {
+        __m128i cb0 = _mm_load_si128(pCB0);
+        __m128i cb1 = _mm_load_si128(pCB1);
+        __m128i cb0_ = _mm_load_si128(pCB0_);
+        __m128i cb1_ = _mm_load_si128(pCB1_);
+
+        // SubBuffer
+        {
+#ifdef SLAP_HIGH_QUALITY_DOWNSCALE
+          __m128i v = _mm_shuffle_epi8(cb0, shuffle);
+#else
+          __m128i v = _mm_srli_si128(cb0, 7);
+#endif
+          *pSubFrameYUV = *(uint16_t *)&v;
+          pSubFrameYUV++;
+
+#ifdef SLAP_HIGH_QUALITY_DOWNSCALE
+          v = _mm_shuffle_epi8(cb1, shuffle);
+#else
+          v = _mm_srli_si128(cb1, 7);
+#endif
+          *pSubFrameYUV = *(uint16_t *)&v;
+          pSubFrameYUV++;
+        }
+
+        __m128i lf0 = _mm_load_si128(pLF0);
+        __m128i lf1 = _mm_load_si128(pLF1);
+        __m128i lf0_ = _mm_load_si128(pLF0_);
+        __m128i lf1_ = _mm_load_si128(pLF1_);
+
+        // last frame diff
+        cb0 = _mm_add_epi8(_mm_sub_epi8(lf0, cb0), half);
+        cb0_ = _mm_add_epi8(_mm_sub_epi8(lf0_, cb0_), half);
+        cb1 = _mm_add_epi8(_mm_sub_epi8(lf1, cb1), half);
+        cb1_ = _mm_add_epi8(_mm_sub_epi8(lf1_, cb1_), half);
+
+        _mm_store_si128(pCB0 + residualOffset, cb0);
+        _mm_store_si128(pCB1 + residualOffset, cb1);
+
+        sad = _mm_add_epi64(sad, _mm_add_epi64(_mm_sad_epu8(cb0, half), _mm_sad_epu8(cb1, half)));
+
+        // Stereo diff
+        cb0_ = _mm_add_epi8(_mm_sub_epi8(cb0_, cb0), half);
+        cb1_ = _mm_add_epi8(_mm_sub_epi8(cb1_, cb1), half);
+        _mm_store_si128(pCB0_ + residualOffset, cb0_);
+        _mm_store_si128(pCB1_ + residualOffset, cb1_);
+
+        pCB0 += stepSize;
+        pCB1 += stepSize;
+        pCB0_ += stepSize;
+        pCB1_ += stepSize;
+        pLF0 += stepSize;
+        pLF1 += stepSize;
+        pLF0_ += stepSize;
+        pLF1_ += stepSize;
+      }
+
+
+      for (size_t k = 0; k < 7; k++)
+      {
+        for (size_t x = 0; x < itX; x++)
+        {
+          __m128i cb0 = _mm_load_si128(pCB0);
+          __m128i cb1 = _mm_load_si128(pCB1);
+          __m128i cb0_ = _mm_load_si128(pCB0_);
+          __m128i cb1_ = _mm_load_si128(pCB1_);
+          __m128i lf0 = _mm_load_si128(pLF0);
+          __m128i lf1 = _mm_load_si128(pLF1);
+          __m128i lf0_ = _mm_load_si128(pLF0_);
+          __m128i lf1_ = _mm_load_si128(pLF1_);
+
+          // last frame diff
+          cb0 = _mm_add_epi8(_mm_sub_epi8(lf0, cb0), half);
+          cb0_ = _mm_add_epi8(_mm_sub_epi8(lf0_, cb0_), half);
+          cb1 = _mm_add_epi8(_mm_sub_epi8(lf1, cb1), half);
+          cb1_ = _mm_add_epi8(_mm_sub_epi8(lf1_, cb1_), half);
+
+          _mm_store_si128(pCB0 + residualOffset, cb0);
+          _mm_store_si128(pCB1 + residualOffset, cb1);
+
+          sad = _mm_add_epi64(sad, _mm_add_epi64(_mm_sad_epu8(cb0, half), _mm_sad_epu8(cb1, half)));
+
+          // Stereo diff
+          cb0_ = _mm_add_epi8(_mm_sub_epi8(cb0_, cb0), half);
+          cb1_ = _mm_add_epi8(_mm_sub_epi8(cb1_, cb1), half);
+          _mm_store_si128(pCB0_ + residualOffset, cb0_);
+          _mm_store_si128(pCB1_ + residualOffset, cb1_);
+
+          pCB0 += stepSize;
+          pCB1 += stepSize;
+          pCB0_ += stepSize;
+          pCB1_ += stepSize;
+          pLF0 += stepSize;
+          pLF1 += stepSize;
+          pLF0_ += stepSize;
+          pLF1_ += stepSize;
+        }
+      }
+    }
+
+    if (i == 0)
+    {
+      itX >>= 1;
+      itY >>= 1;
+    }
+
+    pCB0 = pCB0_;
+    pCB1 = pCB1_;
+    pCB0_ += halfFrameDiv16Quarter;
+    pCB1_ = pCB0_ + 1;
+    pLF0 = pLF0_;
+    pLF1 = pLF1_;
+    pLF0_ += halfFrameDiv16Quarter;
+    pLF1_ = pLF0_ + 1;
+  }
+
+  uint64_t sadParts[2];
+  _mm_storeu_si128((__m128i *)sadParts, sad);
+
+  return sadParts[0] + sadParts[1];
+}
+
+// Restores the original frame from the output of _slapLastFrameDiffAndStereoDiffAndSubBufferYUV420.
+void _slapUndoLastFrameDiffAndStereoDiffYUV420(IN void *pLastFrame, IN_OUT void *pData, const size_t resX, const size_t resY)
+{
+  size_t max = (resY * resX) >> 5;
+
+  __m128i *pCB0 = (__m128i *)pData;
+  __m128i *pCB0_ = (__m128i *)pData + max;
+  __m128i *pLF0 = (__m128i *)pLastFrame;
+  __m128i *pLF0_ = (__m128i *)pLastFrame + max;
+
+  __m128i half = { 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127 };
+
+  for (size_t i = 0; i < 3; i++)
+  {
+    for (size_t j = 0; j < max; j++)
+    {
+      __m128i cb0 = _mm_load_si128(pCB0);
+      __m128i cb0_ = _mm_load_si128(pCB0_);
+      __m128i lf0 = _mm_load_si128(pLF0);
+      __m128i lf0_ = _mm_load_si128(pLF0_);
+
+      // Stereo diff
+      cb0_ = _mm_sub_epi8(_mm_add_epi8(cb0_, cb0), half);
+
+      // Last frame diff
+      cb0 = _mm_add_epi8(_mm_sub_epi8(lf0, cb0), half);
+      cb0_ = _mm_add_epi8(_mm_sub_epi8(lf0_, cb0_), half);
+
+      _mm_store_si128(pCB0, cb0);
+      _mm_store_si128(pCB0_, cb0_);
+
+      pCB0++;
+      pCB0_++;
+      pLF0++;
+      pLF0_++;
+    }
+
+    if (i == 0)
+      max >>= 2;
+
+    pCB0 = pCB0_;
+    pLF0 = pLF0_;
+    pCB0_ += max;
+    pLF0_ += max;
+  }
+}
+
+void _slapCopyToLastFrameAndGenSubBufferAndStereoDiffYUV420(IN void *pData, OUT void *pResidual, OUT void *pLowResData, OUT void *pLastFrame, const size_t resX, const size_t resY)
+{
+  uint8_t *pMainFrameY = (uint8_t *)pData;
+  uint16_t *pSubFrameYUV = (uint16_t *)pLowResData;
+  __m128i *pLastFrameYUV = (__m128i *)pLastFrame;
+  const ptrdiff_t residualOffset = (__m128i *)pResidual - (__m128i *)pData;
+
+#define GREATER_OR_EQUAL_TO_6_BLOCKS
+#define GREATER_OR_EQUAL_TO_8_BLOCKS
+
+  size_t resXdiv16 = resX >> 4;
+  size_t halfFrameDiv16Quarter = resXdiv16 * resY >> 3;
+
+  __m128i *pCB0 = (__m128i *)pMainFrameY;
+  __m128i *pCB1 = pCB0 + 1;
+#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
+  __m128i *pCB2 = pCB0 + 2;
+#endif
+#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
+  __m128i *pCB3 = pCB0 + 3;
+#endif
+
+  __m128i *pCB0_ = (__m128i *)pMainFrameY + resXdiv16 * (resY >> 1);
+  __m128i *pCB1_ = pCB0_ + 1;
+#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
+  __m128i *pCB2_ = pCB0_ + 2;
+#endif
+#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
+  __m128i *pCB3_ = pCB0_ + 3;
+#endif
+
+  __m128i *pLF0 = (__m128i *)pLastFrameYUV;
+  __m128i *pLF1 = pLF0 + 1;
+#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
+  __m128i *pLF2 = pLF0 + 2;
+#endif
+#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
+  __m128i *pLF3 = pLF0 + 3;
+#endif
+
+  __m128i *pLF0_ = (__m128i *)pLastFrameYUV + resXdiv16 * (resY >> 1);
+  __m128i *pLF1_ = pLF0_ + 1;
+#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
+  __m128i *pLF2_ = pLF0_ + 2;
+#endif
+#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
+  __m128i *pLF3_ = pLF0_ + 3;
+#endif
+
+    __m128i half = { 118, 118, 118, 118, 118, 118, 118, 118, 118, 118, 118, 118, 118, 118, 118, 118 };
+
+#ifdef SLAP_HIGH_QUALITY_DOWNSCALE
+  __m128i shuffle = { 0, 7, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 };
+#endif
+
+#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
+  const size_t stepSize = 4;
+#else
+#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
+  const size_t stepSize = 3;
+#else
+  const size_t stepSize = 2;
+#endif
+#endif
+
+  size_t itX = resX / (sizeof(__m128i) * stepSize);
+  size_t itY = resY >> 1;
+
+  for (size_t i = 0; i < 3; i++)
+  {
+    for (size_t y = 0; y < itY; y += 8)
+    {
+      for (size_t x = 0; x < itX; x++)
+      {
+        __m128i cb0 = _mm_load_si128(pCB0);
+        __m128i cb1 = _mm_load_si128(pCB1);
+#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
+        __m128i cb2 = _mm_load_si128(pCB2);
+#endif
+#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
+        __m128i cb3 = _mm_load_si128(pCB3);
+#endif
+
+        // SubBuffer
+        {
+#ifdef SLAP_HIGH_QUALITY_DOWNSCALE
+          __m128i v = _mm_shuffle_epi8(cb0, shuffle);
+#else
+          __m128i v = _mm_srli_si128(cb0, 7);
+#endif
+          *pSubFrameYUV = *(uint16_t *)&v;
+          pSubFrameYUV++;
+
+#ifdef SLAP_HIGH_QUALITY_DOWNSCALE
+          v = _mm_shuffle_epi8(cb1, shuffle);
+#else
+          v = _mm_srli_si128(cb1, 7);
+#endif
+          *pSubFrameYUV = *(uint16_t *)&v;
+          pSubFrameYUV++;
+
+#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
+#ifdef SLAP_HIGH_QUALITY_DOWNSCALE
+          v = _mm_shuffle_epi8(cb2, shuffle);
+#else
+          v = _mm_srli_si128(cb2, 7);
+#endif
+          *pSubFrameYUV = *(uint16_t *)&v;
+          pSubFrameYUV++;
+#endif
+
+#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
+#ifdef SLAP_HIGH_QUALITY_DOWNSCALE
+          v = _mm_shuffle_epi8(cb3, shuffle);
+#else
+          v = _mm_srli_si128(cb3, 7);
+#endif
+          *pSubFrameYUV = *(uint16_t *)&v;
+          pSubFrameYUV++;
+#endif
+        }
+
+        __m128i cb0_ = _mm_load_si128(pCB0_);
+        __m128i cb1_ = _mm_load_si128(pCB1_);
+#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
+        __m128i cb2_ = _mm_load_si128(pCB2_);
+#endif
+#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
+        __m128i cb3_ = _mm_load_si128(pCB3_);
+#endif
+
+        // Copy to last frame
+        _mm_store_si128(pLF0, cb0);
+        _mm_store_si128(pLF1, cb1);
+#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
+        _mm_store_si128(pLF2, cb2);
+#endif
+#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
+        _mm_store_si128(pLF3, cb3);
+#endif
+        _mm_store_si128(pLF0_, cb0_);
+        _mm_store_si128(pLF1_, cb1_);
+#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
+        _mm_store_si128(pLF2_, cb2_);
+#endif
+#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
+        _mm_store_si128(pLF3_, cb3_);
+#endif
+
+        // The top eye is stored as is (only required if the residual isn't written in place).
+        if (residualOffset != 0)
+        {
+          _mm_store_si128(pCB0 + residualOffset, cb0);
+          _mm_store_si128(pCB1 + residualOffset, cb1);
+#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
+          _mm_store_si128(pCB2 + residualOffset, cb2);
+#endif
+#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
+          _mm_store_si128(pCB3 + residualOffset, cb3);
+#endif
+        }
+
+        // Stereo diff
+        cb0_ = _mm_add_epi8(_mm_sub_epi8(cb0_, cb0), half);
+        cb1_ = _mm_add_epi8(_mm_sub_epi8(cb1_, cb1), half);
+#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
+        cb2_ = _mm_add_epi8(_mm_sub_epi8(cb2_, cb2), half);
+#endif
+#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
+        cb3_ = _mm_add_epi8(_mm_sub_epi8(cb3_, cb3), half);
+#endif
+        _mm_store_si128(pCB0_ + residualOffset, cb0_);
+        _mm_store_si128(pCB1_ + residualOffset, cb1_);
+#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
+        _mm_store_si128(pCB2_ + residualOffset, cb2_);
+#endif
+#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
+        _mm_store_si128(pCB3_ + residualOffset, cb3_);
+#endif
+
+        pCB0 += stepSize;
+        pCB1 += stepSize;
+#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
+        pCB2 += stepSize;
+#endif
+#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
+        pCB3 += stepSize;
+#endif
+        pCB0_ += stepSize;
+        pCB1_ += stepSize;
+#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
+        pCB2_ += stepSize;
+#endif
+#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
+        pCB3_ += stepSize;
+#endif
+        pLF0 += stepSize;
+        pLF1 += stepSize;
+#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
+        pLF2 += stepSize;
+#endif
+#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
+        pLF3 += stepSize;
+#endif
+        pLF0_ += stepSize;
+        pLF1_ += stepSize;
+#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
+        pLF2_ += stepSize;
+#endif
+#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
+        pLF3_ += stepSize;
+#endif
+      }
+
+
+      for (size_t k = 0; k < 7; k++)
+      {
+        for (size_t x = 0; x < itX; x++)
+        {
+          __m128i cb0 = _mm_load_si128(pCB0);
+          __m128i cb1 = _mm_load_si128(pCB1);
+#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
+          __m128i cb2 = _mm_load_si128(pCB2);
+#endif
+#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
+          __m128i cb3 = _mm_load_si128(pCB3);
+#endif
+          __m128i cb0_ = _mm_load_si128(pCB0_);
+          __m128i cb1_ = _mm_load_si128(pCB1_);
+#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
+          __m128i cb2_ = _mm_load_si128(pCB2_);
+#endif
+#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
+          __m128i cb3_ = _mm_load_si128(pCB3_);
+#endif
+
+          // Copy to last frame
+          _mm_store_si128(pLF0, cb0);
+          _mm_store_si128(pLF1, cb1);
+#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
+          _mm_store_si128(pLF2, cb2);
+#endif
+#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
+          _mm_store_si128(pLF3, cb3);
+#endif
+          _mm_store_si128(pLF0_, cb0_);
+          _mm_store_si128(pLF1_, cb1_);
+#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
+          _mm_store_si128(pLF2_, cb2_);
+#endif
+#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
+          _mm_store_si128(pLF3_, cb3_);
+#endif
+
+          // The top eye is stored as is (only required if the residual isn't written in place).
+          if (residualOffset != 0)
+          {
+            _mm_store_si128(pCB0 + residualOffset, cb0);
+            _mm_store_si128(pCB1 + residualOffset, cb1);
+#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
+            _mm_store_si128(pCB2 + residualOffset, cb2);
+#endif
+#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
+            _mm_store_si128(pCB3 + residualOffset, cb3);
+#endif
+          }
+
+          // Stereo diff
+          cb0_ = _mm_add_epi8(_mm_sub_epi8(cb0_, cb0), half);
+          cb1_ = _mm_add_epi8(_mm_sub_epi8(cb1_, cb1), half);
+#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
+          cb2_ = _mm_add_epi8(_mm_sub_epi8(cb2_, cb2), half);
+#endif
+#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
+          cb3_ = _mm_add_epi8(_mm_sub_epi8(cb3_, cb3), half);
+#endif
+          _mm_store_si128(pCB0_ + residualOffset, cb0_);
+          _mm_store_si128(pCB1_ + residualOffset, cb1_);
+#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
+          _mm_store_si128(pCB2_ + residualOffset, cb2_);
+#endif
+#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
+          _mm_store_si128(pCB3_ + residualOffset, cb3_);
+#endif
+
+          pCB0 += stepSize;
+          pCB1 += stepSize;
+#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
+          pCB2 += stepSize;
+#endif
+#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
+          pCB3 += stepSize;
+#endif
+          pCB0_ += stepSize;
+          pCB1_ += stepSize;
+#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
+          pCB2_ += stepSize;
+#endif
+#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
+          pCB3_ += stepSize;
+#endif
+          pLF0 += stepSize;
+          pLF1 += stepSize;
+#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
+          pLF2 += stepSize;
+#endif
+#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
+          pLF3 += stepSize;
+#endif
+          pLF0_ += stepSize;
+          pLF1_ += stepSize;
+#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
+          pLF2_ += stepSize;
+#endif
+#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
+          pLF3_ += stepSize;
+#endif
+        }
+      }
+    }
+
+    if (i == 0)
+    {
+      itX >>= 1;
+      itY >>= 1;
+
+      __m128i tmp = { 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127 };
+      half = tmp;
+    }
+
+    pCB0 = pCB0_;
+    pCB1 = pCB1_;
+#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
+    pCB2 = pCB2_;
+#endif
+#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
+    pCB3 = pCB3_;
+#endif
+    pCB0_ += halfFrameDiv16Quarter;
+    pCB1_ = pCB0_ + 1;
+#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
+    pCB2_ = pCB0_ + 2;
+#endif
+#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
+    pCB3_ = pCB0_ + 3;
+#endif
+    pLF0 = pLF0_;
+    pLF1 = pLF1_;
+#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
+    pLF2 = pLF2_;
+#endif
+#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
+    pLF3 = pLF3_;
+#endif
+    pLF0_ += halfFrameDiv16Quarter;
+    pLF1_ = pLF0_ + 1;
+#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
+    pLF2_ = pLF0_ + 2;
+#endif
+#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
+    pLF3_ = pLF0_ + 3;
+#endif
+  }
+
+#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
+#undef GREATER_OR_EQUAL_TO_6_BLOCKS
+#endif
+#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
+#undef GREATER_OR_EQUAL_TO_8_BLOCKS
+#endif
+}
+
+void _slapAddStereoDiffYUV420(IN_OUT void *pData, const size_t resX, const size_t resY)
+{
+  uint8_t *pMainFrameY = (uint8_t *)pData;
+
+#define GREATER_OR_EQUAL_TO_6_BLOCKS
+#define GREATER_OR_EQUAL_TO_8_BLOCKS
+
+  size_t resXdiv16 = resX >> 4;
+
+  __m128i *pCB0 = (__m128i *)pMainFrameY;
+  __m128i *pCB1 = pCB0 + 1;
+  __m128i *pCB2 = pCB0 + 2;
+  __m128i *pCB3 = pCB0 + 3;
+#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
+  __m128i *pCB4 = pCB0 + 4;
+  __m128i *pCB5 = pCB0 + 5;
+#endif
+#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
+  __m128i *pCB6 = pCB0 + 6;
+  __m128i *pCB7 = pCB0 + 7;
+#endif
+
+  __m128i *pCB0_ = (__m128i *)pMainFrameY + resXdiv16 * (resY >> 1);
+  __m128i *pCB1_ = pCB0_ + 1;
+  __m128i *pCB2_ = pCB0_ + 2;
+  __m128i *pCB3_ = pCB0_ + 3;
+#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
+  __m128i *pCB4_ = pCB0_ + 4;
+  __m128i *pCB5_ = pCB0_ + 5;
+#endif
+#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
+  __m128i *pCB6_ = pCB0_ + 6;
+  __m128i *pCB7_ = pCB0_ + 7;
+#endif
+
+  __m128i halfY = { 118, 118, 118, 118, 118, 118, 118, 118, 118, 118, 118, 118, 118, 118, 118, 118 };
+  __m128i halfUV = { 126, 126, 126, 126, 126, 126, 126, 126, 126, 126, 126, 126, 126, 126, 126, 126 };
+
+#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
+  const size_t stepSize = 8;
+#else
+#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
+  const size_t stepSize = 6;
+#else
+  const size_t stepSize = 4;
+#endif
+#endif
+
+  const size_t lumaX = resX / (sizeof(__m128i) * stepSize);
+  const size_t chromaX = lumaX >> 1;
+
+  for (size_t y = 0; y < (resY >> 1); y++)
+  {
+    for (size_t x = 0; x < lumaX; x++)
+    {
+      __m128i cb0 = _mm_load_si128(pCB0);
+      __m128i cb1 = _mm_load_si128(pCB1);
+      __m128i cb2 = _mm_load_si128(pCB2);
+      __m128i cb3 = _mm_load_si128(pCB3);
+#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
+      __m128i cb4 = _mm_load_si128(pCB4);
+      __m128i cb5 = _mm_load_si128(pCB5);
+#endif
+#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
+      __m128i cb6 = _mm_load_si128(pCB6);
+      __m128i cb7 = _mm_load_si128(pCB7);
+#endif
+
+      __m128i cb0_ = _mm_load_si128(pCB0_);
+      __m128i cb1_ = _mm_load_si128(pCB1_);
+      __m128i cb2_ = _mm_load_si128(pCB2_);
+      __m128i cb3_ = _mm_load_si128(pCB3_);
+#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
+      __m128i cb4_ = _mm_load_si128(pCB4_);
+      __m128i cb5_ = _mm_load_si128(pCB5_);
+#endif
+#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
+      __m128i cb6_ = _mm_load_si128(pCB6_);
+      __m128i cb7_ = _mm_load_si128(pCB7_);
+#endif
+
+      // Add stereo diff.
+      cb0_ = _mm_add_epi8(_mm_sub_epi8(cb0_, halfY), cb0);
+      cb1_ = _mm_add_epi8(_mm_sub_epi8(cb1_, halfY), cb1);
+      cb2_ = _mm_add_epi8(_mm_sub_epi8(cb2_, halfY), cb2);
+      cb3_ = _mm_add_epi8(_mm_sub_epi8(cb3_, halfY), cb3);
+#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
+      cb4_ = _mm_add_epi8(_mm_sub_epi8(cb4_, halfY), cb4);
+      cb5_ = _mm_add_epi8(_mm_sub_epi8(cb5_, halfY), cb5);
+#endif
+#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
+      cb6_ = _mm_add_epi8(_mm_sub_epi8(cb6_, halfY), cb6);
+      cb7_ = _mm_add_epi8(_mm_sub_epi8(cb7_, halfY), cb7);
+#endif
+
+      _mm_store_si128(pCB0_, cb0_);
+      _mm_store_si128(pCB1_, cb1_);
+      _mm_store_si128(pCB2_, cb2_);
+      _mm_store_si128(pCB3_, cb3_);
+#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
+      _mm_store_si128(pCB4_, cb4_);
+      _mm_store_si128(pCB5_, cb5_);
+#endif
+#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
+      _mm_store_si128(pCB6_, cb6_);
+      _mm_store_si128(pCB7_, cb7_);
+#endif
+
+      pCB0 += stepSize;
+      pCB1 += stepSize;
+      pCB2 += stepSize;
+      pCB3 += stepSize;
+#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
+      pCB4 += stepSize;
+      pCB5 += stepSize;
+#endif
+#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
+      pCB6 += stepSize;
+      pCB7 += stepSize;
+#endif
+      pCB0_ += stepSize;
+      pCB1_ += stepSize;
+      pCB2_ += stepSize;
+      pCB3_ += stepSize;
+#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
+      pCB4_ += stepSize;
+      pCB5_ += stepSize;
+#endif
+#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
+      pCB6_ += stepSize;
+      pCB7_ += stepSize;
+#endif
+    }
+  }
+
+  size_t halfFrameDiv16Quarter = resXdiv16 * resY >> 3;
+
+  int first = 1;
+chromaSubSampleBuffer:
+
+  pCB0 = pCB0_;
+  pCB1 = pCB0 + 1;
+  pCB2 = pCB0 + 2;
+  pCB3 = pCB0 + 3;
+#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
+  pCB4 = pCB0 + 4;
+  pCB5 = pCB0 + 5;
+#endif
+#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
+  pCB6 = pCB0 + 6;
+  pCB7 = pCB0 + 7;
+#endif
+
+  pCB0_ += halfFrameDiv16Quarter;
+  pCB1_ = pCB0_ + 1;
+  pCB2_ = pCB0_ + 2;
+  pCB3_ = pCB0_ + 3;
+#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
+  pCB4_ = pCB0_ + 4;
+  pCB5_ = pCB0_ + 5;
+#endif
+#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
+  pCB6_ = pCB0_ + 6;
+  pCB7_ = pCB0_ + 7;
+#endif
+
+  for (size_t y = 0; y < (resY >> 2); y++)
+  {
+    for (size_t x = 0; x < chromaX; x++)
+    {
+      __m128i cb0 = _mm_load_si128(pCB0);
+      __m128i cb1 = _mm_load_si128(pCB1);
+      __m128i cb2 = _mm_load_si128(pCB2);
+      __m128i cb3 = _mm_load_si128(pCB3);
+#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
+      __m128i cb4 = _mm_load_si128(pCB4);
+      __m128i cb5 = _mm_load_si128(pCB5);
+#endif
+#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
+      __m128i cb6 = _mm_load_si128(pCB6);
+      __m128i cb7 = _mm_load_si128(pCB7);
+#endif
+
+      __m128i cb0_ = _mm_load_si128(pCB0_);
+      __m128i cb1_ = _mm_load_si128(pCB1_);
+      __m128i cb2_ = _mm_load_si128(pCB2_);
+      __m128i cb3_ = _mm_load_si128(pCB3_);
+#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
+      __m128i cb4_ = _mm_load_si128(pCB4_);
+      __m128i cb5_ = _mm_load_si128(pCB5_);
+#endif
+#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
+      __m128i cb6_ = _mm_load_si128(pCB6_);
+      __m128i cb7_ = _mm_load_si128(pCB7_);
+#endif
+
+      // Add stereo diff.
+      cb0_ = _mm_add_epi8(_mm_sub_epi8(cb0_, halfUV), cb0);
+      cb1_ = _mm_add_epi8(_mm_sub_epi8(cb1_, halfUV), cb1);
+      cb2_ = _mm_add_epi8(_mm_sub_epi8(cb2_, halfUV), cb2);
+      cb3_ = _mm_add_epi8(_mm_sub_epi8(cb3_, halfUV), cb3);
+#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
+      cb4_ = _mm_add_epi8(_mm_sub_epi8(cb4_, halfUV), cb4);
+      cb5_ = _mm_add_epi8(_mm_sub_epi8(cb5_, halfUV), cb5);
+#endif
+#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
+      cb6_ = _mm_add_epi8(_mm_sub_epi8(cb6_, halfUV), cb6);
+      cb7_ = _mm_add_epi8(_mm_sub_epi8(cb7_, halfUV), cb7);
+#endif
+
+      _mm_store_si128(pCB0_, cb0_);
+      _mm_store_si128(pCB1_, cb1_);
+      _mm_store_si128(pCB2_, cb2_);
+      _mm_store_si128(pCB3_, cb3_);
+#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
+      _mm_store_si128(pCB4_, cb4_);
+      _mm_store_si128(pCB5_, cb5_);
+#endif
+#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
+      _mm_store_si128(pCB6_, cb6_);
+      _mm_store_si128(pCB7_, cb7_);
+#endif
+
+      pCB0 += stepSize;
+      pCB1 += stepSize;
+      pCB2 += stepSize;
+      pCB3 += stepSize;
+#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
+      pCB4 += stepSize;
+      pCB5 += stepSize;
+#endif
+#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
+      pCB6 += stepSize;
+      pCB7 += stepSize;
+#endif
+      pCB0_ += stepSize;
+      pCB1_ += stepSize;
+      pCB2_ += stepSize;
+      pCB3_ += stepSize;
+#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
+      pCB4_ += stepSize;
+      pCB5_ += stepSize;
+#endif
+#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
+      pCB6_ += stepSize;
+      pCB7_ += stepSize;
+#endif
+    }
+  }
+
+  if (first)
+  {
+    first = 0;
+    goto chromaSubSampleBuffer;
+  }
+
+
+#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
+#undef GREATER_OR_EQUAL_TO_6_BLOCKS
+#endif
+#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
+#undef GREATER_OR_EQUAL_TO_8_BLOCKS
+#endif
+}
+
+void _slapAddStereoDiffYUV420AndCopyToLastFrame(IN_OUT void * pData, OUT void * pLastFrame, const size_t resX, const size_t resY)
+{
+  size_t max = (resY * resX) >> 5;
+
+  __m128i *pCB0 = (__m128i *)pData;
+  __m128i *pCB0_ = (__m128i *)pData + max;
+  __m128i *pLF0 = (__m128i *)pLastFrame;
+  __m128i *pLF0_ = (__m128i *)pLastFrame + max;
+
+  __m128i halfY = { 118, 118, 118, 118, 118, 118, 118, 118, 118, 118, 118, 118, 118, 118, 118, 118 };
+  __m128i halfUV = { 126, 126, 126, 126, 126, 126, 126, 126, 126, 126, 126, 126, 126, 126, 126, 126 };
+
+  for (size_t i = 0; i < max; i++)
+  {
+    __m128i cb0 = _mm_load_si128(pCB0);
+    _mm_store_si128(pLF0, cb0);
+
+    __m128i cb0_ = _mm_load_si128(pCB0_);
+    cb0_ = _mm_add_epi8(_mm_sub_epi8(cb0_, halfY), cb0);
+
+    _mm_store_si128(pCB0_, cb0_);
+    _mm_store_si128(pLF0_, cb0_);
+
+    pCB0++;
+    pCB0_++;
+    pLF0++;
+    pLF0_++;
+  }
+
+  max >>= 2;
+  pCB0 = pCB0_;
+  pLF0 = pLF0_;
+  pCB0_ += max;
+  pLF0_ += max;
+
+  for (size_t i = 0; i < max; i++)
+  {
+    __m128i cb0 = _mm_load_si128(pCB0);
+    _mm_store_si128(pLF0, cb0);
+
+    __m128i cb0_ = _mm_load_si128(pCB0_);
+    cb0_ = _mm_add_epi8(_mm_sub_epi8(cb0_, halfUV), cb0);
+
+    _mm_store_si128(pCB0_, cb0_);
+    _mm_store_si128(pLF0_, cb0_);
+
+    pCB0++;
+    pCB0_++;
+    pLF0++;
+    pLF0_++;
+  }
+
+  pCB0 = pCB0_;
+  pLF0 = pLF0_;
+  pCB0_ += max;
+  pLF0_ += max;
+
+  for (size_t i = 0; i < max; i++)
+  {
+    __m128i cb0 = _mm_load_si128(pCB0);
+    _mm_store_si128(pLF0, cb0);
+
+    __m128i cb0_ = _mm_load_si128(pCB0_);
+    cb0_ = _mm_add_epi8(_mm_sub_epi8(cb0_, halfUV), cb0);
+
+    _mm_store_si128(pCB0_, cb0_);
+    _mm_store_si128(pLF0_, cb0_);
+
+    pCB0++;
+    pCB0_++;
+    pLF0++;
+    pLF0_++;
+  }
+}
+
+uint8_t _slapGetStaticSubFrameValue(const size_t subFrameRow, const size_t subFrameRows)
+{
+  // The residual that results in the last frame being repeated (see _slapAddStereoDiffYUV420AndAddLastFrameDiff). Only the top half of the luma plane is 127.
+  return subFrameRow < subFrameRows / 3 ? 127 : 126;
+}
+
+size_t _slapGetMotionBlockCount(const mode mode, const size_t resX, const size_t resY, const size_t subFrameRows, const size_t subFrameColumns, const size_t subFrameIndex)
+{
+  // Only the sub frames of the top eye luma store motion vectors.
+  if (!mode.flags.motionCompensation || subFrameIndex >= subFrameRows / 3 * subFrameColumns)
+    return 0;
+
+  const size_t blocksX = resX / subFrameColumns / SLAP_MOTION_BLOCK_WIDTH;
+  const size_t blocksY = resY * 3 / 2 / subFrameRows / SLAP_MOTION_BLOCK_HEIGHT;
+
+  return blocksX * blocksY;
+}
+
+size_t _slapPackMotionVectors(IN const int8_t *pMotionVectors, const size_t blockCount, OUT uint8_t *pRecord)
+{
+  const size_t mapSize = _slapGetMotionBlockMapSize(blockCount);
+  int8_t *pPacked = (int8_t *)(pRecord + mapSize);
+
+  memset(pRecord, 0, mapSize);
+
+  for (size_t i = 0; i < blockCount; i++)
+  {
+    if (pMotionVectors[i * 2] || pMotionVectors[i * 2 + 1])
+    {
+      pRecord[i >> 3] |= (uint8_t)(1 << (i & 7));
+      *pPacked++ = pMotionVectors[i * 2];
+      *pPacked++ = pMotionVectors[i * 2 + 1];
+    }
+  }
+
+  return (uint8_t *)pPacked - pRecord;
+}
+
+// Returns the size of the motion vector record or zero if it's invalid.
+size_t _slapUnpackMotionVectors(IN const uint8_t *pRecord, const size_t recordSize, const size_t blockCount, OUT int8_t *pMotionVectors)
+{
+  const size_t mapSize = _slapGetMotionBlockMapSize(blockCount);
+  size_t size = mapSize;
+
+  if (recordSize < mapSize)
+    return 0;
+
+  for (size_t i = 0; i < blockCount; i++)
+  {
+    if (pRecord[i >> 3] & (1 << (i & 7)))
+    {
+      if (size + 2 > recordSize)
+        return 0;
+
+      pMotionVectors[i * 2] = (int8_t)pRecord[size];
+      pMotionVectors[i * 2 + 1] = (int8_t)pRecord[size + 1];
+      size += 2;
+    }
+    else
+    {
+      pMotionVectors[i * 2] = 0;
+      pMotionVectors[i * 2 + 1] = 0;
+    }
+  }
+
+  return size;
+}
+
+#define SLAP_MOTION_VECTOR_COST 64
+
+size_t _slapGetMotionBlockMapSize(const size_t blockCount)
+{
+  return (blockCount + 7) / 8;
+}
+
+size_t _slapGetMotionVectorRecordCapacity(const size_t blockCount)
+{
+  return _slapGetMotionBlockMapSize(blockCount) + blockCount * 2;
+}
+
+inline uint32_t _slapGetMotionBlockSad(IN const uint8_t *pReference, const size_t stride, IN const __m128i *pBlock)
+{
+  __m128i sad = _mm_setzero_si128();
+
+  for (size_t y = 0; y < SLAP_MOTION_BLOCK_HEIGHT; y++)
+    sad = _mm_add_epi64(sad, _mm_sad_epu8(_mm_loadu_si128((const __m128i *)(pReference + y * stride)), pBlock[y]));
+
+  return (uint32_t)(_mm_cvtsi128_si32(sad) + _mm_extract_epi16(sad, 4));
+}
+
+void _slapEstimateMotion(IN const void *pLastFrame, IN const void *pData, OUT int8_t *pMotionVectors, const size_t resX, const size_t resY, const size_t subFrameRows, const size_t subFrameColumns, const int searchRange)
+{
+  const uint8_t *pLast = (const uint8_t *)pLastFrame;
+  const uint8_t *pCurrent = (const uint8_t *)pData;
+  const size_t subFrameWidth = resX / subFrameColumns;
+  const size_t subFrameHeight = resY * 3 / 2 / subFrameRows;
+  const size_t blocksX = subFrameWidth / SLAP_MOTION_BLOCK_WIDTH;
+  const size_t blocksY = subFrameHeight / SLAP_MOTION_BLOCK_HEIGHT;
+  const int maxX = (int)(resX - SLAP_MOTION_BLOCK_WIDTH);
+  const int maxY = (int)(resY / 2 - SLAP_MOTION_BLOCK_HEIGHT);
+  const int range = searchRange < 0 ? 0 : (searchRange > 127 ? 127 : searchRange);
+
+  // Full search in the top eye luma, the motion vectors are stored in the order of the sub frames.
+  for (size_t subFrame = 0; subFrame < subFrameRows / 3 * subFrameColumns; subFrame++)
+  {
+    for (size_t by = 0; by < blocksY; by++)
+    {
+      for (size_t bx = 0; bx < blocksX; bx++)
+      {
+        const int x = (int)((subFrame % subFrameColumns) * subFrameWidth + bx * SLAP_MOTION_BLOCK_WIDTH);
+        const int y = (int)((subFrame / subFrameColumns) * subFrameHeight + by * SLAP_MOTION_BLOCK_HEIGHT);
+        __m128i block[SLAP_MOTION_BLOCK_HEIGHT];
+
+        for (size_t i = 0; i < SLAP_MOTION_BLOCK_HEIGHT; i++)
+          block[i] = _mm_load_si128((const __m128i *)(pCurrent + (y + i) * resX + x));
+
+        // Zero motion wins ties, so that static content stays static.
+        uint32_t bestSad = _slapGetMotionBlockSad(pLast + y * resX + x, resX, block);
+        int bestX = 0;
+        int bestY = 0;
+
+        const int startY = y - range < 0 ? -y : -range;
+        const int endY = y + range > maxY ? maxY - y : range;
+        const int startX = x - range < 0 ? -x : -range;
+        const int endX = x + range > maxX ? maxX - x : range;
+
+        uint32_t bestCost = bestSad;
+
+        for (int dy = startY; dy <= endY && bestSad; dy++)
+        {
+          for (int dx = startX; dx <= endX; dx++)
+          {
+            if (dx == 0 && dy == 0)
+              continue;
+
+            // Longer motion vectors have to pay off (they're more likely to just match noise and cost 2 bytes to store).
+            const uint32_t sad = _slapGetMotionBlockSad(pLast + (y + dy) * resX + x + dx, resX, block);
+            const uint32_t cost = sad + SLAP_MOTION_VECTOR_COST * (uint32_t)(1 + abs(dx) + abs(dy));
+
+            if (cost < bestCost)
+            {
+              bestSad = sad;
+              bestCost = cost;
+              bestX = dx;
+              bestY = dy;
+            }
+          }
+        }
+
+        pMotionVectors[0] = (int8_t)bestX;
+        pMotionVectors[1] = (int8_t)bestY;
+        pMotionVectors += 2;
+      }
+    }
+  }
+}
+
+// resX & resY are the scaled resolution of scaled decoders (the motion vectors have to be scaled already, see _slapDecoder_ReadSubFramePrefix).
+void _slapMotionCompensateYUV420(IN const void *pLastFrame, OUT void *pPrediction, IN const int8_t *pMotionVectors, const size_t resX, const size_t resY, const size_t subFrameRows, const size_t subFrameColumns, const size_t scaleShift)
+{
+  const uint8_t *pLast = (const uint8_t *)pLastFrame;
+  uint8_t *pPredicted = (uint8_t *)pPrediction;
+  const size_t blockWidth = SLAP_MOTION_BLOCK_WIDTH >> scaleShift;
+  const size_t blockHeight = SLAP_MOTION_BLOCK_HEIGHT >> scaleShift;
+  const size_t subFrameWidth = resX / subFrameColumns;
+  const size_t subFrameHeight = resY * 3 / 2 / subFrameRows;
+  const size_t blocksX = subFrameWidth / blockWidth;
+  const size_t blocksY = subFrameHeight / blockHeight;
+  const int maxX = (int)(resX - blockWidth);
+  const int maxY = (int)(resY / 2 - blockHeight);
+  const size_t eyeSizeY = resX * resY / 2;
+  const size_t resXUV = resX / 2;
+  const size_t eyeSizeUV = resXUV * resY / 4;
+  const size_t planeOffsetsUV[4] = { resX * resY, resX * resY + eyeSizeUV, resX * resY * 5 / 4, resX * resY * 5 / 4 + eyeSizeUV };
+
+  for (size_t subFrame = 0; subFrame < subFrameRows / 3 * subFrameColumns; subFrame++)
+  {
+    for (size_t by = 0; by < blocksY; by++)
+    {
+      for (size_t bx = 0; bx < blocksX; bx++)
+      {
+        const int x = (int)((subFrame % subFrameColumns) * subFrameWidth + bx * blockWidth);
+        const int y = (int)((subFrame / subFrameColumns) * subFrameHeight + by * blockHeight);
+
+        // Motion vectors that point outside of the frame can only come from broken files.
+        int dx = pMotionVectors[0];
+        int dy = pMotionVectors[1];
+        pMotionVectors += 2;
+
+        if (x + dx < 0) dx = -x;
+        else if (x + dx > maxX) dx = maxX - x;
+
+        if (y + dy < 0) dy = -y;
+        else if (y + dy > maxY) dy = maxY - y;
+
+        // Luma of both eyes.
+        for (size_t eye = 0; eye < 2; eye++)
+        {
+          const uint8_t *pSource = pLast + eye * eyeSizeY + (y + dy) * resX + x + dx;
+          uint8_t *pTarget = pPredicted + eye * eyeSizeY + y * resX + x;
+
+          if (scaleShift == 0)
+            for (size_t i = 0; i < SLAP_MOTION_BLOCK_HEIGHT; i++)
+              _mm_store_si128((__m128i *)(pTarget + i * resX), _mm_loadu_si128((const __m128i *)(pSource + i * resX)));
+          else
+            for (size_t i = 0; i < blockHeight; i++)
+              memcpy(pTarget + i * resX, pSource + i * resX, blockWidth);
+        }
+
+        // Chroma of both eyes at half the resolution (with the motion vector rounded down).
+        for (size_t plane = 0; plane < 4; plane++)
+        {
+          const uint8_t *pSource = pLast + planeOffsetsUV[plane] + (y / 2 + (dy >> 1)) * resXUV + x / 2 + (dx >> 1);
+          uint8_t *pTarget = pPredicted + planeOffsetsUV[plane] + (y / 2) * resXUV + x / 2;
+
+          if (scaleShift == 0)
+            for (size_t i = 0; i < SLAP_MOTION_BLOCK_HEIGHT / 2; i++)
+              _mm_storel_epi64((__m128i *)(pTarget + i * resXUV), _mm_loadl_epi64((const __m128i *)(pSource + i * resXUV)));
+          else
+            for (size_t i = 0; i < blockHeight / 2; i++)
+              memcpy(pTarget + i * resXUV, pSource + i * resXUV, blockWidth / 2);
+        }
+      }
+    }
+  }
+}
+
+#define SLAP_GLOBAL_MOTION_LINE_STEP 8
+
+uint64_t _slapGetLineSad(IN const uint8_t *pA, IN const uint8_t *pB, const size_t count)
+{
+  __m128i sad = _mm_setzero_si128();
+  size_t x = 0;
+
+  for (; x + 16 <= count; x += 16)
+    sad = _mm_add_epi64(sad, _mm_sad_epu8(_mm_loadu_si128((const __m128i *)(pA + x)), _mm_loadu_si128((const __m128i *)(pB + x))));
+
+  uint64_t sum = (uint64_t)(_mm_cvtsi128_si32(sad) + _mm_extract_epi16(sad, 4));
+
+  for (; x < count; x++)
+    sum += (uint64_t)abs((int)pA[x] - (int)pB[x]);
+
+  return sum;
+}
+
+// The shift (with the last frame being shifted cyclically along the x axis by that many pixels to the left) with the smallest SAD of every SLAP_GLOBAL_MOTION_LINE_STEP-th line of the top eye luma.
+int _slapEstimateGlobalShift(IN const void *pLastFrame, IN const void *pData, const size_t resX, const size_t resY, const int searchRange)
+{
+  const uint8_t *pLast = (const uint8_t *)pLastFrame;
+  const uint8_t *pCurrent = (const uint8_t *)pData;
+  const int range = searchRange < 0 ? 0 : (searchRange >= (int)resX / 2 ? (int)resX / 2 - 1 : searchRange);
+
+  uint64_t bestSad = UINT64_MAX;
+  int bestShift = 0;
+
+  // No shift wins ties.
+  for (int i = 0; i <= range * 2 && bestSad; i++)
+  {
+    const int shift = (i & 1) ? -((i + 1) >> 1) : (i >> 1);
+    const size_t offset = (size_t)(shift < 0 ? (int)resX + shift : shift);
+    uint64_t sad = 0;
+
+    for (size_t y = 0; y < resY / 2 && sad < bestSad; y += SLAP_GLOBAL_MOTION_LINE_STEP)
+    {
+      const uint8_t *pLine = pCurrent + y * resX;
+      const uint8_t *pLastLine = pLast + y * resX;
+
+      sad += _slapGetLineSad(pLine, pLastLine + offset, resX - offset);
+      sad += _slapGetLineSad(pLine + resX - offset, pLastLine, offset);
+    }
+
+    if (sad < bestSad)
+    {
+      bestSad = sad;
+      bestShift = shift;
+    }
+  }
+
+  return bestShift;
+}
+
+// shift is given at full resolution, width is scaled.
+void _slapShiftLines(IN const uint8_t *pSource, OUT uint8_t *pTarget, const size_t width, const size_t lines, const int shift, const size_t scaleShift)
+{
+  const size_t offset = (size_t)(((shift >> scaleShift) % (int)width + (int)width) % (int)width);
+  const int fraction = shift & ((1 << scaleShift) - 1);
+
+  // Scaled decoders interpolate between the neighbouring pixels, as rounding the shift would drift until the next I-Frame.
+  if (fraction != 0)
+  {
+    const int rounding = 1 << (scaleShift - 1);
+
+    for (size_t y = 0; y < lines; y++)
+    {
+      const uint8_t *pLine = pSource + y * width;
+
+      for (size_t x = 0; x < width; x++)
+      {
+        const size_t source = (x + offset) % width;
+        const size_t next = (source + 1) % width;
+
+        pTarget[y * width + x] = (uint8_t)((pLine[source] * ((1 << scaleShift) - fraction) + pLine[next] * fraction + rounding) >> scaleShift);
+      }
+    }
+
+    return;
+  }
+
+  for (size_t y = 0; y < lines; y++)
+  {
+    memcpy(pTarget + y * width, pSource + y * width + offset, width - offset);
+    memcpy(pTarget + y * width + width - offset, pSource + y * width, offset);
+  }
+}
+
+// resX & resY are the scaled resolution of scaled decoders.
+void _slapShiftFrameYUV420(IN const void *pSource, OUT void *pTarget, const size_t resX, const size_t resY, const int shift, const size_t scaleShift)
+{
+  // Luma of both eyes.
+  _slapShiftLines((const uint8_t *)pSource, (uint8_t *)pTarget, resX, resY, shift, scaleShift);
+
+  // Chroma lines of both planes at half the resolution (with the shift rounded down).
+  _slapShiftLines((const uint8_t *)pSource + resX * resY, (uint8_t *)pTarget + resX * resY, resX / 2, resY, shift >> 1, scaleShift);
+}
+
+// P-Frames refer to the last frame after the global shift and the motion compensation, each of which moves it between pLastFrame and pPrediction.
+uint8_t * _slapGetReferenceFrame(const mode mode, const int globalShift, IN uint8_t *pLastFrame, IN uint8_t *pPrediction)
+{
+  const size_t steps = (mode.flags.globalMotion && globalShift != 0 ? 1 : 0) + (mode.flags.motionCompensation ? 1 : 0);
+
+  return (steps & 1) ? pPrediction : pLastFrame;
+}
+
+// Writes the global shift, motion vectors & disparity of the sub frame. pIsRequired is set if any of them isn't zero.
+size_t _slapEncoder_WriteSubFramePrefix(IN slapEncoder *pEncoder, const size_t subFrameIndex, OUT uint8_t *pPrefix, OUT bool_t *pIsRequired)
+{
+  size_t size = 0;
+  *pIsRequired = 0;
+
+  if (!pEncoder->isIframe && pEncoder->mode.flags.globalMotion && subFrameIndex == 0)
+  {
+    const int16_t shift = (int16_t)pEncoder->globalShift;
+
+    memcpy(pPrefix, &shift, sizeof(int16_t));
+    size += sizeof(int16_t);
+
+    if (shift != 0)
+      *pIsRequired = 1;
+  }
+
+  const size_t motionBlockCount = pEncoder->isIframe ? 0 : _slapGetMotionBlockCount(pEncoder->mode, pEncoder->resX, pEncoder->resY, pEncoder->subFrameRows, pEncoder->subFrameColumns, subFrameIndex);
+
+  if (motionBlockCount)
+  {
+    const size_t motionVectorSize = _slapPackMotionVectors(pEncoder->pMotionVectors + subFrameIndex * motionBlockCount * 2, motionBlockCount, pPrefix + size);
+
+    if (motionVectorSize > _slapGetMotionBlockMapSize(motionBlockCount))
+      *pIsRequired = 1;
+
+    size += motionVectorSize;
+  }
+
+  if (_slapGetDisparitySize(pEncoder->mode, pEncoder->subFrameRows, pEncoder->subFrameColumns, subFrameIndex))
+  {
+    pPrefix[size] = (uint8_t)pEncoder->pDisparities[subFrameIndex];
+    size += sizeof(int8_t);
+
+    if (pEncoder->pDisparities[subFrameIndex] != 0)
+      *pIsRequired = 1;
+  }
+
+  return size;
+}
+
+// Reads the global shift, motion vectors & disparity of the sub frame (applied in slapDecoder_FinalizeFrame) and skips them.
+slapResult _slapDecoder_ReadSubFramePrefix(IN slapDecoder *pDecoder, const size_t subFrameIndex, IN_OUT uint8_t **ppRecord, IN_OUT size_t *pRecordSize)
+{
+  // Static P-Frame sub frames without shift, motion or disparity are empty.
+  const bool_t isEmpty = (!pDecoder->isIframe && *pRecordSize == SLAP_STATIC_SUB_FRAME_SIZE);
+
+  if (!pDecoder->isIframe && pDecoder->mode.flags.globalMotion && subFrameIndex == 0)
+  {
+    int16_t shift = 0;
+
+    if (!isEmpty)
+    {
+      if (*pRecordSize < sizeof(int16_t))
+        return slapError_Compress_Internal;
+
+      memcpy(&shift, *ppRecord, sizeof(int16_t));
+      *ppRecord += sizeof(int16_t);
+      *pRecordSize -= sizeof(int16_t);
+    }
 
-        __m128i cb0_ = _mm_load_si128(pCB0_);
-        __m128i cb1_ = _mm_load_si128(pCB1_);
-#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
-        __m128i cb2_ = _mm_load_si128(pCB2_);
-#endif
-#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
-        __m128i cb3_ = _mm_load_si128(pCB3_);
-#endif
+    pDecoder->globalShift = shift;
+  }
 
-        // Copy to last frame
-        _mm_store_si128(pLF0, cb0);
-        _mm_store_si128(pLF1, cb1);
-#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
-        _mm_store_si128(pLF2, cb2);
-#endif
-#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
-        _mm_store_si128(pLF3, cb3);
-#endif
-        _mm_store_si128(pLF0_, cb0_);
-        _mm_store_si128(pLF1_, cb1_);
-#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
-        _mm_store_si128(pLF2_, cb2_);
-#endif
-#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
-        _mm_store_si128(pLF3_, cb3_);
-#endif
+  const size_t motionBlockCount = pDecoder->isIframe ? 0 : _slapGetMotionBlockCount(pDecoder->mode, pDecoder->resX, pDecoder->resY, pDecoder->subFrameRows, pDecoder->subFrameColumns, subFrameIndex);
 
-        // Stereo diff
-        cb0_ = _mm_add_epi8(_mm_sub_epi8(cb0_, cb0), half);
-        cb1_ = _mm_add_epi8(_mm_sub_epi8(cb1_, cb1), half);
-#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
-        cb2_ = _mm_add_epi8(_mm_sub_epi8(cb2_, cb2), half);
-#endif
-#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
-        cb3_ = _mm_add_epi8(_mm_sub_epi8(cb3_, cb3), half);
-#endif
-        _mm_store_si128(pCB0_, cb0_);
-        _mm_store_si128(pCB1_, cb1_);
-#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
-        _mm_store_si128(pCB2_, cb2_);
-#endif
-#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
-        _mm_store_si128(pCB3_, cb3_);
-#endif
+  if (motionBlockCount)
+  {
+    int8_t *pMotionVectors = pDecoder->pMotionVectors + subFrameIndex * motionBlockCount * 2;
 
-        pCB0 += stepSize;
-        pCB1 += stepSize;
-#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
-        pCB2 += stepSize;
-#endif
-#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
-        pCB3 += stepSize;
-#endif
-        pCB0_ += stepSize;
-        pCB1_ += stepSize;
-#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
-        pCB2_ += stepSize;
-#endif
-#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
-        pCB3_ += stepSize;
-#endif
-        pLF0 += stepSize;
-        pLF1 += stepSize;
-#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
-        pLF2 += stepSize;
-#endif
-#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
-        pLF3 += stepSize;
-#endif
-        pLF0_ += stepSize;
-        pLF1_ += stepSize;
-#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
-        pLF2_ += stepSize;
-#endif
-#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
-        pLF3_ += stepSize;
-#endif
-      }
+    if (isEmpty)
+    {
+      memset(pMotionVectors, 0, motionBlockCount * 2);
+    }
+    else
+    {
+      const size_t motionVectorSize = _slapUnpackMotionVectors(*ppRecord, *pRecordSize, motionBlockCount, pMotionVectors);
 
+      if (motionVectorSize == 0)
+        return slapError_Compress_Internal;
 
-      for (size_t k = 0; k < 7; k++)
+      *ppRecord += motionVectorSize;
+      *pRecordSize -= motionVectorSize;
+
+      // Scaled decoders store the motion vectors at their resolution (rounded down).
+      if (pDecoder->scaleShift != SLAP_DECODER_SCALE_FULL)
+        for (size_t i = 0; i < motionBlockCount * 2; i++)
+          pMotionVectors[i] = (int8_t)(pMotionVectors[i] >> pDecoder->scaleShift);
+    }
+  }
+
+  if (_slapGetDisparitySize(pDecoder->mode, pDecoder->subFrameRows, pDecoder->subFrameColumns, subFrameIndex))
+  {
+    if (isEmpty)
+    {
+      pDecoder->pDisparities[subFrameIndex] = 0;
+    }
+    else
+    {
+      if (*pRecordSize < sizeof(int8_t))
+        return slapError_Compress_Internal;
+
+      pDecoder->pDisparities[subFrameIndex] = (int8_t)(((int8_t)**ppRecord) >> pDecoder->scaleShift);
+      *ppRecord += sizeof(int8_t);
+      *pRecordSize -= sizeof(int8_t);
+    }
+  }
+
+  return slapSuccess;
+}
+
+size_t _slapGetSubFrameRowsPerEye(const size_t subFrameRow, const size_t subFrameRows)
+{
+  return subFrameRow < subFrameRows * 2 / 3 ? subFrameRows / 3 : subFrameRows / 12;
+}
+
+bool_t _slapIsBottomEyeSubFrameRow(const size_t subFrameRow, const size_t subFrameRows)
+{
+  if (subFrameRow < subFrameRows * 2 / 3)
+    return subFrameRow >= subFrameRows / 3;
+  else
+    return ((subFrameRow - subFrameRows * 2 / 3) % (subFrameRows / 6)) >= subFrameRows / 12;
+}
+
+size_t _slapGetDisparitySize(const mode mode, const size_t subFrameRows, const size_t subFrameColumns, const size_t subFrameIndex)
+{
+  if (!mode.flags.stereoDisparity || !_slapIsBottomEyeSubFrameRow(subFrameIndex / subFrameColumns, subFrameRows))
+    return 0;
+
+  return sizeof(int8_t);
+}
+
+#define SLAP_DISPARITY_LINE_STEP 4
+
+// The sum of absolute differences of every SLAP_DISPARITY_LINE_STEP-th line between the bottom eye and the top eye shifted by disparity (normalized to the number of compared pixels). The lines are split into segments of segmentWidth that aren't shifted into each other.
+uint64_t _slapGetDisparityCost(IN const uint8_t *pBottom, IN const uint8_t *pTop, const size_t start, const size_t width, const size_t height, const size_t stride, const size_t segmentWidth, const int disparity)
+{
+  uint64_t sum = 0;
+  size_t count = 0;
+
+  for (size_t segmentStart = start - start % segmentWidth; segmentStart < start + width; segmentStart += segmentWidth)
+  {
+    const int low = (int)(segmentStart < start ? start : segmentStart);
+    const int high = (int)(segmentStart + segmentWidth > start + width ? start + width : segmentStart + segmentWidth);
+    const int first = disparity < 0 ? low - disparity : low;
+    const int last = (disparity > 0 ? high - disparity : high) - 16;
+
+    for (size_t y = 0; y < height; y += SLAP_DISPARITY_LINE_STEP)
+    {
+      __m128i sad = _mm_setzero_si128();
+
+      for (int x = first; x <= last; x += 16)
+        sad = _mm_add_epi64(sad, _mm_sad_epu8(_mm_loadu_si128((const __m128i *)(pBottom + y * stride + x)), _mm_loadu_si128((const __m128i *)(pTop + y * stride + x + disparity))));
+
+      sum += (uint64_t)(_mm_cvtsi128_si32(sad) + _mm_extract_epi16(sad, 4));
+      count += last >= first ? ((last - first) / 16 + 1) * 16 : 0;
+    }
+  }
+
+  return count ? (sum << 8) / count : UINT64_MAX;
+}
+
+void _slapEstimateStereoDisparities(IN const void *pData, OUT int8_t *pDisparities, const size_t resX, const size_t resY, const size_t subFrameRows, const size_t subFrameColumns, const int searchRange)
+{
+  const size_t subFrameWidth = resX / subFrameColumns;
+  const size_t subFrameHeight = resY * 3 / 2 / subFrameRows;
+  const int range = searchRange < 0 ? 0 : (searchRange > 127 ? 127 : searchRange);
+
+  for (size_t row = 0; row < subFrameRows; row++)
+  {
+    if (!_slapIsBottomEyeSubFrameRow(row, subFrameRows))
+      continue;
+
+    const size_t topRow = row - _slapGetSubFrameRowsPerEye(row, subFrameRows);
+    const size_t segmentWidth = row < subFrameRows * 2 / 3 ? resX : resX / 2;
+
+    for (size_t column = 0; column < subFrameColumns; column++)
+    {
+      const uint8_t *pBottom = (const uint8_t *)pData + row * subFrameHeight * resX;
+      const uint8_t *pTop = (const uint8_t *)pData + topRow * subFrameHeight * resX;
+      const size_t start = column * subFrameWidth;
+
+      // No disparity wins ties.
+      uint64_t bestCost = _slapGetDisparityCost(pBottom, pTop, start, subFrameWidth, subFrameHeight, resX, segmentWidth, 0);
+      int bestDisparity = 0;
+
+      for (int disparity = -range; disparity <= range && bestCost; disparity++)
       {
-        for (size_t x = 0; x < itX; x++)
+        if (disparity == 0)
+          continue;
+
+        const uint64_t cost = _slapGetDisparityCost(pBottom, pTop, start, subFrameWidth, subFrameHeight, resX, segmentWidth, disparity);
+
+        if (cost < bestCost)
         {
-          __m128i cb0 = _mm_load_si128(pCB0);
-          __m128i cb1 = _mm_load_si128(pCB1);
-#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
-          __m128i cb2 = _mm_load_si128(pCB2);
-#endif
-#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
-          __m128i cb3 = _mm_load_si128(pCB3);
-#endif
-          __m128i cb0_ = _mm_load_si128(pCB0_);
-          __m128i cb1_ = _mm_load_si128(pCB1_);
-#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
-          __m128i cb2_ = _mm_load_si128(pCB2_);
-#endif
-#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
-          __m128i cb3_ = _mm_load_si128(pCB3_);
-#endif
+          bestCost = cost;
+          bestDisparity = disparity;
+        }
+      }
 
-          // Copy to last frame
-          _mm_store_si128(pLF0, cb0);
-          _mm_store_si128(pLF1, cb1);
-#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
-          _mm_store_si128(pLF2, cb2);
-#endif
-#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
-          _mm_store_si128(pLF3, cb3);
-#endif
-          _mm_store_si128(pLF0_, cb0_);
-          _mm_store_si128(pLF1_, cb1_);
-#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
-          _mm_store_si128(pLF2_, cb2_);
-#endif
-#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
-          _mm_store_si128(pLF3_, cb3_);
-#endif
+      pDisparities[row * subFrameColumns + column] = (int8_t)bestDisparity;
+    }
+  }
+}
 
-          // Stereo diff
-          cb0_ = _mm_add_epi8(_mm_sub_epi8(cb0_, cb0), half);
-          cb1_ = _mm_add_epi8(_mm_sub_epi8(cb1_, cb1), half);
-#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
-          cb2_ = _mm_add_epi8(_mm_sub_epi8(cb2_, cb2), half);
-#endif
-#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
-          cb3_ = _mm_add_epi8(_mm_sub_epi8(cb3_, cb3), half);
-#endif
-          _mm_store_si128(pCB0_, cb0_);
-          _mm_store_si128(pCB1_, cb1_);
-#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
-          _mm_store_si128(pCB2_, cb2_);
-#endif
-#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
-          _mm_store_si128(pCB3_, cb3_);
-#endif
+// Adds (or subtracts if undo is set) the difference between the top eye and the top eye shifted by disparity to the bottom eye, turning the stereo diff into a disparity compensated stereo diff (and back).
+void _slapApplyDisparityToLine(IN_OUT uint8_t *pBottom, IN const uint8_t *pTop, const int low, const int high, const int disparity, const bool_t undo)
+{
+  const int vectorStart = disparity < 0 ? low - disparity : low;
+  const int vectorEnd = (disparity > 0 ? high - disparity : high) - 16;
+  int x = low;
 
-          pCB0 += stepSize;
-          pCB1 += stepSize;
-#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
-          pCB2 += stepSize;
-#endif
-#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
-          pCB3 += stepSize;
-#endif
-          pCB0_ += stepSize;
-          pCB1_ += stepSize;
-#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
-          pCB2_ += stepSize;
-#endif
-#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
-          pCB3_ += stepSize;
-#endif
-          pLF0 += stepSize;
-          pLF1 += stepSize;
-#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
-          pLF2 += stepSize;
-#endif
-#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
-          pLF3 += stepSize;
-#endif
-          pLF0_ += stepSize;
-          pLF1_ += stepSize;
-#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
-          pLF2_ += stepSize;
-#endif
-#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
-          pLF3_ += stepSize;
-#endif
+  for (; x < high; x++)
+  {
+    if (x >= vectorStart && x <= vectorEnd)
+      break;
+
+    const int source = x + disparity < low ? low : (x + disparity >= high ? high - 1 : x + disparity);
+    const uint8_t difference = (uint8_t)(pTop[x] - pTop[source]);
+
+    pBottom[x] = undo ? (uint8_t)(pBottom[x] - difference) : (uint8_t)(pBottom[x] + difference);
+  }
+
+  for (; x <= vectorEnd; x += 16)
+  {
+    const __m128i difference = _mm_sub_epi8(_mm_loadu_si128((const __m128i *)(pTop + x)), _mm_loadu_si128((const __m128i *)(pTop + x + disparity)));
+    const __m128i bottom = _mm_loadu_si128((const __m128i *)(pBottom + x));
+
+    _mm_storeu_si128((__m128i *)(pBottom + x), undo ? _mm_sub_epi8(bottom, difference) : _mm_add_epi8(bottom, difference));
+  }
+
+  for (; x < high; x++)
+  {
+    const int source = x + disparity < low ? low : (x + disparity >= high ? high - 1 : x + disparity);
+    const uint8_t difference = (uint8_t)(pTop[x] - pTop[source]);
+
+    pBottom[x] = undo ? (uint8_t)(pBottom[x] - difference) : (uint8_t)(pBottom[x] + difference);
+  }
+}
+
+void _slapApplyStereoDisparities(IN_OUT void *pData, IN const int8_t *pDisparities, const size_t resX, const size_t resY, const size_t subFrameRows, const size_t subFrameColumns, const bool_t undo)
+{
+  const size_t subFrameWidth = resX / subFrameColumns;
+  const size_t subFrameHeight = resY * 3 / 2 / subFrameRows;
+
+  for (size_t row = 0; row < subFrameRows; row++)
+  {
+    if (!_slapIsBottomEyeSubFrameRow(row, subFrameRows))
+      continue;
+
+    const size_t topRow = row - _slapGetSubFrameRowsPerEye(row, subFrameRows);
+    const size_t segmentWidth = row < subFrameRows * 2 / 3 ? resX : resX / 2;
+
+    for (size_t column = 0; column < subFrameColumns; column++)
+    {
+      const int disparity = pDisparities[row * subFrameColumns + column];
+
+      if (disparity == 0)
+        continue;
+
+      const size_t start = column * subFrameWidth;
+
+      for (size_t y = 0; y < subFrameHeight; y++)
+      {
+        uint8_t *pBottom = (uint8_t *)pData + (row * subFrameHeight + y) * resX;
+        const uint8_t *pTop = (const uint8_t *)pData + (topRow * subFrameHeight + y) * resX;
+
+        // The chroma planes contain two lines per row.
+        for (size_t segmentStart = start - start % segmentWidth; segmentStart < start + subFrameWidth; segmentStart += segmentWidth)
+        {
+          const int low = (int)(segmentStart < start ? start : segmentStart);
+          const int high = (int)(segmentStart + segmentWidth > start + subFrameWidth ? start + subFrameWidth : segmentStart + segmentWidth);
+
+          _slapApplyDisparityToLine(pBottom, pTop, low, high, disparity, undo);
         }
       }
     }
+  }
+}
+
+uint8_t _slapGetExactResidualCorrection(const bool_t isIframe, const size_t subFrameRow, const size_t subFrameRows)
+{
+  // The decoder reconstructs the top eye of the chroma planes one below and the bottom eye of all planes one below the residual of the encoder in P-Frames (the I-Frame stereo diff of the chroma planes is one above).
+  const bool_t isLuma = subFrameRow < subFrameRows * 2 / 3;
+  const bool_t isBottomEye = _slapIsBottomEyeSubFrameRow(subFrameRow, subFrameRows);
+
+  if (isIframe)
+    return (!isLuma && isBottomEye) ? 1 : 0;
+  else
+    return (!isLuma || isBottomEye) ? 1 : 0;
+}
 
-    if (i == 0)
-    {
-      itX >>= 1;
-      itY >>= 1;
+void _slapSubtractFromSubFrame(IN_OUT void *pData, const size_t width, const size_t height, const size_t stride, const uint8_t value)
+{
+  const __m128i v = _mm_set1_epi8((char)value);
 
-      __m128i tmp = { 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127 };
-      half = tmp;
-    }
+  for (size_t y = 0; y < height; y++)
+  {
+    __m128i *pLine = (__m128i *)((uint8_t *)pData + y * stride);
 
-    pCB0 = pCB0_;
-    pCB1 = pCB1_;
-#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
-    pCB2 = pCB2_;
-#endif
-#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
-    pCB3 = pCB3_;
-#endif
-    pCB0_ += halfFrameDiv16Quarter;
-    pCB1_ = pCB0_ + 1;
-#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
-    pCB2_ = pCB0_ + 2;
-#endif
-#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
-    pCB3_ = pCB0_ + 3;
-#endif
-    pLF0 = pLF0_;
-    pLF1 = pLF1_;
-#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
-    pLF2 = pLF2_;
-#endif
-#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
-    pLF3 = pLF3_;
-#endif
-    pLF0_ += halfFrameDiv16Quarter;
-    pLF1_ = pLF0_ + 1;
-#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
-    pLF2_ = pLF0_ + 2;
-#endif
-#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
-    pLF3_ = pLF0_ + 3;
-#endif
+    for (size_t x = 0; x < (width >> 4); x++)
+      _mm_store_si128(pLine + x, _mm_sub_epi8(_mm_load_si128(pLine + x), v));
   }
+}
 
-#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
-#undef GREATER_OR_EQUAL_TO_6_BLOCKS
-#endif
-#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
-#undef GREATER_OR_EQUAL_TO_8_BLOCKS
-#endif
+void _slapFillSubFrame(OUT void *pData, const size_t width, const size_t height, const size_t stride, const uint8_t value)
+{
+  if (width == stride)
+  {
+    memset(pData, value, width * height);
+    return;
+  }
+
+  for (size_t y = 0; y < height; y++)
+    memset(((uint8_t *)pData) + y * stride, value, width);
 }
 
-void _slapAddStereoDiffYUV420(IN_OUT void *pData, const size_t resX, const size_t resY)
+bool_t _slapIsStaticSubFrame(IN const void *pData, const size_t width, const size_t height, const size_t stride, const uint8_t value, const int threshold)
 {
-  uint8_t *pMainFrameY = (uint8_t *)pData;
+  if (threshold < 0)
+    return 0;
 
-#define GREATER_OR_EQUAL_TO_6_BLOCKS
-#define GREATER_OR_EQUAL_TO_8_BLOCKS
+  const __m128i expected = _mm_set1_epi8((char)value);
+  const __m128i maxDiff = _mm_set1_epi8((char)(threshold > 0xFF ? 0xFF : threshold));
+  const __m128i zero = _mm_setzero_si128();
 
-  size_t resXdiv16 = resX >> 4;
+  const size_t widthDiv16 = width >> 4;
+  const size_t strideDiv16 = stride >> 4;
 
-  __m128i *pCB0 = (__m128i *)pMainFrameY;
-  __m128i *pCB1 = pCB0 + 1;
-  __m128i *pCB2 = pCB0 + 2;
-  __m128i *pCB3 = pCB0 + 3;
-#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
-  __m128i *pCB4 = pCB0 + 4;
-  __m128i *pCB5 = pCB0 + 5;
-#endif
-#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
-  __m128i *pCB6 = pCB0 + 6;
-  __m128i *pCB7 = pCB0 + 7;
-#endif
+  for (size_t y = 0; y < height; y++)
+  {
+    const __m128i *pCB0 = ((const __m128i *)pData) + y * strideDiv16;
+    __m128i diff = zero;
 
-  __m128i *pCB0_ = (__m128i *)pMainFrameY + resXdiv16 * (resY >> 1);
-  __m128i *pCB1_ = pCB0_ + 1;
-  __m128i *pCB2_ = pCB0_ + 2;
-  __m128i *pCB3_ = pCB0_ + 3;
-#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
-  __m128i *pCB4_ = pCB0_ + 4;
-  __m128i *pCB5_ = pCB0_ + 5;
-#endif
-#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
-  __m128i *pCB6_ = pCB0_ + 6;
-  __m128i *pCB7_ = pCB0_ + 7;
-#endif
+    for (size_t x = 0; x < widthDiv16; x++)
+    {
+      const __m128i cb0 = _mm_load_si128(pCB0 + x);
+      diff = _mm_max_epu8(diff, _mm_or_si128(_mm_subs_epu8(cb0, expected), _mm_subs_epu8(expected, cb0)));
+    }
 
-  __m128i halfY = { 118, 118, 118, 118, 118, 118, 118, 118, 118, 118, 118, 118, 118, 118, 118, 118 };
-  __m128i halfUV = { 126, 126, 126, 126, 126, 126, 126, 126, 126, 126, 126, 126, 126, 126, 126, 126 };
+    // Early out as soon as any value exceeds the threshold.
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_subs_epu8(diff, maxDiff), zero)) != 0xFFFF)
+      return 0;
+  }
 
-#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
-  const size_t stepSize = 8;
-#else
-#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
-  const size_t stepSize = 6;
-#else
-  const size_t stepSize = 4;
-#endif
-#endif
+  return 1;
+}
 
-  const size_t lumaX = resX / (sizeof(__m128i) * stepSize);
-  const size_t chromaX = lumaX >> 1;
+size_t _slapGetChangedBlockMapSize(const size_t width, const size_t height)
+{
+  return ((width / SLAP_STATIC_BLOCK_SIZE) * (height / SLAP_STATIC_BLOCK_SIZE) + 7) >> 3;
+}
 
-  for (size_t y = 0; y < (resY >> 1); y++)
+size_t _slapGetChangedBlocks(IN const void *pData, const size_t width, const size_t height, const size_t stride, const uint8_t value, const int threshold, OUT uint8_t *pChangedBlockMap)
+{
+  const size_t blocksX = width / SLAP_STATIC_BLOCK_SIZE;
+  const size_t blocksY = height / SLAP_STATIC_BLOCK_SIZE;
+  const size_t strideDiv16 = stride >> 4;
+
+  const __m128i expected = _mm_set1_epi8((char)value);
+  const __m128i maxDiff = _mm_set1_epi8((char)(threshold > 0xFF ? 0xFF : (threshold < 0 ? 0 : threshold)));
+  const __m128i zero = _mm_setzero_si128();
+
+  size_t changedBlocks = 0;
+
+  memset(pChangedBlockMap, 0, _slapGetChangedBlockMapSize(width, height));
+
+  for (size_t by = 0; by < blocksY; by++)
   {
-    for (size_t x = 0; x < lumaX; x++)
+    for (size_t bx = 0; bx < blocksX; bx++)
     {
-      __m128i cb0 = _mm_load_si128(pCB0);
-      __m128i cb1 = _mm_load_si128(pCB1);
-      __m128i cb2 = _mm_load_si128(pCB2);
-      __m128i cb3 = _mm_load_si128(pCB3);
-#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
-      __m128i cb4 = _mm_load_si128(pCB4);
-      __m128i cb5 = _mm_load_si128(pCB5);
-#endif
-#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
-      __m128i cb6 = _mm_load_si128(pCB6);
-      __m128i cb7 = _mm_load_si128(pCB7);
-#endif
+      const __m128i *pCB0 = ((const __m128i *)pData) + by * SLAP_STATIC_BLOCK_SIZE * strideDiv16 + bx * (SLAP_STATIC_BLOCK_SIZE >> 4);
+      bool_t changed = (threshold < 0);
 
-      __m128i cb0_ = _mm_load_si128(pCB0_);
-      __m128i cb1_ = _mm_load_si128(pCB1_);
-      __m128i cb2_ = _mm_load_si128(pCB2_);
-      __m128i cb3_ = _mm_load_si128(pCB3_);
-#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
-      __m128i cb4_ = _mm_load_si128(pCB4_);
-      __m128i cb5_ = _mm_load_si128(pCB5_);
-#endif
-#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
-      __m128i cb6_ = _mm_load_si128(pCB6_);
-      __m128i cb7_ = _mm_load_si128(pCB7_);
-#endif
+      for (size_t y = 0; y < SLAP_STATIC_BLOCK_SIZE && !changed; y++)
+      {
+        __m128i diff = zero;
 
-      // Add stereo diff.
-      cb0_ = _mm_add_epi8(_mm_sub_epi8(cb0_, halfY), cb0);
-      cb1_ = _mm_add_epi8(_mm_sub_epi8(cb1_, halfY), cb1);
-      cb2_ = _mm_add_epi8(_mm_sub_epi8(cb2_, halfY), cb2);
-      cb3_ = _mm_add_epi8(_mm_sub_epi8(cb3_, halfY), cb3);
-#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
-      cb4_ = _mm_add_epi8(_mm_sub_epi8(cb4_, halfY), cb4);
-      cb5_ = _mm_add_epi8(_mm_sub_epi8(cb5_, halfY), cb5);
-#endif
-#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
-      cb6_ = _mm_add_epi8(_mm_sub_epi8(cb6_, halfY), cb6);
-      cb7_ = _mm_add_epi8(_mm_sub_epi8(cb7_, halfY), cb7);
-#endif
+        for (size_t x = 0; x < (SLAP_STATIC_BLOCK_SIZE >> 4); x++)
+        {
+          const __m128i cb0 = _mm_load_si128(pCB0 + x);
+          diff = _mm_max_epu8(diff, _mm_or_si128(_mm_subs_epu8(cb0, expected), _mm_subs_epu8(expected, cb0)));
+        }
 
-      _mm_store_si128(pCB0_, cb0_);
-      _mm_store_si128(pCB1_, cb1_);
-      _mm_store_si128(pCB2_, cb2_);
-      _mm_store_si128(pCB3_, cb3_);
-#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
-      _mm_store_si128(pCB4_, cb4_);
-      _mm_store_si128(pCB5_, cb5_);
-#endif
-#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
-      _mm_store_si128(pCB6_, cb6_);
-      _mm_store_si128(pCB7_, cb7_);
-#endif
+        changed = (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_subs_epu8(diff, maxDiff), zero)) != 0xFFFF);
+        pCB0 += strideDiv16;
+      }
 
-      pCB0 += stepSize;
-      pCB1 += stepSize;
-      pCB2 += stepSize;
-      pCB3 += stepSize;
-#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
-      pCB4 += stepSize;
-      pCB5 += stepSize;
-#endif
-#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
-      pCB6 += stepSize;
-      pCB7 += stepSize;
-#endif
-      pCB0_ += stepSize;
-      pCB1_ += stepSize;
-      pCB2_ += stepSize;
-      pCB3_ += stepSize;
-#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
-      pCB4_ += stepSize;
-      pCB5_ += stepSize;
-#endif
-#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
-      pCB6_ += stepSize;
-      pCB7_ += stepSize;
-#endif
+      if (changed)
+      {
+        const size_t blockIndex = by * blocksX + bx;
+        pChangedBlockMap[blockIndex >> 3] |= (uint8_t)(1 << (blockIndex & 7));
+        changedBlocks++;
+      }
     }
   }
 
-  size_t halfFrameDiv16Quarter = resXdiv16 * resY >> 3;
+  return changedBlocks;
+}
 
-  int first = 1;
-chromaSubSampleBuffer:
+size_t _slapGetPackedHeight(IN const uint8_t *pChangedBlockMap, const size_t width, const size_t height)
+{
+  const size_t blocksX = width / SLAP_STATIC_BLOCK_SIZE;
+  const size_t blockCount = blocksX * (height / SLAP_STATIC_BLOCK_SIZE);
 
-  pCB0 = pCB0_;
-  pCB1 = pCB0 + 1;
-  pCB2 = pCB0 + 2;
-  pCB3 = pCB0 + 3;
-#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
-  pCB4 = pCB0 + 4;
-  pCB5 = pCB0 + 5;
-#endif
-#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
-  pCB6 = pCB0 + 6;
-  pCB7 = pCB0 + 7;
-#endif
+  size_t changedBlocks = 0;
 
-  pCB0_ += halfFrameDiv16Quarter;
-  pCB1_ = pCB0_ + 1;
-  pCB2_ = pCB0_ + 2;
-  pCB3_ = pCB0_ + 3;
-#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
-  pCB4_ = pCB0_ + 4;
-  pCB5_ = pCB0_ + 5;
-#endif
-#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
-  pCB6_ = pCB0_ + 6;
-  pCB7_ = pCB0_ + 7;
-#endif
+  for (size_t i = 0; i < blockCount; i++)
+    changedBlocks += (pChangedBlockMap[i >> 3] >> (i & 7)) & 1;
 
-  for (size_t y = 0; y < (resY >> 2); y++)
+  return ((changedBlocks + blocksX - 1) / blocksX) * SLAP_STATIC_BLOCK_SIZE;
+}
+
+inline void _slapCopyBlock(IN_OUT __m128i *pBlocks, const size_t strideDiv16, const size_t blocksX, const size_t targetIndex, const size_t sourceIndex)
+{
+  __m128i *pSource = pBlocks + (sourceIndex / blocksX) * SLAP_STATIC_BLOCK_SIZE * strideDiv16 + (sourceIndex % blocksX) * (SLAP_STATIC_BLOCK_SIZE >> 4);
+  __m128i *pTarget = pBlocks + (targetIndex / blocksX) * SLAP_STATIC_BLOCK_SIZE * strideDiv16 + (targetIndex % blocksX) * (SLAP_STATIC_BLOCK_SIZE >> 4);
+
+  for (size_t y = 0; y < SLAP_STATIC_BLOCK_SIZE; y++)
   {
-    for (size_t x = 0; x < chromaX; x++)
-    {
-      __m128i cb0 = _mm_load_si128(pCB0);
-      __m128i cb1 = _mm_load_si128(pCB1);
-      __m128i cb2 = _mm_load_si128(pCB2);
-      __m128i cb3 = _mm_load_si128(pCB3);
-#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
-      __m128i cb4 = _mm_load_si128(pCB4);
-      __m128i cb5 = _mm_load_si128(pCB5);
-#endif
-#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
-      __m128i cb6 = _mm_load_si128(pCB6);
-      __m128i cb7 = _mm_load_si128(pCB7);
-#endif
+    for (size_t x = 0; x < (SLAP_STATIC_BLOCK_SIZE >> 4); x++)
+      _mm_store_si128(pTarget + x, _mm_load_si128(pSource + x));
 
-      __m128i cb0_ = _mm_load_si128(pCB0_);
-      __m128i cb1_ = _mm_load_si128(pCB1_);
-      __m128i cb2_ = _mm_load_si128(pCB2_);
-      __m128i cb3_ = _mm_load_si128(pCB3_);
-#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
-      __m128i cb4_ = _mm_load_si128(pCB4_);
-      __m128i cb5_ = _mm_load_si128(pCB5_);
-#endif
-#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
-      __m128i cb6_ = _mm_load_si128(pCB6_);
-      __m128i cb7_ = _mm_load_si128(pCB7_);
-#endif
+    pSource += strideDiv16;
+    pTarget += strideDiv16;
+  }
+}
+
+inline void _slapFillBlock(IN_OUT __m128i *pBlocks, const size_t strideDiv16, const size_t blocksX, const size_t targetIndex, const __m128i value)
+{
+  __m128i *pTarget = pBlocks + (targetIndex / blocksX) * SLAP_STATIC_BLOCK_SIZE * strideDiv16 + (targetIndex % blocksX) * (SLAP_STATIC_BLOCK_SIZE >> 4);
+
+  for (size_t y = 0; y < SLAP_STATIC_BLOCK_SIZE; y++)
+  {
+    for (size_t x = 0; x < (SLAP_STATIC_BLOCK_SIZE >> 4); x++)
+      _mm_store_si128(pTarget + x, value);
+
+    pTarget += strideDiv16;
+  }
+}
 
-      // Add stereo diff.
-      cb0_ = _mm_add_epi8(_mm_sub_epi8(cb0_, halfUV), cb0);
-      cb1_ = _mm_add_epi8(_mm_sub_epi8(cb1_, halfUV), cb1);
-      cb2_ = _mm_add_epi8(_mm_sub_epi8(cb2_, halfUV), cb2);
-      cb3_ = _mm_add_epi8(_mm_sub_epi8(cb3_, halfUV), cb3);
-#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
-      cb4_ = _mm_add_epi8(_mm_sub_epi8(cb4_, halfUV), cb4);
-      cb5_ = _mm_add_epi8(_mm_sub_epi8(cb5_, halfUV), cb5);
-#endif
-#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
-      cb6_ = _mm_add_epi8(_mm_sub_epi8(cb6_, halfUV), cb6);
-      cb7_ = _mm_add_epi8(_mm_sub_epi8(cb7_, halfUV), cb7);
-#endif
+// Moves the changed blocks to the front (in place) and fills the remainder of the last row of blocks with value. Returns the height of the packed image.
+size_t _slapPackChangedBlocks(IN_OUT void *pData, const size_t width, const size_t height, const size_t stride, IN const uint8_t *pChangedBlockMap, const uint8_t value)
+{
+  const size_t blocksX = width / SLAP_STATIC_BLOCK_SIZE;
+  const size_t blockCount = blocksX * (height / SLAP_STATIC_BLOCK_SIZE);
+  const size_t strideDiv16 = stride >> 4;
 
-      _mm_store_si128(pCB0_, cb0_);
-      _mm_store_si128(pCB1_, cb1_);
-      _mm_store_si128(pCB2_, cb2_);
-      _mm_store_si128(pCB3_, cb3_);
-#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
-      _mm_store_si128(pCB4_, cb4_);
-      _mm_store_si128(pCB5_, cb5_);
-#endif
-#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
-      _mm_store_si128(pCB6_, cb6_);
-      _mm_store_si128(pCB7_, cb7_);
-#endif
+  size_t packedIndex = 0;
 
-      pCB0 += stepSize;
-      pCB1 += stepSize;
-      pCB2 += stepSize;
-      pCB3 += stepSize;
-#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
-      pCB4 += stepSize;
-      pCB5 += stepSize;
-#endif
-#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
-      pCB6 += stepSize;
-      pCB7 += stepSize;
-#endif
-      pCB0_ += stepSize;
-      pCB1_ += stepSize;
-      pCB2_ += stepSize;
-      pCB3_ += stepSize;
-#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
-      pCB4_ += stepSize;
-      pCB5_ += stepSize;
-#endif
-#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
-      pCB6_ += stepSize;
-      pCB7_ += stepSize;
-#endif
+  for (size_t i = 0; i < blockCount; i++)
+  {
+    if ((pChangedBlockMap[i >> 3] >> (i & 7)) & 1)
+    {
+      if (packedIndex != i)
+        _slapCopyBlock((__m128i *)pData, strideDiv16, blocksX, packedIndex, i);
+
+      packedIndex++;
     }
   }
 
-  if (first)
+  const size_t packedHeight = ((packedIndex + blocksX - 1) / blocksX) * SLAP_STATIC_BLOCK_SIZE;
+  const __m128i fill = _mm_set1_epi8((char)value);
+
+  for (; packedIndex % blocksX != 0; packedIndex++)
+    _slapFillBlock((__m128i *)pData, strideDiv16, blocksX, packedIndex, fill);
+
+  return packedHeight;
+}
+
+// Moves the packed blocks back to their original position (in place, back to front, so that no packed block is overwritten before it has been moved) and fills the unchanged blocks with value.
+void _slapUnpackChangedBlocks(IN_OUT void *pData, const size_t width, const size_t height, const size_t stride, IN const uint8_t *pChangedBlockMap, const uint8_t value)
+{
+  const size_t blocksX = width / SLAP_STATIC_BLOCK_SIZE;
+  const size_t blockCount = blocksX * (height / SLAP_STATIC_BLOCK_SIZE);
+  const size_t strideDiv16 = stride >> 4;
+  const __m128i fill = _mm_set1_epi8((char)value);
+
+  size_t packedIndex = 0;
+
+  for (size_t i = 0; i < blockCount; i++)
+    packedIndex += (pChangedBlockMap[i >> 3] >> (i & 7)) & 1;
+
+  for (size_t i = blockCount; i > 0; i--)
   {
-    first = 0;
-    goto chromaSubSampleBuffer;
-  }
+    const size_t blockIndex = i - 1;
 
+    if ((pChangedBlockMap[blockIndex >> 3] >> (blockIndex & 7)) & 1)
+    {
+      packedIndex--;
 
-#ifdef GREATER_OR_EQUAL_TO_6_BLOCKS
-#undef GREATER_OR_EQUAL_TO_6_BLOCKS
-#endif
-#ifdef GREATER_OR_EQUAL_TO_8_BLOCKS
-#undef GREATER_OR_EQUAL_TO_8_BLOCKS
-#endif
+      if (packedIndex != blockIndex)
+        _slapCopyBlock((__m128i *)pData, strideDiv16, blocksX, blockIndex, packedIndex);
+    }
+    else
+    {
+      _slapFillBlock((__m128i *)pData, strideDiv16, blocksX, blockIndex, fill);
+    }
+  }
 }
 
-void _slapAddStereoDiffYUV420AndCopyToLastFrame(IN_OUT void * pData, OUT void * pLastFrame, const size_t resX, const size_t resY)
+// Same as _slapUnpackChangedBlocks for sub frames decoded at 1 / (1 << scaleShift) of their resolution (width & height are scaled, the blocks are SLAP_STATIC_BLOCK_SIZE >> scaleShift in size).
+void _slapUnpackScaledChangedBlocks(IN_OUT void *pData, const size_t width, const size_t height, const size_t stride, IN const uint8_t *pChangedBlockMap, const uint8_t value, const size_t scaleShift)
 {
-  size_t max = (resY * resX) >> 5;
+  const size_t blockSize = SLAP_STATIC_BLOCK_SIZE >> scaleShift;
+  const size_t blocksX = width / blockSize;
+  const size_t blockCount = blocksX * (height / blockSize);
+  uint8_t *pPixels = (uint8_t *)pData;
 
-  __m128i *pCB0 = (__m128i *)pData;
-  __m128i *pCB0_ = (__m128i *)pData + max;
-  __m128i *pLF0 = (__m128i *)pLastFrame;
-  __m128i *pLF0_ = (__m128i *)pLastFrame + max;
+  size_t packedIndex = 0;
 
-  __m128i halfYUV = { 126, 126, 126, 126, 126, 126, 126, 126, 126, 126, 126, 126, 126, 126, 126, 126 };
+  for (size_t i = 0; i < blockCount; i++)
+    packedIndex += (pChangedBlockMap[i >> 3] >> (i & 7)) & 1;
 
-  for (size_t i = 0; i < max; i++)
+  for (size_t i = blockCount; i > 0; i--)
   {
-    __m128i cb0 = _mm_load_si128(pCB0);
-    _mm_store_si128(pLF0, cb0);
+    const size_t blockIndex = i - 1;
+    uint8_t *pTarget = pPixels + (blockIndex / blocksX) * blockSize * stride + (blockIndex % blocksX) * blockSize;
 
-    __m128i cb0_ = _mm_load_si128(pCB0_);
-    cb0_ = _mm_add_epi8(_mm_sub_epi8(cb0_, halfYUV), cb0);
+    if ((pChangedBlockMap[blockIndex >> 3] >> (blockIndex & 7)) & 1)
+    {
+      packedIndex--;
 
-    _mm_store_si128(pCB0_, cb0_);
-    _mm_store_si128(pLF0_, cb0_);
+      if (packedIndex != blockIndex)
+      {
+        const uint8_t *pSource = pPixels + (packedIndex / blocksX) * blockSize * stride + (packedIndex % blocksX) * blockSize;
 
-    pCB0++;
-    pCB0_++;
-    pLF0++;
-    pLF0_++;
+        for (size_t y = 0; y < blockSize; y++)
+          memcpy(pTarget + y * stride, pSource + y * stride, blockSize);
+      }
+    }
+    else
+    {
+      for (size_t y = 0; y < blockSize; y++)
+        memset(pTarget + y * stride, value, blockSize);
+    }
   }
+}
 
-  max >>= 2;
-  pCB0 = pCB0_;
-  pLF0 = pLF0_;
-  pCB0_ += max;
-  pLF0_ += max;
+inline void _slapAddStereoDiffAndAddLastFrameDiff(IN_OUT __m128i *pCB0, IN_OUT __m128i *pCB0_, IN_OUT __m128i *pLF0, IN_OUT __m128i *pLF0_, const size_t count, const __m128i half)
+{
+  const __m128i halfYUV = _mm_set1_epi8(126);
 
-  for (size_t i = 0; i < max; i++)
+  for (size_t i = 0; i < count; i++)
   {
     __m128i cb0 = _mm_load_si128(pCB0);
-    _mm_store_si128(pLF0, cb0);
+    __m128i lf0 = _mm_load_si128(pLF0);
+
+    lf0 = _mm_sub_epi8(lf0, _mm_add_epi8(cb0, half));
+    _mm_store_si128(pCB0, lf0);
+    _mm_store_si128(pLF0, lf0);
 
     __m128i cb0_ = _mm_load_si128(pCB0_);
+    __m128i lf0_ = _mm_load_si128(pLF0_);
+
     cb0_ = _mm_add_epi8(_mm_sub_epi8(cb0_, halfYUV), cb0);
+    cb0_ = _mm_sub_epi8(lf0_, _mm_add_epi8(cb0_, half));
 
     _mm_store_si128(pCB0_, cb0_);
     _mm_store_si128(pLF0_, cb0_);
@@ -2120,21 +6731,71 @@ void _slapAddStereoDiffYUV420AndCopyToLastFrame(IN_OUT void * pData, OUT void *
     pLF0++;
     pLF0_++;
   }
+}
 
-  pCB0 = pCB0_;
-  pLF0 = pLF0_;
-  pCB0_ += max;
-  pLF0_ += max;
+void _slapAddStereoDiffYUV420AndAddLastFrameDiff(IN_OUT void * pData, OUT void * pLastFrame, const size_t resX, const size_t resY, const size_t subFrameRows, const size_t subFrameColumns, IN const bool_t *pStaticSubFrames)
+{
+  const size_t subFrameHeight = resY * 3 / 2 / subFrameRows;
+  const size_t subFrameWidth = resX / subFrameColumns;
+  const size_t subFrameWidthDiv16 = subFrameWidth >> 4;
+  const size_t resXdiv16 = resX >> 4;
 
-  for (size_t i = 0; i < max; i++)
+  __m128i *pCB = (__m128i *)pData;
+  __m128i *pLF = (__m128i *)pLastFrame;
+
+  const __m128i halfY = _mm_set1_epi8((char)129);
+  const __m128i halfUV = _mm_set1_epi8((char)130);
+
+  size_t row = 0;
+
+  // Stereo halves are processed in pairs of sub frames (top & bottom eye), so that pairs that are static in both eyes can simply be copied from the last frame.
+  for (size_t plane = 0; plane < 3; plane++)
   {
-    __m128i cb0 = _mm_load_si128(pCB0);
+    const size_t rowsPerHalf = plane == 0 ? subFrameRows / 3 : subFrameRows / 12;
+
+    for (size_t i = 0; i < rowsPerHalf; i++)
+    {
+      const size_t topRow = row + i;
+      const size_t bottomRow = topRow + rowsPerHalf;
+
+      for (size_t column = 0; column < subFrameColumns; column++)
+      {
+        const size_t top = topRow * subFrameColumns + column;
+        const size_t bottom = bottomRow * subFrameColumns + column;
+        const size_t topOffsetDiv16 = topRow * subFrameHeight * resXdiv16 + column * subFrameWidthDiv16;
+        const size_t bottomOffsetDiv16 = bottomRow * subFrameHeight * resXdiv16 + column * subFrameWidthDiv16;
+
+        for (size_t y = 0; y < subFrameHeight; y++)
+        {
+          const size_t lineOffsetDiv16 = y * resXdiv16;
+
+          if (pStaticSubFrames[top] && pStaticSubFrames[bottom])
+          {
+            slapMemcpy(pCB + topOffsetDiv16 + lineOffsetDiv16, pLF + topOffsetDiv16 + lineOffsetDiv16, subFrameWidth);
+            slapMemcpy(pCB + bottomOffsetDiv16 + lineOffsetDiv16, pLF + bottomOffsetDiv16 + lineOffsetDiv16, subFrameWidth);
+          }
+          else
+          {
+            _slapAddStereoDiffAndAddLastFrameDiff(pCB + topOffsetDiv16 + lineOffsetDiv16, pCB + bottomOffsetDiv16 + lineOffsetDiv16, pLF + topOffsetDiv16 + lineOffsetDiv16, pLF + bottomOffsetDiv16 + lineOffsetDiv16, subFrameWidthDiv16, plane == 0 ? halfY : halfUV);
+          }
+        }
+      }
+    }
+
+    row += rowsPerHalf * 2;
+  }
+}
+
+inline void _slapAddStereoDiffAndCopyToLastFrame(IN_OUT __m128i *pCB0, IN_OUT __m128i *pCB0_, OUT __m128i *pLF0, OUT __m128i *pLF0_, const size_t count, const __m128i half)
+{
+  for (size_t i = 0; i < count; i++)
+  {
+    const __m128i cb0 = _mm_load_si128(pCB0);
     _mm_store_si128(pLF0, cb0);
 
     __m128i cb0_ = _mm_load_si128(pCB0_);
-    cb0_ = _mm_add_epi8(_mm_sub_epi8(cb0_, halfYUV), cb0);
+    cb0_ = _mm_add_epi8(_mm_sub_epi8(cb0_, half), cb0);
 
-    _mm_store_si128(pCB0_, cb0_);
     _mm_store_si128(pLF0_, cb0_);
 
     pCB0++;
@@ -2144,99 +6805,256 @@ void _slapAddStereoDiffYUV420AndCopyToLastFrame(IN_OUT void * pData, OUT void *
   }
 }
 
-void _slapAddStereoDiffYUV420AndAddLastFrameDiff(IN_OUT void * pData, OUT void * pLastFrame, const size_t resX, const size_t resY)
+// Full range BT.601 chroma terms of 8 U & V samples, scaled up by one bit & rounded.
+inline void _slapGetChromaTerms(IN const uint8_t *pU, IN const uint8_t *pV, OUT __m128i *pR, OUT __m128i *pG, OUT __m128i *pB)
 {
-  size_t max = (resY * resX) >> 5;
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i one = _mm_set1_epi16(1);
+  const __m128i center = _mm_set1_epi16(128);
 
-  __m128i *pCB0 = (__m128i *)pData;
-  __m128i *pCB0_ = (__m128i *)pData + max;
-  __m128i *pLF0 = (__m128i *)pLastFrame;
-  __m128i *pLF0_ = (__m128i *)pLastFrame + max;
+  const __m128i u = _mm_slli_epi16(_mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)pU), zero), center), 7);
+  const __m128i v = _mm_slli_epi16(_mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)pV), zero), center), 7);
 
-  __m128i halfYUV = { 126, 126, 126, 126, 126, 126, 126, 126, 126, 126, 126, 126, 126, 126, 126, 126 };
-  __m128i halfY = { 129, 129, 129, 129, 129, 129, 129, 129, 129, 129, 129, 129, 129, 129, 129, 129 };
-  __m128i halfUV = { 130, 130, 130, 130, 130, 130, 130, 130, 130, 130, 130, 130, 130, 130, 130, 130 };
+  // 1.402, 0.344136, 0.714136 & 1.772 scaled by 1 << 10.
+  *pR = _mm_srai_epi16(_mm_add_epi16(_mm_mulhi_epi16(v, _mm_set1_epi16(1436)), one), 1);
+  *pG = _mm_srai_epi16(_mm_add_epi16(_mm_add_epi16(_mm_mulhi_epi16(u, _mm_set1_epi16(352)), _mm_mulhi_epi16(v, _mm_set1_epi16(731))), one), 1);
+  *pB = _mm_srai_epi16(_mm_add_epi16(_mm_mulhi_epi16(u, _mm_set1_epi16(1815)), one), 1);
+}
 
-  for (size_t i = 0; i < max; i++)
+void _slapConvertLineToRGBA(IN const uint8_t *pY, IN const uint8_t *pU, IN const uint8_t *pV, OUT uint8_t *pOut, const size_t width, const bool_t bgra)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i alpha = _mm_set1_epi8((char)0xFF);
+
+  for (size_t x = 0; x < width; x += 16)
   {
-    __m128i cb0 = _mm_load_si128(pCB0);
-    __m128i lf0 = _mm_load_si128(pLF0);
+    __m128i r, g, b;
+    _slapGetChromaTerms(pU + x / 2, pV + x / 2, &r, &g, &b);
 
-    lf0 = _mm_sub_epi8(lf0, _mm_add_epi8(cb0, halfY));
-    _mm_store_si128(pCB0, lf0);
-    _mm_store_si128(pLF0, lf0);
+    const __m128i y = _mm_loadu_si128((const __m128i *)(pY + x));
+    const __m128i y0 = _mm_unpacklo_epi8(y, zero);
+    const __m128i y1 = _mm_unpackhi_epi8(y, zero);
 
-    __m128i cb0_ = _mm_load_si128(pCB0_);
-    __m128i lf0_ = _mm_load_si128(pLF0_);
+    // Every chroma sample covers two pixels.
+    const __m128i red = _mm_packus_epi16(_mm_add_epi16(y0, _mm_unpacklo_epi16(r, r)), _mm_add_epi16(y1, _mm_unpackhi_epi16(r, r)));
+    const __m128i green = _mm_packus_epi16(_mm_sub_epi16(y0, _mm_unpacklo_epi16(g, g)), _mm_sub_epi16(y1, _mm_unpackhi_epi16(g, g)));
+    const __m128i blue = _mm_packus_epi16(_mm_add_epi16(y0, _mm_unpacklo_epi16(b, b)), _mm_add_epi16(y1, _mm_unpackhi_epi16(b, b)));
 
-    cb0_ = _mm_add_epi8(_mm_sub_epi8(cb0_, halfYUV), cb0);
-    cb0_ = _mm_sub_epi8(lf0_, _mm_add_epi8(cb0_, halfY));
+    const __m128i first = bgra ? blue : red;
+    const __m128i third = bgra ? red : blue;
 
-    _mm_store_si128(pCB0_, cb0_);
-    _mm_store_si128(pLF0_, cb0_);
+    const __m128i lo0 = _mm_unpacklo_epi8(first, green);
+    const __m128i hi0 = _mm_unpackhi_epi8(first, green);
+    const __m128i lo1 = _mm_unpacklo_epi8(third, alpha);
+    const __m128i hi1 = _mm_unpackhi_epi8(third, alpha);
 
-    pCB0++;
-    pCB0_++;
-    pLF0++;
-    pLF0_++;
+    __m128i *pTarget = (__m128i *)(pOut + x * 4);
+
+    _mm_storeu_si128(pTarget, _mm_unpacklo_epi16(lo0, lo1));
+    _mm_storeu_si128(pTarget + 1, _mm_unpackhi_epi16(lo0, lo1));
+    _mm_storeu_si128(pTarget + 2, _mm_unpacklo_epi16(hi0, hi1));
+    _mm_storeu_si128(pTarget + 3, _mm_unpackhi_epi16(hi0, hi1));
   }
+}
 
-  max >>= 2;
-  pCB0 = pCB0_;
-  pLF0 = pLF0_;
-  pCB0_ += max;
-  pLF0_ += max;
+// Writes the luma lines outputLine & outputLine + 1 (and chroma line outputLine / 2) of the output buffer.
+void _slapConvertLinesToBuffer(IN const uint8_t *pY, const size_t strideY, IN const uint8_t *pU, IN const uint8_t *pV, const size_t width, const size_t outputLine, IN const slapOutputBuffer *pOutput)
+{
+  switch (pOutput->format)
+  {
+  case slapOutputFormat_YUV420:
+    memcpy(pOutput->pPlanes[0] + outputLine * pOutput->strides[0], pY, width);
+    memcpy(pOutput->pPlanes[0] + (outputLine + 1) * pOutput->strides[0], pY + strideY, width);
+    memcpy(pOutput->pPlanes[1] + (outputLine / 2) * pOutput->strides[1], pU, width / 2);
+    memcpy(pOutput->pPlanes[2] + (outputLine / 2) * pOutput->strides[2], pV, width / 2);
+    break;
+
+  case slapOutputFormat_NV12:
+  {
+    memcpy(pOutput->pPlanes[0] + outputLine * pOutput->strides[0], pY, width);
+    memcpy(pOutput->pPlanes[0] + (outputLine + 1) * pOutput->strides[0], pY + strideY, width);
 
-  for (size_t i = 0; i < max; i++)
+    uint8_t *pUV = pOutput->pPlanes[1] + (outputLine / 2) * pOutput->strides[1];
+
+    for (size_t x = 0; x < width / 2; x += 8)
+      _mm_storeu_si128((__m128i *)(pUV + x * 2), _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(pU + x)), _mm_loadl_epi64((const __m128i *)(pV + x))));
+
+    break;
+  }
+
+  case slapOutputFormat_RGBA:
+  case slapOutputFormat_BGRA:
+    _slapConvertLineToRGBA(pY, pU, pV, pOutput->pPlanes[0] + outputLine * pOutput->strides[0], width, pOutput->format == slapOutputFormat_BGRA);
+    _slapConvertLineToRGBA(pY + strideY, pU, pV, pOutput->pPlanes[0] + (outputLine + 1) * pOutput->strides[0], width, pOutput->format == slapOutputFormat_BGRA);
+    break;
+  }
+}
+
+// Same as _slapAddStereoDiffYUV420AndAddLastFrameDiff (or _slapAddStereoDiffYUV420AndCopyToLastFrame for I-Frames), but the reconstructed frame is only written to pLastFrame and converted to pOutput while it's still in the cache.
+// The frame is processed in rows of 4 luma lines per eye and the 2 chroma lines of each plane that belong to them (which are resX wide together).
+void _slapReconstructYUV420ToBuffer(IN_OUT void *pData, IN_OUT void *pLastFrame, const size_t resX, const size_t resY, const bool_t isIframe, IN const slapOutputBuffer *pOutput)
+{
+  const size_t resXdiv16 = resX >> 4;
+  const size_t eyeOffsetY = resX * resY / 2;
+  const size_t eyeOffsetUV = resX * resY / 8;
+  const size_t offsetU = resX * resY;
+  const size_t offsetV = resX * resY * 5 / 4;
+
+  __m128i *pCB = (__m128i *)pData;
+  __m128i *pLF = (__m128i *)pLastFrame;
+  const uint8_t *pReconstructed = (const uint8_t *)pLastFrame;
+
+  const __m128i halfY = _mm_set1_epi8((char)(isIframe ? 118 : 129));
+  const __m128i halfUV = _mm_set1_epi8((char)(isIframe ? 126 : 130));
+
+  for (size_t row = 0; row < resY / 8; row++)
   {
-    __m128i cb0 = _mm_load_si128(pCB0);
-    __m128i lf0 = _mm_load_si128(pLF0);
+    const size_t offsetsDiv16[3] = { (row * 4 * resX) >> 4, (offsetU + row * resX) >> 4, (offsetV + row * resX) >> 4 };
+    const size_t eyeOffsetsDiv16[3] = { eyeOffsetY >> 4, eyeOffsetUV >> 4, eyeOffsetUV >> 4 };
+    const size_t counts[3] = { resXdiv16 * 4, resXdiv16, resXdiv16 };
 
-    lf0 = _mm_sub_epi8(lf0, _mm_add_epi8(cb0, halfUV));
-    _mm_store_si128(pCB0, lf0);
-    _mm_store_si128(pLF0, lf0);
+    for (size_t plane = 0; plane < 3; plane++)
+    {
+      __m128i *pCB0 = pCB + offsetsDiv16[plane];
+      __m128i *pLF0 = pLF + offsetsDiv16[plane];
 
-    __m128i cb0_ = _mm_load_si128(pCB0_);
-    __m128i lf0_ = _mm_load_si128(pLF0_);
+      if (isIframe)
+        _slapAddStereoDiffAndCopyToLastFrame(pCB0, pCB0 + eyeOffsetsDiv16[plane], pLF0, pLF0 + eyeOffsetsDiv16[plane], counts[plane], plane == 0 ? halfY : halfUV);
+      else
+        _slapAddStereoDiffAndAddLastFrameDiff(pCB0, pCB0 + eyeOffsetsDiv16[plane], pLF0, pLF0 + eyeOffsetsDiv16[plane], counts[plane], plane == 0 ? halfY : halfUV);
+    }
 
-    cb0_ = _mm_add_epi8(_mm_sub_epi8(cb0_, halfYUV), cb0);
-    cb0_ = _mm_sub_epi8(lf0_, _mm_add_epi8(cb0_, halfUV));
+    for (size_t eye = 0; eye < 2; eye++)
+    {
+      for (size_t line = 0; line < 2; line++)
+      {
+        const size_t chromaLine = row * 2 + line;
+        const uint8_t *pY = pReconstructed + eye * eyeOffsetY + chromaLine * 2 * resX;
+        const uint8_t *pU = pReconstructed + offsetU + eye * eyeOffsetUV + chromaLine * (resX / 2);
+        const uint8_t *pV = pReconstructed + offsetV + eye * eyeOffsetUV + chromaLine * (resX / 2);
 
-    _mm_store_si128(pCB0_, cb0_);
-    _mm_store_si128(pLF0_, cb0_);
+        _slapConvertLinesToBuffer(pY, resX, pU, pV, resX, eye * (resY / 2) + chromaLine * 2, pOutput);
+      }
+    }
+  }
+}
 
-    pCB0++;
-    pCB0_++;
-    pLF0++;
-    pLF0_++;
+bool_t _slapIsValidInputBuffer(IN const slapInputBuffer *pInput, const size_t resX)
+{
+  switch (pInput->format)
+  {
+  case slapInputFormat_YUV420:
+    return pInput->pPlanes[0] && pInput->pPlanes[1] && pInput->pPlanes[2] && pInput->strides[0] >= resX && pInput->strides[1] >= resX / 2 && pInput->strides[2] >= resX / 2;
+
+  case slapInputFormat_NV12:
+    return pInput->pPlanes[0] && pInput->pPlanes[1] && pInput->strides[0] >= resX && pInput->strides[1] >= resX;
+
+  case slapInputFormat_UYVY:
+    return pInput->pPlanes[0] && pInput->strides[0] >= resX * 2;
+
+  default:
+    return 0;
   }
+}
 
-  pCB0 = pCB0_;
-  pLF0 = pLF0_;
-  pCB0_ += max;
-  pLF0_ += max;
+// Writes pInput as planar YUV420 (resX / 2 wide chroma planes) to pTarget. The input lines don't have to be aligned.
+void _slapConvertInputToYUV420(IN const slapInputBuffer *pInput, OUT uint8_t *pTarget, const size_t resX, const size_t resY)
+{
+  uint8_t *pTargetU = pTarget + resX * resY;
+  uint8_t *pTargetV = pTargetU + resX * resY / 4;
+  const size_t chromaX = resX >> 1;
+  const __m128i lowBytes = _mm_set1_epi16(0xFF);
 
-  for (size_t i = 0; i < max; i++)
+  switch (pInput->format)
   {
-    __m128i cb0 = _mm_load_si128(pCB0);
-    __m128i lf0 = _mm_load_si128(pLF0);
+  case slapInputFormat_YUV420:
+  {
+    for (size_t y = 0; y < resY; y++)
+      memcpy(pTarget + y * resX, pInput->pPlanes[0] + y * pInput->strides[0], resX);
 
-    lf0 = _mm_sub_epi8(lf0, _mm_add_epi8(cb0, halfUV));
-    _mm_store_si128(pCB0, lf0);
-    _mm_store_si128(pLF0, lf0);
+    for (size_t y = 0; y < resY / 2; y++)
+    {
+      memcpy(pTargetU + y * chromaX, pInput->pPlanes[1] + y * pInput->strides[1], chromaX);
+      memcpy(pTargetV + y * chromaX, pInput->pPlanes[2] + y * pInput->strides[2], chromaX);
+    }
 
-    __m128i cb0_ = _mm_load_si128(pCB0_);
-    __m128i lf0_ = _mm_load_si128(pLF0_);
+    break;
+  }
 
-    cb0_ = _mm_add_epi8(_mm_sub_epi8(cb0_, halfYUV), cb0);
-    cb0_ = _mm_sub_epi8(lf0_, _mm_add_epi8(cb0_, halfUV));
+  case slapInputFormat_NV12:
+  {
+    for (size_t y = 0; y < resY; y++)
+      memcpy(pTarget + y * resX, pInput->pPlanes[0] + y * pInput->strides[0], resX);
 
-    _mm_store_si128(pCB0_, cb0_);
-    _mm_store_si128(pLF0_, cb0_);
+    for (size_t y = 0; y < resY / 2; y++)
+    {
+      const __m128i *pUV = (const __m128i *)(pInput->pPlanes[1] + y * pInput->strides[1]);
+      __m128i *pU = (__m128i *)(pTargetU + y * chromaX);
+      __m128i *pV = (__m128i *)(pTargetV + y * chromaX);
 
-    pCB0++;
-    pCB0_++;
-    pLF0++;
-    pLF0_++;
+      for (size_t x = 0; x < chromaX; x += 16)
+      {
+        const __m128i uv0 = _mm_loadu_si128(pUV);
+        const __m128i uv1 = _mm_loadu_si128(pUV + 1);
+
+        _mm_store_si128(pU, _mm_packus_epi16(_mm_and_si128(uv0, lowBytes), _mm_and_si128(uv1, lowBytes)));
+        _mm_store_si128(pV, _mm_packus_epi16(_mm_srli_epi16(uv0, 8), _mm_srli_epi16(uv1, 8)));
+
+        pUV += 2;
+        pU++;
+        pV++;
+      }
+    }
+
+    break;
+  }
+
+  case slapInputFormat_UYVY:
+  {
+    // Two lines at a time, 32 pixels per iteration.
+    for (size_t y = 0; y < resY; y += 2)
+    {
+      const __m128i *pLine0 = (const __m128i *)(pInput->pPlanes[0] + y * pInput->strides[0]);
+      const __m128i *pLine1 = (const __m128i *)(pInput->pPlanes[0] + (y + 1) * pInput->strides[0]);
+      __m128i *pY0 = (__m128i *)(pTarget + y * resX);
+      __m128i *pY1 = (__m128i *)(pTarget + (y + 1) * resX);
+      __m128i *pU = (__m128i *)(pTargetU + (y / 2) * chromaX);
+      __m128i *pV = (__m128i *)(pTargetV + (y / 2) * chromaX);
+
+      for (size_t x = 0; x < resX; x += 32)
+      {
+        const __m128i a0 = _mm_loadu_si128(pLine0);
+        const __m128i a1 = _mm_loadu_si128(pLine0 + 1);
+        const __m128i a2 = _mm_loadu_si128(pLine0 + 2);
+        const __m128i a3 = _mm_loadu_si128(pLine0 + 3);
+        const __m128i b0 = _mm_loadu_si128(pLine1);
+        const __m128i b1 = _mm_loadu_si128(pLine1 + 1);
+        const __m128i b2 = _mm_loadu_si128(pLine1 + 2);
+        const __m128i b3 = _mm_loadu_si128(pLine1 + 3);
+
+        // Luma are the odd bytes.
+        _mm_store_si128(pY0, _mm_packus_epi16(_mm_srli_epi16(a0, 8), _mm_srli_epi16(a1, 8)));
+        _mm_store_si128(pY0 + 1, _mm_packus_epi16(_mm_srli_epi16(a2, 8), _mm_srli_epi16(a3, 8)));
+        _mm_store_si128(pY1, _mm_packus_epi16(_mm_srli_epi16(b0, 8), _mm_srli_epi16(b1, 8)));
+        _mm_store_si128(pY1 + 1, _mm_packus_epi16(_mm_srli_epi16(b2, 8), _mm_srli_epi16(b3, 8)));
+
+        // Chroma are the even bytes (U V U V ...), averaged over both lines.
+        const __m128i uv0 = _mm_avg_epu8(_mm_packus_epi16(_mm_and_si128(a0, lowBytes), _mm_and_si128(a1, lowBytes)), _mm_packus_epi16(_mm_and_si128(b0, lowBytes), _mm_and_si128(b1, lowBytes)));
+        const __m128i uv1 = _mm_avg_epu8(_mm_packus_epi16(_mm_and_si128(a2, lowBytes), _mm_and_si128(a3, lowBytes)), _mm_packus_epi16(_mm_and_si128(b2, lowBytes), _mm_and_si128(b3, lowBytes)));
+
+        _mm_store_si128(pU, _mm_packus_epi16(_mm_and_si128(uv0, lowBytes), _mm_and_si128(uv1, lowBytes)));
+        _mm_store_si128(pV, _mm_packus_epi16(_mm_srli_epi16(uv0, 8), _mm_srli_epi16(uv1, 8)));
+
+        pLine0 += 4;
+        pLine1 += 4;
+        pY0 += 2;
+        pY1 += 2;
+        pU++;
+        pV++;
+      }
+    }
+
+    break;
+  }
   }
 }
@@ -19,6 +19,7 @@ struct task
   void *pUserData;
   size_t result;
   bool taskComplete;
+  uint64_t schedulingKey;
 
   std::mutex mutex;
   std::condition_variable conditionVariable;
@@ -27,6 +28,7 @@ struct task
     pFunction(pFunction),
     pUserData(pUserData),
     taskComplete(false),
+    schedulingKey(UINT64_MAX),
     mutex(),
     conditionVariable()
   { }
@@ -41,16 +43,22 @@ struct threadPool
   volatile bool isRunning;
   std::thread *pThreads;
   size_t threadCount;
+  ThreadPool_WorkerDataDestructor *pDestroyWorkerData;
 
   std::mutex mutex;
   std::condition_variable conditionVariable;
 
-  threadPool(const size_t threadCount);
+  threadPool(const size_t threadCount, ThreadPool_WorkerDataDestructor *pDestroyWorkerData);
   ~threadPool();
 };
 
+thread_local bool isWorkerThread = false;
+thread_local void *pWorkerData = nullptr;
+
 void threadFunc(threadPool *pThreadPool)
 {
+  isWorkerThread = true;
+
   while (pThreadPool->isRunning)
   {
     task *pTask = nullptr;
@@ -77,17 +85,24 @@ void threadFunc(threadPool *pThreadPool)
       pTask->mutex.lock();
       pTask->result = (*pTask->pFunction)(pTask->pUserData);
       pTask->taskComplete = true;
-      pTask->mutex.unlock();
+
+      // The task can be destroyed once its mutex is unlocked (see ThreadPool_JoinTask).
       pTask->conditionVariable.notify_all();
+      pTask->mutex.unlock();
     }
 
     std::unique_lock<std::mutex> lock(pThreadPool->mutex);
     /*std::cv_status result = */pThreadPool->conditionVariable.wait_for(lock, std::chrono::milliseconds(1));
   }
+
+  if (pWorkerData != nullptr && pThreadPool->pDestroyWorkerData != nullptr)
+    (*pThreadPool->pDestroyWorkerData)(pWorkerData);
+
+  pWorkerData = nullptr;
 }
 
 
-threadPool::threadPool(const size_t threadCount) :
+threadPool::threadPool(const size_t threadCount, ThreadPool_WorkerDataDestructor *pDestroyWorkerData) :
   ppTasks(nullptr),
   capacity(0),
   startIndex(0),
@@ -95,6 +110,7 @@ threadPool::threadPool(const size_t threadCount) :
   isRunning(true),
   threadCount(threadCount),
   pThreads(nullptr),
+  pDestroyWorkerData(pDestroyWorkerData),
   mutex(),
   conditionVariable()
 {
@@ -122,7 +138,20 @@ size_t ThreadPool_GetSystemThreadCount()
 
 ThreadPool_Handle ThreadPool_Init(const size_t threadCount)
 {
-  return new threadPool(threadCount);
+  return ThreadPool_InitWithWorkerData(threadCount, nullptr);
+}
+
+ThreadPool_Handle ThreadPool_InitWithWorkerData(const size_t threadCount, ThreadPool_WorkerDataDestructor *pDestroyWorkerData)
+{
+  return new threadPool(threadCount, pDestroyWorkerData);
+}
+
+void ** ThreadPool_GetWorkerData()
+{
+  if (!isWorkerThread)
+    return nullptr;
+
+  return &pWorkerData;
 }
 
 void ThreadPool_Destroy(ThreadPool_Handle threadPoolHandle)
@@ -131,8 +160,16 @@ void ThreadPool_Destroy(ThreadPool_Handle threadPoolHandle)
 }
 
 void ThreadPool_EnqueueTask(ThreadPool_Handle threadPool, ThreadPool_TaskHandle taskHandle)
+{
+  ThreadPool_EnqueueTaskWithKey(threadPool, taskHandle, UINT64_MAX);
+}
+
+void ThreadPool_EnqueueTaskWithKey(ThreadPool_Handle threadPool, ThreadPool_TaskHandle taskHandle, const uint64_t schedulingKey)
 {
   struct threadPool *pThreadPool = (struct threadPool *)threadPool;
+  task *pTask = (task *)taskHandle;
+
+  pTask->schedulingKey = schedulingKey;
 
   pThreadPool->mutex.lock();
 
@@ -152,7 +189,16 @@ void ThreadPool_EnqueueTask(ThreadPool_Handle threadPool, ThreadPool_TaskHandle
       pThreadPool->ppTasks[oldCapacity++] = pThreadPool->ppTasks[i];
   }
 
-  pThreadPool->ppTasks[(pThreadPool->startIndex + pThreadPool->count) % pThreadPool->capacity] = (task *)taskHandle;
+  // The queue is kept sorted by the scheduling key.
+  size_t index = pThreadPool->count;
+
+  while (index > 0 && pThreadPool->ppTasks[(pThreadPool->startIndex + index - 1) % pThreadPool->capacity]->schedulingKey > schedulingKey)
+  {
+    pThreadPool->ppTasks[(pThreadPool->startIndex + index) % pThreadPool->capacity] = pThreadPool->ppTasks[(pThreadPool->startIndex + index - 1) % pThreadPool->capacity];
+    --index;
+  }
+
+  pThreadPool->ppTasks[(pThreadPool->startIndex + index) % pThreadPool->capacity] = pTask;
   ++pThreadPool->count;
 
   pThreadPool->mutex.unlock();
@@ -173,17 +219,11 @@ size_t ThreadPool_JoinTask(ThreadPool_TaskHandle task)
 {
   struct task *pTask = (struct task *)task;
 
-  while (true)
-  {
-    std::unique_lock<std::mutex> lock(pTask->mutex);
-    std::cv_status result = pTask->conditionVariable.wait_for(lock, std::chrono::microseconds(10));
-
-    if (result == std::cv_status::no_timeout)
-      break;
+  // Wake ups can be spurious, so only taskComplete (which is set while the task mutex is held) signals completion. The task may be destroyed as soon as this returns.
+  std::unique_lock<std::mutex> lock(pTask->mutex);
 
-    if (*(volatile bool *)&(pTask->taskComplete))
-      break;
-  }
+  while (!pTask->taskComplete)
+    pTask->conditionVariable.wait_for(lock, std::chrono::microseconds(10));
 
   return pTask->result;
 }
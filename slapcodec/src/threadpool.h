@@ -9,10 +9,13 @@
 #ifndef threadpool_h__
 #define threadpool_h__
 
+#include <stdint.h>
+
 typedef void * ThreadPool_TaskHandle;
 typedef void * ThreadPool_Handle;
 
 typedef size_t ThreadPool_Function(void *);
+typedef void ThreadPool_WorkerDataDestructor(void *);
 
 #ifdef __cplusplus
 extern "C"
@@ -22,11 +25,20 @@ extern "C"
   size_t ThreadPool_GetSystemThreadCount();
   ThreadPool_Handle ThreadPool_Init(const size_t threadCount);
 
+  // Every worker thread has a data slot (see ThreadPool_GetWorkerData), that's destroyed with pDestroyWorkerData by the worker thread when the thread pool is destroyed.
+  ThreadPool_Handle ThreadPool_InitWithWorkerData(const size_t threadCount, ThreadPool_WorkerDataDestructor *pDestroyWorkerData);
+
+  // Returns the data slot of the worker thread that's calling, or NULL if it isn't called from a task.
+  void ** ThreadPool_GetWorkerData();
+
   // make sure that all tasks are done when this is called!
   void ThreadPool_Destroy(ThreadPool_Handle threadPoolHandle);
 
   void ThreadPool_EnqueueTask(ThreadPool_Handle threadPool, ThreadPool_TaskHandle taskHandle);
 
+  // Tasks with a lower scheduling key are dequeued first, tasks with the same key in the order they've been enqueued. ThreadPool_EnqueueTask enqueues with the highest key.
+  void ThreadPool_EnqueueTaskWithKey(ThreadPool_Handle threadPool, ThreadPool_TaskHandle taskHandle, const uint64_t schedulingKey);
+
   ThreadPool_TaskHandle ThreadPool_CreateTask(ThreadPool_Function *pFunction, void *pUserData);
   void ThreadPool_DestroyTask(ThreadPool_TaskHandle task);
   size_t ThreadPool_JoinTask(ThreadPool_TaskHandle task);